@@ -11,8 +11,9 @@
 #include "kernel/memlayout.h"
 
 #define SECTSIZE  512
+#define MAXSECTS  255  // sectors one read command can ask for
 
-void readseg(uchar*, uint, uint);
+static void readseg(uchar*, uint, uint);
 
 void
 bootmain(void)
@@ -47,7 +48,7 @@ bootmain(void)
 	entry();
 }
 
-void
+static void
 waitdisk(void)
 {
 	// Wait for disk ready.
@@ -55,30 +56,13 @@ waitdisk(void)
 		;
 }
 
-// Read a single sector at offset into dst.
-void
-readsect(void *dst, uint offset)
-{
-	// Issue command.
-	waitdisk();
-	outb(0x1F2, 1);   // count = 1
-	outb(0x1F3, offset);
-	outb(0x1F4, offset >> 8);
-	outb(0x1F5, offset >> 16);
-	outb(0x1F6, (offset >> 24) | 0xE0);
-	outb(0x1F7, 0x20);  // cmd 0x20 - read sectors
-
-	// Read data.
-	waitdisk();
-	insl(0x1F0, dst, SECTSIZE/4);
-}
-
 // Read 'count' bytes at 'offset' from kernel into physical address 'pa'.
 // Might copy more than asked.
-void
+static void
 readseg(uchar* pa, uint count, uint offset)
 {
 	uchar* epa;
+	uint n;
 
 	epa = pa + count;
 
@@ -88,9 +72,28 @@ readseg(uchar* pa, uint count, uint offset)
 	// Translate from bytes to sectors; kernel starts at sector 1.
 	offset = (offset / SECTSIZE) + 1;
 
-	// If this is too slow, we could read lots of sectors at a time.
-	// We'd write more to memory than asked, but it doesn't matter --
+	// Read lots of sectors at a time. We write more to memory
+	// than asked, perhaps a sector more, but it doesn't matter --
 	// we load in increasing order.
-	for(; pa < epa; pa += SECTSIZE, offset++)
-		readsect(pa, offset);
+	while(pa < epa){
+		n = (uint)(epa - pa) / SECTSIZE + 1;
+		if(n > MAXSECTS)
+			n = MAXSECTS;
+
+		// Issue command.
+		waitdisk();
+		outb(0x1F2, n);   // count = n
+		outb(0x1F3, offset);
+		outb(0x1F4, offset >> 8);
+		outb(0x1F5, offset >> 16);
+		outb(0x1F6, (offset >> 24) | 0xE0);
+		outb(0x1F7, 0x20);  // cmd 0x20 - read sectors
+		offset += n;
+
+		// Read data, one sector as each is ready.
+		for(; n > 0; n--, pa += SECTSIZE){
+			waitdisk();
+			insl(0x1F0, pa, SECTSIZE/4);
+		}
+	}
 }
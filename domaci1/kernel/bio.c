@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -21,37 +21,303 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "stats.h"
 
-struct {
+// Cached blocks are found through a hash table keyed by
+// (dev, blockno). Each bucket has its own lock, hash chain
+// and free list, so blocks in different buckets can be looked
+// up and released concurrently. A bucket's free list holds its
+// buffers that nobody holds and that are clean, most recently
+// used at head.next. When a bucket has no free buffer, bget()
+// steals the least recently used free buffer of another bucket.
+//
+// A buffer's refcnt and list links are protected by the lock of
+// the bucket it is in. While being moved between buckets it is
+// in no list and has refcnt 0, so nobody else can find it.
+//
+// Buffers live in pages from kalloc(), BPERPAGE to a page.
+// binit() gives the cache 1/BCACHEFRAC of free memory, at least
+// NBUF and at most BCACHEMAX buffers. bget() adds a page when
+// every buffer is in use, up to BCACHEMAX, and kalloc() calls
+// bshrink() to take back a page whose buffers are all free.
+#define NBUCKET 127
+#define BHASH(dev, blockno) (((dev) * 7 + (blockno)) % NBUCKET)
+
+struct bpage {
+	struct bpage *next;
+	struct buf buf[];
+};
+
+#define BPERPAGE ((PGSIZE - sizeof(struct bpage)) / sizeof(struct buf))
+
+struct bucket {
 	struct spinlock lock;
-	struct buf buf[NBUF];
+	struct buf *chain;  // Hash chain through hnext
+	struct buf head;    // Free list through prev/next
+};
 
-	// Linked list of all buffers, through prev/next.
-	// head.next is most recently used.
-	struct buf head;
+struct {
+	struct spinlock lock;  // Protects pages and nbuf
+	struct bpage *pages;
+	int nbuf;
+	struct bucket bucket[NBUCKET];
 } bcache;
 
+struct bdevsw bdevsw[NBDEV];
+
+static struct bdevsw*
+bdev(uint dev)
+{
+	if(dev >= NBDEV || bdevsw[dev].submit == 0)
+		panic("bio: no such device");
+	return &bdevsw[dev];
+}
+
+// Point b's data at its memory, which is the block itself if
+// the device keeps its blocks in memory.
+static void
+bsetdata(struct buf *b)
+{
+	struct bdevsw *d;
+
+	d = bdev(b->dev);
+	b->data = d->map ? d->map(b->blockno) : b->buf;
+}
+
+// Charge a transfer of b to the process asking for it.
+static void
+bcharge(struct buf *b)
+{
+	struct proc *p;
+
+	if((p = myproc()) == 0)
+		return;
+	if(b->flags & B_DIRTY)
+		p->nwrite++;
+	else
+		p->nread++;
+}
+
+// Sync b with its device; see idesubmit().
+static void
+brw(struct buf *b)
+{
+	struct bdevsw *d;
+	int async;
+
+	d = bdev(b->dev);
+	bcharge(b);
+	async = b->flags & B_ASYNC;  // b may be gone once submitted
+	d->submit(b);
+	if(!async)
+		d->wait(b);
+}
+
+// Insert b at the MRU end of bk's free list.
+static void
+freepush(struct bucket *bk, struct buf *b)
+{
+	b->next = bk->head.next;
+	b->prev = &bk->head;
+	bk->head.next->prev = b;
+	bk->head.next = b;
+}
+
+static void
+freeunlink(struct buf *b)
+{
+	b->next->prev = b->prev;
+	b->prev->next = b->next;
+	b->next = b->prev = 0;
+}
+
+static void
+hashinsert(struct bucket *bk, struct buf *b)
+{
+	b->hnext = bk->chain;
+	if(bk->chain)
+		bk->chain->hprev = &b->hnext;
+	b->hprev = &bk->chain;
+	bk->chain = b;
+}
+
+static void
+hashunlink(struct buf *b)
+{
+	if(b->hprev){
+		*b->hprev = b->hnext;
+		if(b->hnext)
+			b->hnext->hprev = b->hprev;
+		b->hprev = 0;
+	}
+}
+
+// Add a page of free buffers to the cache, if under the cap.
+// Called with no bucket lock held.
+static int
+bgrow(void)
+{
+	struct bpage *pg;
+	struct bucket *bk;
+	struct buf *b;
+	int i;
+
+	acquire(&bcache.lock);
+	if(bcache.nbuf + BPERPAGE > BCACHEMAX && bcache.nbuf >= NBUF){
+		release(&bcache.lock);
+		return 0;
+	}
+	i = bcache.nbuf;
+	bcache.nbuf += BPERPAGE;
+	release(&bcache.lock);
+
+	if((pg = (struct bpage*)kalloc()) == 0){
+		acquire(&bcache.lock);
+		bcache.nbuf -= BPERPAGE;
+		release(&bcache.lock);
+		return 0;
+	}
+	memset(pg, 0, PGSIZE);
+
+	// Spread the buffers over the free lists.
+	for(b = pg->buf; b < pg->buf+BPERPAGE; b++){
+		initsleeplock(&b->lock, "buffer");
+		b->data = b->buf;
+		bk = &bcache.bucket[i++ % NBUCKET];
+		acquire(&bk->lock);
+		freepush(bk, b);
+		release(&bk->lock);
+	}
+
+	acquire(&bcache.lock);
+	pg->next = bcache.pages;
+	bcache.pages = pg;
+	release(&bcache.lock);
+	return 1;
+}
+
+// Give a page back to kalloc() if all its buffers are free.
+// Returns 1 if a page was freed. The caller must hold no
+// bucket lock.
+int
+bshrink(void)
+{
+	struct bpage *pg, **pp;
+	struct bucket *bk;
+	struct buf *b;
+
+	acquire(&bcache.lock);
+	if(bcache.nbuf - (int)BPERPAGE < NBUF){
+		release(&bcache.lock);
+		return 0;
+	}
+
+	// Holding every bucket lock keeps all refcnts and lists still.
+	for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+		acquire(&bk->lock);
+	for(pp = &bcache.pages; (pg = *pp) != 0; pp = &pg->next){
+		// A free buffer is on a free list; a held, dirty or
+		// in-transit buffer is not.
+		for(b = pg->buf; b < pg->buf+BPERPAGE; b++)
+			if(b->next == 0)
+				break;
+		if(b == pg->buf+BPERPAGE)
+			break;
+	}
+	if(pg){
+		for(b = pg->buf; b < pg->buf+BPERPAGE; b++){
+			freeunlink(b);
+			hashunlink(b);
+		}
+		*pp = pg->next;
+		bcache.nbuf -= BPERPAGE;
+	}
+	for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+		release(&bk->lock);
+	release(&bcache.lock);
+
+	if(pg == 0)
+		return 0;
+	kfree((char*)pg);
+	return 1;
+}
+
 void
 binit(void)
 {
-	struct buf *b;
+	struct bucket *bk;
+	int n;
 
 	initlock(&bcache.lock, "bcache");
+	for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+		initlock(&bk->lock, "bcache.bucket");
+		bk->chain = 0;
+		bk->head.prev = &bk->head;
+		bk->head.next = &bk->head;
+	}
 
-	// Create linked list of buffers
-	bcache.head.prev = &bcache.head;
-	bcache.head.next = &bcache.head;
-	for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-		b->next = bcache.head.next;
-		b->prev = &bcache.head;
-		initsleeplock(&b->lock, "buffer");
-		bcache.head.next->prev = b;
-		bcache.head.next = b;
+	n = kfreecount() / BCACHEFRAC * BPERPAGE;
+	if(n > BCACHEMAX)
+		n = BCACHEMAX;
+	while(bcache.nbuf + BPERPAGE <= n || bcache.nbuf < NBUF)
+		if(!bgrow())
+			panic("binit");
+}
+
+// Return the cached buffer for (dev, blockno) in bk, or 0.
+// Caller holds bk->lock.
+static struct buf*
+blookup(struct bucket *bk, uint dev, uint blockno)
+{
+	struct buf *b;
+
+	for(b = bk->chain; b != 0; b = b->hnext)
+		if(b->dev == dev && b->blockno == blockno)
+			return b;
+	return 0;
+}
+
+// Like blookup, but takes a reference on the buffer.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+	struct buf *b;
+
+	if((b = blookup(bk, dev, blockno)) != 0)
+		if(b->refcnt++ == 0 && b->next != 0)
+			freeunlink(b);
+	return b;
+}
+
+// Take the least recently used free buffer of another bucket,
+// trying bk itself last, and return it in no list, or 0 if no
+// buffer is free. bk->lock is not held.
+static struct buf*
+bsteal(struct bucket *bk)
+{
+	struct bucket *v;
+	struct buf *b;
+	int i;
+
+	for(i = 1; i <= NBUCKET; i++){
+		v = &bcache.bucket[(bk - bcache.bucket + i) % NBUCKET];
+		acquire(&v->lock);
+		b = v->head.prev;
+		if(b != &v->head){
+			freeunlink(b);
+			hashunlink(b);
+			release(&v->lock);
+			return b;
+		}
+		release(&v->lock);
 	}
+	return 0;
 }
 
 // Look through buffer cache for block on device dev.
@@ -60,35 +326,54 @@ binit(void)
 static struct buf*
 bget(uint dev, uint blockno)
 {
-	struct buf *b;
+	struct bucket *bk;
+	struct buf *b, *nb;
 
-	acquire(&bcache.lock);
+	statadd(ST_BGET, 1);
+	bk = &bcache.bucket[BHASH(dev, blockno)];
+	acquire(&bk->lock);
 
 	// Is the block already cached?
-	for(b = bcache.head.next; b != &bcache.head; b = b->next){
-		if(b->dev == dev && b->blockno == blockno){
-			b->refcnt++;
-			release(&bcache.lock);
-			acquiresleep(&b->lock);
-			return b;
-		}
+	if((b = bfind(bk, dev, blockno)) != 0){
+		release(&bk->lock);
+		statadd(ST_BHIT, 1);
+		acquiresleep(&b->lock);
+		return b;
 	}
 
-	// Not cached; recycle an unused buffer.
-	// Even if refcnt==0, B_DIRTY indicates a buffer is in use
-	// because log.c has modified it but not yet committed it.
-	for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-		if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-			b->dev = dev;
-			b->blockno = blockno;
-			b->flags = 0;
-			b->refcnt = 1;
-			release(&bcache.lock);
+	// Not cached; recycle the least recently used free buffer.
+	// Buffers that are held or B_DIRTY (modified by log.c but not
+	// yet committed) are never on a free list.
+	nb = bk->head.prev;
+	if(nb != &bk->head){
+		freeunlink(nb);
+		hashunlink(nb);
+	} else {
+		// Steal without holding bk->lock, so two CPUs stealing
+		// from each other's buckets cannot deadlock. Someone may
+		// have brought the block in meanwhile; look again.
+		release(&bk->lock);
+		while((nb = bsteal(bk)) == 0)
+			if(!bgrow())
+				panic("bget: no buffers");
+		acquire(&bk->lock);
+		if((b = bfind(bk, dev, blockno)) != 0){
+			freepush(bk, nb);
+			release(&bk->lock);
+			statadd(ST_BHIT, 1);
 			acquiresleep(&b->lock);
 			return b;
 		}
 	}
-	panic("bget: no buffers");
+	nb->dev = dev;
+	nb->blockno = blockno;
+	nb->flags = 0;
+	nb->refcnt = 1;
+	bsetdata(nb);
+	hashinsert(bk, nb);
+	release(&bk->lock);
+	acquiresleep(&nb->lock);
+	return nb;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -99,11 +384,67 @@ bread(uint dev, uint blockno)
 
 	b = bget(dev, blockno);
 	if((b->flags & B_VALID) == 0) {
-		iderw(b);
+		brw(b);
 	}
 	return b;
 }
 
+// Return a locked, zero-filled buffer for a block whose old
+// contents do not matter, without reading it from disk.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+	struct buf *b;
+
+	b = bget(dev, blockno);
+	memset(b->data, 0, BSIZE);
+	b->flags |= B_VALID;
+	return b;
+}
+
+// Start reading the block into the cache without waiting,
+// unless it is cached already. The buffer stays locked until
+// the disk driver calls bdone(), so a bread() of the block in
+// the meantime waits for the read to finish. Read-ahead is a
+// hint: it gives up rather than grow the cache.
+void
+breadahead(uint dev, uint blockno)
+{
+	struct bucket *bk;
+	struct buf *nb;
+
+	bk = &bcache.bucket[BHASH(dev, blockno)];
+	acquire(&bk->lock);
+	if(blookup(bk, dev, blockno)){
+		release(&bk->lock);
+		return;
+	}
+	nb = bk->head.prev;
+	if(nb != &bk->head){
+		freeunlink(nb);
+		hashunlink(nb);
+	} else {
+		release(&bk->lock);
+		if((nb = bsteal(bk)) == 0)
+			return;
+		acquire(&bk->lock);
+		if(blookup(bk, dev, blockno)){
+			freepush(bk, nb);
+			release(&bk->lock);
+			return;
+		}
+	}
+	nb->dev = dev;
+	nb->blockno = blockno;
+	nb->flags = B_ASYNC;
+	nb->refcnt = 1;
+	bsetdata(nb);
+	hashinsert(bk, nb);
+	acquiresleep(&nb->lock);  // free buffer, so this does not sleep
+	release(&bk->lock);
+	brw(nb);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,31 +452,64 @@ bwrite(struct buf *b)
 	if(!holdingsleep(&b->lock))
 		panic("bwrite");
 	b->flags |= B_DIRTY;
-	iderw(b);
+	brw(b);
 }
 
-// Release a locked buffer.
-// Move to the head of the MRU list.
+// Write n locked buffers to disk and wait for all of them.
+// Queueing them together lets the driver merge adjacent
+// blocks into one transfer.
 void
-brelse(struct buf *b)
+bwritev(struct buf **bp, int n)
 {
-	if(!holdingsleep(&b->lock))
-		panic("brelse");
+	int i;
 
-	releasesleep(&b->lock);
+	for(i = 0; i < n; i++){
+		if(!holdingsleep(&bp[i]->lock))
+			panic("bwritev");
+		bp[i]->flags |= B_DIRTY;
+		bcharge(bp[i]);
+		bdev(bp[i]->dev)->submit(bp[i]);
+	}
+	for(i = 0; i < n; i++)
+		bdev(bp[i]->dev)->wait(bp[i]);
+}
 
-	acquire(&bcache.lock);
+// Drop a reference to b.
+// If no one else holds it and it is clean,
+// move it to the head of the free list.
+static void
+bput(struct buf *b)
+{
+	struct bucket *bk;
+
+	// b cannot change buckets while we hold a reference.
+	bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+	acquire(&bk->lock);
 	b->refcnt--;
-	if (b->refcnt == 0) {
+	if (b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
 		// no one is waiting for it.
-		b->next->prev = b->prev;
-		b->prev->next = b->next;
-		b->next = bcache.head.next;
-		b->prev = &bcache.head;
-		bcache.head.next->prev = b;
-		bcache.head.next = b;
+		freepush(bk, b);
 	}
 
-	release(&bcache.lock);
+	release(&bk->lock);
 }
 
+// Release a locked buffer.
+void
+brelse(struct buf *b)
+{
+	if(!holdingsleep(&b->lock))
+		panic("brelse");
+
+	releasesleep(&b->lock);
+	bput(b);
+}
+
+// Release a buffer whose read-ahead has completed.
+// Called by the disk driver, possibly from an interrupt.
+void
+bdone(struct buf *b)
+{
+	releasesleep(&b->lock);
+	bput(b);
+}
@@ -0,0 +1,125 @@
+// Buddy allocator.
+//
+// Physically contiguous runs of 2^order pages, for buffers
+// larger than a page or that a device reads directly, come
+// from a pool of 2^BUDDYORDER pages that kinit2() sets aside.
+// Free blocks of order k are on list k, and buddy.order[i]
+// is k+1 if page i of the pool starts one. Freeing a block
+// merges it with its buddy, the block whose page offset
+// differs in bit k, for as long as the buddy is free too.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+
+#define NPOOL (1 << BUDDYORDER)  // pages in the pool
+
+struct bblock {
+	struct bblock *next;
+	struct bblock *prev;
+};
+
+static struct {
+	struct spinlock lock;
+	char *base;                         // first page of the pool
+	struct bblock free[BUDDYORDER+1];   // list heads
+	uchar order[NPOOL];
+} buddy;
+
+static void
+bbpush(int k, int i)
+{
+	struct bblock *b;
+
+	b = (struct bblock*)(buddy.base + i*PGSIZE);
+	b->next = buddy.free[k].next;
+	b->prev = &buddy.free[k];
+	b->next->prev = b;
+	b->prev->next = b;
+	buddy.order[i] = k + 1;
+}
+
+static void
+bbunlink(int i)
+{
+	struct bblock *b;
+
+	b = (struct bblock*)(buddy.base + i*PGSIZE);
+	b->next->prev = b->prev;
+	b->prev->next = b->next;
+	buddy.order[i] = 0;
+}
+
+// Set the pool aside from the top of [vstart, vend), aligned
+// to its own size. Returns the new end of the range.
+void*
+buddyinit(void *vstart, void *vend)
+{
+	int k;
+	char *base;
+
+	initlock(&buddy.lock, "buddy");
+	for(k = 0; k <= BUDDYORDER; k++)
+		buddy.free[k].next = buddy.free[k].prev = &buddy.free[k];
+	base = (char*)(((uint)vend - NPOOL*PGSIZE) & ~(NPOOL*PGSIZE - 1));
+	if(base < (char*)vstart)
+		panic("buddyinit");
+	buddy.base = base;
+	bbpush(BUDDYORDER, 0);
+	return base;
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size. Returns 0 if there is no such run free.
+char*
+kallocpages(int order)
+{
+	int k, i;
+	struct bblock *b;
+
+	if(order < 0 || order > BUDDYORDER)
+		return 0;
+	acquire(&buddy.lock);
+	for(k = order; k <= BUDDYORDER; k++)
+		if(buddy.free[k].next != &buddy.free[k])
+			break;
+	if(k > BUDDYORDER){
+		release(&buddy.lock);
+		return 0;
+	}
+	b = buddy.free[k].next;
+	i = ((char*)b - buddy.base) / PGSIZE;
+	bbunlink(i);
+	while(k > order){
+		k--;
+		bbpush(k, i + (1 << k));  // free the upper half
+	}
+	release(&buddy.lock);
+	return (char*)b;
+}
+
+// Free pages allocated by kallocpages(order).
+void
+kfreepages(char *v, int order)
+{
+	int i, bi;
+
+	i = (v - buddy.base) / PGSIZE;
+	if(v < buddy.base || i >= NPOOL || (uint)v % PGSIZE ||
+	   order < 0 || order > BUDDYORDER || i % (1 << order))
+		panic("kfreepages");
+	acquire(&buddy.lock);
+	for(; order < BUDDYORDER; order++){
+		bi = i ^ (1 << order);
+		if(buddy.order[bi] != order + 1)
+			break;
+		bbunlink(bi);
+		if(bi < i)
+			i = bi;
+	}
+	bbpush(order, i);
+	release(&buddy.lock);
+}
@@ -4,11 +4,28 @@ struct buf {
 	uint blockno;
 	struct sleeplock lock;
 	uint refcnt;
-	struct buf *prev; // LRU cache list
+	struct buf *prev; // LRU free list, 0 when not on it
 	struct buf *next;
+	struct buf *hnext; // hash chain
+	struct buf **hprev; // link that points at this buf, 0 if unhashed
 	struct buf *qnext; // disk queue
-	uchar data[BSIZE];
+	uchar *data;       // buf[], or the block itself on a memory device
+	uchar buf[BSIZE];
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // read-ahead: driver calls bdone() when finished
 
+// Block device switch: bio.c hands the buffers of device dev
+// to bdevsw[dev]. submit() starts a read or write as idesubmit()
+// in ide.c describes it and wait() waits for it to finish. A device that
+// keeps its blocks in memory sets map() to return block blockno;
+// the buffer cache then uses the block in place, and submit()
+// need only update the flags.
+struct bdevsw {
+	void (*submit)(struct buf*);
+	void (*wait)(struct buf*);
+	uchar* (*map)(uint blockno);
+};
+
+extern struct bdevsw bdevsw[];
@@ -14,6 +14,8 @@
 #include "mmu.h"
 #include "proc.h"
 #include "x86.h"
+#include "ioctl.h"
+#include "poll.h"
 
 static int currentColor = 0x0700;
 static int clrs[16] = {
@@ -36,10 +38,12 @@ static int clrs[16] = {
 
 void getColor();
 void getBrightColor();
-void repaint();
-void repaintLastRow();
+
+// 1 - active ... 0 - hidden
+static int menuStatus = 0;
 
 static void consputc(int);
+static void cgaflush(void);
 
 static int panicked = 0;
 
@@ -48,8 +52,34 @@ static struct {
 	int locking;
 } cons;
 
+// cprintf() output is formatted into a line buffer and, once the
+// klogd kernel thread is running, appended to the calling CPU's log
+// ring (struct cpu logbuf) without taking any lock. klogd copies
+// the rings to the console. Before klogd starts, and while
+// panicking, cprintf() writes to the console directly.
+#define KLOGLINE 256  // longest single cprintf() record
+
+static struct {
+	int ready;              // klogd is draining the per-CPU rings
+	volatile int pending;   // a record was added since klogd last looked
+	char hist[KLOGHIST];    // console log history for dmesg, under cons.lock
+	uint nhist;             // bytes ever added to hist
+} klog;
+
+struct fmtbuf {
+	char buf[KLOGLINE];
+	int n;
+};
+
+static void
+fmtputc(struct fmtbuf *f, int c)
+{
+	if(f->n < sizeof(f->buf))
+		f->buf[f->n++] = c;
+}
+
 static void
-printint(int xx, int base, int sign)
+printint(struct fmtbuf *f, int xx, int base, int sign)
 {
 	static char digits[] = "0123456789abcdef";
 	char buf[16];
@@ -70,28 +100,19 @@ printint(int xx, int base, int sign)
 		buf[i++] = '-';
 
 	while(--i >= 0)
-		consputc(buf[i]);
+		fmtputc(f, buf[i]);
 }
 
-// Print to the console. only understands %d, %x, %p, %s.
-void
-cprintf(char *fmt, ...)
+// Format fmt. Only understands %d, %x, %p, %s.
+static void
+vformat(struct fmtbuf *f, char *fmt, uint *argp)
 {
-	int i, c, locking;
-	uint *argp;
+	int i, c;
 	char *s;
 
-	locking = cons.locking;
-	if(locking)
-		acquire(&cons.lock);
-
-	if (fmt == 0)
-		panic("null fmt");
-
-	argp = (uint*)(void*)(&fmt + 1);
 	for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
 		if(c != '%'){
-			consputc(c);
+			fmtputc(f, c);
 			continue;
 		}
 		c = fmt[++i] & 0xff;
@@ -99,29 +120,162 @@ cprintf(char *fmt, ...)
 			break;
 		switch(c){
 		case 'd':
-			printint(*argp++, 10, 1);
+			printint(f, *argp++, 10, 1);
 			break;
 		case 'x':
 		case 'p':
-			printint(*argp++, 16, 0);
+			printint(f, *argp++, 16, 0);
 			break;
 		case 's':
 			if((s = (char*)*argp++) == 0)
 				s = "(null)";
 			for(; *s; s++)
-				consputc(*s);
+				fmtputc(f, *s);
 			break;
 		case '%':
-			consputc('%');
+			fmtputc(f, '%');
 			break;
 		default:
 			// Print unknown % sequence to draw attention.
-			consputc('%');
-			consputc(c);
+			fmtputc(f, '%');
+			fmtputc(f, c);
 			break;
 		}
 	}
+}
+
+// Write kernel log text to the console and remember it for dmesg.
+// Caller holds cons.lock (or is panicking).
+static void
+klogputs(char *s, int n)
+{
+	int i;
+
+	for(i = 0; i < n; i++){
+		klog.hist[klog.nhist++ % KLOGHIST] = s[i];
+		consputc(s[i] & 0xff);
+	}
+}
+
+// Append a record to this CPU's log ring. Interrupts are off,
+// so this CPU is the only writer; klogd only moves logr.
+static void
+klogappend(char *s, int n)
+{
+	struct cpu *c;
+	uint w;
+	int i;
+
+	pushcli();
+	c = mycpu();
+	w = c->logw;
+	if(w + n - c->logr > KLOGSIZE){
+		c->loglost++;
+	} else {
+		for(i = 0; i < n; i++)
+			c->logbuf[(w + i) % KLOGSIZE] = s[i];
+		__sync_synchronize();  // record contents before logw
+		c->logw = w + n;
+		klog.pending = 1;
+	}
+	popcli();
+}
+
+// Copy everything in the per-CPU rings to the console.
+// Caller holds cons.lock (or is panicking).
+static void
+klogdrain(void)
+{
+	struct fmtbuf f;
+	struct cpu *c;
+	uint w, lost, args[2];
+	int n;
+
+	for(c = cpus; c < cpus+ncpu; c++){
+		w = c->logw;
+		__sync_synchronize();  // see the records up to w
+		while(c->logr != w){
+			n = KLOGSIZE - c->logr % KLOGSIZE;
+			if(n > w - c->logr)
+				n = w - c->logr;
+			klogputs(c->logbuf + c->logr % KLOGSIZE, n);
+			c->logr += n;
+		}
+		if((lost = c->loglost) != 0){
+			c->loglost = 0;
+			args[0] = c - cpus;
+			args[1] = lost;
+			f.n = 0;
+			vformat(&f, "klog: cpu %d dropped %d messages\n", args);
+			klogputs(f.buf, f.n);
+		}
+	}
+}
+
+// Called from the timer interrupt, and by a CPU about to idle.
+void
+klogkick(void)
+{
+	if(klog.pending)
+		wakeup(&klog);
+}
+
+// Kernel thread that moves cprintf() output to the console.
+void
+klogd(void)
+{
+	acquire(&cons.lock);
+	klog.ready = 1;
+	for(;;){
+		klog.pending = 0;
+		klogdrain();
+		cgaflush();
+		while(!klog.pending)
+			sleep(&klog, &cons.lock);
+	}
+}
+
+// Copy the most recent console log text, at most n bytes, to dst.
+int
+klogread(char *dst, int n)
+{
+	uint i, start;
+
+	acquire(&cons.lock);
+	if(n > KLOGHIST)
+		n = KLOGHIST;
+	if(n > klog.nhist)
+		n = klog.nhist;
+	start = klog.nhist - n;
+	for(i = 0; i < n; i++)
+		dst[i] = klog.hist[(start + i) % KLOGHIST];
+	release(&cons.lock);
+	return n;
+}
 
+// Print to the console. only understands %d, %x, %p, %s.
+void
+cprintf(char *fmt, ...)
+{
+	struct fmtbuf f;
+	int locking;
+
+	if (fmt == 0)
+		panic("null fmt");
+
+	f.n = 0;
+	vformat(&f, fmt, (uint*)(void*)(&fmt + 1));
+
+	locking = cons.locking;
+	if(klog.ready && locking){
+		klogappend(f.buf, f.n);
+		return;
+	}
+
+	if(locking)
+		acquire(&cons.lock);
+	klogputs(f.buf, f.n);
+	cgaflush();
 	if(locking)
 		release(&cons.lock);
 }
@@ -134,6 +288,8 @@ panic(char *s)
 
 	cli();
 	cons.locking = 0;
+	uartsync();
+	klogdrain();  // Get out what other CPUs logged before us.
 	// use lapiccpunum so that we can call panic from mycpu()
 	cprintf("lapicid %d: panic: ", lapicid());
 	cprintf(s);
@@ -148,41 +304,375 @@ panic(char *s)
 
 #define BACKSPACE 0x100
 #define CRTPORT 0x3d4
+#define CRTROWS 25
+#define CRTCOLS 80
 static ushort *crt = (ushort*)P2V(0xb8000);  // CGA memory
 
+#define CRTRING (CRTROWS+SCROLLBACK)
+
+// The colour menu is drawn into an overlay of MENUROWS x MENUCOLS
+// cells whose top left corner is at screen position MENUPOS.
+// cgaflush() shows it on top of the text without touching the
+// shadow, so closing the menu just recomposes those rows.
+#define MENUPOS  57
+#define MENUROWS 10
+#define MENUCOLS 23
+static ushort menubuf[MENUROWS*MENUCOLS];
+
+// All output goes into a RAM shadow of the CGA screen first;
+// cgaflush() copies the rows marked in cga.dirty to video
+// memory and moves the hardware cursor once per flush,
+// instead of a round trip on CRTPORT for every character.
+//
+// The shadow is a ring of CRTRING rows. Visible row r lives
+// in ring row (top + r) % CRTRING, so scrolling only advances
+// top and clears one row; the rows above top that have not been
+// reused yet are the scrollback shown by Shift+PgUp/PgDn.
+//
+// Characters and attributes are kept in separate planes. A cell
+// with attribute 0 is drawn in currentColor, so picking a colour
+// in the menu only has to mark the screen dirty; a cell with its
+// own CGA attribute a holds ATTROWN|a, so that it survives colour
+// changes, black on black (a = 0) included.
+#define ATTROWN 0x100
+
+static struct {
+	uchar ch[CRTRING*CRTCOLS];    // Character plane
+	ushort attr[CRTRING*CRTCOLS]; // Attribute plane, 0 = currentColor
+	ushort color; // Attribute given to new output, as in attr
+	int esc;      // Escape parser state: 0 text, 1 after ESC, 2 in CSI
+	int par[8];   // CSI parameters
+	int npar;     // Number of CSI parameters seen
+	int top;      // Ring row shown as visible row 0
+	int nhist;    // Rows of scrollback available above top
+	int view;     // Rows currently scrolled back (0 = live screen)
+	int pos;      // Cursor position: col + 80*row
+	int hwpos;    // Cursor position last written to CRTPORT
+	uint dirty;   // Bit r set: row r differs from crt[]
+	int ready;    // Planes and pos have been loaded from the hardware
+} cga;
+
+// Give the k cells from ring index i the colour of new output.
 static void
-cgaputc(int c)
+attrfill(int i, int k)
+{
+	while(k-- > 0)
+		cga.attr[i++] = cga.color;
+}
+
+// Return the ring index of the cell at visible position pos.
+static int
+cgaidx(int pos)
 {
-	int pos;
+	return ((cga.top + pos/CRTCOLS) % CRTRING)*CRTCOLS + pos%CRTCOLS;
+}
 
-	// Cursor position: col + 80*row.
+static void
+cgaload(void)
+{
+	int pos, i;
+
+	// Pick up whatever the BIOS and boot loader left on the screen.
 	outb(CRTPORT, 14);
 	pos = inb(CRTPORT+1) << 8;
 	outb(CRTPORT, 15);
 	pos |= inb(CRTPORT+1);
 
-	if(c == '\n')
-		pos += 80 - pos%80;
-	else if(c == BACKSPACE){
-		if(pos > 0) --pos;
-	} else
-		crt[pos++] = (c&0xff) | currentColor;  // black on white
+	for(i = 0; i < CRTROWS*CRTCOLS; i++){
+		cga.ch[i] = crt[i] & 0xff;
+		cga.attr[i] = (crt[i] >> 8) == 0x07 ? 0 : ATTROWN | crt[i] >> 8;
+	}
+	cga.color = 0;
+	cga.top = 0;
+	cga.nhist = 0;
+	cga.view = 0;
+	cga.pos = cga.hwpos = pos;
+	cga.dirty = 0;
+	cga.ready = 1;
+}
+
+// Mark the rows holding cells [pos, pos+n) as needing a flush.
+static void
+cgadirty(int pos, int n)
+{
+	int r;
+
+	for(r = pos/CRTCOLS; r <= (pos+n-1)/CRTCOLS && r < CRTROWS; r++)
+		cga.dirty |= 1 << r;
+}
+
+// Write dirty rows of the visible window to video memory
+// and update the hardware cursor if it moved.
+static void
+cgaflush(void)
+{
+	int r, c, first, i, pos;
+	ushort *dst;
+
+	if(!cga.ready)
+		return;
+	first = cga.top + CRTRING - cga.view;
+	for(r = 0; cga.dirty != 0 && r < CRTROWS; r++){
+		if((cga.dirty & (1 << r)) == 0)
+			continue;
+		cga.dirty &= ~(1 << r);
+		dst = crt + r*CRTCOLS;
+		i = ((first + r) % CRTRING)*CRTCOLS;
+		for(c = 0; c < CRTCOLS; c++, i++){
+			if(menuStatus && r < MENUROWS && c >= MENUPOS && c < MENUPOS+MENUCOLS)
+				dst[c] = menubuf[r*MENUCOLS + c-MENUPOS];
+			else if(cga.attr[i])
+				dst[c] = cga.ch[i] | ((cga.attr[i] & 0xff) << 8);
+			else
+				dst[c] = cga.ch[i] | currentColor;
+		}
+	}
 
+	// Park the cursor off screen while looking at the scrollback.
+	pos = cga.view ? CRTROWS*CRTCOLS : cga.pos;
+	if(pos != cga.hwpos){
+		outb(CRTPORT, 14);
+		outb(CRTPORT+1, pos>>8);
+		outb(CRTPORT, 15);
+		outb(CRTPORT+1, pos);
+		cga.hwpos = pos;
+	}
+}
+
+// Page the visible window n rows back into the scrollback
+// (n > 0) or forward towards the live screen (n < 0).
+static void
+cgascroll(int n)
+{
+	int view;
+
+	if(!cga.ready)
+		cgaload();
+	view = cga.view + n;
+	if(view > cga.nhist)
+		view = cga.nhist;
+	if(view < 0)
+		view = 0;
+	if(view != cga.view){
+		cga.view = view;
+		cgadirty(0, CRTROWS*CRTCOLS);
+	}
+}
+
+// Set cells [pos, pos+n) of the visible screen to blanks
+// in the current output colour.
+static void
+cgaclear(int pos, int n)
+{
+	int i, k;
+
+	while(n > 0){
+		k = CRTCOLS - pos%CRTCOLS;  // Rows need not be adjacent in the ring.
+		if(k > n)
+			k = n;
+		i = cgaidx(pos);
+		memset(cga.ch + i, ' ', k);
+		attrfill(i, k);
+		cgadirty(pos, k);
+		pos += k;
+		n -= k;
+	}
+}
+
+// Finish moving the cursor to pos, scrolling if it ran
+// off the bottom of the screen.
+static void
+cgamove(int pos)
+{
 	if(pos < 0 || pos > 25*80)
 		panic("pos under/overflow");
 
 	if((pos/80) >= 24){  // Scroll up.
-		memmove(crt, crt+80, sizeof(crt[0])*23*80);
+		cga.top = (cga.top + 1) % CRTRING;
+		if(cga.nhist < SCROLLBACK)
+			cga.nhist++;
 		pos -= 80;
-		memset(crt+pos, 0, sizeof(crt[0])*(24*80 - pos));
-		if(currentColor != 0x0700) repaintLastRow();
+		// The ring row that just became row 24 held the oldest
+		// scrollback line; clear it along with the rest of row 23.
+		cgaclear(pos, 24*80 - pos);
+		cgaclear(24*80, 80);
+		cgadirty(0, CRTROWS*CRTCOLS);
 	}
+	cga.pos = pos;
+}
 
-	outb(CRTPORT, 14);
-	outb(CRTPORT+1, pos>>8);
-	outb(CRTPORT, 15);
-	outb(CRTPORT+1, pos);
-	crt[pos] = ' ' | currentColor;
+static void
+cgaputc(int c)
+{
+	int pos, i;
+
+	if(!cga.ready)
+		cgaload();
+	if(cga.view)  // New output jumps back to the live screen.
+		cgascroll(-cga.view);
+	pos = cga.pos;
+
+	if(c == '\n')
+		pos += 80 - pos%80;
+	else if(c == BACKSPACE){
+		if(pos > 0) --pos;
+	} else {
+		i = cgaidx(pos);
+		cga.ch[i] = c&0xff;
+		cga.attr[i] = cga.color;
+		cgadirty(pos, 1);
+		pos++;
+	}
+
+	cgamove(pos);
+	if(c == BACKSPACE)
+		cgaclear(pos, 1);
+}
+
+// Put n printable characters (no controls, no escapes) on the
+// screen, copying as much of each row as fits in one go.
+static void
+cgaputs(char *s, int n)
+{
+	int i, k;
+
+	if(!cga.ready)
+		cgaload();
+	if(cga.view)
+		cgascroll(-cga.view);
+	while(n > 0){
+		k = CRTCOLS - cga.pos%CRTCOLS;
+		if(k > n)
+			k = n;
+		i = cgaidx(cga.pos);
+		memmove(cga.ch + i, s, k);
+		attrfill(i, k);
+		cgadirty(cga.pos, k);
+		cgamove(cga.pos + k);
+		s += k;
+		n -= k;
+	}
+}
+
+// CGA colour numbers for ANSI colours 0-7
+// (black, red, green, yellow, blue, magenta, cyan, white).
+static uchar ansicolor[8] = { 0, 4, 2, 6, 1, 5, 3, 7 };
+
+// Apply one SGR (Select Graphic Rendition) parameter to cga.color.
+static void
+cgasgr(int p)
+{
+	int a, def;
+
+	def = (currentColor >> 8) & 0xff;
+	a = cga.color ? cga.color & 0xff : def;
+	if(p == 0){
+		cga.color = 0;
+		return;
+	} else if(p == 1)
+		a |= 0x08;
+	else if(p == 22)
+		a &= ~0x08;
+	else if(p >= 30 && p <= 37)
+		a = (a & 0xf8) | ansicolor[p-30];
+	else if(p == 39)
+		a = (a & 0xf0) | (def & 0x0f);
+	else if(p >= 40 && p <= 47)
+		a = (a & 0x8f) | (ansicolor[p-40] << 4);
+	else if(p == 49)
+		a = (a & 0x0f) | (def & 0xf0);
+	else if(p >= 90 && p <= 97)
+		a = (a & 0xf0) | 0x08 | ansicolor[p-90];
+	else if(p >= 100 && p <= 107)
+		a = (a & 0x0f) | 0x80 | (ansicolor[p-100] << 4);
+	else
+		return;
+	cga.color = ATTROWN | a;
+}
+
+// Execute a complete CSI sequence ESC [ par ; par ... c.
+static void
+cgacsi(int c)
+{
+	int i, row, col;
+
+	switch(c){
+	case 'H':  // CUP: move cursor to row;col, 1-based.
+	case 'f':
+		row = cga.par[0] ? cga.par[0]-1 : 0;
+		col = cga.par[1] ? cga.par[1]-1 : 0;
+		if(row > CRTROWS-2)  // Row 24 is kept free for scrolling.
+			row = CRTROWS-2;
+		if(col > CRTCOLS-1)
+			col = CRTCOLS-1;
+		cga.pos = row*CRTCOLS + col;
+		break;
+	case 'J':  // ED: erase in display.
+		if(cga.par[0] == 0)
+			cgaclear(cga.pos, CRTROWS*CRTCOLS - cga.pos);
+		else if(cga.par[0] == 1)
+			cgaclear(0, cga.pos+1);
+		else if(cga.par[0] == 2)
+			cgaclear(0, CRTROWS*CRTCOLS);
+		break;
+	case 'K':  // EL: erase in line.
+		col = cga.pos % CRTCOLS;
+		if(cga.par[0] == 0)
+			cgaclear(cga.pos, CRTCOLS - col);
+		else if(cga.par[0] == 1)
+			cgaclear(cga.pos - col, col+1);
+		else if(cga.par[0] == 2)
+			cgaclear(cga.pos - col, CRTCOLS);
+		break;
+	case 'm':  // SGR: set colours and intensity.
+		for(i = 0; i < cga.npar; i++)
+			cgasgr(cga.par[i]);
+		break;
+	}
+}
+
+// Feed one output character through the escape sequence parser.
+// Ordinary characters go to cgaputc(); CSI sequences are
+// interpreted and not shown.
+static void
+cgawrite(int c)
+{
+	if(!cga.ready)
+		cgaload();
+	switch(cga.esc){
+	case 0:
+		if(c == '\x1b')
+			cga.esc = 1;
+		else
+			cgaputc(c);
+		break;
+	case 1:
+		if(c == '['){
+			cga.esc = 2;
+			cga.npar = 1;
+			memset(cga.par, 0, sizeof(cga.par));
+		} else {
+			cga.esc = 0;
+			cgaputc(c);
+		}
+		break;
+	case 2:
+		if(c >= '0' && c <= '9'){
+			cga.par[cga.npar-1] = cga.par[cga.npar-1]*10 + c - '0';
+		} else if(c == ';'){
+			if(cga.npar < NELEM(cga.par))
+				cga.npar++;
+			else
+				cga.par[cga.npar-1] = 0;
+		} else if(c >= 0x40 && c <= 0x7e){
+			cga.esc = 0;
+			if(cga.view)
+				cgascroll(-cga.view);
+			cgacsi(c);
+		} else if(c < 0x20 || c > 0x7e)
+			cga.esc = 0;  // Not a sequence after all; drop it.
+		break;
+	}
 }
 
 void
@@ -198,41 +688,96 @@ consputc(int c)
 		uartputc('\b'); uartputc(' '); uartputc('\b');
 	} else
 		uartputc(c);
-	cgaputc(c);
+	cgawrite(c);
 }
 
-#define INPUT_BUF 128
 struct {
 	char buf[INPUT_BUF];
 	uint r;  // Read index
 	uint w;  // Write index
 	uint e;  // Edit index
+	int mode;  // CONS_COOKED, CONS_CBREAK or CONS_RAW
 } input;
 
 #define C(x)  ((x)-'@')  // Control-x
 #define A(x) (x + 100)  // Alt
+#define KEY_SPGUP 0xEA  // Shift+PgUp, see kbd.h
+#define KEY_SPGDN 0xEB  // Shift+PgDn
 
 void showMenu();
-void saveBackground();
-void loadBackground();
-static char backgroundBackup[230];
 
 void handleInput(char c);
 void displaySelection(int cur);
 int computeLowerBound(int x);
 
-static int flagC = 0;
-static int flagO = 0;
-
-// 1 - active ... 0 - hidden
-static int menuStatus = 0;
-
 // 0 - Default 
 static int currentSelection = 0;
 
-void clearFlags(){
-	flagC = 0;
-	flagO = 0;
+static void
+togglemenu(void)
+{
+	menuStatus =! menuStatus;
+	if(menuStatus){
+		showMenu();
+		displaySelection(currentSelection);
+	}
+	cgadirty(0, MENUROWS*CRTCOLS);
+}
+
+static void
+pageup(void)
+{
+	cgascroll(CRTROWS/2);
+}
+
+static void
+pagedown(void)
+{
+	cgascroll(-CRTROWS/2);
+}
+
+// Console hotkeys: a sequence of up to four keys, pressed one
+// after another with nothing in between, runs fn. Keys that
+// appear in any sequence are kept from the reader.
+static struct hotkey {
+	uchar keys[4];  // The sequence, 0-terminated if shorter
+	void (*fn)(void);
+	int matched;    // Keys of the sequence seen so far
+} hotkeys[] = {
+	{ { A('c'), A('o'), A('l') }, togglemenu },
+	{ { KEY_SPGUP }, pageup },  // Page through the scrollback.
+	{ { KEY_SPGDN }, pagedown },
+};
+
+// Feed key c to the hotkey matcher. Returns 1
+// if c is a hotkey key and must not be passed on.
+static int
+hotkey(int c)
+{
+	struct hotkey *h;
+	void (*fn)(void);
+	int n, used;
+
+	if(c == 0)  // Modifier up/down; keeps a sequence going.
+		return 0;
+	fn = 0;
+	used = 0;
+	for(h = hotkeys; h < hotkeys+NELEM(hotkeys); h++){
+		for(n = 0; n < NELEM(h->keys) && h->keys[n]; n++)
+			if(h->keys[n] == c)
+				used = 1;
+		if(h->keys[h->matched] == c)
+			h->matched++;
+		else
+			h->matched = h->keys[0] == c;
+		if(h->matched == n){
+			h->matched = 0;
+			fn = h->fn;
+		}
+	}
+	if(fn)
+		fn();
+	return used;
 }
 
 void
@@ -242,11 +787,26 @@ consoleintr(int (*getc)(void))
 
 	acquire(&cons.lock);
 	while((c = getc()) >= 0){
+		if(hotkey(c))
+			continue;
+		if(c >= A('a') && c <= A('z'))
+			c -= A(0);  // Alt with a letter that is not a hotkey
+		if(input.mode == CONS_RAW && !menuStatus){
+			// Raw: every byte goes to the reader untouched.
+			if(c != 0 && input.e-input.r < INPUT_BUF){
+				input.buf[input.e++ % INPUT_BUF] = c;
+				input.w = input.e;
+				wakeup(&input.r);
+				pollwake();
+			}
+			continue;
+		}
+		if(input.mode == CONS_CBREAK && (c == C('U') || c == C('H') || c == '\x7f'))
+			goto deliver;  // No line editing; pass the key on.
 		switch(c){
 		case C('P'):  // Process listing.
 			// procdump() locks cons.lock indirectly; invoke later
 			doprocdump = 1;
-			clearFlags();
 			break;
 		case C('U'):  // Kill line.
 			while(input.e != input.w &&
@@ -254,7 +814,6 @@ consoleintr(int (*getc)(void))
 				input.e--;
 				consputc(BACKSPACE);
 			}
-			clearFlags();
 			break;
 		case C('H'): case '\x7f':  // Backspace
 			if(!menuStatus){
@@ -263,48 +822,30 @@ consoleintr(int (*getc)(void))
 				consputc(BACKSPACE);
 				}	
 			}
-			clearFlags();
-			break;
-		case A('c'):			
-			flagC = 1;
-			flagO = 0;
-			break;
-		case A('o'):
-			if(flagO){
-				clearFlags();
-				break;
-				} 	// stops alt c-o-o-l sequence
-			flagC? flagO = 1:clearFlags(); 
-			break;
-		case A('l'):
-			if(flagC && flagO){
-				menuStatus? loadBackground():saveBackground();
-				menuStatus =! menuStatus;
-			}
-			clearFlags();
 			break;
 		default: // Da li kombinacija tastera koja nema ispis prekida sekvencu???
+		deliver:
 			if(!menuStatus){			
 				if(c != 0 && input.e-input.r < INPUT_BUF){
-					clearFlags();
 					c = (c == '\r') ? '\n' : c;
 					input.buf[input.e++ % INPUT_BUF] = c;
 					consputc(c);
-					if(c == '\n' || c == C('D') || input.e == input.r+INPUT_BUF){
+					if(c == '\n' || c == C('D') || input.e == input.r+INPUT_BUF ||
+					   input.mode != CONS_COOKED){
 						input.w = input.e;
 						wakeup(&input.r);
+						pollwake();
 					}
 				}
 			}else { 	
 				handleInput(c);
 				showMenu(); // clears last selected row
 				displaySelection(currentSelection);
-				if(c != 0) clearFlags(); // bez ovoga ne radi zatvaranje menija, prolazi alt cXXXXol 
-				//clearFlags(); // ne radi menu close, jedino ako razmak skoro ne postoji izmedju c-o-l
 			}
 			break;
 		}
 	}
+	cgaflush();
 	release(&cons.lock);
 	if(doprocdump) {
 		procdump();  // now call procdump() wo. cons.lock held
@@ -329,6 +870,14 @@ consoleread(struct inode *ip, char *dst, int n)
 			}
 			sleep(&input.r, &cons.lock);
 		}
+		if(input.mode != CONS_COOKED){
+			// No line discipline: hand over everything typed so far.
+			while(n > 0 && input.r != input.w){
+				*dst++ = input.buf[input.r++ % INPUT_BUF];
+				--n;
+			}
+			break;
+		}
 		c = input.buf[input.r++ % INPUT_BUF];
 		if(c == C('D')){  // EOF
 			if(n < target){
@@ -352,18 +901,86 @@ consoleread(struct inode *ip, char *dst, int n)
 int
 consolewrite(struct inode *ip, char *buf, int n)
 {
-	int i;
+	int i, j;
 
 	iunlock(ip);
 	acquire(&cons.lock);
-	for(i = 0; i < n; i++)
-		consputc(buf[i] & 0xff);
+	if(panicked){
+		cli();
+		for(;;)
+			;
+	}
+	// Printable runs are copied to the screen a row at a time;
+	// control bytes and escape sequences go through cgawrite().
+	for(i = 0; i < n; i = j){
+		for(j = i; j < n && buf[j] >= ' ' && buf[j] <= '~'; j++)
+			;
+		if(j > i && !cga.esc)
+			cgaputs(buf + i, j - i);
+		else {
+			if(j == i)
+				j++;
+			for(; i < j; i++)
+				cgawrite(buf[i] & 0xff);
+		}
+	}
+	cgaflush();
 	release(&cons.lock);
+
+	// The serial port gets the same bytes through its transmit
+	// queue, sleeping if the queue is full, so cons.lock must
+	// not be held here.
+	uartwrite(buf, n);
 	ilock(ip);
 
 	return n;
 }
 
+int
+consoleioctl(struct inode *ip, int req, int arg)
+{
+	int r;
+
+	acquire(&cons.lock);
+	switch(req){
+	case CONSOLE_GETMODE:
+		r = input.mode;
+		break;
+	case CONSOLE_SETMODE:
+		if(arg != CONS_COOKED && arg != CONS_CBREAK && arg != CONS_RAW){
+			r = -1;
+			break;
+		}
+		// Whatever was typed so far becomes readable, so a
+		// partial line is not lost when leaving cooked mode.
+		input.w = input.e;
+		input.mode = arg;
+		wakeup(&input.r);
+		pollwake();
+		r = 0;
+		break;
+	default:
+		r = -1;
+		break;
+	}
+	release(&cons.lock);
+	return r;
+}
+
+// Input is ready once consoleread() would not wait.
+int
+consolepoll(struct inode *ip)
+{
+	int r;
+
+	acquire(&cons.lock);
+	r = POLLOUT;
+	if(input.r != input.w)
+		r |= POLLIN;
+	release(&cons.lock);
+	return r;
+}
+
 void
 consoleinit(void)
 {
@@ -371,8 +988,11 @@ consoleinit(void)
 
 	devsw[CONSOLE].write = consolewrite;
 	devsw[CONSOLE].read = consoleread;
+	devsw[CONSOLE].ioctl = consoleioctl;
+	devsw[CONSOLE].poll = consolepoll;
 	cons.locking = 1;
 
+	kbdinit();
 	ioapicenable(IRQ_KBD, 0);
 }
 
@@ -418,40 +1038,9 @@ upperbound = lowerbound + 10
 static char menustr[] = "/---<FG>--- ---<BG>---\\|Black     |Black     ||Blue      |Blue      ||Green     |Green     ||Aqua      |Aqua      ||Red       |Red       ||Purple    |Purple    ||Yellow    |Yellow    ||White     |White     |\\---------------------/";
 
 void showMenu(){
-int startingPosition = 57;
-for(int i = 0; i < 230; i++){
-		if(i % 23 == 0){
-			startingPosition = 57 + 80 * (i / 23);
-		}
-		crt[startingPosition] = (menustr[i]&0xff) | 0x0f00;
-		startingPosition++;
-		}
-			
-}
-
-
-void saveBackground(){
-int startingPosition = 57;
-for(int i = 0; i < 230; i++){
-		if(i % 23 == 0){
-			startingPosition = 57 + 80 * (i / 23);
-		}
-		backgroundBackup[i] = crt[startingPosition];
-		startingPosition++;
-		}
-}
-
-
-void loadBackground(){
-int startingPosition = 57;
-for(int i = 0; i < 230; i++){
-		if(i % 23 == 0){
-			startingPosition = 57 + 80 * (i / 23);
-		}
-		crt[startingPosition] = backgroundBackup[i] | currentColor;
-		startingPosition++;
-		}
-
+	for(int i = 0; i < MENUROWS*MENUCOLS; i++)
+		menubuf[i] = (menustr[i]&0xff) | 0x0f00;
+	cgadirty(0, MENUROWS*CRTCOLS);
 }
 
 
@@ -468,11 +1057,11 @@ void handleInput(char c){
 		break;
 	case('e'):
 		getColor(currentSelection);
-		repaint(); 
+		cgadirty(0, CRTROWS*CRTCOLS);
 		break;
 	case('r'):
 		getBrightColor(currentSelection);
-		repaint(); 
+		cgadirty(0, CRTROWS*CRTCOLS);
 		break;	
 	}
 
@@ -481,9 +1070,11 @@ void handleInput(char c){
 
 void displaySelection(int cur){
 	int lowerbound = computeLowerBound(cur);
-	for(int i = lowerbound; i < lowerbound + 10; i++){
-		crt[i] = (crt[i]&0xff) | 0xf000;
+	ushort *p = &menubuf[(lowerbound/80)*MENUCOLS + lowerbound%80 - MENUPOS];
+	for(int i = 0; i < 10; i++){
+		p[i] = (p[i]&0xff) | 0xf000;
 	}
+	cgadirty(lowerbound, 10);
 }
 
 
@@ -510,15 +1101,3 @@ void getBrightColor(){
 	}
 }
 
-
-void repaint(){
-	for(int i=0; i < 2000; i++){
-		crt[i] = (crt[i]&0xff) | currentColor;
-	}
-}
-
-void repaintLastRow(){
-	for(int i=1840; i < 1920; i++){
-		crt[i] = (crt[i]&0xff) | currentColor;
-	}
-}
\ No newline at end of file
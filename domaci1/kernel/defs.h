@@ -2,24 +2,47 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct irqstat;
+struct iovec;
+struct kmcache;
+struct lockstat;
+struct mm;
 struct pipe;
+struct pollfd;
 struct proc;
+struct profsample;
 struct rtcdate;
+struct rusage;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct traceev;
+struct trapframe;
+
+// buddy.c
+void*           buddyinit(void*, void*);
+char*           kallocpages(int);
+void            kfreepages(char*, int);
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bnew(uint, uint);
 void            brelse(struct buf*);
+int             bshrink(void);
+void            breadahead(uint, uint);
+void            bdone(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
 
 // console.c
 void            consoleinit(void);
 void            cprintf(char*, ...);
 void            consoleintr(int(*)(void));
+void            klogd(void);
+void            klogkick(void);
+int             klogread(char*, int);
 void            panic(char*) __attribute__((noreturn));
 
 // exec.c
@@ -29,23 +52,38 @@ int             exec(char*, char**);
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
+int             fileioctl(struct file*, int, int);
 void            fileinit(void);
 int             fileread(struct file*, char*, int n);
+int             filereadv(struct file*, struct iovec*, int, uint*);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filewritev(struct file*, struct iovec*, int, uint*);
+int             filesplice(struct file*, struct file*, int);
+int             filepoll(struct file*);
+int             filecopy(struct file*, struct file*, int);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
+int             copyi(struct inode*, uint, struct inode*, uint, uint);
 int             dirlink(struct inode*, char*, uint);
+int             dirnent(struct inode*);
+void            dirunlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
-struct inode*   ialloc(uint, short);
+struct inode*   ialloc(uint, short, uint);
 struct inode*   idup(struct inode*);
-void            iinit(int dev);
+void            iinit(void);
+void            itext(struct inode*, int);
+int             fsattach(uint);
 void            ilock(struct inode*);
+void            ilockshared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
+void            iunlockshared(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
+int             mount(struct inode*, char*);
+int             mounted(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
@@ -56,20 +94,32 @@ int             writei(struct inode*, char*, uint, uint);
 // ide.c
 void            ideinit(void);
 void            ideintr(void);
-void            iderw(struct buf*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
 extern uchar    ioapicid;
 void            ioapicinit(void);
+int             irqaffinity(int, int);
+int             irqbalance(int);
+void            irqbalancer(void);
+void            irqcount(int);
+int             irqstat(struct irqstat*, int);
 
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+int             kfreecount(void);
+void            kincref(char*);
+int             kref(char*);
+uint            palloc(void);
+void            pfree(uint);
+void            pincref(uint);
+int             pref(uint);
 
 // kbd.c
+void            kbdinit(void);
 void            kbdintr(void);
 
 // lapic.c
@@ -77,15 +127,20 @@ void            cmostime(struct rtcdate *r);
 int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
+void            lapicipi(int, int);
+void            lapictimer(uint64);
+uint64          nanouptime(void);
 void            lapicinit(void);
-void            lapicstartap(uchar, uint);
+void            lapicstartaps(uchar*, int, uint);
 void            microdelay(int);
 
 // log.c
 void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
+void            begin_opn(int);
 void            end_op();
+void            log_sync(void);
 
 // mp.c
 extern int      ismp;
@@ -95,31 +150,82 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// mmap.c
+uint            mmap(uint, int, int, struct file*, uint);
+int             munmap(uint, uint);
+uint            mmapbase(struct mm*);
+int             mmapfault(struct mm*, uint, int);
+int             mmapfork(struct mm*, struct mm*);
+void            mmapclose(struct mm*);
+int             pagefault(struct mm*, uint, uint, int);
+uint            uvmlimit(struct mm*, uint);
+int             uvmaccess(struct mm*, uint, uint);
+int             copyin(struct mm*, void*, uint, uint);
+int             copyinstr(struct mm*, char*, uint, uint);
+
+// pcache.c
+void            pcacheinit(void);
+char*           pcacheget(struct inode*, uint);
+int             pcacheread(struct inode*, char*, uint, uint);
+void            pcacheinval(struct inode*, uint, uint);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
+int             pipewspan(struct pipe*, char**);
+void            pipewdone(struct pipe*, int);
+int             piperspan(struct pipe*, char**);
+void            piperdone(struct pipe*, int);
+int             pipepoll(struct pipe*, int);
+
+// poll.c
+int             poll(struct pollfd*, int, uint64);
+void            pollinit(void);
+void            pollwake(void);
 
 // proc.c
+int             clone(uint, uint, uint, uint);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             futexwait(uint, int);
+void            futexwake(uint);
+int             getrusage(int, struct rusage*, int);
 int             growproc(int);
+int             join(uint*);
+struct proc*    kthread(char*, void(*)(void));
 int             kill(int);
+struct mm*      mmalloc(pde_t*);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+void            schedtick(void);
+int             setpriority(int, int);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+int             vfork(void);
+void            vforkdone(struct mm*);
 int             wait(void);
 void            wakeup(void*);
 void            yield(void);
 
+// prof.c
+extern int      profiling;
+int             profctl(int);
+void            profinit(void);
+int             profread(struct profsample*, int);
+void            profsample(struct trapframe*);
+
+// ramdisk.c
+void            ramdiskinit(void);
+
 // swtch.S
 void            swtch(struct context**, struct context*);
 
@@ -128,16 +234,30 @@ void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+int             lockstats(struct lockstat*, int);
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// slab.c
+void            kmcacheinit(struct kmcache*, char*, uint);
+void            kminit(void);
+void*           kmcachealloc(struct kmcache*);
+void            kmfree(void*);
+void*           kmalloc(uint);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+void            acquiresleepshared(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
+void            releasesleepshared(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// stats.c
+void            statadd(int, uint);
+void            statinit(void);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -150,13 +270,37 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
-int             argstr(int, char**);
+int             argstr(int, char*, int);
 int             fetchint(uint, int*);
-int             fetchstr(uint, char**);
+int             fetchstr(uint, char*, int);
 void            syscall(void);
 
 // timer.c
+void            clockupdate(void);
+int             sleepseq(uint*, uint, uint64);
+void            sleepuntil(uint64, struct spinlock*);
 void            timerinit(void);
+int             timerintr(void);
+void            timerresume(void);
+void            wakeseq(uint*);
+
+// tmpfs.c
+uint            tmpalloc(short);
+int             tmpcopyi(struct inode*, uint, struct inode*, uint, uint);
+void            tmpinit(void);
+void            tmpload(struct inode*);
+int             tmpread(struct inode*, char*, uint, uint);
+struct inode*   tmproot(void);
+void            tmptrunc(struct inode*);
+void            tmpupdate(struct inode*);
+int             tmpwrite(struct inode*, char*, uint, uint);
+
+// trace.c
+extern uint     tracemask;
+int             tracectl(uint);
+void            traceev(int, uint);
+void            traceinit(void);
+int             traceread(struct traceev*, int);
 
 // trap.c
 void            idtinit(void);
@@ -168,22 +312,36 @@ extern struct spinlock tickslock;
 void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
+void            uartsync(void);
+void            uartwrite(char*, int);
 
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
+void            kvmstart(void);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
+void            uvmunmap(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
-int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+int             mapcow(pde_t*, char*, char*);
+int             cowfault(pde_t*, uint);
+int             uvmcopy(pde_t*, pde_t*, uint, uint);
+int             uvmmap(pde_t*, uint, uint, int);
+int             uvmpresent(pde_t*, uint);
+char*           pgmap(uint);
+void            pgunmap(char*);
+void            pgzero(uint);
+void            pgcopy(uint, uint);
+void            tlbshoot(pde_t*);
+void            tlbintr(void);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
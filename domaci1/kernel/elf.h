@@ -40,3 +40,33 @@ struct proghdr {
 #define ELF_PROG_FLAG_EXEC      1
 #define ELF_PROG_FLAG_WRITE     2
 #define ELF_PROG_FLAG_READ      4
+
+// Section header, for tools that read the symbol table
+struct secthdr {
+	uint name;
+	uint type;
+	uint flags;
+	uint addr;
+	uint off;
+	uint size;
+	uint link;
+	uint info;
+	uint addralign;
+	uint entsize;
+};
+
+// Values for Secthdr type
+#define ELF_SECT_SYMTAB         2
+
+// Symbol table entry
+struct elfsym {
+	uint name;
+	uint value;
+	uint size;
+	uchar info;
+	uchar other;
+	ushort shndx;
+};
+
+#define ELF_SYM_TYPE(info)      ((info) & 0xf)
+#define ELF_SYM_FUNC            2
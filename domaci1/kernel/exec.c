@@ -3,6 +3,11 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mm.h"
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
@@ -11,13 +16,20 @@ int
 exec(char *path, char **argv)
 {
 	char *s, *last;
-	int i, off;
-	uint argc, sz, sp, ustack[3+MAXARG+1];
+	int i, j, off, nseg;
+	uint argc, sz, sp, e, ustack[3+MAXARG+1], memend[NSEG];
+	struct seg seg[NSEG];
 	struct elfhdr elf;
-	struct inode *ip;
+	struct inode *ip, *exe;
 	struct proghdr ph;
 	pde_t *pgdir, *oldpgdir;
 	struct proc *curproc = myproc();
+	struct mm *mm = curproc->mm, *nmm;
+
+	// The other threads would be left without their memory.
+	// A vfork() child leaves its parent's alone and makes its own.
+	if(mm->ref > 1 && curproc->vfork != 1)
+		return -1;
 
 	begin_op();
 
@@ -28,6 +40,8 @@ exec(char *path, char **argv)
 	}
 	ilock(ip);
 	pgdir = 0;
+	exe = 0;
+	nmm = 0;
 
 	// Check ELF header
 	if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -37,9 +51,16 @@ exec(char *path, char **argv)
 
 	if((pgdir = setupkvm()) == 0)
 		goto bad;
+	if(curproc->vfork == 1 && (nmm = mmalloc(pgdir)) == 0){
+		pgdir = 0;  // freed by mmalloc()
+		goto bad;
+	}
 
-	// Load program into memory.
+	// Note where the program's segments go; their pages are
+	// read in from ip on first touch (see imagefault()).
 	sz = 0;
+	nseg = 0;
+	memset(seg, 0, sizeof(seg));
 	for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
 		if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
 			goto bad;
@@ -47,17 +68,35 @@ exec(char *path, char **argv)
 			continue;
 		if(ph.memsz < ph.filesz)
 			goto bad;
-		if(ph.vaddr + ph.memsz < ph.vaddr)
-			goto bad;
-		if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+		if(ph.vaddr + ph.memsz < ph.vaddr || ph.vaddr + ph.memsz >= KERNBASE)
 			goto bad;
-		if(ph.vaddr % PGSIZE != 0)
+		if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
 			goto bad;
-		if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+		if(ph.vaddr % PGSIZE != 0 || nseg == NSEG)
 			goto bad;
+		seg[nseg].va = ph.vaddr;
+		seg[nseg].filesz = ph.filesz;
+		seg[nseg].off = ph.off;
+		seg[nseg].nobss = ph.memsz == ph.filesz;
+		memend[nseg] = ph.vaddr + ph.memsz;
+		if(memend[nseg] > sz)
+			sz = memend[nseg];
+		nseg++;
 	}
-	iunlockput(ip);
+	// The rest of a segment's last page may come from the file
+	// only if no memory that must start out zeroed is there.
+	for(i = 0; i < nseg; i++){
+		e = PGROUNDUP(seg[i].va + seg[i].filesz);
+		if(e > sz)
+			seg[i].nobss = 0;
+		for(j = 0; j < nseg; j++)
+			if(seg[j].va < e && memend[j] > seg[i].va + seg[i].filesz)
+				seg[i].nobss = 0;
+	}
+	itext(ip, 1);
+	iunlock(ip);
 	end_op();
+	exe = ip;
 	ip = 0;
 
 	// Allocate two pages at the next page boundary.
@@ -94,21 +133,41 @@ exec(char *path, char **argv)
 	safestrcpy(curproc->name, last, sizeof(curproc->name));
 
 	// Commit to the user image.
-	oldpgdir = curproc->pgdir;
-	curproc->pgdir = pgdir;
-	curproc->sz = sz;
+	if(nmm){
+		vforkdone(nmm);
+		mm = nmm;
+		oldpgdir = 0;
+	} else {
+		oldpgdir = mm->pgdir;
+		mm->pgdir = pgdir;
+	}
+	mm->sz = sz;
+	curproc->ring = 0;
 	curproc->tf->eip = elf.entry;  // main
 	curproc->tf->esp = sp;
 	switchuvm(curproc);
-	freevm(oldpgdir);
+	if(oldpgdir){
+		freevm(oldpgdir);
+		mmapclose(mm);
+	}
+	mm->exe = exe;
+	memmove(mm->seg, seg, sizeof(seg));
 	return 0;
 
 	bad:
 	if(pgdir)
 		freevm(pgdir);
+	if(nmm)
+		kmfree(nmm);
 	if(ip){
 		iunlockput(ip);
 		end_op();
 	}
+	if(exe){
+		itext(exe, -1);
+		begin_op();
+		iput(exe);
+		end_op();
+	}
 	return -1;
 }
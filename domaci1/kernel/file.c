@@ -6,20 +6,26 @@
 #include "defs.h"
 #include "param.h"
 #include "fs.h"
+#include "stat.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "uio.h"
+#include "poll.h"
+#include "slab.h"
 
 struct devsw devsw[NDEV];
 struct {
 	struct spinlock lock;
-	struct file file[NFILE];
+	struct kmcache cache;
+	int nfile;  // open files, at most NFILE
 } ftable;
 
 void
 fileinit(void)
 {
 	initlock(&ftable.lock, "ftable");
+	kmcacheinit(&ftable.cache, "file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -29,15 +35,20 @@ filealloc(void)
 	struct file *f;
 
 	acquire(&ftable.lock);
-	for(f = ftable.file; f < ftable.file + NFILE; f++){
-		if(f->ref == 0){
-			f->ref = 1;
-			release(&ftable.lock);
-			return f;
-		}
+	if(ftable.nfile >= NFILE){
+		release(&ftable.lock);
+		return 0;
 	}
+	ftable.nfile++;
 	release(&ftable.lock);
-	return 0;
+	if((f = kmcachealloc(&ftable.cache)) == 0){
+		acquire(&ftable.lock);
+		ftable.nfile--;
+		release(&ftable.lock);
+		return 0;
+	}
+	f->ref = 1;
+	return f;
 }
 
 // Increment ref count for file f.
@@ -66,12 +77,14 @@ fileclose(struct file *f)
 		return;
 	}
 	ff = *f;
-	f->ref = 0;
-	f->type = FD_NONE;
+	ftable.nfile--;
 	release(&ftable.lock);
+	kmfree(f);
 
 	if(ff.type == FD_PIPE)
 		pipeclose(ff.pipe, ff.writable);
+	else if(ff.type == FD_INODE && ff.ip->dev == TMPDEV)
+		iput(ff.ip);  // tmpfs has no log
 	else if(ff.type == FD_INODE){
 		begin_op();
 		iput(ff.ip);
@@ -92,65 +105,306 @@ filestat(struct file *f, struct stat *st)
 	return -1;
 }
 
-// Read from file f.
+// Send a device-specific request to the device behind f.
 int
-fileread(struct file *f, char *addr, int n)
+fileioctl(struct file *f, int req, int arg)
 {
+	struct inode *ip;
 	int r;
 
-	if(f->readable == 0)
+	if(f->type != FD_INODE)
 		return -1;
+	ip = f->ip;
+	ilock(ip);
+	if(ip->type != T_DEV || ip->major < 0 || ip->major >= NDEV ||
+	   !devsw[ip->major].ioctl){
+		iunlock(ip);
+		return -1;
+	}
+	r = devsw[ip->major].ioctl(ip, req, arg);
+	iunlock(ip);
+	return r;
+}
+
+// Return the POLLIN, POLLOUT, POLLERR and POLLHUP conditions
+// that hold for f now. Files on disk are always ready.
+int
+filepoll(struct file *f)
+{
+	struct inode *ip;
+	int r;
+
 	if(f->type == FD_PIPE)
-		return piperead(f->pipe, addr, n);
+		r = pipepoll(f->pipe, f->writable);
+	else {
+		ip = f->ip;
+		if(ip->type == T_DEV && ip->major >= 0 && ip->major < NDEV &&
+		   devsw[ip->major].poll)
+			r = devsw[ip->major].poll(ip);
+		else
+			r = POLLIN | POLLOUT;
+	}
+	if(!f->readable)
+		r &= ~POLLIN;
+	if(!f->writable)
+		r &= ~POLLOUT;
+	return r;
+}
+
+// Read from file f into the segments of iov in turn. One
+// ilock covers them all. A pipe or device stops after the
+// first segment that gets data, since another read might
+// block with data already in hand.
+// If off is not 0 the read starts at *off instead of f->off,
+// which it leaves alone; such reads of a regular file share
+// its lock with each other.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt, uint *off)
+{
+	int i, r, m, tot, shared;
+	struct inode *ip;
+	char *addr;
+
+	if(f->readable == 0)
+		return -1;
+	if(f->type == FD_PIPE){
+		if(off)
+			return -1;
+		for(i = 0; i < cnt && iov[i].len == 0; i++)
+			;
+		return i < cnt ? piperead(f->pipe, iov[i].base, iov[i].len) : 0;
+	}
 	if(f->type == FD_INODE){
-		ilock(f->ip);
-		if((r = readi(f->ip, addr, f->off, n)) > 0)
-			f->off += r;
-		iunlock(f->ip);
-		return r;
+		ip = f->ip;
+		shared = 0;
+		if(off){
+			ilockshared(ip);
+			shared = ip->type == T_FILE;
+			if(!shared){
+				iunlockshared(ip);
+				ilock(ip);
+			}
+		} else {
+			off = &f->off;
+			ilock(ip);
+		}
+		tot = 0;
+		for(i = 0; i < cnt; i++){
+			addr = iov[i].base;
+			if(ip->type == T_DEV){
+				if(iov[i].len == 0)
+					continue;
+				tot = readi(ip, addr, *off, iov[i].len);
+				break;
+			}
+			// Whole pages may be mapped from the page cache;
+			// readi() copies the rest.
+			m = pcacheread(ip, addr, *off, iov[i].len);
+			*off += m;
+			if((r = readi(ip, addr + m, *off, iov[i].len - m)) > 0)
+				*off += r;
+			if(m > 0 && r < 0)
+				r = 0;
+			if(r < 0){
+				if(tot == 0)
+					tot = -1;
+				break;
+			}
+			tot += m + r;
+			if(m + r < iov[i].len)
+				break;  // end of file
+		}
+		if(shared)
+			iunlockshared(ip);
+		else
+			iunlock(ip);
+		return tot;
 	}
 	panic("fileread");
 }
 
-// Write to file f.
+// Read from file f.
 int
-filewrite(struct file *f, char *addr, int n)
+fileread(struct file *f, char *addr, int n)
 {
-	int r;
+	struct iovec iov;
+
+	iov.base = addr;
+	iov.len = n;
+	return filereadv(f, &iov, 1, 0);
+}
+
+// Write the segments of iov to file f in turn, at *off if off
+// is not 0, as filereadv() does.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt, uint *off)
+{
+	int i, r, m, n, n1, left, tot, done;
 
 	if(f->writable == 0)
 		return -1;
-	if(f->type == FD_PIPE)
-		return pipewrite(f->pipe, addr, n);
+	n = 0;
+	for(i = 0; i < cnt; i++)
+		n += iov[i].len;
+	if(f->type == FD_PIPE){
+		if(off)
+			return -1;
+		for(i = 0, tot = 0; i < cnt; i++, tot += r)
+			if((r = pipewrite(f->pipe, iov[i].base, iov[i].len)) < 0)
+				return -1;
+		return tot;
+	}
 	if(f->type == FD_INODE){
 		// write a few blocks at a time to avoid exceeding
 		// the maximum log transaction size, including
-		// i-node, indirect block, allocation blocks,
-		// and 2 blocks of slop for non-aligned writes.
+		// i-node, overflow extent block, 2 allocation blocks,
+		// and 1 block of slop for non-aligned writes.
 		// this really belongs lower down, since writei()
 		// might be writing a device like the console.
-		int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
-		int i = 0;
-		while(i < n){
-			int n1 = n - i;
+		// The segments are contiguous in the file, so one
+		// transaction takes as many as fit.
+		// A tmpfs file goes without transactions.
+		int max = (MAXWRITEBLOCKS-1-1-2-1) * BSIZE;
+		int logged = f->ip->dev != TMPDEV;
+		if(off == 0)
+			off = &f->off;
+		i = 0;
+		done = 0;
+		r = 0;
+		for(tot = 0; tot < n && r >= 0; ){
+			n1 = n - tot;
 			if(n1 > max)
 				n1 = max;
 
-			begin_op();
+			if(logged)
+				begin_opn((n1 + BSIZE-1)/BSIZE + 1+1+2+1);
 			ilock(f->ip);
-			if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
-				f->off += r;
+			for(left = n1; left > 0; left -= m){
+				while(iov[i].len == done){
+					i++;
+					done = 0;
+				}
+				m = iov[i].len - done;
+				if(m > left)
+					m = left;
+				if ((r = writei(f->ip, (char*)iov[i].base + done, *off, m)) > 0){
+					*off += r;
+					tot += r;
+					done += r;
+				}
+				if(r != m){
+					r = -1;  // file has run out of extents
+					break;
+				}
+			}
 			iunlock(f->ip);
-			end_op();
-
-			if(r < 0)
-				break;
-			if(r != n1)
-				panic("short filewrite");
-			i += r;
+			if(logged)
+				end_op();
 		}
-		return i == n ? n : -1;
+		return tot == n ? n : -1;
 	}
 	panic("filewrite");
 }
 
+// Write to file f.
+int
+filewrite(struct file *f, char *addr, int n)
+{
+	struct iovec iov;
+
+	iov.base = addr;
+	iov.len = n;
+	return filewritev(f, &iov, 1, 0);
+}
+
+
+// Copy up to n bytes from file in to file out, both regular
+// files, inside the kernel: copyi() moves each block from one
+// buffer to the other, in transactions of the same size as
+// filewrite()'s. Returns the number of bytes copied, or -1.
+int
+filecopy(struct file *in, struct file *out, int n)
+{
+	struct inode *a, *b;
+	int r, i;
+
+	if(in->readable == 0 || out->writable == 0 || n < 0)
+		return -1;
+	if(in->type != FD_INODE || out->type != FD_INODE || in->ip == out->ip)
+		return -1;
+	// Lock the lower-numbered inode first.
+	a = in->ip;
+	b = out->ip;
+	if(a->dev > b->dev || (a->dev == b->dev && a->inum > b->inum)){
+		a = out->ip;
+		b = in->ip;
+	}
+	int max = (MAXWRITEBLOCKS-1-1-2-1) * BSIZE;
+	int logged = out->ip->dev != TMPDEV;
+	for(i = 0; i < n; i += r){
+		int n1 = n - i;
+		if(n1 > max)
+			n1 = max;
+
+		if(logged)
+			begin_opn((n1 + BSIZE-1)/BSIZE + 1+1+2+1);
+		ilock(a);
+		ilock(b);
+		if((r = copyi(in->ip, in->off, out->ip, out->off, n1)) > 0){
+			in->off += r;
+			out->off += r;
+		}
+		iunlock(b);
+		iunlock(a);
+		if(logged)
+			end_op();
+
+		if(r < 0)
+			return i > 0 ? i : -1;
+		if(r != n1)
+			return i + r;  // end of in, or out has run out of extents
+	}
+	return i;
+}
+
+// Move up to n bytes from file in to file out, one of which
+// must be a pipe, without copying them through user memory:
+// the other file reads into or writes from the pipe's ring
+// directly. Returns the number of bytes moved, or -1.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+	char *span;
+	int r, m;
+
+	if(in->readable == 0 || out->writable == 0 || n < 0)
+		return -1;
+	if(in->type == FD_PIPE){
+		if(out->type == FD_PIPE && out->pipe == in->pipe)
+			return -1;
+		if((m = piperspan(in->pipe, &span)) <= 0)
+			return m;
+		if(m > n)
+			m = n;
+		r = filewrite(out, span, m);
+		piperdone(in->pipe, r < 0 ? 0 : r);
+		return r;
+	}
+	if(in->type != FD_INODE || out->type != FD_PIPE)
+		return -1;
+	m = 0;
+	for(r = 0; r < n; r += m){
+		if((m = pipewspan(out->pipe, &span)) < 0)
+			return r > 0 ? r : -1;
+		if(m > n - r)
+			m = n - r;
+		ilock(in->ip);
+		if((m = readi(in->ip, span, in->off, m)) > 0)
+			in->off += m;
+		iunlock(in->ip);
+		pipewdone(out->pipe, m < 0 ? 0 : m);
+		if(m <= 0)
+			break;
+	}
+	return r > 0 || m == 0 ? r : -1;
+}
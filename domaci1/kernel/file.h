@@ -16,13 +16,21 @@ struct inode {
 	int ref;            // Reference count
 	struct sleeplock lock; // protects everything below here
 	int valid;          // inode has been read from disk?
+	uint seqnext;       // block after the last one readi() read
+	uint ranext;        // first block not yet read ahead
+	struct inode *hnext; // icache hash chain
+	struct inode *prev; // icache LRU list of unreferenced entries
+	struct inode *next;
 
 	short type;         // copy of disk inode
 	short major;
 	short minor;
 	short nlink;
 	uint size;
-	uint addrs[NDIRECT+1];
+	struct extent ext[NEXTENT];
+	uint xblock;
+
+	int textbusy;       // mms running this file; see itext()
 };
 
 // table mapping major device number to
@@ -30,8 +38,11 @@ struct inode {
 struct devsw {
 	int (*read)(struct inode*, char*, int);
 	int (*write)(struct inode*, char*, int);
+	int (*ioctl)(struct inode*, int, int);
+	int (*poll)(struct inode*);  // POLLIN, POLLOUT now
 };
 
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define STATS   2
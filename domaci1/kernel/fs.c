@@ -20,12 +20,16 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "slab.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
-// there should be one superblock per disk device, but we run with
-// only one device
-struct superblock sb;
+static void dcacheinit(void);
+static void dcachepurge(uint, uint);
+static void mntinit(void);
+static void icount(int);
+// One superblock per block device, read by fsattach().
+struct superblock sb[NBDEV];
 
 // Read the super block.
 void
@@ -38,45 +42,133 @@ readsb(int dev, struct superblock *sb)
 	brelse(bp);
 }
 
-// Zero a block.
+// Zero a block. Its old contents do not matter, so the
+// buffer is not read from disk first.
 static void
 bzero(int dev, int bno)
 {
 	struct buf *bp;
 
-	bp = bread(dev, bno);
-	memset(bp->data, 0, BSIZE);
+	bp = bnew(dev, bno);
 	log_write(bp);
 	brelse(bp);
 }
 
 // Blocks.
+//
+// The allocator keeps a cursor after the last block it handed
+// out and a count of free bits per bitmap block, read at mount.
+// A scan starts at the caller's goal, or else at the cursor,
+// skips bitmap blocks whose count is zero and full 32-bit words
+// of the bitmap, and takes a run of free blocks at once. The
+// counts change only while the bitmap block's buffer is locked;
+// a scan that trusts them and finds nothing is repeated without
+// them before the allocator gives up.
+
+#define NBMAP (FSSIZE/BPB + 1)
+
+static struct {
+	uint cursor;
+	int nfree[NBMAP];  // free blocks covered by each bitmap block
+} bmap_sum[NBDEV];
+
+// Count the free blocks in each bitmap block.
+static void
+bcount(int dev)
+{
+	struct buf *bp;
+	uint b, bi;
+
+	memset(bmap_sum[dev].nfree, 0, sizeof(bmap_sum[dev].nfree));
+	for(b = 0; b < sb[dev].size; b += BPB){
+		bp = bread(dev, BBLOCK(b, sb[dev]));
+		for(bi = 0; bi < BPB && b + bi < sb[dev].size; bi++)
+			if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+				bmap_sum[dev].nfree[b/BPB]++;
+		brelse(bp);
+	}
+	bmap_sum[dev].cursor = 0;
+}
 
-// Allocate a zeroed disk block.
+// In the bitmap block bp, which covers blocks from base, find
+// the first free block at or after bit from and mark up to n
+// free blocks from there in use. Returns the first block and
+// sets *got, or returns 0 if no bit from on is free.
 static uint
-balloc(uint dev)
+bscan(struct buf *bp, uint base, uint from, uint n, uint *got)
 {
-	int b, bi, m;
+	uint *w, bi, k, limit;
+
+	limit = sb[bp->dev].size - base < BPB ? sb[bp->dev].size - base : BPB;
+	w = (uint*)bp->data;
+	for(bi = from; bi < limit; bi++){
+		if(bi % 32 == 0 && w[bi/32] == 0xffffffff){
+			bi += 31;  // whole word in use
+			continue;
+		}
+		if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+			break;
+	}
+	if(bi >= limit)
+		return 0;
+
+	for(k = 0; k < n && bi + k < limit; k++){
+		if(bp->data[(bi+k)/8] & (1 << ((bi+k) % 8)))
+			break;
+		bp->data[(bi+k)/8] |= 1 << ((bi+k) % 8);  // Mark block in use.
+	}
+	*got = k;
+	return base + bi;
+}
+
+// Allocate up to n zeroed disk blocks that are contiguous on
+// disk, as near after goal as possible (or after the cursor, if
+// goal is 0). Returns the first block and sets *got to how many
+// were allocated, which is at least 1.
+static uint
+ballocn(uint dev, uint goal, uint n, uint *got)
+{
+	uint b, bb, nb, i, k;
+	int pass;
 	struct buf *bp;
 
-	bp = 0;
-	for(b = 0; b < sb.size; b += BPB){
-		bp = bread(dev, BBLOCK(b, sb));
-		for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-			m = 1 << (bi % 8);
-			if((bp->data[bi/8] & m) == 0){  // Is block free?
-				bp->data[bi/8] |= m;  // Mark block in use.
+	if(goal == 0 || goal >= sb[dev].size)
+		goal = bmap_sum[dev].cursor < sb[dev].size ? bmap_sum[dev].cursor : 0;
+	nb = (sb[dev].size + BPB - 1) / BPB;
+	for(pass = 0; pass < 2; pass++){
+		// Visit goal's bitmap block first from goal, and again
+		// at the end from its start.
+		for(i = 0; i <= nb; i++){
+			bb = (goal/BPB + i) % nb;
+			if(pass == 0 && bmap_sum[dev].nfree[bb] == 0)
+				continue;
+			bp = bread(dev, sb[dev].bmapstart + bb);
+			b = bscan(bp, bb*BPB, i == 0 ? goal % BPB : 0, n, got);
+			if(b){
+				bmap_sum[dev].nfree[bb] -= *got;
 				log_write(bp);
 				brelse(bp);
-				bzero(dev, b + bi);
-				return b + bi;
+				bmap_sum[dev].cursor = b + *got;
+				for(k = 0; k < *got; k++)
+					bzero(dev, b + k);
+				return b;
 			}
+			brelse(bp);
 		}
-		brelse(bp);
 	}
 	panic("balloc: out of blocks");
 }
 
+// Allocate a zeroed disk block, preferring goal and the
+// blocks after it so that files stay contiguous.
+static uint
+balloc(uint dev, uint goal)
+{
+	uint got;
+
+	return ballocn(dev, goal, 1, &got);
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -84,12 +176,13 @@ bfree(int dev, uint b)
 	struct buf *bp;
 	int bi, m;
 
-	bp = bread(dev, BBLOCK(b, sb));
+	bp = bread(dev, BBLOCK(b, sb[dev]));
 	bi = b % BPB;
 	m = 1 << (bi % 8);
 	if((bp->data[bi/8] & m) == 0)
 		panic("freeing free block");
 	bp->data[bi/8] &= ~m;
+	bmap_sum[dev].nfree[b/BPB]++;
 	log_write(bp);
 	brelse(bp);
 }
@@ -159,46 +252,192 @@ bfree(int dev, uint b)
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold icache.lock while using any of those fields.
 //
+// Entries are found through a hash table on (dev, inum). Entries
+// with ref 0 sit on an LRU free list and keep their contents, so
+// iget() of a recently used inode need not read the disk again;
+// when the list is empty, icache grows by an entry from its
+// slab cache.
+//
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 61
+#define IHASH(dev, inum) (((dev) * 7 + (inum)) % NIHASH)
+
 struct {
 	struct spinlock lock;
-	struct inode inode[NINODE];
+	struct kmcache cache;
+	struct inode *hash[NIHASH];
+	struct inode head;  // Free list through prev/next
+	int ninode;
 } icache;
 
-void
-iinit(int dev)
+// Put ip, which has no references, at the MRU end of the free
+// list. Caller holds icache.lock.
+static void
+ifree(struct inode *ip)
+{
+	ip->next = icache.head.next;
+	ip->prev = &icache.head;
+	icache.head.next->prev = ip;
+	icache.head.next = ip;
+}
+
+static void
+iunfree(struct inode *ip)
 {
-	int i = 0;
+	ip->next->prev = ip->prev;
+	ip->prev->next = ip->next;
+}
+
+// Add a free entry to icache. Caller holds icache.lock.
+static int
+igrow(void)
+{
+	struct inode *ip;
+
+	if((ip = kmcachealloc(&icache.cache)) == 0)
+		return 0;
+	initsleeplock(&ip->lock, "inode");
+	ifree(ip);
+	icache.ninode++;
+	return 1;
+}
 
+void
+iinit(void)
+{
 	initlock(&icache.lock, "icache");
-	for(i = 0; i < NINODE; i++) {
-		initsleeplock(&icache.inode[i].lock, "inode");
+	kmcacheinit(&icache.cache, "inode", sizeof(struct inode));
+	icache.head.prev = &icache.head;
+	icache.head.next = &icache.head;
+	acquire(&icache.lock);
+	while(icache.ninode < NINODE)
+		if(!igrow())
+			panic("iinit");
+	release(&icache.lock);
+	dcacheinit();
+	mntinit();
+}
+
+static struct inode* iget(uint dev, uint inum);
+
+// Which inodes are in use, read from the inode blocks at
+// mount and kept up to date by ialloc() and iput(), so that
+// allocation does not have to read the inode blocks to find
+// a free one. A bit is set from the time ialloc() claims the
+// inode until iput() has written it back as free.
+
+#define MAXINUM (BSIZE*8)
+
+static struct {
+	struct spinlock lock;
+	uint used[MAXINUM/32];
+} imap[NBDEV];
+
+static void
+icount(int dev)
+{
+	struct buf *bp;
+	struct dinode *dip;
+	uint inum;
+
+	initlock(&imap[dev].lock, "imap");
+	memset(imap[dev].used, 0, sizeof(imap[dev].used));
+	imap[dev].used[0] |= 1;  // inode 0 is never allocated
+	for(inum = 1; inum < sb[dev].ninodes; inum++){
+		if(inum == 1 || inum % IPB == 0)
+			bp = bread(dev, IBLOCK(inum, sb[dev]));
+		dip = (struct dinode*)bp->data + inum%IPB;
+		if(dip->type != 0)
+			imap[dev].used[inum/32] |= 1 << (inum % 32);
+		if(inum % IPB == IPB-1 || inum == sb[dev].ninodes-1)
+			brelse(bp);
 	}
+}
 
-	readsb(dev, &sb);
-	cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
- inodestart %d bmap start %d\n", sb.size, sb.nblocks,
-		sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-		sb.bmapstart);
+// Make the file system on block device dev usable: read its
+// super block and count its free blocks and inodes. Returns
+// -1 if there is no such device or it holds no file system.
+int
+fsattach(uint dev)
+{
+	struct superblock *s;
+
+	if(dev >= NBDEV || bdevsw[dev].submit == 0)
+		return -1;
+	s = &sb[dev];
+	readsb(dev, s);
+	if(s->size == 0 || s->size > NBMAP*BPB || s->ninodes > MAXINUM)
+		return -1;
+	cprintf("sb %d: size %d nblocks %d ninodes %d nlog %d logstart %d\
+ inodestart %d bmap start %d\n", dev, s->size, s->nblocks,
+		s->ninodes, s->nlog, s->logstart, s->inodestart,
+		s->bmapstart);
+	bcount(dev);
+	icount(dev);
+	return 0;
 }
 
-static struct inode* iget(uint dev, uint inum);
+// Claim a free inode number, starting the search at the
+// first inode in near's block so that inodes created in
+// the same directory share inode blocks. Returns 0 if
+// every inode is in use.
+static uint
+iclaim(uint dev, uint near)
+{
+	uint inum, n, w;
+
+	if(near >= sb[dev].ninodes)
+		near = 0;
+	inum = near - near%IPB;
+	acquire(&imap[dev].lock);
+	for(n = 0; n < sb[dev].ninodes; n++, inum++){
+		if(inum >= sb[dev].ninodes)
+			inum = 0;
+		w = imap[dev].used[inum/32];
+		if(w == 0xffffffff){
+			n += 31 - inum%32;  // whole word in use
+			inum += 31 - inum%32;
+			continue;
+		}
+		if((w & (1 << (inum % 32))) == 0){
+			imap[dev].used[inum/32] = w | (1 << (inum % 32));
+			release(&imap[dev].lock);
+			return inum;
+		}
+	}
+	release(&imap[dev].lock);
+	return 0;
+}
 
-// Allocate an inode on device dev.
+static void
+iunclaim(uint dev, uint inum)
+{
+	acquire(&imap[dev].lock);
+	imap[dev].used[inum/32] &= ~(1 << (inum % 32));
+	release(&imap[dev].lock);
+}
+
+// Allocate an inode on device dev, near inode near.
 // Mark it as allocated by  giving it type type.
-// Returns an unlocked but allocated and referenced inode.
+// Returns an unlocked but allocated and referenced inode,
+// or 0 if a tmpfs is out of inodes.
 struct inode*
-ialloc(uint dev, short type)
+ialloc(uint dev, short type, uint near)
 {
-	int inum;
+	uint inum;
 	struct buf *bp;
 	struct dinode *dip;
 
-	for(inum = 1; inum < sb.ninodes; inum++){
-		bp = bread(dev, IBLOCK(inum, sb));
+	if(dev == TMPDEV){
+		if((inum = tmpalloc(type)) == 0)
+			return 0;
+		return iget(dev, inum);
+	}
+	while((inum = iclaim(dev, near)) != 0){
+		bp = bread(dev, IBLOCK(inum, sb[dev]));
 		dip = (struct dinode*)bp->data + inum%IPB;
 		if(dip->type == 0){  // a free inode
 			memset(dip, 0, sizeof(*dip));
@@ -207,7 +446,7 @@ ialloc(uint dev, short type)
 			brelse(bp);
 			return iget(dev, inum);
 		}
-		brelse(bp);
+		brelse(bp);  // the map was wrong; leave the bit set
 	}
 	panic("ialloc: no inodes");
 }
@@ -222,14 +461,19 @@ iupdate(struct inode *ip)
 	struct buf *bp;
 	struct dinode *dip;
 
-	bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+	if(ip->dev == TMPDEV){
+		tmpupdate(ip);
+		return;
+	}
+	bp = bread(ip->dev, IBLOCK(ip->inum, sb[ip->dev]));
 	dip = (struct dinode*)bp->data + ip->inum%IPB;
 	dip->type = ip->type;
 	dip->major = ip->major;
 	dip->minor = ip->minor;
 	dip->nlink = ip->nlink;
 	dip->size = ip->size;
-	memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+	memmove(dip->ext, ip->ext, sizeof(ip->ext));
+	dip->xblock = ip->xblock;
 	log_write(bp);
 	brelse(bp);
 }
@@ -240,31 +484,39 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-	struct inode *ip, *empty;
+	struct inode *ip, **pp;
 
 	acquire(&icache.lock);
 
 	// Is the inode already cached?
-	empty = 0;
-	for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-		if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-			ip->ref++;
+	for(ip = icache.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+		if(ip->dev == dev && ip->inum == inum){
+			if(ip->ref++ == 0)
+				iunfree(ip);
 			release(&icache.lock);
 			return ip;
 		}
-		if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-			empty = ip;
 	}
 
-	// Recycle an inode cache entry.
-	if(empty == 0)
+	// Recycle the least recently used free entry.
+	if(icache.head.prev == &icache.head && !igrow())
 		panic("iget: no inodes");
+	ip = icache.head.prev;
+	iunfree(ip);
+	if(ip->inum){
+		for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+			;
+		*pp = ip->hnext;
+	}
+	ip->hnext = icache.hash[IHASH(dev, inum)];
+	icache.hash[IHASH(dev, inum)] = ip;
 
-	ip = empty;
 	ip->dev = dev;
 	ip->inum = inum;
 	ip->ref = 1;
 	ip->valid = 0;
+	ip->seqnext = 0;
+	ip->ranext = 0;
 	release(&icache.lock);
 
 	return ip;
@@ -281,6 +533,23 @@ idup(struct inode *ip)
 	return ip;
 }
 
+// Count one more (n = 1) or one fewer (n = -1) address space
+// running ip's program. imagefault() reads a program's pages
+// only when they are first touched, so while textbusy is set
+// writei() and copyi() refuse to change the file, and open()
+// to open it for writing. Caller holds a reference; it must
+// hold ip->lock to count the first one, so that a writer that
+// holds the lock and saw 0 is done before exec() reads the file.
+void
+itext(struct inode *ip, int n)
+{
+	acquire(&icache.lock);
+	ip->textbusy += n;
+	if(ip->textbusy < 0)
+		panic("itext");
+	release(&icache.lock);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -295,15 +564,20 @@ ilock(struct inode *ip)
 	acquiresleep(&ip->lock);
 
 	if(ip->valid == 0){
-		bp = bread(ip->dev, IBLOCK(ip->inum, sb));
-		dip = (struct dinode*)bp->data + ip->inum%IPB;
-		ip->type = dip->type;
-		ip->major = dip->major;
-		ip->minor = dip->minor;
-		ip->nlink = dip->nlink;
-		ip->size = dip->size;
-		memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
-		brelse(bp);
+		if(ip->dev == TMPDEV)
+			tmpload(ip);
+		else {
+			bp = bread(ip->dev, IBLOCK(ip->inum, sb[ip->dev]));
+			dip = (struct dinode*)bp->data + ip->inum%IPB;
+			ip->type = dip->type;
+			ip->major = dip->major;
+			ip->minor = dip->minor;
+			ip->nlink = dip->nlink;
+			ip->size = dip->size;
+			memmove(ip->ext, dip->ext, sizeof(ip->ext));
+			ip->xblock = dip->xblock;
+			brelse(bp);
+		}
 		ip->valid = 1;
 		if(ip->type == 0)
 			panic("ilock: no type");
@@ -320,6 +594,37 @@ iunlock(struct inode *ip)
 	releasesleep(&ip->lock);
 }
 
+// Lock the given inode in shared mode, for reading only:
+// readi() on a regular file changes nothing that other such
+// readers use, apart from the readahead hints.
+// Reads the inode from disk if necessary.
+void
+ilockshared(struct inode *ip)
+{
+	if(ip == 0 || ip->ref < 1)
+		panic("ilockshared");
+
+	// Only an exclusive holder may fill in the inode. Once
+	// valid, it stays so while we hold a reference.
+	for(;;){
+		acquiresleepshared(&ip->lock);
+		if(ip->valid)
+			break;
+		releasesleepshared(&ip->lock);
+		ilock(ip);
+		iunlock(ip);
+	}
+}
+
+void
+iunlockshared(struct inode *ip)
+{
+	if(ip == 0 || ip->ref < 1)
+		panic("iunlockshared");
+
+	releasesleepshared(&ip->lock);
+}
+
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode cache entry can
 // be recycled.
@@ -337,16 +642,21 @@ iput(struct inode *ip)
 		release(&icache.lock);
 		if(r == 1){
 			// inode has no links and no other references: truncate and free.
+			if(ip->type == T_DIR)
+				dcachepurge(ip->dev, ip->inum);
 			itrunc(ip);
 			ip->type = 0;
 			iupdate(ip);
 			ip->valid = 0;
+			if(ip->dev != TMPDEV)
+				iunclaim(ip->dev, ip->inum);
 		}
 	}
 	releasesleep(&ip->lock);
 
 	acquire(&icache.lock);
-	ip->ref--;
+	if(--ip->ref == 0)
+		ifree(ip);
 	release(&icache.lock);
 }
 
@@ -361,40 +671,99 @@ iunlockput(struct inode *ip)
 // Inode content
 //
 // The content (data) associated with each inode is stored
-// in blocks on the disk. The first NDIRECT block numbers
-// are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// in blocks on the disk, described by extents. The first
+// NEXTENT extents are in ip->ext[]; if the file needs more,
+// the next NXEXTENT are in block ip->xblock. Unused extents
+// have len 0. Files only grow at the end, so a new block
+// either lengthens the last extent, when the block after it
+// is free, or starts a new one.
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If bn is just past the end of the file's blocks, bmap
+// allocates it, together with up to want-1 blocks after it
+// when they are contiguous on disk. Returns 0 if the file has
+// no room for another extent.
 static uint
-bmap(struct inode *ip, uint bn)
+bmap(struct inode *ip, uint bn, uint want)
 {
-	uint addr, *a;
+	uint addr, got;
 	struct buf *bp;
-
-	if(bn < NDIRECT){
-		if((addr = ip->addrs[bn]) == 0)
-			ip->addrs[bn] = addr = balloc(ip->dev);
-		return addr;
+	struct extent *x, *last;
+	int i, j, xdirty;
+
+	// Look through the inode's extents, then the overflow block's.
+	last = 0;
+	for(i = 0; i < NEXTENT && ip->ext[i].len; i++){
+		if(bn < ip->ext[i].len)
+			return ip->ext[i].start + bn;
+		bn -= ip->ext[i].len;
+		last = &ip->ext[i];
 	}
-	bn -= NDIRECT;
-
-	if(bn < NINDIRECT){
-		// Load indirect block, allocating if necessary.
-		if((addr = ip->addrs[NDIRECT]) == 0)
-			ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-		bp = bread(ip->dev, addr);
-		a = (uint*)bp->data;
-		if((addr = a[bn]) == 0){
-			a[bn] = addr = balloc(ip->dev);
-			log_write(bp);
+	bp = 0;
+	x = 0;
+	j = 0;
+	if(i == NEXTENT && ip->xblock){
+		bp = bread(ip->dev, ip->xblock);
+		x = (struct extent*)bp->data;
+		for(; j < NXEXTENT && x[j].len; j++){
+			if(bn < x[j].len){
+				addr = x[j].start + bn;
+				brelse(bp);
+				return addr;
+			}
+			bn -= x[j].len;
+			last = &x[j];
 		}
+	}
+	if(bn != 0)
+		panic("bmap: hole");
+
+	// Append blocks, lengthening the last extent if the
+	// blocks after it are free.
+	xdirty = 0;
+	addr = ballocn(ip->dev, last ? last->start + last->len : 0, want ? want : 1, &got);
+	if(last && addr == last->start + last->len){
+		last->len += got;
+		xdirty = j > 0;
+	} else if(i < NEXTENT){
+		ip->ext[i].start = addr;
+		ip->ext[i].len = got;
+	} else if(j < NXEXTENT){
+		if(bp == 0){
+			// balloc() zeroes the new overflow block.
+			ip->xblock = balloc(ip->dev, 0);
+			bp = bread(ip->dev, ip->xblock);
+			x = (struct extent*)bp->data;
+		}
+		x[j].start = addr;
+		x[j].len = got;
+		xdirty = 1;
+	} else {
+		while(got > 0)
+			bfree(ip->dev, addr + --got);  // no room for another extent
+		addr = 0;
+	}
+	if(bp){
+		if(xdirty)
+			log_write(bp);
 		brelse(bp);
-		return addr;
 	}
+	return addr;
+}
 
-	panic("bmap: out of range");
+// Free the blocks of n extents.
+static void
+efree(struct inode *ip, struct extent *ext, int n)
+{
+	int i;
+	uint b;
+
+	for(i = 0; i < n && ext[i].len; i++){
+		for(b = 0; b < ext[i].len; b++)
+			bfree(ip->dev, ext[i].start + b);
+		ext[i].start = 0;
+		ext[i].len = 0;
+	}
 }
 
 // Truncate inode (discard contents).
@@ -405,27 +774,22 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-	int i, j;
 	struct buf *bp;
-	uint *a;
 
-	for(i = 0; i < NDIRECT; i++){
-		if(ip->addrs[i]){
-			bfree(ip->dev, ip->addrs[i]);
-			ip->addrs[i] = 0;
-		}
+	pcacheinval(ip, 0, ip->size);
+	if(ip->dev == TMPDEV){
+		tmptrunc(ip);
+		return;
 	}
 
-	if(ip->addrs[NDIRECT]){
-		bp = bread(ip->dev, ip->addrs[NDIRECT]);
-		a = (uint*)bp->data;
-		for(j = 0; j < NINDIRECT; j++){
-			if(a[j])
-				bfree(ip->dev, a[j]);
-		}
+	efree(ip, ip->ext, NEXTENT);
+
+	if(ip->xblock){
+		bp = bread(ip->dev, ip->xblock);
+		efree(ip, (struct extent*)bp->data, NXEXTENT);
 		brelse(bp);
-		bfree(ip->dev, ip->addrs[NDIRECT]);
-		ip->addrs[NDIRECT] = 0;
+		bfree(ip->dev, ip->xblock);
+		ip->xblock = 0;
 	}
 
 	ip->size = 0;
@@ -444,6 +808,37 @@ stati(struct inode *ip, struct stat *st)
 	st->size = ip->size;
 }
 
+// Queue reads for the blocks readi() is about to copy, and if
+// ip is being read sequentially also for the NREADAHEAD blocks
+// after them, without waiting. The disk then works through the
+// queue while readi() copies out the first blocks.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint off, uint n)
+{
+	uint bn, last, end;
+
+	if(n == 0)
+		return;
+	bn = off/BSIZE;
+	last = (off + n - 1)/BSIZE;
+	end = last;
+	if(bn == ip->seqnext)
+		end += NREADAHEAD;
+	else
+		ip->ranext = 0;
+	ip->seqnext = last + 1;
+
+	if(end > (ip->size - 1)/BSIZE)
+		end = (ip->size - 1)/BSIZE;
+	if(bn < ip->ranext)
+		bn = ip->ranext;
+	for(; bn <= end; bn++)
+		breadahead(ip->dev, bmap(ip, bn, 1));
+	if(bn > ip->ranext)
+		ip->ranext = bn;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 int
@@ -462,9 +857,12 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 		return -1;
 	if(off + n > ip->size)
 		n = ip->size - off;
+	if(ip->dev == TMPDEV)
+		return tmpread(ip, dst, off, n);
 
+	readahead(ip, off, n);
 	for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-		bp = bread(ip->dev, bmap(ip, off/BSIZE));
+		bp = bread(ip->dev, bmap(ip, off/BSIZE, 1));
 		m = min(n - tot, BSIZE - off%BSIZE);
 		memmove(dst, bp->data + off%BSIZE, m);
 		brelse(bp);
@@ -477,7 +875,7 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-	uint tot, m;
+	uint tot, m, addr;
 	struct buf *bp;
 
 	if(ip->type == T_DEV){
@@ -486,24 +884,77 @@ writei(struct inode *ip, char *src, uint off, uint n)
 		return devsw[ip->major].write(ip, src, n);
 	}
 
+	if(ip->textbusy)
+		return -1;
 	if(off > ip->size || off + n < off)
 		return -1;
 	if(off + n > MAXFILE*BSIZE)
 		return -1;
+	pcacheinval(ip, off, n);
+	if(ip->dev == TMPDEV)
+		return tmpwrite(ip, src, off, n);
 
 	for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-		bp = bread(ip->dev, bmap(ip, off/BSIZE));
+		// Let an append allocate the rest of the write at once.
+		if((addr = bmap(ip, off/BSIZE, (off + n - tot - 1)/BSIZE - off/BSIZE + 1)) == 0)
+			break;  // out of extents
+		bp = bread(ip->dev, addr);
 		m = min(n - tot, BSIZE - off%BSIZE);
 		memmove(bp->data + off%BSIZE, src, m);
 		log_write(bp);
 		brelse(bp);
 	}
 
-	if(n > 0 && off > ip->size){
+	if(tot > 0 && off > ip->size){
 		ip->size = off;
 		iupdate(ip);
 	}
-	return n;
+	return tot > 0 || n == 0 ? tot : -1;
+}
+
+// Copy n bytes of ip at off to dp at doff, from one buffer
+// cache block straight into the other. Like writei(), an
+// append allocates the blocks of the whole copy at once.
+// Returns the number of bytes copied, short at the end of ip
+// or if dp runs out of extents, or -1.
+// Caller must hold both locks.
+int
+copyi(struct inode *ip, uint off, struct inode *dp, uint doff, uint n)
+{
+	uint tot, m, addr;
+	struct buf *sbp, *dbp;
+
+	if(ip == dp || ip->type != T_FILE || dp->type != T_FILE || dp->textbusy)
+		return -1;
+	if(off > ip->size || off + n < off || doff > dp->size || doff + n < doff)
+		return -1;
+	if(off + n > ip->size)
+		n = ip->size - off;
+	if(doff + n > MAXFILE*BSIZE)
+		return -1;
+	pcacheinval(dp, doff, n);
+	if(ip->dev == TMPDEV || dp->dev == TMPDEV)
+		return tmpcopyi(ip, off, dp, doff, n);
+
+	readahead(ip, off, n);
+	for(tot=0; tot<n; tot+=m, off+=m, doff+=m){
+		if((addr = bmap(dp, doff/BSIZE, (doff + n - tot - 1)/BSIZE - doff/BSIZE + 1)) == 0)
+			break;  // out of extents
+		sbp = bread(ip->dev, bmap(ip, off/BSIZE, 1));
+		dbp = bread(dp->dev, addr);
+		m = min(n - tot, BSIZE - off%BSIZE);
+		m = min(m, BSIZE - doff%BSIZE);
+		memmove(dbp->data + doff%BSIZE, sbp->data + off%BSIZE, m);
+		log_write(dbp);
+		brelse(dbp);
+		brelse(sbp);
+	}
+
+	if(tot > 0 && doff > dp->size){
+		dp->size = doff;
+		iupdate(dp);
+	}
+	return tot > 0 || n == 0 ? tot : -1;
 }
 
 // Directories
@@ -514,40 +965,354 @@ namecmp(const char *s, const char *t)
 	return strncmp(s, t, DIRSIZ);
 }
 
+// Directory entry cache.
+//
+// Maps (dev, directory inum, name) to the inum and offset of the
+// entry, or to inum 0 if the directory has no such name, so that
+// dirlookup() can skip scanning the directory. The entries for a
+// directory change only while its inode is locked: dirlookup()
+// adds them, dirlink() and unlink update them, and freeing the
+// directory purges them. dcache.lock protects the table itself.
+// Unused entries have dinum 0 and are recycled in LRU order.
+
+#define NDHASH 61
+
+struct dentry {
+	uint dev;
+	uint dinum;            // directory holding the name
+	char name[DIRSIZ];
+	uint inum;             // 0 if name is not in the directory
+	uint off;              // byte offset of the entry
+	struct dentry *hnext;  // hash chain
+	struct dentry *prev;   // LRU list, most recent at head.next
+	struct dentry *next;
+};
+
+struct {
+	struct spinlock lock;
+	struct dentry ent[NDENTRY];
+	struct dentry *hash[NDHASH];
+	struct dentry head;
+} dcache;
+
+static void
+dcacheinit(void)
+{
+	struct dentry *e;
+
+	initlock(&dcache.lock, "dcache");
+	dcache.head.prev = &dcache.head;
+	dcache.head.next = &dcache.head;
+	for(e = dcache.ent; e < dcache.ent+NDENTRY; e++){
+		e->next = dcache.head.next;
+		e->prev = &dcache.head;
+		dcache.head.next->prev = e;
+		dcache.head.next = e;
+	}
+}
+
+static struct dentry**
+dhash(uint dev, uint dinum, char *name)
+{
+	uint h;
+	int i;
+
+	h = dev * 31 + dinum;
+	for(i = 0; i < DIRSIZ && name[i]; i++)
+		h = h * 31 + (uchar)name[i];
+	return &dcache.hash[h % NDHASH];
+}
+
+// Caller holds dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dinum, char *name)
+{
+	struct dentry *e;
+
+	for(e = *dhash(dev, dinum, name); e; e = e->hnext)
+		if(e->dinum == dinum && e->dev == dev && namecmp(e->name, name) == 0)
+			return e;
+	return 0;
+}
+
+// Take e off its hash chain. Caller holds dcache.lock.
+static void
+dunhash(struct dentry *e)
+{
+	struct dentry **pp;
+
+	for(pp = dhash(e->dev, e->dinum, e->name); *pp; pp = &(*pp)->hnext){
+		if(*pp == e){
+			*pp = e->hnext;
+			break;
+		}
+	}
+	e->dinum = 0;
+}
+
+// Move e to the front (tail if !used) of the LRU list.
+// Caller holds dcache.lock.
+static void
+dtouch(struct dentry *e, int used)
+{
+	e->next->prev = e->prev;
+	e->prev->next = e->next;
+	if(used){
+		e->next = dcache.head.next;
+		e->prev = &dcache.head;
+	} else {
+		e->next = &dcache.head;
+		e->prev = dcache.head.prev;
+	}
+	e->next->prev = e;
+	e->prev->next = e;
+}
+
+// Look name up in dp's cached entries. Returns 1 and sets
+// *pinum (0 for a known miss) and *poff if the answer is cached.
+static int
+dcachelookup(struct inode *dp, char *name, uint *pinum, uint *poff)
+{
+	struct dentry *e;
+
+	acquire(&dcache.lock);
+	if((e = dfind(dp->dev, dp->inum, name)) == 0){
+		release(&dcache.lock);
+		return 0;
+	}
+	*pinum = e->inum;
+	*poff = e->off;
+	dtouch(e, 1);
+	release(&dcache.lock);
+	return 1;
+}
+
+// Record that name in dp is inum at offset off, or that
+// dp has no entry name if inum is 0.
+static void
+dcacheenter(struct inode *dp, char *name, uint inum, uint off)
+{
+	struct dentry *e, **pp;
+
+	acquire(&dcache.lock);
+	if((e = dfind(dp->dev, dp->inum, name)) == 0){
+		e = dcache.head.prev;  // least recently used
+		if(e->dinum)
+			dunhash(e);
+		e->dev = dp->dev;
+		e->dinum = dp->inum;
+		strncpy(e->name, name, DIRSIZ);
+		pp = dhash(e->dev, e->dinum, e->name);
+		e->hnext = *pp;
+		*pp = e;
+	}
+	e->inum = inum;
+	e->off = off;
+	dtouch(e, 1);
+	release(&dcache.lock);
+}
+
+// The entry name has been removed from dp.
+static void
+dcacheforget(struct inode *dp, char *name)
+{
+	dcacheenter(dp, name, 0, 0);
+}
+
+// Directory dinum is being freed; its inode number may be
+// reused, so drop every entry cached for it.
+static void
+dcachepurge(uint dev, uint dinum)
+{
+	struct dentry *e;
+
+	acquire(&dcache.lock);
+	for(e = dcache.ent; e < dcache.ent+NDENTRY; e++){
+		if(e->dinum == dinum && e->dev == dev){
+			dunhash(e);
+			dtouch(e, 0);
+		}
+	}
+	release(&dcache.lock);
+}
+
+// Hashed directories.
+//
+// The first nblock blocks of a hashed directory are a hash
+// table: name goes in block dirhash(name) % nblock or, if that
+// block is full, in the first block after it with room, and
+// every block passed over is marked DH_OVERFLOW. A lookup can
+// therefore stop at the first block without the mark. Once the
+// whole table is full, new entries go in plain dirent blocks
+// after it, which are searched linearly. Directories made by
+// mkdir are classic flat arrays of dirents.
+
+// Read dp's first block header. Returns 1 if dp is hashed.
+static int
+dirhashed(struct inode *dp, struct dirhdr *h)
+{
+	if(dp->size < BSIZE)
+		return 0;
+	if(readi(dp, (char*)h, 0, sizeof(*h)) != sizeof(*h))
+		panic("dirhashed read");
+	return h->zero == 0 && h->magic == DIRMAGIC && h->nblock > 0;
+}
+
+// Scan dp's plain dirents from byte off on for name.
+// Returns its inum and sets *poff, or returns 0.
+static uint
+dirscan(struct inode *dp, char *name, uint off, uint *poff)
+{
+	struct dirent de;
+
+	for(; off < dp->size; off += sizeof(de)){
+		if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+			panic("dirlookup read");
+		if(de.inum == 0)
+			continue;
+		if(namecmp(name, de.name) == 0){
+			*poff = off;
+			return de.inum;
+		}
+	}
+	return 0;
+}
+
+// Look name up in the hash table of dp, whose header is h.
+static uint
+hashlookup(struct inode *dp, struct dirhdr *h, char *name, uint *poff)
+{
+	struct dirent de[DPB];
+	uint i, j, bn;
+
+	bn = dirhash(name) % h->nblock;
+	for(i = 0; i < h->nblock; i++){
+		if(readi(dp, (char*)de, bn*BSIZE, BSIZE) != BSIZE)
+			panic("dirlookup read");
+		for(j = 1; j < DPB; j++){
+			if(de[j].inum && namecmp(name, de[j].name) == 0){
+				*poff = bn*BSIZE + j*sizeof(de[0]);
+				return de[j].inum;
+			}
+		}
+		if((((struct dirhdr*)de)->flags & DH_OVERFLOW) == 0)
+			return 0;
+		bn = (bn + 1) % h->nblock;
+	}
+	return dirscan(dp, name, h->nblock*BSIZE, poff);
+}
+
+// Return the offset of the first free plain dirent in dp
+// at or after off, or dp->size if there is none.
+static uint
+dirfree(struct inode *dp, uint off)
+{
+	struct dirent de;
+
+	for(; off < dp->size; off += sizeof(de)){
+		if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+			panic("dirlink read");
+		if(de.inum == 0)
+			break;
+	}
+	return off;
+}
+
+// Find a free slot for name in the hash table of dp, marking
+// the full blocks passed over.
+static uint
+hashfree(struct inode *dp, struct dirhdr *h, char *name)
+{
+	struct dirent de[DPB];
+	struct dirhdr *bh;
+	uint i, j, bn;
+
+	bn = dirhash(name) % h->nblock;
+	for(i = 0; i < h->nblock; i++){
+		if(readi(dp, (char*)de, bn*BSIZE, BSIZE) != BSIZE)
+			panic("dirlink read");
+		for(j = 1; j < DPB; j++)
+			if(de[j].inum == 0)
+				return bn*BSIZE + j*sizeof(de[0]);
+		bh = (struct dirhdr*)de;
+		if((bh->flags & DH_OVERFLOW) == 0){
+			bh->flags |= DH_OVERFLOW;
+			if(writei(dp, (char*)bh, bn*BSIZE, sizeof(*bh)) != sizeof(*bh))
+				panic("dirlink write");
+		}
+		bn = (bn + 1) % h->nblock;
+	}
+	return dirfree(dp, h->nblock*BSIZE);
+}
+
+// Add delta to the entry count of hashed directory dp.
+static void
+hashcount(struct inode *dp, int delta)
+{
+	struct dirhdr h;
+
+	if(!dirhashed(dp, &h))
+		panic("hashcount");
+	h.nent += delta;
+	if(writei(dp, (char*)&h, 0, sizeof(h)) != sizeof(h))
+		panic("hashcount write");
+}
+
+// Return the number of entries in dp, . and .. included,
+// if dp is hashed, or -1 if it would have to be scanned.
+// Caller must hold dp->lock.
+int
+dirnent(struct inode *dp)
+{
+	struct dirhdr h;
+
+	if(!dirhashed(dp, &h))
+		return -1;
+	return h.nent;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Caller must hold dp->lock.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
 	uint off, inum;
-	struct dirent de;
+	struct dirhdr h;
 
 	if(dp->type != T_DIR)
 		panic("dirlookup not DIR");
 
-	for(off = 0; off < dp->size; off += sizeof(de)){
-		if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-			panic("dirlookup read");
-		if(de.inum == 0)
-			continue;
-		if(namecmp(name, de.name) == 0){
-			// entry matches path element
-			if(poff)
-				*poff = off;
-			inum = de.inum;
-			return iget(dp->dev, inum);
-		}
+	if(dcachelookup(dp, name, &inum, &off)){
+		if(inum == 0)
+			return 0;
+		if(poff)
+			*poff = off;
+		return iget(dp->dev, inum);
 	}
 
-	return 0;
+	if(dirhashed(dp, &h))
+		inum = hashlookup(dp, &h, name, &off);
+	else
+		inum = dirscan(dp, name, 0, &off);
+	if(inum == 0){
+		dcacheenter(dp, name, 0, 0);
+		return 0;
+	}
+	// entry matches path element
+	if(poff)
+		*poff = off;
+	dcacheenter(dp, name, inum, off);
+	return iget(dp->dev, inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-	int off;
+	int off, hashed;
 	struct dirent de;
+	struct dirhdr h;
 	struct inode *ip;
 
 	// Check that name is not present.
@@ -557,21 +1322,36 @@ dirlink(struct inode *dp, char *name, uint inum)
 	}
 
 	// Look for an empty dirent.
-	for(off = 0; off < dp->size; off += sizeof(de)){
-		if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-			panic("dirlink read");
-		if(de.inum == 0)
-			break;
-	}
+	if((hashed = dirhashed(dp, &h)) != 0)
+		off = hashfree(dp, &h, name);
+	else
+		off = dirfree(dp, 0);
 
 	strncpy(de.name, name, DIRSIZ);
 	de.inum = inum;
 	if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
 		panic("dirlink");
+	if(hashed)
+		hashcount(dp, 1);
+	dcacheenter(dp, name, inum, off);
 
 	return 0;
 }
 
+// Remove the entry name, found by dirlookup() at off, from dp.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+	struct dirent de;
+
+	memset(&de, 0, sizeof(de));
+	if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+		panic("unlink: writei");
+	if(dirnent(dp) >= 0)
+		hashcount(dp, -1);
+	dcacheforget(dp, name);
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -611,6 +1391,133 @@ skipelem(char *path, char *name)
 	return path;
 }
 
+// Mount points.
+//
+// A directory with a file system mounted on it is covered:
+// namex() goes on from the root of the mounted file system
+// instead, and from that root, ".." goes to the covered
+// directory's parent. The table holds a reference to both
+// inodes, so each stays at the same address in the inode
+// cache and can be compared by pointer.
+
+struct mount {
+	struct inode *dp;    // covered directory; 0 if the slot is free
+	struct inode *root;  // mounted root; 0 while being mounted
+	uint dev;
+};
+
+static struct {
+	struct spinlock lock;
+	struct mount m[NMOUNT];
+} mtab;
+
+static void
+mntinit(void)
+{
+	initlock(&mtab.lock, "mtab");
+}
+
+// If ip is covered (up is 0), or is a mounted root (up is 1),
+// drop it and return the inode on the other side of the mount.
+// Otherwise return ip.
+static struct inode*
+mntcross(struct inode *ip, int up)
+{
+	struct mount *m;
+	struct inode *to;
+
+	to = 0;
+	acquire(&mtab.lock);
+	for(m = mtab.m; m < mtab.m+NMOUNT; m++){
+		if(m->root && (up ? m->root : m->dp) == ip){
+			to = up ? m->dp : m->root;
+			break;
+		}
+	}
+	release(&mtab.lock);
+	if(to == 0)
+		return ip;
+	to = idup(to);
+	iput(ip);
+	return to;
+}
+
+// Is a file system mounted on ip?
+int
+mounted(struct inode *ip)
+{
+	struct mount *m;
+	int r;
+
+	r = 0;
+	acquire(&mtab.lock);
+	for(m = mtab.m; m < mtab.m+NMOUNT; m++)
+		if(m->dp == ip)
+			r = 1;
+	release(&mtab.lock);
+	return r;
+}
+
+// Mount a new file system of type type on the directory dp:
+// "tmpfs" makes an empty tmpfs, "ramdisk" mounts the RAM disk's
+// file system. On success the mount table keeps the caller's
+// reference to dp. Not every directory can be covered: not "/",
+// nor one that is covered or a mounted root already.
+int
+mount(struct inode *dp, char *type)
+{
+	struct mount *m, *free;
+	struct inode *root;
+	uint dev;
+
+	if(strncmp(type, "tmpfs", 6) == 0)
+		dev = TMPDEV;
+	else if(strncmp(type, "ramdisk", 8) == 0 && sb[RAMDEV].size)
+		dev = RAMDEV;
+	else
+		return -1;
+
+	ilock(dp);
+	if(dp->type != T_DIR || (dp->dev == ROOTDEV && dp->inum == ROOTINO)){
+		iunlock(dp);
+		return -1;
+	}
+	iunlock(dp);
+
+	// Claim a slot, so that nobody else mounts on dp or mounts
+	// the RAM disk twice while root is being made.
+	free = 0;
+	acquire(&mtab.lock);
+	for(m = mtab.m; m < mtab.m+NMOUNT; m++){
+		if(m->dp == 0){
+			if(free == 0)
+				free = m;
+		} else if(m->dp == dp || m->root == dp || (dev != TMPDEV && m->dev == dev)){
+			release(&mtab.lock);
+			return -1;
+		}
+	}
+	if(free)
+		free->dp = dp;
+	release(&mtab.lock);
+	if(free == 0)
+		return -1;
+
+	if(dev == TMPDEV)
+		root = tmproot();
+	else
+		root = iget(dev, ROOTINO);
+
+	acquire(&mtab.lock);
+	if(root){
+		free->root = root;
+		free->dev = dev;
+	} else
+		free->dp = 0;
+	release(&mtab.lock);
+	return root ? 0 : -1;
+}
+
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
@@ -626,6 +1533,8 @@ namex(char *path, int nameiparent, char *name)
 		ip = idup(myproc()->cwd);
 
 	while((path = skipelem(path, name)) != 0){
+		if(namecmp(name, "..") == 0)
+			ip = mntcross(ip, 1);
 		ilock(ip);
 		if(ip->type != T_DIR){
 			iunlockput(ip);
@@ -641,7 +1550,7 @@ namex(char *path, int nameiparent, char *name)
 			return 0;
 		}
 		iunlockput(ip);
-		ip = next;
+		ip = mntcross(next, 0);
 	}
 	if(nameiparent){
 		iput(ip);
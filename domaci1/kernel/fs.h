@@ -21,9 +21,20 @@ struct superblock {
 	uint bmapstart;    // Block number of first free map block
 };
 
-#define NDIRECT 12
-#define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+// The log header is one block: a count and the block numbers.
+#define MAXLOGBLOCKS ((BSIZE - sizeof(int)) / sizeof(int))
+
+// A file's blocks are described by extents: runs of len
+// consecutive disk blocks starting at start. The inode holds
+// the first NEXTENT; an overflow block holds NXEXTENT more.
+struct extent {
+	uint start;
+	uint len;
+};
+
+#define NEXTENT 6
+#define NXEXTENT (BSIZE / sizeof(struct extent))
+#define MAXFILE 2048  // blocks
 
 // On-disk inode structure
 struct dinode {
@@ -32,7 +43,8 @@ struct dinode {
 	short minor;          // Minor device number (T_DEV only)
 	short nlink;          // Number of links to inode in file system
 	uint size;            // Size of file (bytes)
-	uint addrs[NDIRECT+1];   // Data block addresses
+	struct extent ext[NEXTENT];  // First extents of the file
+	uint xblock;          // Block of further extents, or 0
 };
 
 // Inodes per block.
@@ -55,3 +67,36 @@ struct dirent {
 	char name[DIRSIZ];
 };
 
+
+// Dirents per directory block
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// A hashed directory begins each of its first nblock blocks
+// with a header in place of a dirent. Its zero field sits where
+// a dirent's inum does, so plain dirent readers skip it. Only
+// the header of block 0 keeps nblock and nent.
+#define DIRMAGIC      0x4844  // "DH"
+#define DH_OVERFLOW   0x1     // an insert found this block full
+#define DIRHASHBLOCKS 64      // table size mkfs -d uses
+
+struct dirhdr {
+	ushort zero;      // always 0
+	ushort magic;     // DIRMAGIC
+	ushort nblock;    // blocks in the hash table
+	ushort flags;     // DH_OVERFLOW
+	uint nent;        // entries in the directory, . and .. included
+	uint pad;
+};
+
+// The table block a name starts in is dirhash(name) % nblock.
+static inline uint
+dirhash(char *name)
+{
+	uint h;
+	int i;
+
+	h = 0;
+	for(i = 0; i < DIRSIZ && name[i]; i++)
+		h = h * 31 + (uchar)name[i];
+	return h;
+}
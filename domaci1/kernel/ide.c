@@ -1,4 +1,9 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code.
+//
+// Transfers use PCI bus-master DMA when the controller has it:
+// the disk moves the data straight to or from buf->data and the
+// CPU only sets up a PRD table. Without it, the driver falls back
+// to programmed I/O through port 0x1f0.
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +17,8 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "stats.h"
+#include "trace.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,16 +30,59 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+#define IDE_MAXSECT   16  // sectors per READ/WRITE MULTIPLE transfer
+#define IDE_NPRD      32  // blocks per DMA transfer
+
+// PCI configuration space, for finding the bus-master registers.
+#define PCI_ADDR      0xcf8
+#define PCI_DATA      0xcfc
+#define PCI_CMD_IO    0x01
+#define PCI_CMD_BUSMASTER 0x04
+
+// Bus-master IDE registers, at the offset in BAR4 (primary channel).
+#define BM_CMD        0   // command: start, direction
+#define BM_STATUS     2   // status: active, error, interrupt
+#define BM_PRDT       4   // physical address of PRD table
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // device to memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
+
+// Physical region descriptor: one contiguous piece of a transfer.
+struct prd {
+	uint addr;
+	ushort count;
+	ushort flags;
+};
+#define PRD_EOT       0x8000  // last entry of the table
+
+// The table may not cross a 64 KB boundary; aligning it to
+// its size makes sure of that.
+static struct prd prdt[IDE_NPRD] __attribute__((aligned(sizeof(struct prd)*IDE_NPRD)));
+static ushort bmbase;  // bus-master I/O base, 0 for PIO
+
+// idequeue holds the pending bufs sorted by (dev, blockno),
+// linked through qnext. ideactive lists the bufs of the transfer
+// now in progress: a run of adjacent blocks going the same
+// direction, moved with one multi-sector command. The elevator
+// sweeps upward from lastdev/lastblock and wraps at the top.
+// You must hold idelock while manipulating the queue.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static struct buf *ideactive;
+static int idenqueue;  // bufs on idequeue
+static uint lastdev, lastblock;
+static int maxmerge;  // bufs per transfer
 
 static int havedisk1;
-static void idestart(struct buf*);
+static void idestart(struct buf*, int);
+static void idesubmit(struct buf*);
+static void idewaitrw(struct buf*);
 
 // Wait for IDE disk to become ready.
 static int
@@ -47,6 +97,59 @@ idewait(int checkerr)
 	return 0;
 }
 
+// Have READ/WRITE MULTIPLE on disk move IDE_MAXSECT sectors
+// per data request. Returns -1 if the drive refuses.
+static int
+idesetmul(int disk)
+{
+	outb(0x1f2, IDE_MAXSECT);
+	outb(0x1f6, 0xe0 | (disk<<4));
+	outb(0x1f7, IDE_CMD_SETMUL);
+	return idewait(1);
+}
+
+static uint
+pciread(int bus, int dev, int fn, int off)
+{
+	outl(PCI_ADDR, 0x80000000 | bus<<16 | dev<<11 | fn<<8 | off);
+	return inl(PCI_DATA);
+}
+
+static void
+pciwrite(int bus, int dev, int fn, int off, uint v)
+{
+	outl(PCI_ADDR, 0x80000000 | bus<<16 | dev<<11 | fn<<8 | off);
+	outl(PCI_DATA, v);
+}
+
+// Look on PCI bus 0 for an IDE controller that can do bus-master
+// DMA, turn bus mastering on and return its bus-master I/O base,
+// or 0 if there is none.
+static ushort
+idefinddma(void)
+{
+	int dev, fn;
+	uint class, bar;
+
+	for(dev = 0; dev < 32; dev++){
+		for(fn = 0; fn < 8; fn++){
+			if((pciread(0, dev, fn, 0x00) & 0xffff) == 0xffff)
+				continue;
+			class = pciread(0, dev, fn, 0x08);
+			// Mass storage, IDE, with bus mastering (prog-if bit 7).
+			if((class >> 16) != 0x0101 || !(class & 0x8000))
+				continue;
+			bar = pciread(0, dev, fn, 0x20);
+			if(!(bar & 1) || (bar & ~3) == 0)
+				continue;
+			pciwrite(0, dev, fn, 0x04, pciread(0, dev, fn, 0x04) |
+			    PCI_CMD_IO | PCI_CMD_BUSMASTER);
+			return bar & ~3;
+		}
+	}
+	return 0;
+}
+
 void
 ideinit(void)
 {
@@ -65,76 +168,202 @@ ideinit(void)
 		}
 	}
 
+	// With DMA a transfer is limited by the PRD table. With PIO,
+	// merge requests only if every drive takes multi-sector
+	// transfers; otherwise send one block per command.
+	if((bmbase = idefinddma()) != 0)
+		maxmerge = IDE_NPRD;
+	else {
+		maxmerge = IDE_MAXSECT / (BSIZE/SECTOR_SIZE);
+		if(idesetmul(0) < 0 || (havedisk1 && idesetmul(1) < 0))
+			maxmerge = 1;
+	}
+
 	// Switch back to disk 0.
 	outb(0x1f6, 0xe0 | (0<<4));
+
+	bdevsw[0].submit = idesubmit;
+	bdevsw[0].wait = idewaitrw;
+	if(havedisk1)
+		bdevsw[1] = bdevsw[0];
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Start a DMA transfer of the bufs listed from b, covering
+// nsect sectors from sector. Caller must hold idelock.
 static void
-idestart(struct buf *b)
+idestartdma(struct buf *b, int sector, int nsect)
+{
+	struct prd *p;
+	struct buf *nb;
+	int dir;
+
+	// Each buffer lies within one kalloc page, so its data is
+	// physically contiguous and takes one descriptor.
+	for(p = prdt, nb = b; nb; nb = nb->qnext, p++){
+		p->addr = V2P(nb->data);
+		p->count = BSIZE;
+		p->flags = nb->qnext ? 0 : PRD_EOT;
+	}
+	dir = (b->flags & B_DIRTY) ? 0 : BM_CMD_READ;
+
+	idewait(0);
+	outl(bmbase+BM_PRDT, V2P(prdt));
+	outb(bmbase+BM_CMD, dir);
+	outb(bmbase+BM_STATUS, BM_ST_ERR | BM_ST_INTR);  // write 1 to clear
+
+	outb(0x3f6, 0);  // generate interrupt
+	outb(0x1f2, nsect);  // number of sectors
+	outb(0x1f3, sector & 0xff);
+	outb(0x1f4, (sector >> 8) & 0xff);
+	outb(0x1f5, (sector >> 16) & 0xff);
+	outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
+	outb(0x1f7, dir ? IDE_CMD_RDDMA : IDE_CMD_WRDMA);
+	outb(bmbase+BM_CMD, dir | BM_CMD_START);
+}
+
+// Start the transfer of the n adjacent bufs listed from b.
+// Caller must hold idelock.
+static void
+idestart(struct buf *b, int n)
 {
 	if(b == 0)
 		panic("idestart");
-	if(b->blockno >= FSSIZE)
+	if(b->blockno + n > FSSIZE)
 		panic("incorrect blockno");
 	int sector_per_block =  BSIZE/SECTOR_SIZE;
 	int sector = b->blockno * sector_per_block;
-	int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-	int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+	int nsect = n * sector_per_block;
+	int read_cmd = (nsect == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
+	int write_cmd = (nsect == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-	if (sector_per_block > 7) panic("idestart");
+	if (nsect > IDE_MAXSECT && !bmbase) panic("idestart");
+
+	if(bmbase){
+		idestartdma(b, sector, nsect);
+		return;
+	}
 
 	idewait(0);
 	outb(0x3f6, 0);  // generate interrupt
-	outb(0x1f2, sector_per_block);  // number of sectors
+	outb(0x1f2, nsect);  // number of sectors
 	outb(0x1f3, sector & 0xff);
 	outb(0x1f4, (sector >> 8) & 0xff);
 	outb(0x1f5, (sector >> 16) & 0xff);
 	outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
 	if(b->flags & B_DIRTY){
 		outb(0x1f7, write_cmd);
-		outsl(0x1f0, b->data, BSIZE/4);
+		for(; b; b = b->qnext)
+			outsl(0x1f0, b->data, BSIZE/4);
 	} else {
 		outb(0x1f7, read_cmd);
 	}
 }
 
+// Is a ahead of b in sort order?
+static int
+idebefore(struct buf *a, uint dev, uint blockno)
+{
+	return a->dev < dev || (a->dev == dev && a->blockno < blockno);
+}
+
+// Take the next run of requests off idequeue and start it.
+// Caller must hold idelock, with no transfer in progress.
+static void
+idenext(void)
+{
+	struct buf **pp, *b, *last, *nb;
+	int n;
+
+	for(pp = &idequeue; *pp; pp = &(*pp)->qnext)
+		if(!idebefore(*pp, lastdev, lastblock))
+			break;
+	if(*pp == 0)
+		pp = &idequeue;  // wrap to the lowest block
+	if((b = *pp) == 0)
+		return;
+
+	last = b;
+	for(n = 1; n < maxmerge; n++){
+		nb = last->qnext;
+		if(nb == 0 || nb->dev != b->dev || nb->blockno != last->blockno + 1 ||
+		   (nb->flags & B_DIRTY) != (b->flags & B_DIRTY))
+			break;
+		last = nb;
+	}
+	*pp = last->qnext;
+	last->qnext = 0;
+	idenqueue -= n;
+
+	ideactive = b;
+	lastdev = b->dev;
+	lastblock = last->blockno + 1;
+	idestart(b, n);
+}
+
 // Interrupt handler.
 void
 ideintr(void)
 {
-	struct buf *b;
+	struct buf *b, *nb, *async;
 
-	// First queued buffer is the active request.
+	// ideactive lists the bufs of the finished transfer.
 	acquire(&idelock);
 
-	if((b = idequeue) == 0){
+	if((b = ideactive) == 0){
 		release(&idelock);
 		return;
 	}
-	idequeue = b->qnext;
+	ideactive = 0;
+	statadd(ST_IDEINTR, 1);
 
-	// Read data if needed.
-	if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-		insl(0x1f0, b->data, BSIZE/4);
+	if(bmbase){
+		// Stop the engine; reading the status register
+		// acknowledges the drive's interrupt.
+		outb(bmbase+BM_CMD, 0);
+		if(inb(bmbase+BM_STATUS) & BM_ST_ERR)
+			cprintf("ide: dma error at block %d\n", b->blockno);
+		outb(bmbase+BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+		idewait(1);
+	} else if(!(b->flags & B_DIRTY) && idewait(1) >= 0){
+		// Read data if needed.
+		for(nb = b; nb; nb = nb->qnext)
+			insl(0x1f0, nb->data, BSIZE/4);
+	}
 
-	// Wake process waiting for this buf.
-	b->flags |= B_VALID;
-	b->flags &= ~B_DIRTY;
-	wakeup(b);
+	// Complete each buf and wake the process waiting for it.
+	// Nobody waits for a read-ahead; collect those to release
+	// after dropping idelock.
+	async = 0;
+	for(; b; b = nb){
+		nb = b->qnext;
+		if(b->flags & B_ASYNC){
+			b->qnext = async;
+			async = b;
+		}
+		b->flags |= B_VALID;
+		b->flags &= ~(B_DIRTY | B_ASYNC);
+		TRACE(TC_DISK, TE_IDEDONE, b->blockno);
+		wakeup(b);
+	}
 
-	// Start disk on next buf in queue.
-	if(idequeue != 0)
-		idestart(idequeue);
+	// Start disk on next run in queue.
+	idenext();
 
 	release(&idelock);
+
+	for(b = async; b; b = nb){
+		nb = b->qnext;
+		bdone(b);
+	}
 }
 
-// Sync buf with disk.
+// Queue b for the disk and return without waiting.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-iderw(struct buf *b)
+// A B_ASYNC buf is released by ideintr(); otherwise the caller
+// waits with idewaitrw().
+static void
+idesubmit(struct buf *b)
 {
 	struct buf **pp;
 
@@ -147,21 +376,29 @@ iderw(struct buf *b)
 
 	acquire(&idelock);  //DOC:acquire-lock
 
-	// Append b to idequeue.
-	b->qnext = 0;
-	for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
+	// Insert b into idequeue in block order.
+	for(pp=&idequeue; *pp && idebefore(*pp, b->dev, b->blockno+1); pp=&(*pp)->qnext)  //DOC:insert-queue
 		;
+	b->qnext = *pp;
 	*pp = b;
+	statadd(ST_IDEREQ, 1);
+	statadd(ST_IDEQLEN, idenqueue++);
+	TRACE(TC_DISK, TE_IDEREQ, b->blockno);
 
 	// Start disk if necessary.
-	if(idequeue == b)
-		idestart(b);
+	if(ideactive == 0)
+		idenext();
 
-	// Wait for request to finish.
+	release(&idelock);
+}
+
+// Wait for a request queued with idesubmit() to finish.
+static void
+idewaitrw(struct buf *b)
+{
+	acquire(&idelock);
 	while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
 		sleep(b, &idelock);
 	}
-
-
 	release(&idelock);
 }
@@ -1,10 +1,25 @@
 // The I/O APIC manages hardware interrupts for an SMP system.
 // http://www.intel.com/design/chipsets/datashts/29056601.pdf
 // See also picirq.c.
+//
+// Each enabled interrupt goes to one CPU. Drivers pick it with
+// ioapicenable(); irqaffinity() moves it later and pins it there.
+// With balancing on, irqbalancer() looks every BALANCENS at the
+// unpinned interrupts and moves a busy one off a CPU that spent
+// the interval running processes to the least busy CPU, so that
+// I/O interrupts do not pile up behind a CPU-bound process.
 
 #include "types.h"
 #include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "traps.h"
+#include "spinlock.h"
+#include "irq.h"
+
+#define BALANCENS (100*TICKNS)  // how often irqbalancer() looks
+#define HOTIRQ    50            // interrupts per interval worth moving
 
 #define IOAPIC  0xFEC00000   // Default physical address of IO APIC
 
@@ -24,6 +39,23 @@
 
 volatile struct ioapic *ioapic;
 
+static struct {
+	struct spinlock lock;
+	int balance;           // irqbalancer() moves unpinned interrupts
+	uint64 next;           // when irqbalancer() looks next
+	int maxintr;
+	int cpu[NIRQ];         // CPU each interrupt goes to; -1 if disabled
+	int pinned[NIRQ];      // set by irqaffinity()
+	uint last[NIRQ];       // total count at the last balance
+	uint lastbusy[NCPU];   // busy ticks at the last balance
+} irqs;
+
+// Interrupts taken, a row per CPU on its own cache line, counted
+// with no lock by the CPU taking them.
+static struct {
+	uint n[NIRQ];
+} __attribute__((aligned(64))) irqcnt[NCPU];
+
 // IO APIC MMIO structure: write reg, then read or write data.
 struct ioapic {
 	uint reg;
@@ -50,8 +82,12 @@ ioapicinit(void)
 {
 	int i, id, maxintr;
 
+	initlock(&irqs.lock, "irqs");
 	ioapic = (volatile struct ioapic*)IOAPIC;
 	maxintr = (ioapicread(REG_VER) >> 16) & 0xFF;
+	irqs.maxintr = maxintr < NIRQ ? maxintr : NIRQ - 1;
+	for(i = 0; i < NIRQ; i++)
+		irqs.cpu[i] = -1;
 	id = ioapicread(REG_ID) >> 24;
 	if(id != ioapicid)
 		cprintf("ioapicinit: id isn't equal to ioapicid; not a MP\n");
@@ -64,12 +100,147 @@ ioapicinit(void)
 	}
 }
 
-void
-ioapicenable(int irq, int cpunum)
+// Send irq to cpu. Caller holds irqs.lock.
+static void
+route(int irq, int cpu)
 {
 	// Mark interrupt edge-triggered, active high,
-	// enabled, and routed to the given cpunum,
-	// which happens to be that cpu's APIC ID.
+	// enabled, and routed to the cpu's APIC ID.
+	irqs.cpu[irq] = cpu;
+	ioapicwrite(REG_TABLE+2*irq+1, cpus[cpu].apicid << 24);
 	ioapicwrite(REG_TABLE+2*irq, T_IRQ0 + irq);
-	ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
+}
+
+void
+ioapicenable(int irq, int cpunum)
+{
+	if(irq < 0 || irq > irqs.maxintr || cpunum < 0 || cpunum >= ncpu)
+		panic("ioapicenable");
+	acquire(&irqs.lock);
+	route(irq, cpunum);
+	release(&irqs.lock);
+}
+
+// Count an interrupt taken by this CPU. Called by trap().
+void
+irqcount(int irq)
+{
+	if(irq >= 0 && irq < NIRQ)
+		irqcnt[cpuid()].n[irq]++;
+}
+
+// Send enabled interrupt irq to CPU cpu and keep it there, or
+// let the balancer move it again if cpu is -1. Returns the CPU
+// irq went to before, or -1 on error.
+int
+irqaffinity(int irq, int cpu)
+{
+	int old;
+
+	if(irq < 0 || irq >= NIRQ || cpu < -1 || cpu >= ncpu)
+		return -1;
+	acquire(&irqs.lock);
+	if((old = irqs.cpu[irq]) < 0){
+		release(&irqs.lock);
+		return -1;
+	}
+	irqs.pinned[irq] = cpu >= 0;
+	if(cpu >= 0 && cpu != old)
+		route(irq, cpu);
+	release(&irqs.lock);
+	return old;
+}
+
+// Turn balancing on (1) or off (0). Returns the old setting.
+int
+irqbalance(int on)
+{
+	int old, c;
+
+	acquire(&irqs.lock);
+	old = irqs.balance;
+	if(on && !old){
+		// Start the first interval now.
+		irqs.next = nanouptime() + BALANCENS;
+		for(c = 0; c < ncpu; c++)
+			irqs.lastbusy[c] = cpus[c].busyticks;
+	}
+	irqs.balance = on;
+	release(&irqs.lock);
+	return old;
+}
+
+// Report up to n enabled interrupts. Returns how many.
+int
+irqstat(struct irqstat *st, int n)
+{
+	int i, c, m;
+
+	m = 0;
+	acquire(&irqs.lock);
+	for(i = 0; i < NIRQ && m < n; i++){
+		if(irqs.cpu[i] < 0)
+			continue;
+		memset(&st[m], 0, sizeof(st[m]));
+		st[m].irq = i;
+		st[m].cpu = irqs.cpu[i];
+		st[m].pinned = irqs.pinned[i];
+		for(c = 0; c < ncpu; c++)
+			st[m].count[c] = irqcnt[c].n[i];
+		m++;
+	}
+	release(&irqs.lock);
+	return m;
+}
+
+// Called by trap() at each scheduling tick, on any CPU. Every
+// BALANCENS, move each unpinned interrupt that came HOTIRQ times
+// or more in the interval off its CPU if that CPU was busier
+// running processes than the least busy one. A moved interrupt
+// counts towards its new CPU's load, so that two do not follow
+// each other there.
+void
+irqbalancer(void)
+{
+	uint load[NCPU], busy, n;
+	int i, c, best;
+	uint64 now;
+
+	if(!irqs.balance || ncpu < 2)
+		return;
+	now = nanouptime();
+	if(now < irqs.next)  // read without the lock; looked at again below
+		return;
+	acquire(&irqs.lock);
+	if(!irqs.balance || now < irqs.next){
+		release(&irqs.lock);
+		return;
+	}
+	irqs.next = now + BALANCENS;
+	for(c = 0; c < ncpu; c++){
+		busy = cpus[c].busyticks;
+		load[c] = cpus[c].started ? busy - irqs.lastbusy[c] : ~0U;
+		irqs.lastbusy[c] = busy;
+	}
+	for(i = 0; i < NIRQ; i++){
+		if(irqs.cpu[i] < 0)
+			continue;
+		for(n = 0, c = 0; c < ncpu; c++)
+			n += irqcnt[c].n[i];
+		busy = n - irqs.last[i];
+		irqs.last[i] = n;
+		if(irqs.pinned[i] || busy < HOTIRQ)
+			continue;
+		best = irqs.cpu[i];
+		for(c = 0; c < ncpu; c++)
+			if(load[c] < load[best])
+				best = c;
+		// Worth a move only if the CPU it is on charged
+		// more than a tick in ten to processes.
+		if(best != irqs.cpu[i] && load[irqs.cpu[i]] > load[best] + BALANCENS/TICKNS/10){
+			route(i, best);
+			load[best] += BALANCENS/TICKNS/10;
+		}
+	}
+	release(&irqs.lock);
 }
@@ -0,0 +1,10 @@
+// ioctl() requests
+
+// Console (major CONSOLE)
+#define CONSOLE_GETMODE  1  // return the current input mode
+#define CONSOLE_SETMODE  2  // set the input mode to arg
+
+// Console input modes
+#define CONS_COOKED  0  // line editing, read() returns a line at a time
+#define CONS_CBREAK  1  // no line editing, echo, read() returns what is typed
+#define CONS_RAW     2  // like CBREAK, but no echo and no CR->NL
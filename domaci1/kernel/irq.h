@@ -0,0 +1,7 @@
+// A device interrupt as irqstat() reports it; see ioapic.c.
+struct irqstat {
+	int irq;
+	int cpu;              // CPU it is routed to
+	int pinned;           // 1 if put there by irqaffinity()
+	uint count[NCPU];     // interrupts taken, by CPU
+};
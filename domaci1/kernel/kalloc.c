@@ -1,6 +1,17 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
 // and pipe buffers. Allocates 4096-byte pages.
+//
+// A page may be shared, e.g. by the page cache and the
+// processes it is mapped into copy-on-write, so each page
+// has a reference count: kalloc() returns a page with one
+// reference, kincref() adds one and kfree() drops one,
+// putting the page back on the free list with the last.
+//
+// RAM above PHYSTOP, which the kernel does not map, is high
+// memory. It holds only user pages, named by physical address:
+// palloc() returns one, preferring high memory, and pfree(),
+// pincref() and pref() work on pages from either place.
 
 #include "types.h"
 #include "defs.h"
@@ -8,6 +19,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "stats.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
@@ -17,30 +29,161 @@ struct run {
 	struct run *next;
 };
 
+// Each CPU keeps a short list of free pages so that most
+// kalloc() and kfree() calls take only its own, uncontended,
+// lock. A CPU whose list is empty takes KBATCH pages from the
+// global list, or failing that half of another CPU's list,
+// and one whose list grows to 2*KBATCH gives KBATCH back.
+#define KBATCH 32
+
+struct kcpu {
+	struct spinlock lock;
+	struct run *freelist;
+	int nfree;
+};
+
 struct {
 	struct spinlock lock;
 	int use_lock;
 	struct run *freelist;
+	int nfree;  // pages on freelist
+	struct kcpu cpu[NCPU];
+	ushort ref[PHYSTOP/PGSIZE];  // updated atomically
 } kmem;
 
+// One entry of the BIOS memory map at E820MAP.
+struct e820 {
+	uint addr;
+	uint addrhi;
+	uint len;
+	uint lenhi;
+	uint type;
+};
+
+#define E820_RAM 1
+#define NE820    128  // more entries than that means no map
+
+// High memory is counted in chunks of HCHUNK pages, each with a
+// page of uchar references allocated when the chunk has RAM.
+// A free page has 0 references; not RAM is HNONE.
+#define HCHUNK   PGSIZE
+#define NHCHUNK  ((DEVSPACE - PHYSTOP) / (HCHUNK*PGSIZE))
+#define HNONE    0xff
+
+struct {
+	struct spinlock lock;
+	uchar *ref[NHCHUNK];
+	int nfree;   // free pages
+	uint next;   // page to start the next search at
+} hmem;
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
+// Until then only the global list is used.
 void
 kinit1(void *vstart, void *vend)
 {
+	int i;
+
 	initlock(&kmem.lock, "kmem");
+	for(i = 0; i < NCPU; i++)
+		initlock(&kmem.cpu[i].lock, "kmem cpu");
 	kmem.use_lock = 0;
 	freerange(vstart, vend);
 }
 
+// The BIOS memory map, or 0 if the boot loader left none.
+static int
+e820map(struct e820 **map)
+{
+	int n;
+
+	n = *(ushort*)P2V(E820MAP);
+	*map = (struct e820*)P2V(E820MAP+4);
+	return n <= NE820 ? n : 0;
+}
+
+// Clip RAM entry e to [lo, hi). Returns 0 if nothing is left.
+static int
+e820clip(struct e820 *e, uint lo, uint hi, uint *a, uint *b)
+{
+	uint end;
+
+	if(e->type != E820_RAM || e->addrhi != 0)
+		return 0;
+	end = e->addr + e->len;
+	if(e->lenhi != 0 || end < e->addr)
+		end = 0xFFFFFFFF;  // runs past 4GB
+	*a = PGROUNDUP(e->addr) > lo ? PGROUNDUP(e->addr) : lo;
+	*b = PGROUNDDOWN(end) < hi ? PGROUNDDOWN(end) : hi;
+	return *a < *b;
+}
+
+// Put the RAM in [PHYSTOP, DEVSPACE) on the high memory free list.
+static void
+highinit(struct e820 *map, int n)
+{
+	uint a, b, pg, c;
+	int i;
+
+	initlock(&hmem.lock, "hmem");
+	for(i = 0; i < n; i++){
+		if(!e820clip(&map[i], PHYSTOP, DEVSPACE, &a, &b))
+			continue;
+		for(; a < b; a += PGSIZE){
+			pg = (a - PHYSTOP)/PGSIZE;
+			c = pg/HCHUNK;
+			if(hmem.ref[c] == 0){
+				if((hmem.ref[c] = (uchar*)kalloc()) == 0)
+					return;
+				memset(hmem.ref[c], HNONE, PGSIZE);
+			}
+			hmem.ref[c][pg%HCHUNK] = 0;
+			hmem.nfree++;
+		}
+	}
+	if(hmem.nfree)
+		cprintf("highmem: %d pages\n", hmem.nfree);
+}
+
+// Free the RAM in [vstart, vend) that the BIOS memory map
+// lists, taking the contiguous pool off the top of the highest
+// piece. Without a map, all of [vstart, vend) is taken to be RAM.
 void
 kinit2(void *vstart, void *vend)
 {
-	freerange(vstart, vend);
+	struct e820 *map;
+	uint a, b, lo, hi, top, pool;
+	int i, n;
+
+	if((n = e820map(&map)) == 0){
+		vend = buddyinit(vstart, vend);  // contiguous pool off the top
+		freerange(vstart, vend);
+		kmem.use_lock = 1;
+		return;
+	}
+	lo = V2P(vstart);
+	hi = V2P(vend);
+	top = pool = 0;
+	for(i = 0; i < n; i++)
+		if(e820clip(&map[i], lo, hi, &a, &b) && b > top){
+			top = b;
+			pool = a;
+		}
+	if(top)
+		pool = V2P(buddyinit(P2V(pool), P2V(top)));
+	for(i = 0; i < n; i++){
+		if(!e820clip(&map[i], lo, hi, &a, &b))
+			continue;
+		if(b == top)
+			b = pool;
+		freerange(P2V(a), P2V(b));
+	}
 	kmem.use_lock = 1;
+	highinit(map, n);
 }
 
 void
@@ -52,45 +195,266 @@ freerange(void *vstart, void *vend)
 		kfree(p);
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Lock and return this CPU's free list.
+static struct kcpu*
+kcpulock(void)
+{
+	struct kcpu *kc;
+
+	pushcli();
+	kc = &kmem.cpu[cpuid()];
+	acquire(&kc->lock);
+	popcli();  // acquire() keeps interrupts off
+	return kc;
+}
+
+// Move up to n pages from the list *from to the list *to.
+static int
+kmove(struct run **from, struct run **to, int n)
+{
+	struct run *r;
+	int i;
+
+	for(i = 0; i < n && (r = *from) != 0; i++){
+		*from = r->next;
+		r->next = *to;
+		*to = r;
+	}
+	return i;
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last.
+// (The exception is when initializing the allocator;
+// see kinit above.)
 void
 kfree(char *v)
 {
 	struct run *r;
+	struct kcpu *kc;
+	ushort *ref;
+	int n;
 
 	if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
 		panic("kfree");
 
-	// Fill with junk to catch dangling refs.
-	memset(v, 1, PGSIZE);
+	// Pages freed by freerange() have no references yet.
+	ref = &kmem.ref[V2P(v)/PGSIZE];
+	if(*ref != 0 && __sync_sub_and_fetch(ref, 1) != 0)
+		return;
+
+	if(KALLOCJUNK)
+		memset(v, 1, PGSIZE);  // Fill with junk to catch dangling refs.
 
-	if(kmem.use_lock)
-		acquire(&kmem.lock);
 	r = (struct run*)v;
-	r->next = kmem.freelist;
-	kmem.freelist = r;
-	if(kmem.use_lock)
+	if(!kmem.use_lock){
+		r->next = kmem.freelist;
+		kmem.freelist = r;
+		kmem.nfree++;
+		return;
+	}
+	kc = kcpulock();
+	r->next = kc->freelist;
+	kc->freelist = r;
+	if(++kc->nfree >= 2*KBATCH){
+		acquire(&kmem.lock);
+		n = kmove(&kc->freelist, &kmem.freelist, KBATCH);
+		kc->nfree -= n;
+		kmem.nfree += n;
 		release(&kmem.lock);
+	}
+	release(&kc->lock);
+}
+
+// Take a batch of free pages from the global list or, if
+// that is empty, half of another CPU's list. Holds one lock
+// at a time, so CPUs taking from each other cannot deadlock.
+static struct run*
+kgrab(void)
+{
+	struct run *list;
+	struct kcpu *o;
+	int n;
+
+	list = 0;
+	acquire(&kmem.lock);
+	n = kmove(&kmem.freelist, &list, KBATCH);
+	kmem.nfree -= n;
+	release(&kmem.lock);
+	for(o = kmem.cpu; list == 0 && o < kmem.cpu+NCPU; o++){
+		if(o->nfree == 0)
+			continue;
+		acquire(&o->lock);
+		o->nfree -= kmove(&o->freelist, &list, (o->nfree + 1)/2);
+		release(&o->lock);
+	}
+	return list;
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
+// When memory runs out, asks the buffer cache to give
+// pages back before failing.
 // Returns 0 if the memory cannot be allocated.
 char*
 kalloc(void)
 {
 	struct run *r;
+	struct kcpu *kc;
 
-	if(kmem.use_lock)
-		acquire(&kmem.lock);
-	r = kmem.freelist;
+	if(!kmem.use_lock){
+		if((r = kmem.freelist) != 0){
+			kmem.freelist = r->next;
+			kmem.nfree--;
+			kmem.ref[V2P(r)/PGSIZE] = 1;
+		}
+		return (char*)r;
+	}
+	do {
+		kc = kcpulock();
+		if((r = kc->freelist) != 0){
+			kc->freelist = r->next;
+			kc->nfree--;
+		}
+		release(&kc->lock);
+		if(r == 0 && (r = kgrab()) != 0 && r->next){
+			// Keep the rest of the batch on this CPU.
+			kc = kcpulock();
+			kc->nfree += kmove(&r->next, &kc->freelist, 2*KBATCH);
+			release(&kc->lock);
+		}
+	} while(r == 0 && bshrink());
+	statadd(ST_KALLOC, 1);
 	if(r)
-		kmem.freelist = r->next;
-	if(kmem.use_lock)
-		release(&kmem.lock);
+		kmem.ref[V2P(r)/PGSIZE] = 1;
+	else
+		statadd(ST_KALLOCFAIL, 1);
 	return (char*)r;
 }
 
+// Add a reference to the allocated page v.
+void
+kincref(char *v)
+{
+	if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+		panic("kincref");
+	if(__sync_fetch_and_add(&kmem.ref[V2P(v)/PGSIZE], 1) == 0)
+		panic("kincref: free page");
+}
+
+// Number of references to the allocated page v.
+int
+kref(char *v)
+{
+	return kmem.ref[V2P(v)/PGSIZE];
+}
+
+// Number of free pages; a snapshot, for sizing caches.
+int
+kfreecount(void)
+{
+	int i, n;
+
+	n = kmem.nfree;
+	for(i = 0; i < NCPU; i++)
+		n += kmem.cpu[i].nfree;
+	return n;
+}
+
+// Reference count of high page pa. Caller holds hmem.lock.
+static uchar*
+href(uint pa)
+{
+	uint pg;
+
+	pg = (pa - PHYSTOP)/PGSIZE;
+	if(pa % PGSIZE || pa < PHYSTOP || pa >= DEVSPACE ||
+	   hmem.ref[pg/HCHUNK] == 0 || hmem.ref[pg/HCHUNK][pg%HCHUNK] == HNONE)
+		panic("href");
+	return &hmem.ref[pg/HCHUNK][pg%HCHUNK];
+}
+
+// Allocate a page for user memory, from high memory if it has
+// any free. Returns its physical address, or 0 if out of memory.
+uint
+palloc(void)
+{
+	uint i, n, pg;
+	uchar *r;
+	char *v;
+
+	if(hmem.nfree > 0){
+		acquire(&hmem.lock);
+		n = NHCHUNK*HCHUNK;
+		for(i = 0; hmem.nfree > 0 && i < n; i++){
+			pg = (hmem.next + i) % n;
+			if((r = hmem.ref[pg/HCHUNK]) == 0){
+				i += HCHUNK - 1 - pg%HCHUNK;  // skip the chunk
+				continue;
+			}
+			if(r[pg%HCHUNK] == 0){
+				r[pg%HCHUNK] = 1;
+				hmem.nfree--;
+				hmem.next = pg + 1;
+				release(&hmem.lock);
+				return PHYSTOP + pg*PGSIZE;
+			}
+		}
+		release(&hmem.lock);
+	}
+	if((v = kalloc()) == 0)
+		return 0;
+	return V2P(v);
+}
+
+// Drop a reference to the user page pa, freeing it with the last.
+void
+pfree(uint pa)
+{
+	uchar *r;
+
+	if(pa < PHYSTOP){
+		kfree(P2V(pa));
+		return;
+	}
+	acquire(&hmem.lock);
+	r = href(pa);
+	if(*r == 0)
+		panic("pfree");
+	if(--*r == 0)
+		hmem.nfree++;
+	release(&hmem.lock);
+}
+
+// Add a reference to the allocated user page pa.
+void
+pincref(uint pa)
+{
+	uchar *r;
+
+	if(pa < PHYSTOP){
+		kincref(P2V(pa));
+		return;
+	}
+	acquire(&hmem.lock);
+	r = href(pa);
+	if(*r == 0 || *r == HNONE - 1)
+		panic("pincref");
+	++*r;
+	release(&hmem.lock);
+}
+
+// Number of references to the allocated user page pa.
+int
+pref(uint pa)
+{
+	int n;
+
+	if(pa < PHYSTOP)
+		return kref(P2V(pa));
+	acquire(&hmem.lock);
+	n = *href(pa);
+	release(&hmem.lock);
+	return n;
+}
@@ -3,14 +3,46 @@
 #include "defs.h"
 #include "kbd.h"
 
-int
-kbdgetc(void)
+// Modifier bits that select a keymap row.
+#define KEYMODS (SHIFT | CTL | ALT | CAPSLOCK)
+
+// keymap[mods][scancode] is the key the scancode produces with
+// the modifiers in mods held or toggled on. It is built once
+// from normalmap/shiftmap/ctlmap so kbdgetc() needs one lookup.
+static uchar keymap[KEYMODS+1][256];
+
+// A(x) (x + 100): Alt with a lowercase letter gives the letter + 100.
+#define A(x) ((x) + 100)
+
+void
+kbdinit(void)
 {
-	static uint shift;
 	static uchar *charcode[4] = {
 		normalmap, shiftmap, ctlmap, ctlmap
 	};
-	uint st, data, c;
+	uint mods, data, c;
+
+	for(mods = 0; mods <= KEYMODS; mods++){
+		for(data = 0; data < 256; data++){
+			c = charcode[mods & (CTL | SHIFT)][data];
+			if(mods & CAPSLOCK){
+				if('a' <= c && c <= 'z')
+					c += 'A' - 'a';
+				else if('A' <= c && c <= 'Z')
+					c += 'a' - 'A';
+			}
+			if((mods & ALT) && 'a' <= c && c <= 'z')
+				c = A(c);
+			keymap[mods][data] = c;
+		}
+	}
+}
+
+int
+kbdgetc(void)
+{
+	static uint shift;
+	uint st, data;
 
 	st = inb(KBSTATP);
 	if((st & KBS_DIB) == 0)
@@ -33,30 +65,7 @@ kbdgetc(void)
 
 	shift |= shiftcode[data];
 	shift ^= togglecode[data];
-	c = charcode[shift & (CTL | SHIFT)][data];
-	if(shift & CAPSLOCK){
-		if('a' <= c && c <= 'z')
-			c += 'A' - 'a';
-		else if('A' <= c && c <= 'Z')
-			c += 'a' - 'A';
-	}
-
-	// A(x) (x + 100)
-	if(shift & ALT){
-		switch(c){
-			case('c'):
-				c = 199;
-				break;
-			case('o'):
-				c = 211;
-				break;
-			case('l'):
-				c = 208;
-				break;
-			}
-	}
-
-	return c;
+	return keymap[shift & KEYMODS][data];
 }
 
 void
@@ -27,6 +27,8 @@
 #define KEY_PGDN        0xE7
 #define KEY_INS         0xE8
 #define KEY_DEL         0xE9
+#define KEY_SPGUP       0xEA    // Shift+PgUp
+#define KEY_SPGDN       0xEB    // Shift+PgDn
 
 // C('A') == Control-A
 #define C(x) (x - '@')
@@ -86,7 +88,7 @@ static uchar shiftmap[256] =
 	[0x9C] '\n',      // KP_Enter
 	[0xB5] '/',       // KP_Div
 	[0xC8] KEY_UP,    [0xD0] KEY_DN,
-	[0xC9] KEY_PGUP,  [0xD1] KEY_PGDN,
+	[0xC9] KEY_SPGUP, [0xD1] KEY_SPGDN,
 	[0xCB] KEY_LF,    [0xCD] KEY_RT,
 	[0x97] KEY_HOME,  [0xCF] KEY_END,
 	[0xD2] KEY_INS,   [0xD3] KEY_DEL
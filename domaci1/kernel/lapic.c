@@ -50,6 +50,67 @@ lapicw(int index, int value)
 	lapic[ID];  // wait for write to finish, by reading
 }
 
+#define PIT_CH2   0x42   // PIT channel 2 data
+#define PIT_MODE  0x43
+#define PIT_GATE  0x61   // bit 0: channel 2 gate; bit 5: its output
+#define PIT_HZ    1193182
+
+static uint lapicperus;  // LAPIC timer counts per microsecond
+static uint tscperus;    // TSC cycles per microsecond
+static uint64 tsc0;      // TSC at calibration: time 0
+
+// Count the LAPIC timer and the TSC over 10ms of PIT channel 2.
+static void
+lapiccalibrate(void)
+{
+	uint n;
+	uint64 t;
+
+	outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) | 0x01);  // gate on, speaker off
+	outb(PIT_MODE, 0xB0);  // channel 2, both bytes, mode 0
+	outb(PIT_CH2, (PIT_HZ/100) & 0xFF);
+	outb(PIT_CH2, (PIT_HZ/100) >> 8);
+	lapicw(TIMER, MASKED);
+	lapicw(TICR, 0xFFFFFFFF);
+	t = rdtsc();
+	while((inb(PIT_GATE) & 0x20) == 0)
+		;
+	n = 0xFFFFFFFF - lapic[TCCR];
+	tsc0 = rdtsc();
+	tscperus = div64(tsc0 - t, 10000);
+	lapicperus = n / 10000;
+	if(lapicperus == 0)
+		lapicperus = 1;
+	if(tscperus == 0)
+		tscperus = 1;
+	lapicw(TICR, 0);
+}
+
+// Nanoseconds since the boot CPU set up its local APIC.
+uint64
+nanouptime(void)
+{
+	if(tscperus == 0)
+		return 0;
+	return div64((rdtsc() - tsc0) * 1000, tscperus);
+}
+
+// Interrupt this CPU once, ns nanoseconds from now.
+void
+lapictimer(uint64 ns)
+{
+	uint64 n;
+
+	if(!lapic)
+		return;
+	n = div64(ns * lapicperus, 1000);
+	if(n == 0)
+		n = 1;
+	if(n > 0xFFFFFFFF)
+		n = 0xFFFFFFFF;
+	lapicw(TICR, (uint)n);
+}
+
 void
 lapicinit(void)
 {
@@ -59,13 +120,15 @@ lapicinit(void)
 	// Enable local APIC; set spurious interrupt vector.
 	lapicw(SVR, ENABLE | (T_IRQ0 + IRQ_SPURIOUS));
 
-	// The timer repeatedly counts down at bus frequency
-	// from lapic[TICR] and then issues an interrupt.
-	// If xv6 cared more about precise timekeeping,
-	// TICR would be calibrated using an external time source.
+	// The timer counts down once at bus frequency from
+	// lapic[TICR] and then issues an interrupt; lapictimer()
+	// starts it for each deadline (see timer.c). The first
+	// CPU measures its rate, and the TSC's, against the PIT.
 	lapicw(TDCR, X1);
-	lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-	lapicw(TICR, 10000000);
+	if(lapicperus == 0)
+		lapiccalibrate();
+	lapicw(TIMER, T_IRQ0 + IRQ_TIMER);
+	lapictimer(TICKNS);
 
 	// Disable logical interrupt lines.
 	lapicw(LINT0, MASKED);
@@ -112,6 +175,19 @@ lapiceoi(void)
 		lapicw(EOI, 0);
 }
 
+// Send interrupt vector to the CPU whose local APIC ID is apicid.
+// Caller has interrupts off.
+void
+lapicipi(int apicid, int vector)
+{
+	if(!lapic)
+		return;
+	lapicw(ICRHI, apicid<<24);
+	lapicw(ICRLO, FIXED | vector);
+	while(lapic[ICRLO] & DELIVS)
+		;
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
@@ -122,12 +198,28 @@ microdelay(int us)
 #define CMOS_PORT    0x70
 #define CMOS_RETURN  0x71
 
-// Start additional processor running entry code at addr.
-// See Appendix B of MultiProcessor Specification.
+// Send the IPI icrlo to the CPU whose local APIC ID is apicid,
+// and wait for it to be delivered.
+static void
+lapicsend(uchar apicid, uint icrlo)
+{
+	lapicw(ICRHI, apicid<<24);
+	lapicw(ICRLO, icrlo);
+	while(lapic[ICRLO] & DELIVS)
+		;
+}
+
+// Start the n additional processors whose local APIC IDs are
+// in apicid[] running entry code at addr, all at once: each
+// step of the startup algorithm goes to every one of them
+// before the delay that follows it, so starting many costs no
+// more waiting than starting one. A broadcast would do it in
+// one IPI, but would also start processors the MP table does
+// not list. See Appendix B of MultiProcessor Specification.
 void
-lapicstartap(uchar apicid, uint addr)
+lapicstartaps(uchar *apicid, int n, uint addr)
 {
-	int i;
+	int i, j;
 	ushort *wrv;
 
 	// "The BSP must initialize CMOS shutdown code to 0AH
@@ -141,10 +233,11 @@ lapicstartap(uchar apicid, uint addr)
 
 	// "Universal startup algorithm."
 	// Send INIT (level-triggered) interrupt to reset other CPU.
-	lapicw(ICRHI, apicid<<24);
-	lapicw(ICRLO, INIT | LEVEL | ASSERT);
+	for(j = 0; j < n; j++)
+		lapicsend(apicid[j], INIT | LEVEL | ASSERT);
 	microdelay(200);
-	lapicw(ICRLO, INIT | LEVEL);
+	for(j = 0; j < n; j++)
+		lapicsend(apicid[j], INIT | LEVEL);
 	microdelay(100);    // should be 10ms, but too slow in Bochs!
 
 	// Send startup IPI (twice!) to enter code.
@@ -153,8 +246,8 @@ lapicstartap(uchar apicid, uint addr)
 	// should be ignored, but it is part of the official Intel algorithm.
 	// Bochs complains about the second one.  Too bad for Bochs.
 	for(i = 0; i < 2; i++){
-		lapicw(ICRHI, apicid<<24);
-		lapicw(ICRLO, STARTUP | (addr>>12));
+		for(j = 0; j < n; j++)
+			lapicsend(apicid[j], STARTUP | (addr>>12));
 		microdelay(200);
 	}
 }
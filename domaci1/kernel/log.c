@@ -5,6 +5,10 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "mmu.h"
+#include "proc.h"
+#include "stats.h"
+#include "trace.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -15,10 +19,19 @@
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. begin_op() reserves MAXOPBLOCKS of log
+// space; begin_opn() reserves a caller-supplied amount. Each new
+// block the op logs uses up one block of its reservation, and
+// end_op() returns what is left. Usually begin_op() just takes
+// the reservation and returns. But if the log might run out,
+// it sets log.flush and sleeps until the last outstanding
+// end_op() commits.
+//
+// Commits are grouped: end_op() does not commit by itself, so
+// the updates of many system calls share one commit. The logd
+// thread commits once the oldest update is LOGDELAY ticks old,
+// and fsync() (log_sync) commits at once. A system call's
+// updates are therefore durable only after the next commit.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -27,21 +40,37 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// mkfs chooses the log size and records it in the superblock.
+//
+// A commit does not install its blocks right away. They stay in
+// the log, pinned dirty in the cache, and later transactions are
+// appended after them; the header always lists every block in
+// the log. Only when the log is nearly full does commit() write
+// the blocks home, straight from the cache, and empty the log.
+// A block that several transactions log is then written home
+// once. Recovery installs the slots in order, so the last copy
+// of such a block wins.
+// Log appends are synchronous, but each phase queues all
+// its block writes at once.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
 	int n;
-	int block[LOGSIZE];
+	int block[MAXLOGBLOCKS];
 };
 
 struct log {
 	struct spinlock lock;
 	int start;
-	int size;
+	int size;        // data blocks the log holds
+	int committed;   // lh.block[0..committed-1] are committed, not installed
 	int outstanding; // how many FS sys calls are executing.
+	int reserved;    // unused reservations of outstanding ops
 	int committing;  // in commit(), please wait.
+	int flush;       // commit when outstanding drops to 0; admit no new ops.
+	uint since;      // ticks when the transaction got its first block.
+	uint ncommit;    // commits completed, for log_sync().
 	int dev;
 	struct logheader lh;
 };
@@ -49,36 +78,58 @@ struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void logd(void);
 
 void
 initlog(int dev)
 {
-	if (sizeof(struct logheader) >= BSIZE)
+	if (sizeof(struct logheader) > BSIZE)
 		panic("initlog: too big logheader");
 
 	struct superblock sb;
 	initlock(&log.lock, "log");
 	readsb(dev, &sb);
 	log.start = sb.logstart;
-	log.size = sb.nlog;
+	log.size = sb.nlog - 1;  // less the header block
+	if (log.size > MAXLOGBLOCKS)
+		log.size = MAXLOGBLOCKS;
+	if (log.size < MAXWRITEBLOCKS)
+		panic("initlog: log too small");
 	log.dev = dev;
 	recover_from_log();
+	kthread("logd", logd);
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.
+// After a commit the cached home buffers already hold the
+// committed data, so fromcache skips reading the log.
+// A block logged more than once is installed from its last slot.
+// The writes are queued together so the disk can sort and
+// merge them.
 static void
-install_trans(void)
+install_trans(int fromcache)
 {
-	int tail;
+	int tail, i, n;
+	struct buf *dbuf[MAXLOGBLOCKS];
 
+	n = 0;
 	for (tail = 0; tail < log.lh.n; tail++) {
-		struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-		struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-		memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-		bwrite(dbuf);  // write dst to disk
-		brelse(lbuf);
-		brelse(dbuf);
+		for (i = tail+1; i < log.lh.n; i++)
+			if (log.lh.block[i] == log.lh.block[tail])
+				break;
+		if (i < log.lh.n)
+			continue;  // a later slot has a newer copy
+		dbuf[n] = bread(log.dev, log.lh.block[tail]); // read dst
+		if (!fromcache) {
+			struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
+			memmove(dbuf[n]->data, lbuf->data, BSIZE);  // copy block to dst
+			brelse(lbuf);
+		}
+		n++;
 	}
+	bwritev(dbuf, n);  // write dst to disk
+	for (i = 0; i < n; i++)
+		brelse(dbuf[i]);
 }
 
 // Read the log header from disk into the in-memory log header
@@ -116,44 +167,80 @@ static void
 recover_from_log(void)
 {
 	read_head();
-	install_trans(); // if committed, copy from log to disk
+	install_trans(0); // if committed, copy from log to disk
 	log.lh.n = 0;
 	write_head(); // clear the log
 }
 
-// called at the start of each FS system call.
+// Commit the current transaction. Caller holds log.lock and
+// there are no FS system calls outstanding; returns with
+// log.lock held.
+static void
+logcommit(void)
+{
+	log.committing = 1;
+	// call commit w/o holding locks, since not allowed
+	// to sleep with locks.
+	release(&log.lock);
+	commit();
+	acquire(&log.lock);
+	log.committing = 0;
+	log.flush = 0;
+	log.ncommit++;
+	wakeup(&log);
+}
+
+// called at the start of an FS system call that logs at
+// most nblocks new blocks.
 void
-begin_op(void)
+begin_opn(int nblocks)
 {
+	if(nblocks > log.size)
+		panic("begin_opn: too big");
+
 	acquire(&log.lock);
 	while(1){
 		if(log.committing){
 			sleep(&log, &log.lock);
-		} else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-			// this op might exhaust log space; wait for commit.
-			sleep(&log, &log.lock);
+		} else if(log.flush ||
+		    log.lh.n + log.reserved + nblocks > log.size){
+			// a commit is due, or this op might exhaust log space.
+			if(log.outstanding == 0)
+				logcommit();
+			else {
+				log.flush = 1;
+				sleep(&log, &log.lock);
+			}
 		} else {
+			TRACE(TC_LOG, TE_BEGINOP, log.outstanding);
 			log.outstanding += 1;
+			log.reserved += nblocks;
+			myproc()->logres = nblocks;
 			release(&log.lock);
 			break;
 		}
 	}
 }
 
+// called at the start of each FS system call.
+void
+begin_op(void)
+{
+	begin_opn(MAXOPBLOCKS);
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if a commit is due and this was the last
+// outstanding operation.
 void
 end_op(void)
 {
-	int do_commit = 0;
-
 	acquire(&log.lock);
 	log.outstanding -= 1;
-	if(log.committing)
-		panic("log.committing");
-	if(log.outstanding == 0){
-		do_commit = 1;
-		log.committing = 1;
+	log.reserved -= myproc()->logres;
+	myproc()->logres = 0;
+	if(log.outstanding == 0 && log.flush){
+		logcommit();
 	} else {
 		// begin_op() may be waiting for log space,
 		// and decrementing log.outstanding has decreased
@@ -161,43 +248,97 @@ end_op(void)
 		wakeup(&log);
 	}
 	release(&log.lock);
+}
 
-	if(do_commit){
-		// call commit w/o holding locks, since not allowed
-		// to sleep with locks.
-		commit();
-		acquire(&log.lock);
-		log.committing = 0;
-		wakeup(&log);
-		release(&log.lock);
+// Make every completed FS system call durable: commit the
+// current transaction now and wait for it to reach the disk.
+void
+log_sync(void)
+{
+	uint target;
+
+	acquire(&log.lock);
+	if(log.lh.n > log.committed || log.committing){
+		// The updates are in the commit now running or in the
+		// next one.
+		target = log.ncommit + 1;
+		if(log.outstanding == 0 && !log.committing)
+			logcommit();
+		else {
+			if(!log.committing)
+				log.flush = 1;
+			while((int)(log.ncommit - target) < 0)
+				sleep(&log, &log.lock);
+		}
 	}
+	release(&log.lock);
 }
 
-// Copy modified blocks from cache to log.
+// Kernel thread that commits transactions once their first
+// update is LOGDELAY ticks old. Sleeps on &log.lh while the
+// current transaction is empty and until it is due otherwise,
+// checking every tick while a commit is already under way.
+static void
+logd(void)
+{
+	acquire(&log.lock);
+	for(;;){
+		if(log.lh.n == log.committed){
+			sleep(&log.lh, &log.lock);
+			continue;
+		}
+		if(!log.committing && !log.flush && ticks - log.since >= LOGDELAY){
+			if(log.outstanding == 0)
+				logcommit();
+			else
+				log.flush = 1;
+			continue;
+		}
+		if(ticks - log.since >= LOGDELAY)
+			sleepuntil(nanouptime() + TICKNS, &log.lock);
+		else
+			sleepuntil((uint64)(log.since + LOGDELAY) * TICKNS, &log.lock);
+	}
+}
+
+// Copy the current transaction's modified blocks from cache
+// to log. The log blocks are adjacent, so the disk writes them
+// in a few large transfers.
 static void
 write_log(void)
 {
-	int tail;
+	int tail, n;
+	struct buf *to[MAXLOGBLOCKS];
 
-	for (tail = 0; tail < log.lh.n; tail++) {
-		struct buf *to = bread(log.dev, log.start+tail+1); // log block
-		struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-		memmove(to->data, from->data, BSIZE);
-		bwrite(to);  // write the log
+	n = log.lh.n - log.committed;
+	for (tail = 0; tail < n; tail++) {
+		to[tail] = bread(log.dev, log.start+log.committed+tail+1); // log block
+		struct buf *from = bread(log.dev, log.lh.block[log.committed+tail]); // cache block
+		memmove(to[tail]->data, from->data, BSIZE);
 		brelse(from);
-		brelse(to);
 	}
+	bwritev(to, n);  // write the log
+	for (tail = 0; tail < n; tail++)
+		brelse(to[tail]);
 }
 
 static void
 commit()
 {
-	if (log.lh.n > 0) {
+	if (log.lh.n > log.committed) {
+		TRACE(TC_LOG, TE_COMMIT, log.lh.n);
+		statadd(ST_COMMIT, 1);
+		statadd(ST_COMMITBLK, log.lh.n - log.committed);
 		write_log();     // Write modified blocks from cache to log
 		write_head();    // Write header to disk -- the real commit
-		install_trans(); // Now install writes to home locations
+		log.committed = log.lh.n;
+	}
+	if (log.lh.n > 0 && log.size - log.lh.n < MAXWRITEBLOCKS) {
+		// Not enough room left for the largest op.
+		install_trans(1); // Now install writes to home locations
 		log.lh.n = 0;
-		write_head();    // Erase the transaction from the log
+		log.committed = 0;
+		write_head();    // Erase the transactions from the log
 	}
 }
 
@@ -215,19 +356,36 @@ log_write(struct buf *b)
 {
 	int i;
 
-	if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
-		panic("too big a transaction");
 	if (log.outstanding < 1)
 		panic("log_write outside of trans");
+	if (b->dev != log.dev) {
+		// Only the root disk has a log. A memory device has no
+		// crash to survive, and b->data is the block itself.
+		if (bdevsw[b->dev].map == 0)
+			panic("log_write: device has no log");
+		return;
+	}
 
 	acquire(&log.lock);
-	for (i = 0; i < log.lh.n; i++) {
+	// Absorb only within the current transaction; the
+	// committed slots must stay as they are.
+	for (i = log.committed; i < log.lh.n; i++) {
 		if (log.lh.block[i] == b->blockno)   // log absorbtion
 			break;
 	}
-	log.lh.block[i] = b->blockno;
-	if (i == log.lh.n)
-		log.lh.n++;
+	if (i == log.lh.n){
+		if (log.lh.n >= log.size)
+			panic("too big a transaction");
+		log.lh.block[i] = b->blockno;
+		if (log.lh.n++ == log.committed){
+			log.since = ticks;
+			wakeup(&log.lh);  // logd starts the clock
+		}
+		if (myproc()->logres > 0){
+			myproc()->logres--;
+			log.reserved--;
+		}
+	}
 	b->flags |= B_DIRTY; // prevent eviction
 	release(&log.lock);
 }
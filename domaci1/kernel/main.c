@@ -18,6 +18,7 @@ int
 main(void)
 {
 	kinit1(end, P2V(4*1024*1024)); // phys page allocator
+	kminit();        // kmalloc() caches
 	kvmalloc();      // kernel page table
 	mpinit();        // detect other processors
 	lapicinit();     // interrupt controller
@@ -28,12 +29,22 @@ main(void)
 	uartinit();      // serial port
 	pinit();         // process table
 	tvinit();        // trap vectors
-	binit();         // buffer cache
+	timerinit();     // timer queue
+	profinit();      // sampling profiler
+	statinit();      // /dev/stats
+	traceinit();     // event tracing
 	fileinit();      // file table
+	pipeinit();      // pipe cache
+	pollinit();      // poll() wakeups
 	ideinit();       // disk
 	startothers();   // start other processors
 	kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+	binit();         // buffer cache, sized from free memory
+	pcacheinit();    // page cache
+	ramdiskinit();   // RAM disk, sized from free memory
+	tmpinit();       // tmpfs
 	userinit();      // first user process
+	kthread("klogd", klogd); // drains cprintf rings to the console
 	mpmain();        // finish this processor's setup
 }
 
@@ -41,7 +52,7 @@ main(void)
 static void
 mpenter(void)
 {
-	switchkvm();
+	kvmstart();
 	seginit();
 	lapicinit();
 	mpmain();
@@ -64,9 +75,10 @@ static void
 startothers(void)
 {
 	extern uchar _binary_kernel_entryother_start[], _binary_kernel_entryother_size[];
-	uchar *code;
+	static char *stack[NCPU];
+	uchar *code, apicid[NCPU];
 	struct cpu *c;
-	char *stack;
+	int n;
 
 	// Write entry code to unused memory at 0x7000.
 	// The linker has placed the image of entryother.S in
@@ -74,24 +86,34 @@ startothers(void)
 	code = P2V(0x7000);
 	memmove(code, _binary_kernel_entryother_start, (uint)_binary_kernel_entryother_size);
 
+	// Allocate the stacks first, so that the APs can all start
+	// at once and each take the next one.
+	n = 0;
 	for(c = cpus; c < cpus+ncpu; c++){
 		if(c == mycpu())  // We've started already.
 			continue;
+		if((stack[n] = kalloc()) == 0)
+			panic("startothers");
+		stack[n] += KSTACKSIZE;
+		apicid[n++] = c->apicid;
+	}
+	if(n == 0)
+		return;
 
-		// Tell entryother.S what stack to use, where to enter, and what
-		// pgdir to use. We cannot use kpgdir yet, because the AP processor
-		// is running in low  memory, so we use entrypgdir for the APs too.
-		stack = kalloc();
-		*(void**)(code-4) = stack + KSTACKSIZE;
-		*(void(**)(void))(code-8) = mpenter;
-		*(int**)(code-12) = (void *) V2P(entrypgdir);
+	// Tell entryother.S where the stacks are, where to enter, and what
+	// pgdir to use. We cannot use kpgdir yet, because the AP processor
+	// is running in low  memory, so we use entrypgdir for the APs too.
+	*(char***)(code-4) = stack;
+	*(void(**)(void))(code-8) = mpenter;
+	*(int**)(code-12) = (void *) V2P(entrypgdir);
+	*(uint*)(code-16) = 0;
 
-		lapicstartap(c->apicid, V2P(code));
+	lapicstartaps(apicid, n, V2P(code));
 
-		// wait for cpu to finish mpmain()
-		while(c->started == 0)
+	// wait for every cpu to finish mpmain()
+	for(c = cpus; c < cpus+ncpu; c++)
+		while(c != mycpu() && c->started == 0)
 			;
-	}
 }
 
 // The boot page table used in entry.S and entryother.S.
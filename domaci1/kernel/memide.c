@@ -18,11 +18,18 @@ extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
 static int disksize;
 static uchar *memdisk;
 
+static void memsubmit(struct buf*);
+static void memwait(struct buf*);
+static uchar* memmap(uint);
+
 void
 ideinit(void)
 {
 	memdisk = _binary_fs_img_start;
 	disksize = (uint)_binary_fs_img_size/BSIZE;
+	bdevsw[1].submit = memsubmit;
+	bdevsw[1].wait = memwait;
+	bdevsw[1].map = memmap;
 }
 
 // Interrupt handler.
@@ -32,29 +39,36 @@ ideintr(void)
 	// no-op
 }
 
-// Sync buf with disk.
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-iderw(struct buf *b)
+// The buffer cache uses the block in the image itself as the
+// buffer's data, so there is nothing to copy.
+static uchar*
+memmap(uint blockno)
 {
-	uchar *p;
+	if(blockno >= disksize)
+		panic("memide: block out of range");
+	return memdisk + blockno*BSIZE;
+}
 
+// Sync buf with disk; the memory disk finishes at once.
+// If B_DIRTY is set, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, set B_VALID.
+static void
+memsubmit(struct buf *b)
+{
 	if(!holdingsleep(&b->lock))
-		panic("iderw: buf not locked");
+		panic("memide: buf not locked");
 	if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-		panic("iderw: nothing to do");
-	if(b->dev != 1)
-		panic("iderw: request not for disk 1");
-	if(b->blockno >= disksize)
-		panic("iderw: block out of range");
-
-	p = memdisk + b->blockno*BSIZE;
-
-	if(b->flags & B_DIRTY){
-		b->flags &= ~B_DIRTY;
-		memmove(p, b->data, BSIZE);
-	} else
-		memmove(b->data, p, BSIZE);
+		panic("memide: nothing to do");
+
+	b->flags &= ~B_DIRTY;
 	b->flags |= B_VALID;
+	if(b->flags & B_ASYNC){
+		b->flags &= ~B_ASYNC;
+		bdone(b);
+	}
+}
+
+static void
+memwait(struct buf *b)
+{
 }
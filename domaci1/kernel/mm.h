@@ -0,0 +1,34 @@
+// A memory mapping made by mmap(); see mmap.c.
+struct vma {
+	uint start;                  // Page-aligned first address
+	uint len;                    // Bytes, page multiple; 0 if unused
+	int prot;                    // PROT_READ, PROT_WRITE
+	int flags;                   // MAP_SHARED or MAP_PRIVATE, MAP_ANON
+	struct file *f;              // Mapped file; 0 if anonymous
+	uint off;                    // File offset of start
+};
+
+// A program segment that exec() left to be read in from the
+// program file on first touch; see imagefault() in mmap.c.
+struct seg {
+	uint va;                     // First address; 0 filesz if unused
+	uint filesz;                 // Bytes read from the file; the rest
+	uint off;                    //   up to mm->sz starts out zeroed
+	int nobss;                   // Nothing zeroed follows filesz, so
+	                             //   its last page may be shared
+};
+
+// A user address space. The threads made by clone() share
+// their parent's. lock serializes changes to sz and vma[] and
+// the removal of pages. Page faults taken by the kernel, which
+// must not sleep, go without it; page table entries are only
+// ever changed with atomic instructions.
+struct mm {
+	int ref;                     // Threads using it; under ptable.lock
+	struct sleeplock lock;
+	uint sz;                     // Size of process memory (bytes)
+	pde_t* pgdir;                // Page table
+	struct vma vma[NVMA];        // Memory mappings
+	struct inode *exe;           // Program file the segments come from
+	struct seg seg[NSEG];
+};
@@ -0,0 +1,505 @@
+// Memory mappings.
+//
+// mmap() places mappings top down from KERNBASE, and
+// growproc() keeps the heap below the lowest of them. Each
+// address space describes its mappings in mm->vma[], and their pages
+// are filled in on first touch by mmapfault(), from the page
+// fault handler. Anonymous pages start out zeroed. A page
+// that lies wholly inside the file is taken from the page
+// cache and mapped copy-on-write; the page holding the end of
+// the file gets a private copy, zeroed past the end. All
+// mappings are private; MAP_SHARED is accepted only for
+// read-only file mappings, which behave the same.
+//
+// The heap is lazy in the same way: growproc() only moves
+// mm->sz, and a missing page below mm->sz is allocated zeroed
+// when first touched. So is the program: exec() only records
+// its segments in mm->seg[], and imagefault() reads a page of
+// them from mm->exe on first touch, taking it from the page
+// cache if it lies wholly inside one segment at a page-aligned
+// file offset. Processes running the same program then share
+// its text until one stores to it. For the pages to stay those
+// of the program that was started, the file cannot be written
+// while any address space runs it (see itext() in fs.c).
+//
+// Filling in a file page may sleep, which a page fault taken
+// by the kernel must not do, and running out of memory there
+// is fatal. So before a system call uses a user buffer,
+// uvmaccess() checks it and fills in whatever is missing.
+//
+// The threads of a process share its struct mm. Each of
+// these functions that looks at the mappings from system call
+// or user page fault context holds mm->lock, so that none
+// disappears while its file is read.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "stat.h"
+#include "mman.h"
+#include "mm.h"
+
+// Return the mapping holding user address va, or 0.
+static struct vma*
+vmafind(struct mm *mm, uint va)
+{
+	struct vma *v;
+
+	for(v = mm->vma; v < mm->vma+NVMA; v++)
+		if(v->len && va >= v->start && va - v->start < v->len)
+			return v;
+	return 0;
+}
+
+static struct vma*
+vmaalloc(struct mm *mm)
+{
+	struct vma *v;
+
+	for(v = mm->vma; v < mm->vma+NVMA; v++)
+		if(v->len == 0)
+			return v;
+	return 0;
+}
+
+// Lowest address used by mm's mappings; the heap ends below it.
+uint
+mmapbase(struct mm *mm)
+{
+	struct vma *v;
+	uint base;
+
+	base = KERNBASE;
+	for(v = mm->vma; v < mm->vma+NVMA; v++)
+		if(v->len && v->start < base)
+			base = v->start;
+	return base;
+}
+
+// Map len bytes of f from offset off, or anonymous memory
+// if f is 0, into the current process.
+// Returns the address of the mapping, or -1.
+uint
+mmap(uint len, int prot, int flags, struct file *f, uint off)
+{
+	struct mm *mm;
+	struct vma *v, *nv;
+	uint a;
+	int moved;
+
+	mm = myproc()->mm;
+	if(len == 0 || len > KERNBASE || prot == 0 ||
+	   (prot & ~(PROT_READ|PROT_WRITE)) != 0 ||
+	   ((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+		return -1;
+	if(f){
+		if(f->type != FD_INODE || !f->readable || off % PGSIZE ||
+		   f->ip->type != T_FILE)
+			return -1;
+		if((flags & MAP_SHARED) && (prot & PROT_WRITE))
+			return -1;
+	} else if(flags & MAP_SHARED)
+		return -1;
+	acquiresleep(&mm->lock);
+	if((nv = vmaalloc(mm)) == 0)
+		goto bad;
+
+	// Take the highest gap that is big enough.
+	len = PGROUNDUP(len);
+	a = KERNBASE - len;
+	do {
+		moved = 0;
+		for(v = mm->vma; v < mm->vma+NVMA; v++){
+			if(v->len && a < v->start + v->len && v->start < a + len){
+				if(v->start < len)
+					goto bad;
+				a = v->start - len;
+				moved = 1;
+			}
+		}
+	} while(moved);
+	if(a < PGROUNDUP(mm->sz))
+		goto bad;
+
+	nv->start = a;
+	nv->len = len;
+	nv->prot = prot;
+	nv->flags = flags;
+	nv->f = f ? filedup(f) : 0;
+	nv->off = off;
+	releasesleep(&mm->lock);
+	return a;
+
+bad:
+	releasesleep(&mm->lock);
+	return -1;
+}
+
+// Remove the mappings of [addr, addr+len) from the current
+// process. Returns -1 if the range is bad or a mapping would
+// have to be split in two and there is no room for that.
+int
+munmap(uint addr, uint len)
+{
+	struct mm *mm;
+	struct vma *v, *nv;
+	uint end, s, e;
+
+	mm = myproc()->mm;
+	len = PGROUNDUP(len);
+	end = addr + len;
+	if(addr % PGSIZE || len == 0 || end < addr || end > KERNBASE)
+		return -1;
+
+	acquiresleep(&mm->lock);
+	nv = 0;
+	for(v = mm->vma; v < mm->vma+NVMA; v++){
+		if(v->len && addr > v->start && end < v->start + v->len){
+			if((nv = vmaalloc(mm)) == 0){
+				releasesleep(&mm->lock);
+				return -1;
+			}
+		}
+	}
+
+	for(v = mm->vma; v < mm->vma+NVMA; v++){
+		if(v->len == 0 || end <= v->start || v->start + v->len <= addr)
+			continue;
+		s = addr > v->start ? addr : v->start;
+		e = end < v->start + v->len ? end : v->start + v->len;
+		uvmunmap(mm->pgdir, s, e);
+		if(s == v->start && e == v->start + v->len){
+			if(v->f)
+				fileclose(v->f);
+			v->f = 0;
+			v->len = 0;
+		} else if(s == v->start){
+			v->off += e - v->start;
+			v->len -= e - v->start;
+			v->start = e;
+		} else if(e == v->start + v->len){
+			v->len = s - v->start;
+		} else {
+			// Split: nv gets the part after the hole.
+			*nv = *v;
+			nv->start = e;
+			nv->len = v->start + v->len - e;
+			nv->off = v->off + (e - v->start);
+			if(nv->f)
+				filedup(nv->f);
+			v->len = s - v->start;
+		}
+	}
+	releasesleep(&mm->lock);
+	return 0;
+}
+
+// Fill in the page of mm's mappings that holds va. A file
+// page is read in only if cansleep. Returns -1 if va is not
+// mapped or the page cannot be filled.
+int
+mmapfault(struct mm *mm, uint va, int cansleep)
+{
+	struct vma *v;
+	struct inode *ip;
+	char *mem;
+	uint off, pa;
+	int perm, r;
+
+	if((v = vmafind(mm, va)) == 0)
+		return -1;
+	va = PGROUNDDOWN(va);
+	// Pages the process may not store to are still mapped
+	// copy-on-write, so that a store by the kernel, as when
+	// read() fills a buffer, only changes this process's copy.
+	perm = PTE_U | (v->prot & PROT_WRITE ? PTE_W : PTE_COW);
+	if(v->f == 0){
+		if((pa = palloc()) == 0)
+			return -1;
+		pgzero(pa);
+	} else {
+		if(!cansleep)
+			return -1;
+		ip = v->f->ip;
+		off = v->off + (va - v->start);
+		ilock(ip);
+		if(off + PGSIZE <= ip->size && (mem = pcacheget(ip, off/PGSIZE)) != 0){
+			perm = PTE_U | PTE_COW;
+		} else if((mem = kalloc()) != 0){
+			memset(mem, 0, PGSIZE);
+			if(off < ip->size)
+				readi(ip, mem, off, PGSIZE);
+		}
+		iunlock(ip);
+		if(mem == 0)
+			return -1;
+		pa = V2P(mem);
+	}
+	if((r = uvmmap(mm->pgdir, va, pa, perm)) != 0)
+		pfree(pa);
+	return r < 0 ? -1 : 0;
+}
+
+// Map a zeroed writable page at user address va of mm.
+static int
+zeropage(struct mm *mm, uint va)
+{
+	uint pa;
+	int r;
+
+	if((pa = palloc()) == 0)
+		return -1;
+	pgzero(pa);
+	if((r = uvmmap(mm->pgdir, PGROUNDDOWN(va), pa, PTE_W|PTE_U)) != 0)
+		pfree(pa);
+	return r < 0 ? -1 : 0;
+}
+
+// Fill in the page of mm's program image that holds user
+// address va, below mm->sz: read in the parts of it that
+// segments take from the program file, and zero the rest.
+// A page of one segment, at a page-aligned file offset, is
+// the page cache's page, mapped copy-on-write: every process
+// running the program shares it until it stores to it. That
+// goes for the last page of a segment too, what follows it
+// in the file standing in for bytes the program does not use,
+// unless the segment has bss to zero there.
+// Returns -1 if the file must be read and !cansleep.
+static int
+imagefault(struct mm *mm, uint va, int cansleep)
+{
+	struct seg *s, *whole;
+	struct inode *ip;
+	char *mem;
+	uint a, e, off, pa;
+	int perm, n, r;
+
+	va = PGROUNDDOWN(va);
+	whole = 0;
+	n = 0;
+	for(s = mm->seg; mm->exe && s < mm->seg+NSEG; s++){
+		if(s->filesz == 0 || va + PGSIZE <= s->va || s->va + s->filesz <= va)
+			continue;
+		n++;
+		if(s->va <= va && (va + PGSIZE <= s->va + s->filesz || s->nobss) &&
+		   (s->off + (va - s->va)) % PGSIZE == 0)
+			whole = s;
+	}
+	if(n == 0)
+		return zeropage(mm, va);
+	if(!cansleep)
+		return -1;
+
+	ip = mm->exe;
+	perm = PTE_W | PTE_U;
+	ilock(ip);
+	off = whole ? whole->off + (va - whole->va) : 0;
+	if(n == 1 && whole && off + PGSIZE <= ip->size &&
+	   (mem = pcacheget(ip, off/PGSIZE)) != 0){
+		perm = PTE_U | PTE_COW;
+	} else if((mem = kalloc()) != 0){
+		memset(mem, 0, PGSIZE);
+		for(s = mm->seg; s < mm->seg+NSEG; s++){
+			if(s->filesz == 0 || va + PGSIZE <= s->va || s->va + s->filesz <= va)
+				continue;
+			a = s->va > va ? s->va : va;
+			e = s->va + s->filesz < va + PGSIZE ? s->va + s->filesz : va + PGSIZE;
+			readi(ip, mem + (a - va), s->off + (a - s->va), e - a);
+		}
+	}
+	iunlock(ip);
+	if(mem == 0)
+		return -1;
+	pa = V2P(mem);
+	if((r = uvmmap(mm->pgdir, va, pa, perm)) != 0)
+		pfree(pa);
+	return r < 0 ? -1 : 0;
+}
+
+// Fill in the missing page of mm that holds user address va.
+static int
+fillpage(struct mm *mm, uint va, int cansleep)
+{
+	if(va >= mm->sz)
+		return mmapfault(mm, va, cansleep);
+	return imagefault(mm, va, cansleep);
+}
+
+// Handle a page fault at user address va with error code err,
+// taken in user mode if user. Returns 0 if the access can be
+// retried.
+int
+pagefault(struct mm *mm, uint va, uint err, int user)
+{
+	struct vma *v;
+	int r;
+
+	if(va >= KERNBASE)
+		return -1;
+	if(user)
+		acquiresleep(&mm->lock);
+	if(err & FEC_PR){
+		// Only a store to a copy-on-write page can be fixed.
+		if((err & FEC_WR) == 0)
+			r = -1;
+		else if(user && (v = vmafind(mm, va)) != 0 && (v->prot & PROT_WRITE) == 0)
+			r = -1;
+		else
+			r = cowfault(mm->pgdir, va);
+	} else if((r = fillpage(mm, va, user)) < 0 && !user && mm->ref > 1){
+		// Another thread unmapped memory that a system call is
+		// using. Let the kernel finish with a zeroed page; it
+		// is freed with the rest of the address space.
+		r = zeropage(mm, va);
+	}
+	if(user)
+		releasesleep(&mm->lock);
+	return r;
+}
+
+// Return the end of the region of mm's memory holding user
+// address va: the end of the heap or of va's mapping.
+// Returns 0 if va is not in use.
+uint
+uvmlimit(struct mm *mm, uint va)
+{
+	struct vma *v;
+
+	if(va < mm->sz)
+		return mm->sz;
+	if((v = vmafind(mm, va)) != 0)
+		return v->start + v->len;
+	return 0;
+}
+
+// Check that user memory [va, va+n) is mm's, and fill in the
+// pages of it that are not present yet, so that the kernel
+// can use it without faulting. Returns -1 if not.
+int
+uvmaccess(struct mm *mm, uint va, uint n)
+{
+	uint end, a;
+	int r;
+
+	acquiresleep(&mm->lock);
+	end = uvmlimit(mm, va);
+	r = 0;
+	if(end == 0 || va + n < va || va + n > end)
+		r = -1;
+	for(a = PGROUNDDOWN(va); r == 0 && a < va + n; a += PGSIZE)
+		if(!uvmpresent(mm->pgdir, a) && fillpage(mm, a, 1) < 0)
+			r = -1;
+	releasesleep(&mm->lock);
+	return r;
+}
+
+// Copy n bytes from user address va of mm, the current address
+// space, to dst. mm->lock is held for the whole copy, so each
+// page needs checking only once, and no other thread can unmap
+// it meanwhile. Returns -1 if [va, va+n) is not all mm's.
+int
+copyin(struct mm *mm, void *dst, uint va, uint n)
+{
+	uint end, m;
+	char *d;
+	int r;
+
+	acquiresleep(&mm->lock);
+	end = uvmlimit(mm, va);
+	r = 0;
+	if(end == 0 || va + n < va || va + n > end)
+		r = -1;
+	for(d = dst; r == 0 && n > 0; va += m, d += m, n -= m){
+		m = PGSIZE - va%PGSIZE;
+		if(m > n)
+			m = n;
+		if(!uvmpresent(mm->pgdir, PGROUNDDOWN(va)) && fillpage(mm, PGROUNDDOWN(va), 1) < 0)
+			r = -1;
+		else
+			memmove(d, (char*)va, m);
+	}
+	releasesleep(&mm->lock);
+	return r;
+}
+
+// Copy the nul-terminated string at user address va of mm, the
+// current address space, to dst, as copyin() does. Returns its
+// length, not including the nul, or -1 if it is not all mm's
+// or does not fit in max bytes.
+int
+copyinstr(struct mm *mm, char *dst, uint va, uint max)
+{
+	uint end, i;
+	int r;
+
+	acquiresleep(&mm->lock);
+	end = uvmlimit(mm, va);
+	r = -1;
+	for(i = 0; end != 0 && i < max && va + i < end; i++){
+		if((i == 0 || (va + i)%PGSIZE == 0) && !uvmpresent(mm->pgdir, PGROUNDDOWN(va + i)) &&
+		   fillpage(mm, PGROUNDDOWN(va + i), 1) < 0)
+			break;
+		if((dst[i] = *(char*)(va + i)) == 0){
+			r = i;
+			break;
+		}
+	}
+	releasesleep(&mm->lock);
+	return r;
+}
+
+// Give nm a copy of mm's mappings and of their present pages,
+// and of the program segments not read in yet.
+// Caller holds mm->lock.
+int
+mmapfork(struct mm *nm, struct mm *mm)
+{
+	struct vma *v, *nv;
+
+	if(mm->exe){
+		nm->exe = idup(mm->exe);
+		itext(nm->exe, 1);
+		memmove(nm->seg, mm->seg, sizeof(nm->seg));
+	}
+
+	for(v = mm->vma, nv = nm->vma; v < mm->vma+NVMA; v++, nv++){
+		if(v->len == 0)
+			continue;
+		if(uvmcopy(mm->pgdir, nm->pgdir, v->start, v->start + v->len) < 0)
+			return -1;
+		*nv = *v;
+		if(nv->f)
+			filedup(nv->f);
+	}
+	return 0;
+}
+
+// Forget all of mm's mappings and its program file. Their
+// pages are in mm's page table and are freed with it.
+void
+mmapclose(struct mm *mm)
+{
+	struct vma *v;
+
+	for(v = mm->vma; v < mm->vma+NVMA; v++){
+		if(v->len && v->f)
+			fileclose(v->f);
+		v->f = 0;
+		v->len = 0;
+	}
+	if(mm->exe){
+		itext(mm->exe, -1);
+		begin_op();
+		iput(mm->exe);
+		end_op();
+		mm->exe = 0;
+	}
+}
@@ -1,14 +1,49 @@
 #define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
+#define TICKNS 10000000  // scheduling tick, in nanoseconds
+#define NQLEVEL       4  // scheduler priority levels
+#define BOOSTTICKS  100  // ticks between moving everyone to the top level
+#define NICEMAX      19  // largest nice value
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NVMA         16  // memory mappings per process
+#define NSEG          4  // loadable segments in a program
+#define NFILE       100  // maximum open files per system
+#define NINODE       50  // i-node cache entries made at boot; grows on demand
+#define NDENTRY     256  // directory entries cached for dirlookup()
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
+#define RAMDEV        2  // device number of the RAM disk
+#define NBDEV         3  // block devices: IDE disks 0 and 1, RAM disk
+#define TMPDEV        3  // device number of tmpfs inodes; not a block device
+#define NMOUNT        8  // mounted file systems besides the root
 #define MAXARG       32  // max exec arguments
+#define NSYSCALL     64  // more than the highest system call number
+#define MAXPATH     128  // max bytes in a path, with the nul
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define MAXWRITEBLOCKS 24  // log blocks reserved by each filewrite() chunk
+#define LOGSIZE      (MAXOPBLOCKS*6)  // default on-disk log size made by mkfs
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
+#define BCACHEMAX    2048  // boot-time cap on cached blocks
+#define BCACHEFRAC      8  // cache gets 1/BCACHEFRAC of free memory
+#define NREADAHEAD      8  // blocks readi() reads ahead of a sequential reader
+#define NPCACHE       128  // file pages kept for mapping into readers
+#define KALLOCJUNK      0  // debug: kfree() fills pages with junk
+#define LOCKDEBUG       0  // debug: spinlocks record their holder's call stack
+#define NLOCKSTAT     256  // statically allocated spinlocks lockstat() reports
+#define PROFNS    1000000  // profiler sampling interval, in nanoseconds
+#define NPROFSAMPLE  2048  // profiler samples kept per CPU, a power of 2
+#define NTRACE       1024  // trace records kept per CPU, a power of 2
+#define BUDDYORDER     10  // contiguous page pool is 2^BUDDYORDER pages
+#define PGMAPSLOTS      2  // per-CPU pgmap() windows onto high memory
+#define FSSIZE       4000  // size of file system in blocks
+#define RAMDISKFRAC    16  // RAM disk gets 1/RAMDISKFRAC of free memory
+#define RAMDISKMAX FSSIZE  // most blocks in the RAM disk
+#define NTMPNODE      256  // inodes in all tmpfs file systems together
+#define TMPFSMAX     1024  // pages of data in all tmpfs file systems together
+#define LOGDELAY       10  // ticks a transaction may wait for group commit
+#define SCROLLBACK   200  // console rows kept for Shift+PgUp
+#define KLOGSIZE    2048  // per-CPU cprintf ring
+#define KLOGHIST    4096  // kernel log history kept for dmesg
+#define INPUT_BUF   1024  // console input buffer, must be a power of 2
 
@@ -0,0 +1,241 @@
+// Page cache.
+//
+// Holds whole pages of regular files so that a read of full,
+// page-aligned pages into a page-aligned user buffer can map
+// the cached pages into the reader instead of copying them.
+// A mapped page is read-only and copy-on-write (PTE_COW); the
+// cache and every mapping hold a reference on it, so a store
+// by one reader, or eviction from the cache, leaves the others
+// alone.
+//
+// Since readers may still have a page mapped, writes and
+// truncation never change a cached page: they drop it from the
+// cache. Eviction passes over pages that are still mapped, as
+// the text of running programs is (see imagefault() in
+// mmap.c), so that the next exec() of a program finds its
+// text here instead of reading in another copy. Pages are
+// filled only with the inode's lock held, perhaps shared, and
+// dropped only with it held exclusively.
+// pcache.lock protects the table and the LRU list.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "proc.h"
+#include "mm.h"
+#include "x86.h"
+#include "stat.h"
+
+#define NPHASH 61
+
+struct cpage {
+	uint dev;
+	uint inum;
+	uint pgno;           // page index in the file
+	char *data;          // 0 if the slot is unused
+	struct cpage *hnext; // hash chain
+	struct cpage *prev;  // LRU list, most recent at head.next
+	struct cpage *next;
+};
+
+static struct {
+	struct spinlock lock;
+	struct cpage page[NPCACHE];
+	struct cpage *hash[NPHASH];
+	struct cpage head;
+} pcache;
+
+void
+pcacheinit(void)
+{
+	struct cpage *c;
+
+	initlock(&pcache.lock, "pcache");
+	pcache.head.prev = &pcache.head;
+	pcache.head.next = &pcache.head;
+	for(c = pcache.page; c < pcache.page+NPCACHE; c++){
+		c->next = pcache.head.next;
+		c->prev = &pcache.head;
+		pcache.head.next->prev = c;
+		pcache.head.next = c;
+	}
+}
+
+static struct cpage**
+phash(uint dev, uint inum, uint pgno)
+{
+	return &pcache.hash[(dev*31 + inum*17 + pgno) % NPHASH];
+}
+
+// Caller holds pcache.lock.
+static struct cpage*
+pfind(uint dev, uint inum, uint pgno)
+{
+	struct cpage *c;
+
+	for(c = *phash(dev, inum, pgno); c; c = c->hnext)
+		if(c->pgno == pgno && c->inum == inum && c->dev == dev)
+			return c;
+	return 0;
+}
+
+// Move c to the front (tail if !used) of the LRU list.
+// Caller holds pcache.lock.
+static void
+ptouch(struct cpage *c, int used)
+{
+	c->next->prev = c->prev;
+	c->prev->next = c->next;
+	if(used){
+		c->next = pcache.head.next;
+		c->prev = &pcache.head;
+	} else {
+		c->next = &pcache.head;
+		c->prev = pcache.head.prev;
+	}
+	c->next->prev = c;
+	c->prev->next = c;
+}
+
+// Remove c from the cache and drop the cache's reference
+// to its page. Caller holds pcache.lock.
+static void
+pdrop(struct cpage *c)
+{
+	struct cpage **pp;
+
+	for(pp = phash(c->dev, c->inum, c->pgno); *pp; pp = &(*pp)->hnext){
+		if(*pp == c){
+			*pp = c->hnext;
+			break;
+		}
+	}
+	kfree(c->data);
+	c->data = 0;
+	ptouch(c, 0);
+}
+
+// Return page pgno of ip, with a reference for the caller,
+// reading it into the cache if it is not there.
+// Caller holds ip->lock; the page must be inside the file.
+char*
+pcacheget(struct inode *ip, uint pgno)
+{
+	struct cpage *c;
+	char *mem;
+
+	acquire(&pcache.lock);
+	if((c = pfind(ip->dev, ip->inum, pgno)) != 0){
+		kincref(c->data);
+		ptouch(c, 1);
+		release(&pcache.lock);
+		return c->data;
+	}
+	release(&pcache.lock);
+
+	if((mem = kalloc()) == 0)
+		return 0;
+	if(readi(ip, mem, pgno*PGSIZE, PGSIZE) != PGSIZE){
+		kfree(mem);
+		return 0;
+	}
+
+	// Another reader holding ip->lock shared may have
+	// cached the page meanwhile.
+	acquire(&pcache.lock);
+	if((c = pfind(ip->dev, ip->inum, pgno)) != 0){
+		kfree(mem);
+		mem = c->data;
+		kincref(mem);
+		ptouch(c, 1);
+		release(&pcache.lock);
+		return mem;
+	}
+	// Take the least recently used page that only the cache
+	// holds, or failing that the least recently used.
+	for(c = pcache.head.prev; c != &pcache.head; c = c->prev)
+		if(c->data == 0 || kref(c->data) == 1)
+			break;
+	if(c == &pcache.head)
+		c = pcache.head.prev;
+	if(c->data)
+		pdrop(c);
+	c->dev = ip->dev;
+	c->inum = ip->inum;
+	c->pgno = pgno;
+	c->data = mem;
+	c->hnext = *phash(c->dev, c->inum, c->pgno);
+	*phash(c->dev, c->inum, c->pgno) = c;
+	ptouch(c, 1);
+	kincref(mem);
+	release(&pcache.lock);
+	return mem;
+}
+
+// Read n bytes of ip at off into the current process at
+// user address dst by mapping cached pages, as far as that
+// is possible: off and dst must be page-aligned, and only
+// whole pages inside the file are mapped. Returns the number
+// of bytes read, a multiple of PGSIZE, possibly 0.
+// Replacing pages that other threads may be using would take
+// a TLB shootdown before freeing each, so a process with
+// threads always copies.
+// Caller holds ip->lock.
+int
+pcacheread(struct inode *ip, char *dst, uint off, uint n)
+{
+	struct mm *mm;
+	uint tot;
+	char *mem;
+
+	mm = myproc()->mm;
+	if(ip->type != T_FILE || off % PGSIZE || (uint)dst % PGSIZE || mm->ref > 1)
+		return 0;
+	for(tot = 0; n - tot >= PGSIZE; tot += PGSIZE){
+		if(off + tot + PGSIZE > ip->size)
+			break;
+		if((uint)dst + tot + PGSIZE > uvmlimit(mm, (uint)dst + tot))
+			break;
+		if((mem = pcacheget(ip, (off + tot)/PGSIZE)) == 0)
+			break;
+		if(mapcow(mm->pgdir, dst + tot, mem) < 0){
+			kfree(mem);
+			break;
+		}
+	}
+	if(tot > 0)
+		lcr3(V2P(mm->pgdir));
+	return tot;
+}
+
+// Bytes [off, off+n) of ip are being changed: drop the
+// cached pages that hold them. Caller holds ip->lock.
+void
+pcacheinval(struct inode *ip, uint off, uint n)
+{
+	struct cpage *c;
+	uint pg, last;
+
+	if(ip->type != T_FILE || n == 0)
+		return;
+	pg = off/PGSIZE;
+	last = (off + n - 1)/PGSIZE;
+	acquire(&pcache.lock);
+	if(last - pg < NPCACHE){
+		for(; pg <= last; pg++)
+			if((c = pfind(ip->dev, ip->inum, pg)) != 0)
+				pdrop(c);
+	} else {
+		for(c = pcache.page; c < pcache.page+NPCACHE; c++)
+			if(c->data && c->inum == ip->inum && c->dev == ip->dev &&
+			   c->pgno >= pg && c->pgno <= last)
+				pdrop(c);
+	}
+	release(&pcache.lock);
+}
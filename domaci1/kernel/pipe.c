@@ -7,18 +7,46 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
+#include "slab.h"
+#include "stats.h"
 
-#define PIPESIZE 512
+// Data moves through a one-page ring with memmove(), in at
+// most two spans per pass, one up to the end of the ring and
+// one from its start. A reader sleeps only on an empty pipe
+// and a writer only on a full one, so each wakes the other
+// only on the way out of that state: a writer after putting
+// bytes into an empty pipe, a reader once it has emptied a
+// full one down to half, so that the writer has room for a
+// good amount when it runs.
+//
+// splice() fills or drains the ring straight from or to a
+// file, with p->lock released while the file is read or
+// written: pipewspan() waits for room and returns the free span
+// at the write end, and pipewdone() adds what was put there.
+// wbusy keeps other writers out meanwhile. piperspan() and
+// piperdone() do the same at the read end, under rbusy.
+#define PIPESIZE PGSIZE
 
 struct pipe {
 	struct spinlock lock;
-	char data[PIPESIZE];
+	char *data;     // PIPESIZE bytes, a page from kalloc()
 	uint nread;     // number of bytes read
 	uint nwrite;    // number of bytes written
 	int readopen;   // read fd is still open
 	int writeopen;  // write fd is still open
+	int rbusy;      // a splice is reading from a span
+	int wbusy;      // a splice is writing to a span
 };
 
+static struct kmcache pipecache;
+
+void
+pipeinit(void)
+{
+	kmcacheinit(&pipecache, "pipe", sizeof(struct pipe));
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,7 +56,9 @@ pipealloc(struct file **f0, struct file **f1)
 	*f0 = *f1 = 0;
 	if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
 		goto bad;
-	if((p = (struct pipe*)kalloc()) == 0)
+	if((p = kmcachealloc(&pipecache)) == 0)
+		goto bad;
+	if((p->data = kalloc()) == 0)
 		goto bad;
 	p->readopen = 1;
 	p->writeopen = 1;
@@ -46,8 +76,11 @@ pipealloc(struct file **f0, struct file **f1)
 	return 0;
 
 	bad:
-	if(p)
-		kfree((char*)p);
+	if(p){
+		if(p->data)
+			kfree(p->data);
+		kmfree(p);
+	}
 	if(*f0)
 		fileclose(*f0);
 	if(*f1)
@@ -62,13 +95,16 @@ pipeclose(struct pipe *p, int writable)
 	if(writable){
 		p->writeopen = 0;
 		wakeup(&p->nread);
+		pollwake();
 	} else {
 		p->readopen = 0;
 		wakeup(&p->nwrite);
+		pollwake();
 	}
 	if(p->readopen == 0 && p->writeopen == 0){
 		release(&p->lock);
-		kfree((char*)p);
+		kfree(p->data);
+		kmfree(p);
 	} else
 		release(&p->lock);
 }
@@ -76,21 +112,42 @@ pipeclose(struct pipe *p, int writable)
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
-	int i;
+	int i, m, wake;
+	uint off;
 
+	statadd(ST_PIPEWRITE, 1);
 	acquire(&p->lock);
-	for(i = 0; i < n; i++){
-		while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+	wake = 0;
+	for(i = 0; i < n; i += m){
+		while(p->wbusy || p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
 			if(p->readopen == 0 || myproc()->killed){
 				release(&p->lock);
 				return -1;
 			}
-			wakeup(&p->nread);
-			sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+			if(wake){
+				statadd(ST_PIPEWAKE, 1);
+				wakeup(&p->nread);
+				pollwake();
+			}
+			wake = 0;
+			sleep(p->wbusy ? (void*)&p->wbusy : &p->nwrite, &p->lock);  //DOC: pipewrite-sleep
 		}
-		p->data[p->nwrite++ % PIPESIZE] = addr[i];
+		if(p->nread == p->nwrite)
+			wake = 1;  // the reader may be asleep
+		off = p->nwrite % PIPESIZE;
+		m = n - i;
+		if(m > p->nread + PIPESIZE - p->nwrite)
+			m = p->nread + PIPESIZE - p->nwrite;
+		if(m > PIPESIZE - off)
+			m = PIPESIZE - off;
+		memmove(p->data + off, addr + i, m);
+		p->nwrite += m;
+	}
+	if(wake){
+		statadd(ST_PIPEWAKE, 1);
+		wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+		pollwake();
 	}
-	wakeup(&p->nread);  //DOC: pipewrite-wakeup1
 	release(&p->lock);
 	return n;
 }
@@ -98,22 +155,147 @@ pipewrite(struct pipe *p, char *addr, int n)
 int
 piperead(struct pipe *p, char *addr, int n)
 {
-	int i;
+	int i, m, full;
+	uint off;
 
 	acquire(&p->lock);
-	while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
+	while(p->rbusy || (p->nread == p->nwrite && p->writeopen)){  //DOC: pipe-empty
 		if(myproc()->killed){
 			release(&p->lock);
 			return -1;
 		}
-		sleep(&p->nread, &p->lock); //DOC: piperead-sleep
+		sleep(p->rbusy ? (void*)&p->rbusy : &p->nread, &p->lock); //DOC: piperead-sleep
 	}
-	for(i = 0; i < n; i++){  //DOC: piperead-copy
-		if(p->nread == p->nwrite)
-			break;
-		addr[i] = p->data[p->nread++ % PIPESIZE];
+	full = p->nwrite - p->nread > PIPESIZE/2;
+	for(i = 0; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+		off = p->nread % PIPESIZE;
+		m = n - i;
+		if(m > p->nwrite - p->nread)
+			m = p->nwrite - p->nread;
+		if(m > PIPESIZE - off)
+			m = PIPESIZE - off;
+		memmove(addr + i, p->data + off, m);
+		p->nread += m;
+	}
+	if(full && p->nwrite - p->nread <= PIPESIZE/2){
+		wakeup(&p->nwrite);  //DOC: piperead-wakeup
+		pollwake();
 	}
-	wakeup(&p->nwrite);  //DOC: piperead-wakeup
 	release(&p->lock);
 	return i;
 }
+
+// Wait for room in p and return the length of the free span
+// at the write end, with its address in *span; -1 if the read
+// end is closed. The caller fills it and calls pipewdone().
+int
+pipewspan(struct pipe *p, char **span)
+{
+	uint off;
+	int m;
+
+	acquire(&p->lock);
+	while(p->wbusy || p->nwrite == p->nread + PIPESIZE){
+		if(p->readopen == 0 || myproc()->killed){
+			release(&p->lock);
+			return -1;
+		}
+		sleep(p->wbusy ? (void*)&p->wbusy : &p->nwrite, &p->lock);
+	}
+	p->wbusy = 1;
+	off = p->nwrite % PIPESIZE;
+	m = p->nread + PIPESIZE - p->nwrite;
+	if(m > PIPESIZE - off)
+		m = PIPESIZE - off;
+	*span = p->data + off;
+	release(&p->lock);
+	return m;
+}
+
+// The first m bytes of the span from pipewspan() hold data.
+void
+pipewdone(struct pipe *p, int m)
+{
+	acquire(&p->lock);
+	if(m > 0 && p->nread == p->nwrite){
+		wakeup(&p->nread);
+		pollwake();
+	}
+	p->nwrite += m;
+	p->wbusy = 0;
+	wakeup(&p->wbusy);
+	release(&p->lock);
+}
+
+// Wait for data in p and return the length of the span of it
+// at the read end, with its address in *span; 0 at end of
+// file, or -1. The caller empties it and calls piperdone().
+int
+piperspan(struct pipe *p, char **span)
+{
+	uint off;
+	int m;
+
+	acquire(&p->lock);
+	while(p->rbusy || (p->nread == p->nwrite && p->writeopen)){
+		if(myproc()->killed){
+			release(&p->lock);
+			return -1;
+		}
+		sleep(p->rbusy ? (void*)&p->rbusy : &p->nread, &p->lock);
+	}
+	if(p->nread == p->nwrite){
+		release(&p->lock);
+		return 0;
+	}
+	p->rbusy = 1;
+	off = p->nread % PIPESIZE;
+	m = p->nwrite - p->nread;
+	if(m > PIPESIZE - off)
+		m = PIPESIZE - off;
+	*span = p->data + off;
+	release(&p->lock);
+	return m;
+}
+
+// The first m bytes of the span from piperspan() are used up.
+void
+piperdone(struct pipe *p, int m)
+{
+	int full;
+
+	acquire(&p->lock);
+	full = p->nwrite - p->nread > PIPESIZE/2;
+	p->nread += m;
+	if(full && p->nwrite - p->nread <= PIPESIZE/2){
+		wakeup(&p->nwrite);
+		pollwake();
+	}
+	p->rbusy = 0;
+	wakeup(&p->rbusy);
+	release(&p->lock);
+}
+
+// The poll() conditions of the read end of p, or of the write
+// end if writing.
+int
+pipepoll(struct pipe *p, int writing)
+{
+	int r;
+
+	acquire(&p->lock);
+	r = 0;
+	if(writing){
+		if(p->readopen == 0)
+			r = POLLERR;
+		else if(p->nwrite != p->nread + PIPESIZE)
+			r = POLLOUT;
+	} else {
+		if(p->nread != p->nwrite)
+			r = POLLIN;
+		if(p->writeopen == 0)
+			r |= POLLIN | POLLHUP;
+	}
+	release(&p->lock);
+	return r;
+}
@@ -0,0 +1,76 @@
+// Waiting on many files at once.
+//
+// Rather than a wait queue per file, there is one counter,
+// pollseq, that pipes and the console bump with pollwake()
+// whenever they wake their own readers or writers. poll()
+// looks at each file in turn and, if none is ready, sleeps
+// until pollseq changes or the timeout passes, then looks
+// again. A bump wakes every poller, and each checks its own
+// files, which is cheap with few pollers. When there are none,
+// pollwake() costs a load.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "poll.h"
+
+static struct spinlock pollock;
+static uint pollseq;
+static int npollers;  // under pollock; read without it
+
+void
+pollinit(void)
+{
+	initlock(&pollock, "poll");
+}
+
+// Something a poller might wait for has happened. The caller
+// changed the state under its own lock before, so a poller
+// that counted itself in npollers after that sees the change.
+void
+pollwake(void)
+{
+	if(npollers)
+		wakeseq(&pollseq);
+}
+
+// Fill in revents for the n entries of fds, waiting until at
+// least one has an event or nanouptime() reaches when (never,
+// if when is 0; at once if when is 1). Returns the number of
+// entries with events, or -1 if killed.
+int
+poll(struct pollfd *fds, int n, uint64 when)
+{
+	struct proc *curproc = myproc();
+	struct file *f;
+	int i, ready;
+	uint seq;
+
+	acquire(&pollock);
+	npollers++;
+	release(&pollock);
+	for(;;){
+		seq = pollseq;
+		ready = 0;
+		for(i = 0; i < n; i++){
+			fds[i].revents = 0;
+			if(fds[i].fd < 0)
+				continue;
+			if(fds[i].fd >= NOFILE || (f = curproc->ofile[fds[i].fd]) == 0)
+				fds[i].revents = POLLNVAL;
+			else
+				fds[i].revents = filepoll(f) & (fds[i].events | POLLERR | POLLHUP);
+			if(fds[i].revents)
+				ready++;
+		}
+		if(ready || curproc->killed || !sleepseq(&pollseq, seq, when))
+			break;
+	}
+	acquire(&pollock);
+	npollers--;
+	release(&pollock);
+	return curproc->killed ? -1 : ready;
+}
@@ -0,0 +1,11 @@
+#define POLLIN   0x001  // Data to read, or end of file
+#define POLLOUT  0x004  // Room to write
+#define POLLERR  0x008  // Pipe has no reader
+#define POLLHUP  0x010  // Pipe has no writer
+#define POLLNVAL 0x020  // fd is not open
+
+struct pollfd {
+	int fd;        // File descriptor
+	short events;  // Conditions wanted
+	short revents; // Conditions found
+};
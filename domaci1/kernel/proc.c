@@ -4,26 +4,124 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "x86.h"
+#include "traps.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "rusage.h"
+#include "stats.h"
+#include "trace.h"
+#include "mm.h"
+#include "slab.h"
 
 struct {
 	struct spinlock lock;
 	struct proc proc[NPROC];
 } ptable;
 
+// Each CPU has a queue of RUNNABLE processes with its own
+// lock, so choosing the next process takes neither a scan of
+// ptable nor ptable.lock. A process is queued on the CPU it
+// last ran on (p->cpu); a CPU whose queue is empty steals from
+// the others. A process holds its CPU's queue lock across
+// sched(), in place of ptable.lock, so it is queued, and taken
+// off a queue, only once its context has been saved.
+// Lock order: ptable.lock, then a queue lock.
+//
+// The queue is a multilevel feedback queue: a FIFO list for
+// each of NQLEVEL levels, run highest (0) first. A process
+// that uses up the time slice of its level drops a level, to
+// a longer slice; one that sleeps first keeps its level. Its
+// nice value sets the highest level it may have, and every
+// BOOSTTICKS ticks all processes go back there, so none starve.
+struct runq {
+	struct spinlock lock;
+	struct proc *head[NQLEVEL];
+	struct proc *tail[NQLEVEL];
+	int n;
+	uint epoch;  // ticks/BOOSTTICKS when last boosted
+};
+
+static struct runq runq[NCPU];
+
+// Time slice, in ticks, of each level.
+static int qslice[NQLEVEL] = { 1, 2, 4, 8 };
+
+// Sleeping processes, hashed by channel, so that wakeup()
+// looks only at those sleeping on its channel. A bucket's
+// lock, not ptable.lock, guards the state and chan of the
+// processes sleeping in it.
+// Lock order: ptable.lock, then a bucket lock, then a queue lock.
+#define NSLPQ 64
+
+static struct slpq {
+	struct spinlock lock;
+	struct proc *head;
+} slpq[NSLPQ];
+
+// Address spaces. A thread made by clone() is a process that
+// shares its parent's; wait() reaps the children that do not,
+// join() the ones that do. The last of them to be reaped frees
+// the space.
+static struct kmcache mmcache;
+
+// futexwait() and futexwake() check and sleep, and wake, with
+// this held.
+static struct spinlock futexlock;
+
 static struct proc *initproc;
 
 int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
-static void wakeup1(void *chan);
-
 void
 pinit(void)
 {
+	int i;
+
 	initlock(&ptable.lock, "ptable");
+	for(i = 0; i < NCPU; i++)
+		initlock(&runq[i].lock, "runq");
+	for(i = 0; i < NSLPQ; i++)
+		initlock(&slpq[i].lock, "slpq");
+	initlock(&futexlock, "futex");
+	kmcacheinit(&mmcache, "mm", sizeof(struct mm));
+}
+
+// Make an address space with page table pgdir, or free pgdir
+// and return 0 if out of memory.
+struct mm*
+mmalloc(pde_t *pgdir)
+{
+	struct mm *mm;
+
+	if(pgdir == 0)
+		return 0;
+	if((mm = kmcachealloc(&mmcache)) == 0){
+		freevm(pgdir);
+		return 0;
+	}
+	mm->ref = 1;
+	initsleeplock(&mm->lock, "mm");
+	mm->pgdir = pgdir;
+	mm->exe = 0;
+	return mm;
+}
+
+// Free an address space no process uses any more.
+static void
+mmfree(struct mm *mm)
+{
+	mmapclose(mm);
+	freevm(mm->pgdir);
+	kmfree(mm);
+}
+
+static struct slpq*
+slpqof(void *chan)
+{
+	return &slpq[((uint)chan * 2654435761u) >> 26];
 }
 
 // Must be called with interrupts disabled
@@ -53,6 +151,139 @@ mycpu(void)
 	panic("unknown apicid\n");
 }
 
+// This CPU's run queue. Must be called with interrupts disabled.
+static struct runq*
+myrunq(void)
+{
+	return &runq[cpuid()];
+}
+
+// The highest level p may have.
+static int
+toplevel(struct proc *p)
+{
+	return p->nice * NQLEVEL / (NICEMAX + 1);
+}
+
+// Put p back at its top level if it has not been since the
+// last boost.
+static void
+boost(struct proc *p)
+{
+	if(p->epoch != ticks/BOOSTTICKS){
+		p->epoch = ticks/BOOSTTICKS;
+		p->level = toplevel(p);
+		p->ticks = 0;
+	}
+}
+
+// Add p to the tail of its level in q. Caller holds q->lock.
+static void
+rqput(struct runq *q, struct proc *p)
+{
+	boost(p);
+	p->rqnext = 0;
+	if(q->tail[p->level])
+		q->tail[p->level]->rqnext = p;
+	else
+		q->head[p->level] = p;
+	q->tail[p->level] = p;
+	q->n++;
+}
+
+// Take the process at the head of the highest non-empty level
+// of q, or return 0. Boosts the queued processes first if a
+// boost is due. Caller holds q->lock.
+static struct proc*
+rqget(struct runq *q)
+{
+	struct proc *p, *list, **last;
+	int l;
+
+	if(q->epoch != ticks/BOOSTTICKS){
+		q->epoch = ticks/BOOSTTICKS;
+		// Chain the levels together, in order, and queue again.
+		last = &list;
+		for(l = 0; l < NQLEVEL; l++){
+			if((*last = q->head[l]) != 0)
+				last = &q->tail[l]->rqnext;
+			q->head[l] = q->tail[l] = 0;
+		}
+		*last = 0;
+		q->n = 0;
+		while((p = list) != 0){
+			list = p->rqnext;
+			rqput(q, p);
+		}
+	}
+	for(l = 0; l < NQLEVEL; l++){
+		if((p = q->head[l]) == 0)
+			continue;
+		if((q->head[l] = p->rqnext) == 0)
+			q->tail[l] = 0;
+		q->n--;
+		return p;
+	}
+	return 0;
+}
+
+// Take a process from another CPU's queue than self.
+// Holds one queue lock at a time.
+static struct proc*
+rqsteal(struct runq *self)
+{
+	struct runq *q;
+	struct proc *p;
+
+	for(q = runq; q < &runq[ncpu]; q++){
+		if(q == self || q->n == 0)
+			continue;
+		acquire(&q->lock);
+		p = rqget(q);
+		release(&q->lock);
+		if(p)
+			return p;
+	}
+	return 0;
+}
+
+// Is there a process on any run queue?
+static int
+anyqueued(void)
+{
+	struct runq *q;
+
+	for(q = runq; q < &runq[ncpu]; q++)
+		if(q->n > 0)
+			return 1;
+	return 0;
+}
+
+// Make p, which is not running, RUNNABLE on its CPU's queue.
+// An idle CPU halts in scheduler(), so wake that CPU if it is
+// idle, or else any idle CPU, which can then steal p.
+static void
+runnable(struct proc *p)
+{
+	struct runq *q;
+	struct cpu *c;
+
+	q = &runq[p->cpu];
+	acquire(&q->lock);
+	p->state = RUNNABLE;
+	rqput(q, p);
+	__sync_synchronize();  // see scheduler()
+	c = &cpus[p->cpu];
+	if(!c->idle)
+		for(c = cpus; c < &cpus[ncpu] && !c->idle; c++)
+			;
+	if(c < &cpus[ncpu] && c != mycpu()){
+		c->idle = 0;
+		lapicipi(c->apicid, T_IRQ0 + IRQ_WAKEUP);
+	}
+	release(&q->lock);
+}
+
 // Disable interrupts so that we are not rescheduled
 // while reading proc from the cpu structure
 struct proc*
@@ -89,6 +320,18 @@ allocproc(void)
 found:
 	p->state = EMBRYO;
 	p->pid = nextpid++;
+	p->cpu = cpuid();  // interrupts are off
+	p->nice = 0;
+	p->level = 0;
+	p->ticks = 0;
+	p->epoch = ticks/BOOSTTICKS;
+	p->ring = 0;
+	p->vfork = 0;
+	p->ustack = 0;
+	p->utime = p->stime = 0;
+	p->nswitch = p->nfault = 0;
+	p->nread = p->nwrite = 0;
+	memset(p->nsyscall, 0, sizeof(p->nsyscall));
 
 	release(&ptable.lock);
 
@@ -126,10 +369,10 @@ userinit(void)
 	p = allocproc();
 
 	initproc = p;
-	if((p->pgdir = setupkvm()) == 0)
+	if((p->mm = mmalloc(setupkvm())) == 0)
 		panic("userinit: out of memory?");
-	inituvm(p->pgdir, _binary_user_initcode_start, (int)_binary_user_initcode_size);
-	p->sz = PGSIZE;
+	inituvm(p->mm->pgdir, _binary_user_initcode_start, (int)_binary_user_initcode_size);
+	p->mm->sz = PGSIZE;
 	memset(p->tf, 0, sizeof(*p->tf));
 	p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
 	p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
@@ -143,35 +386,81 @@ userinit(void)
 	p->cwd = namei("/");
 
 	// this assignment to p->state lets other cores
-	// run this process. the acquire forces the above
-	// writes to be visible, and the lock is also needed
-	// because the assignment might not be atomic.
-	acquire(&ptable.lock);
+	// run this process. the queue lock forces the above
+	// writes to be visible.
+	runnable(p);
+}
 
-	p->state = RUNNABLE;
+// Called by the first scheduling of a kernel thread.
+// Returns into the thread's function (see kthread).
+static void
+kthreadret(void)
+{
+	// Still holding the run queue lock from scheduler.
+	release(&myrunq()->lock);
+}
 
-	release(&ptable.lock);
+// Start a kernel thread that runs fn in process context,
+// so it can sleep. fn must never return. The thread has a
+// kernel-only page table and no user memory.
+struct proc*
+kthread(char *name, void (*fn)(void))
+{
+	struct proc *p;
+
+	if((p = allocproc()) == 0)
+		panic("kthread: no proc");
+	if((p->mm = mmalloc(setupkvm())) == 0)
+		panic("kthread: out of memory");
+	p->parent = 0;
+	// allocproc left trapret as the return address of forkret;
+	// have the first swtch return through kthreadret into fn.
+	*(uint*)(p->context + 1) = (uint)fn;
+	p->context->eip = (uint)kthreadret;
+	safestrcpy(p->name, name, sizeof(p->name));
+
+	runnable(p);
+	return p;
 }
 
 // Grow current process's memory by n bytes.
-// Return 0 on success, -1 on failure.
+// Return the old size, or -1 on failure.
 int
 growproc(int n)
 {
 	uint sz;
-	struct proc *curproc = myproc();
+	struct seg *s;
+	struct mm *mm = myproc()->mm;
 
-	sz = curproc->sz;
+	acquiresleep(&mm->lock);
+	sz = mm->sz;
 	if(n > 0){
-		if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
-			return -1;
+		// The new pages are allocated when first touched.
+		if(sz + n < sz || sz + n > mmapbase(mm))
+			goto bad;
+		mm->sz = sz + n;
 	} else if(n < 0){
-		if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
-			return -1;
+		if(-n > sz)
+			goto bad;
+		mm->sz = sz + n;
+		uvmunmap(mm->pgdir, mm->sz, sz);
+		// Memory grown back must come back zeroed, not
+		// read from the program file again.
+		for(s = mm->seg; s < mm->seg+NSEG; s++){
+			if(s->va >= mm->sz)
+				s->filesz = 0;
+			else if(s->va + s->filesz > mm->sz)
+				s->filesz = mm->sz - s->va;
+			if(PGROUNDUP(s->va + s->filesz) > mm->sz)
+				s->nobss = 0;
+		}
 	}
-	curproc->sz = sz;
-	switchuvm(curproc);
-	return 0;
+	releasesleep(&mm->lock);
+	return sz;
+
+bad:
+	releasesleep(&mm->lock);
+	return -1;
 }
 
 // Create a new process copying p as the parent.
@@ -183,6 +472,7 @@ fork(void)
 	int i, pid;
 	struct proc *np;
 	struct proc *curproc = myproc();
+	struct mm *mm = curproc->mm;
 
 	// Allocate process.
 	if((np = allocproc()) == 0){
@@ -190,13 +480,25 @@ fork(void)
 	}
 
 	// Copy process state from proc.
-	if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+	acquiresleep(&mm->lock);
+	if((np->mm = mmalloc(copyuvm(mm->pgdir, mm->sz))) == 0){
+		releasesleep(&mm->lock);
+		kfree(np->kstack);
+		np->kstack = 0;
+		np->state = UNUSED;
+		return -1;
+	}
+	np->mm->sz = mm->sz;
+	if(mmapfork(np->mm, mm) < 0){
+		releasesleep(&mm->lock);
+		mmfree(np->mm);
+		np->mm = 0;
 		kfree(np->kstack);
 		np->kstack = 0;
 		np->state = UNUSED;
 		return -1;
 	}
-	np->sz = curproc->sz;
+	releasesleep(&mm->lock);
 	np->parent = curproc;
 	*np->tf = *curproc->tf;
 
@@ -209,18 +511,132 @@ fork(void)
 	np->cwd = idup(curproc->cwd);
 
 	safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+	np->nice = curproc->nice;
+	np->level = toplevel(np);
+	np->ring = curproc->ring;  // the child's copy of it
 
 	pid = np->pid;
 
-	acquire(&ptable.lock);
+	runnable(np);
 
-	np->state = RUNNABLE;
+	return pid;
+}
 
+// Create a thread: a process that shares the caller's address
+// space and starts in fn(arg) on the user stack that ends at
+// stack+size. It gets duplicates of the caller's open files
+// and current directory, as a forked child does; the tables
+// themselves are not shared. Returns its pid, or -1.
+int
+clone(uint fn, uint arg, uint stack, uint size)
+{
+	int i, pid;
+	uint sp;
+	struct proc *np;
+	struct proc *curproc = myproc();
+	struct mm *mm = curproc->mm;
+
+	// Push arg and a fake return PC, as exec() does for main.
+	// Store through the page table, so that a copy-on-write
+	// page is copied.
+	sp = stack + size;
+	if(sp < stack || sp < 8 || sp % 4 || uvmaccess(mm, sp - 8, 8) < 0)
+		return -1;
+	sp -= 8;
+	((uint*)sp)[0] = 0xffffffff;
+	((uint*)sp)[1] = arg;
+
+	if((np = allocproc()) == 0)
+		return -1;
+	acquire(&ptable.lock);
+	mm->ref++;
 	release(&ptable.lock);
+	np->mm = mm;
+	np->ustack = stack;
+	np->parent = curproc;
+	*np->tf = *curproc->tf;
+	np->tf->eip = fn;
+	np->tf->esp = sp;
+
+	for(i = 0; i < NOFILE; i++)
+		if(curproc->ofile[i])
+			np->ofile[i] = filedup(curproc->ofile[i]);
+	np->cwd = idup(curproc->cwd);
+
+	safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+	np->nice = curproc->nice;
+	np->level = toplevel(np);
+
+	pid = np->pid;
+
+	runnable(np);
 
 	return pid;
 }
 
+// Create a child process that runs in the caller's address
+// space, as clone() does, but on the caller's stack: like a
+// forked child it returns 0 from the system call. The caller
+// sleeps until the child execs, which gives it memory of its
+// own, or exits; until then the child must do nothing else, for
+// whatever it changes it changes for the caller too. This saves
+// copying the page table of a program that is about to be
+// replaced. Returns the child's pid, or -1.
+int
+vfork(void)
+{
+	int i;
+	struct proc *np;
+	struct proc *curproc = myproc();
+	struct mm *mm = curproc->mm;
+
+	if(mm->ref > 1)
+		return -1;  // other threads would run on
+	if((np = allocproc()) == 0)
+		return -1;
+	acquire(&ptable.lock);
+	mm->ref++;
+	release(&ptable.lock);
+	np->mm = mm;
+	np->vfork = 1;
+	np->parent = curproc;
+	*np->tf = *curproc->tf;
+	np->tf->eax = 0;
+
+	for(i = 0; i < NOFILE; i++)
+		if(curproc->ofile[i])
+			np->ofile[i] = filedup(curproc->ofile[i]);
+	np->cwd = idup(curproc->cwd);
+
+	safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+	np->nice = curproc->nice;
+	np->level = toplevel(np);
+
+	runnable(np);
+	acquire(&ptable.lock);
+	while(np->vfork == 1)
+		sleep(np, &ptable.lock);
+	release(&ptable.lock);
+	return np->pid;
+}
+
+// A vfork() child is done with its parent's memory: it exits,
+// or execs into mm, which it takes instead. Let the parent go.
+void
+vforkdone(struct mm *mm)
+{
+	struct proc *curproc = myproc();
+
+	acquire(&ptable.lock);
+	if(mm){
+		curproc->mm->ref--;
+		curproc->mm = mm;
+	}
+	curproc->vfork = 2;
+	wakeup(curproc);
+	release(&ptable.lock);
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -241,38 +657,50 @@ exit(void)
 			curproc->ofile[fd] = 0;
 		}
 	}
+	// The other threads may still use the mappings.
+	if(curproc->mm->ref == 1)
+		mmapclose(curproc->mm);
 
 	begin_op();
 	iput(curproc->cwd);
 	end_op();
 	curproc->cwd = 0;
 
+	if(curproc->vfork == 1)
+		vforkdone(0);
+
 	acquire(&ptable.lock);
 
 	// Parent might be sleeping in wait().
-	wakeup1(curproc->parent);
+	wakeup(curproc->parent);
 
 	// Pass abandoned children to init.
 	for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
 		if(p->parent == curproc){
 			p->parent = initproc;
 			if(p->state == ZOMBIE)
-				wakeup1(initproc);
+				wakeup(initproc);
 		}
 	}
 
-	// Jump into the scheduler, never to return.
+	// Jump into the scheduler, never to return. Keep holding
+	// ptable.lock until then, so that wait() cannot free the
+	// stack we are on; scheduler() releases it.
 	curproc->state = ZOMBIE;
+	acquire(&myrunq()->lock);
 	sched();
 	panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
-int
-wait(void)
+// Wait for a child to exit and return its pid: a thread, one
+// sharing this process's address space, if thread, and
+// otherwise a process. Sets *ustack to a thread's clone()
+// stack. Return -1 if this process has no such children.
+static int
+waitchild(int thread, uint *ustack)
 {
 	struct proc *p;
+	struct mm *mm;
 	int havekids, pid;
 	struct proc *curproc = myproc();
 
@@ -281,21 +709,28 @@ wait(void)
 		// Scan through table looking for exited children.
 		havekids = 0;
 		for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-			if(p->parent != curproc)
+			if(p->parent != curproc || (p->mm == curproc->mm && !p->vfork) != thread)
 				continue;
 			havekids = 1;
 			if(p->state == ZOMBIE){
 				// Found one.
 				pid = p->pid;
+				if(ustack)
+					*ustack = p->ustack;
 				kfree(p->kstack);
 				p->kstack = 0;
-				freevm(p->pgdir);
+				mm = p->mm;
+				p->mm = 0;
 				p->pid = 0;
 				p->parent = 0;
 				p->name[0] = 0;
 				p->killed = 0;
 				p->state = UNUSED;
+				if(--mm->ref > 0)
+					mm = 0;
 				release(&ptable.lock);
+				if(mm)
+					mmfree(mm);
 				return pid;
 			}
 		}
@@ -311,6 +746,23 @@ wait(void)
 	}
 }
 
+// Wait for a child process to exit and return its pid.
+// Return -1 if this process has no children.
+int
+wait(void)
+{
+	return waitchild(0, 0);
+}
+
+// Wait for a thread made by this process with clone() to exit
+// and return its pid, and in *ustack the stack it was given.
+// Return -1 if this process has no threads.
+int
+join(uint *ustack)
+{
+	return waitchild(1, ustack);
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -323,39 +775,72 @@ scheduler(void)
 {
 	struct proc *p;
 	struct cpu *c = mycpu();
+	struct runq *q;
 	c->proc = 0;
+	q = myrunq();
 
 	for(;;){
 		// Enable interrupts on this processor.
 		sti();
 
-		// Loop over process table looking for process to run.
-		acquire(&ptable.lock);
-		for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-			if(p->state != RUNNABLE)
+		// Take a process from this CPU's queue, or another's.
+		acquire(&q->lock);
+		if((p = rqget(q)) == 0){
+			release(&q->lock);
+			if((p = rqsteal(q)) == 0){
+				// Nothing to run: halt until an interrupt. Set
+				// idle before looking at the queues one last time,
+				// so runnable() either sees idle and sends an IPI
+				// or queued its process before we looked.
+				klogkick();
+				cli();
+				c->idle = 1;
+				__sync_synchronize();
+				if(!anyqueued()){
+					statadd(ST_IDLE, 1);
+					stihlt();
+				}
+				c->idle = 0;
+				clockupdate();  // no ticks while halted
 				continue;
-
+			}
+			acquire(&q->lock);
+		}
+		for(; p; p = rqget(q)){
 			// Switch to chosen process.  It is the process's job
-			// to release ptable.lock and then reacquire it
+			// to release q->lock and then reacquire it
 			// before jumping back to us.
 			c->proc = p;
+			p->cpu = c - cpus;
 			switchuvm(p);
+			timerresume();
 			p->state = RUNNING;
+			statadd(ST_SWITCH, 1);
+			TRACE(TC_SCHED, TE_SWITCH, 0);
 
 			swtch(&(c->scheduler), p->context);
-			switchkvm();
 
 			// Process is done running for now.
 			// It should have changed its p->state before coming back.
 			c->proc = 0;
+			if(p->state == ZOMBIE){
+				// exit() held on to ptable.lock; wait() may free
+				// p's page table as soon as it is released.
+				switchkvm();
+				release(&ptable.lock);
+			}
 		}
-		release(&ptable.lock);
-
+		// The last process's page table stays loaded until the next
+		// switchuvm(), saving a cr3 load per switch, but not past
+		// q->lock: until then that process cannot be woken or run
+		// elsewhere, so cannot free it.
+		switchkvm();
+		release(&q->lock);
 	}
 }
 
-// Enter scheduler.  Must hold only ptable.lock
-// and have changed proc->state. Saves and restores
+// Enter scheduler.  Must hold only this CPU's run queue lock
+// (and ptable.lock, when exiting) and have changed proc->state. Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
 // be proc->intena and proc->ncli, but that would
@@ -367,15 +852,17 @@ sched(void)
 	int intena;
 	struct proc *p = myproc();
 
-	if(!holding(&ptable.lock))
-		panic("sched ptable.lock");
-	if(mycpu()->ncli != 1)
+	if(!holding(&myrunq()->lock))
+		panic("sched runq lock");
+	if(mycpu()->ncli != (p->state == ZOMBIE ? 2 : 1))
 		panic("sched locks");
 	if(p->state == RUNNING)
 		panic("sched running");
 	if(readeflags()&FL_IF)
 		panic("sched interruptible");
 	intena = mycpu()->intena;
+	p->nswitch++;
+	TRACE(TC_SCHED, TE_SCHED, p->state);
 	swtch(&p->context, mycpu()->scheduler);
 	mycpu()->intena = intena;
 }
@@ -384,10 +871,73 @@ sched(void)
 void
 yield(void)
 {
-	acquire(&ptable.lock);  //DOC: yieldlock
-	myproc()->state = RUNNABLE;
+	struct proc *p = myproc();
+	struct runq *q;
+
+	pushcli();
+	q = myrunq();
+	acquire(&q->lock);  //DOC: yieldlock
+	popcli();
+	p->state = RUNNABLE;
+	rqput(q, p);
 	sched();
+	release(&myrunq()->lock);
+}
+
+// Charge the running process for a timer tick on this CPU.
+// It gives up the CPU when it has used up its time slice,
+// dropping a level, or a process of a higher level is waiting.
+void
+schedtick(void)
+{
+	struct proc *p = myproc();
+	struct runq *q;
+	int l, preempt;
+
+	if(++p->ticks >= qslice[p->level]){
+		p->ticks = 0;
+		if(p->level < NQLEVEL-1)
+			p->level++;
+		yield();
+		return;
+	}
+	preempt = 0;
+	pushcli();
+	q = myrunq();
+	for(l = 0; l < p->level; l++)
+		if(q->head[l])
+			preempt = 1;
+	popcli();
+	if(preempt)
+		yield();
+}
+
+// Set the nice value of process pid, 0 (the default) to
+// NICEMAX; a higher value gets the CPU less eagerly but in
+// longer slices. Returns -1 if there is no such process.
+int
+setpriority(int pid, int nice)
+{
+	struct proc *p;
+
+	if(nice < 0)
+		nice = 0;
+	if(nice > NICEMAX)
+		nice = NICEMAX;
+	acquire(&ptable.lock);
+	for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+		if(p->pid == pid && p->state != UNUSED){
+			p->nice = nice;
+			// A higher nice takes effect at once, a lower one
+			// at the next boost.
+			if(p->level < toplevel(p))
+				p->level = toplevel(p);
+			release(&ptable.lock);
+			return 0;
+		}
+	}
 	release(&ptable.lock);
+	return -1;
 }
 
 // A fork child's very first scheduling by scheduler()
@@ -396,16 +946,19 @@ void
 forkret(void)
 {
 	static int first = 1;
-	// Still holding ptable.lock from scheduler.
-	release(&ptable.lock);
+	// Still holding the run queue lock from scheduler.
+	release(&myrunq()->lock);
 
 	if (first) {
 		// Some initialization functions must be run in the context
 		// of a regular process (e.g., they call sleep), and thus cannot
 		// be run from main().
 		first = 0;
-		iinit(ROOTDEV);
+		iinit();
+		if(fsattach(ROOTDEV) < 0)
+			panic("no root file system");
 		initlog(ROOTDEV);
+		fsattach(RAMDEV);  // if there is a RAM disk
 	}
 
 	// Return to "caller", actually trapret (see allocproc).
@@ -417,6 +970,7 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
 	struct proc *p = myproc();
+	struct slpq *sq;
 
 	if(p == 0)
 		panic("sleep");
@@ -424,51 +978,69 @@ sleep(void *chan, struct spinlock *lk)
 	if(lk == 0)
 		panic("sleep without lk");
 
-	// Must acquire ptable.lock in order to
-	// change p->state and then call sched.
-	// Once we hold ptable.lock, we can be
+	// Must acquire chan's bucket lock in order to
+	// change p->state. Once we hold it, we can be
 	// guaranteed that we won't miss any wakeup
-	// (wakeup runs with ptable.lock locked),
+	// (wakeup runs with the bucket locked),
 	// so it's okay to release lk.
-	if(lk != &ptable.lock){  //DOC: sleeplock0
-		acquire(&ptable.lock);  //DOC: sleeplock1
-		release(lk);
-	}
+	sq = slpqof(chan);
+	acquire(&sq->lock);  //DOC: sleeplock1
+	release(lk);
+
 	// Go to sleep.
+	TRACE(TC_SLEEP, TE_SLEEP, chan);
 	p->chan = chan;
 	p->state = SLEEPING;
-
+	p->slpnext = sq->head;
+	sq->head = p;
+
+	// Trade the bucket lock for the run queue lock that sched()
+	// wants. A wakeup must take that too to queue p, so p
+	// cannot be run again before it has switched away.
+	acquire(&myrunq()->lock);
+	release(&sq->lock);
 	sched();
+	release(&myrunq()->lock);
 
 	// Tidy up.
 	p->chan = 0;
 
 	// Reacquire original lock.
-	if(lk != &ptable.lock){  //DOC: sleeplock2
-		release(&ptable.lock);
-		acquire(lk);
-	}
+	acquire(lk);  //DOC: sleeplock2
 }
 
-// Wake up all processes sleeping on chan.
-// The ptable lock must be held.
+// Take p, which sleeps in sq, off it and make it RUNNABLE.
+// Caller holds sq->lock.
 static void
-wakeup1(void *chan)
+unsleep(struct slpq *sq, struct proc *p)
 {
-	struct proc *p;
+	struct proc **pp;
 
-	for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-		if(p->state == SLEEPING && p->chan == chan)
-			p->state = RUNNABLE;
+	for(pp = &sq->head; *pp; pp = &(*pp)->slpnext){
+		if(*pp == p){
+			*pp = p->slpnext;
+			break;
+		}
+	}
+	TRACE(TC_SLEEP, TE_WAKEUP, p->pid);
+	runnable(p);
 }
 
 // Wake up all processes sleeping on chan.
 void
 wakeup(void *chan)
 {
-	acquire(&ptable.lock);
-	wakeup1(chan);
-	release(&ptable.lock);
+	struct slpq *sq;
+	struct proc *p, *next;
+
+	sq = slpqof(chan);
+	acquire(&sq->lock);
+	for(p = sq->head; p; p = next){
+		next = p->slpnext;
+		if(p->chan == chan)
+			unsleep(sq, p);
+	}
+	release(&sq->lock);
 }
 
 // Kill the process with the given pid.
@@ -478,14 +1050,20 @@ int
 kill(int pid)
 {
 	struct proc *p;
+	struct slpq *sq;
 
 	acquire(&ptable.lock);
 	for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
 		if(p->pid == pid){
 			p->killed = 1;
 			// Wake process from sleep if necessary.
-			if(p->state == SLEEPING)
-				p->state = RUNNABLE;
+			if(p->state == SLEEPING){
+				sq = slpqof(p->chan);
+				acquire(&sq->lock);
+				if(p->state == SLEEPING && slpqof(p->chan) == sq)
+					unsleep(sq, p);
+				release(&sq->lock);
+			}
 			release(&ptable.lock);
 			return 0;
 		}
@@ -494,6 +1072,62 @@ kill(int pid)
 	return -1;
 }
 
+// Sleep until futexwake(addr), unless the int at user address
+// addr, which the caller has checked, is no longer val. A
+// futex is known by its address alone, so a wakeup meant for
+// another process only has its waiters look again, as they
+// must after any wakeup anyway.
+int
+futexwait(uint addr, int val)
+{
+	acquire(&futexlock);
+	if(*(int*)addr == val)
+		sleep((void*)addr, &futexlock);
+	release(&futexlock);
+	return myproc()->killed ? -1 : 0;
+}
+
+// Wake the processes in futexwait(addr).
+void
+futexwake(uint addr)
+{
+	acquire(&futexlock);
+	wakeup((void*)addr);
+	release(&futexlock);
+}
+
+// Copy the counters of process pid, of the caller if pid is 0,
+// or of up to n processes if pid is -1, into ru, which argptr()
+// has checked. Returns the number of processes copied.
+int
+getrusage(int pid, struct rusage *ru, int n)
+{
+	struct proc *p;
+	int m;
+
+	if(pid == 0)
+		pid = myproc()->pid;
+	m = 0;
+	acquire(&ptable.lock);
+	for(p = ptable.proc; p < &ptable.proc[NPROC] && m < n; p++){
+		if(p->state == UNUSED || (pid != -1 && p->pid != pid))
+			continue;
+		ru[m].pid = p->pid;
+		ru[m].state = p->state;
+		memmove(ru[m].name, p->name, sizeof(ru[m].name));
+		ru[m].utime = p->utime;
+		ru[m].stime = p->stime;
+		ru[m].nswitch = p->nswitch;
+		ru[m].nfault = p->nfault;
+		ru[m].nread = p->nread;
+		ru[m].nwrite = p->nwrite;
+		memmove(ru[m].nsyscall, p->nsyscall, sizeof(ru[m].nsyscall));
+		m++;
+	}
+	release(&ptable.lock);
+	return m;
+}
+
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
@@ -511,7 +1145,7 @@ procdump(void)
 	int i;
 	struct proc *p;
 	char *state;
-	uint pc[10];
+	uint pc[10], nsys;
 
 	for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
 		if(p->state == UNUSED)
@@ -520,7 +1154,12 @@ procdump(void)
 			state = states[p->state];
 		else
 			state = "???";
-		cprintf("%d %s %s", p->pid, state, p->name);
+		nsys = 0;
+		for(i = 0; i < NSYSCALL; i++)
+			nsys += p->nsyscall[i];
+		cprintf("%d %s %s  usr %d sys %d csw %d calls %d flt %d rd %d wr %d",
+			p->pid, state, p->name, p->utime, p->stime, p->nswitch,
+			nsys, p->nfault, p->nread, p->nwrite);
 		if(p->state == SLEEPING){
 			getcallerpcs((uint*)p->context->ebp+2, pc);
 			for(i=0; i<10 && pc[i] != 0; i++)
@@ -8,6 +8,18 @@ struct cpu {
 	int ncli;                    // Depth of pushcli nesting.
 	int intena;                  // Were interrupts enabled before pushcli?
 	struct proc *proc;           // The process running on this cpu or null
+	char logbuf[KLOGSIZE];       // cprintf records waiting for klogd
+	volatile uint logr;          // Next byte klogd will copy out
+	volatile uint logw;          // End of the last complete record
+	uint loglost;                // Records dropped because logbuf was full
+	int npgmap;                  // pgmap() windows in use
+	volatile int idle;           // Halted in scheduler(), wants an IPI for work
+	uint64 nexttick;             // When the running process's tick is up
+	uint64 deadline;             // When the local timer goes off; 0 if stopped
+	pde_t *pgdir;                // Page table in %cr3
+	volatile uint tlbreq;        // TLB flushes asked of this CPU
+	volatile uint tlbdone;       // TLB flushes done
+	uint busyticks;              // Scheduling ticks spent running processes
 };
 
 extern struct cpu cpus[NCPU];
@@ -35,8 +47,7 @@ enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
 struct proc {
-	uint sz;                     // Size of process memory (bytes)
-	pde_t* pgdir;                // Page table
+	struct mm *mm;               // Address space
 	char *kstack;                // Bottom of kernel stack for this process
 	enum procstate state;        // Process state
 	int pid;                     // Process ID
@@ -44,10 +55,29 @@ struct proc {
 	struct trapframe *tf;        // Trap frame for current syscall
 	struct context *context;     // swtch() here to run process
 	void *chan;                  // If non-zero, sleeping on chan
+	struct proc *slpnext;        // Next sleeper in chan's bucket
 	int killed;                  // If non-zero, have been killed
 	struct file *ofile[NOFILE];  // Open files
 	struct inode *cwd;           // Current directory
 	char name[16];               // Process name (debugging)
+	int logres;                  // Log blocks reserved by current FS op
+	uint ustack;                 // Stack given to clone(), for join()
+	int vfork;                   // Made by vfork(): 1 while using the
+	                             //   parent's memory, then 2
+	uint ring;                   // User address of ringsetup()'s ring, or 0
+	int cpu;                     // CPU last run on, whose run queue p goes on
+	struct proc *rqnext;         // Next on the run queue
+	int nice;                    // 0..NICEMAX; sets the highest level
+	int level;                   // Scheduling level, 0 is run first
+	int ticks;                   // Ticks used of this level's slice
+	uint epoch;                  // ticks/BOOSTTICKS at the last boost
+	uint utime;                  // Ticks running in user space
+	uint stime;                  // Ticks running in the kernel
+	uint nswitch;                // Times given up the CPU
+	uint nfault;                 // Page faults
+	uint nread;                  // Disk blocks read
+	uint nwrite;                 // Disk blocks written
+	uint nsyscall[NSYSCALL];     // System calls made, by number
 };
 
 // Process memory is laid out contiguously, low addresses first:
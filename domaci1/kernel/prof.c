@@ -0,0 +1,98 @@
+// Sampling profiler.
+//
+// While profiling is on, every CPU's timer goes off at least
+// every PROFNS (see timerarm() in timer.c), and trap() records
+// where each timer interrupt found the CPU in that CPU's ring of
+// samples. profread() drains the rings; a ring that fills up
+// before then drops samples and counts them. A CPU that is idle
+// when profiling starts begins at its next timer interrupt.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "prof.h"
+
+int profiling;
+
+static struct {
+	struct spinlock lock;
+	struct profsample s[NPROFSAMPLE];
+	uint r;     // next sample to read
+	uint w;     // next sample to write; r and w only increase
+	uint lost;  // samples dropped because the ring was full
+} prof[NCPU];
+
+void
+profinit(void)
+{
+	int i;
+
+	for(i = 0; i < NCPU; i++)
+		initlock(&prof[i].lock, "prof");
+}
+
+// Record where tf found this CPU. Interrupts are off.
+void
+profsample(struct trapframe *tf)
+{
+	struct profsample *s;
+	struct proc *p;
+	int c;
+
+	c = cpuid();
+	p = myproc();
+	acquire(&prof[c].lock);
+	if(prof[c].w - prof[c].r == NPROFSAMPLE)
+		prof[c].lost++;
+	else {
+		s = &prof[c].s[prof[c].w++ % NPROFSAMPLE];
+		s->eip = tf->eip;
+		s->pid = p ? p->pid : 0;
+		s->cpu = c;
+		s->user = (tf->cs&3) == DPL_USER;
+	}
+	release(&prof[c].lock);
+}
+
+// Turn profiling on, emptying the rings, or off. Turning it off
+// returns the number of samples dropped since it was turned on.
+int
+profctl(int on)
+{
+	int i, lost;
+
+	lost = 0;
+	if(!on)
+		profiling = 0;
+	for(i = 0; i < NCPU; i++){
+		acquire(&prof[i].lock);
+		if(on)
+			prof[i].r = prof[i].w = prof[i].lost = 0;
+		lost += prof[i].lost;
+		release(&prof[i].lock);
+	}
+	if(on)
+		profiling = 1;
+	return lost;
+}
+
+// Move up to n samples into dst, which argptr() has checked.
+// Returns the number moved.
+int
+profread(struct profsample *dst, int n)
+{
+	int i, m;
+
+	m = 0;
+	for(i = 0; i < NCPU && m < n; i++){
+		acquire(&prof[i].lock);
+		while(prof[i].r != prof[i].w && m < n)
+			dst[m++] = prof[i].s[prof[i].r++ % NPROFSAMPLE];
+		release(&prof[i].lock);
+	}
+	return m;
+}
@@ -0,0 +1,7 @@
+// A sample taken by the profiler; see prof.c.
+struct profsample {
+	uint eip;
+	ushort pid;   // 0 if no process was running
+	uchar cpu;
+	uchar user;   // 1 if taken in user space
+};
@@ -0,0 +1,128 @@
+// RAM disk: block device RAMDEV, kept in pages from kalloc().
+//
+// ramdiskinit() sizes it from free memory at boot and puts an
+// empty file system on it. The buffer cache uses the blocks in
+// place (see struct bdevsw), so reading or writing a block never
+// copies it, and the file system does not log its changes. The
+// contents last until the machine is turned off.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "stat.h"
+
+#define BPERPG (PGSIZE/BSIZE)
+
+static char **page;  // page[i] holds blocks i*BPERPG on
+static uint nblock;
+
+static uchar*
+rdmap(uint blockno)
+{
+	if(blockno >= nblock)
+		panic("ramdisk: block out of range");
+	return (uchar*)page[blockno/BPERPG] + blockno%BPERPG*BSIZE;
+}
+
+// The blocks are the buffers: a write has already happened
+// and a read has nothing to do. See memsubmit() in memide.c.
+static void
+rdsubmit(struct buf *b)
+{
+	if(!holdingsleep(&b->lock))
+		panic("ramdisk: buf not locked");
+	b->flags &= ~B_DIRTY;
+	b->flags |= B_VALID;
+	if(b->flags & B_ASYNC){
+		b->flags &= ~B_ASYNC;
+		bdone(b);
+	}
+}
+
+static void
+rdwait(struct buf *b)
+{
+}
+
+// Lay out an empty file system, as mkfs would with no log:
+// boot block, super block, inode blocks, bitmap, then data
+// blocks, the first of which holds the root directory.
+static void
+rdformat(void)
+{
+	struct superblock *sb;
+	struct dinode *dip;
+	struct dirent *de;
+	uint nmeta, root, b;
+	uchar *bits;
+
+	sb = (struct superblock*)rdmap(1);
+	sb->size = nblock;
+	sb->ninodes = (nblock/8 + IPB - 1) / IPB * IPB;
+	sb->nlog = 0;
+	sb->logstart = 2;
+	sb->inodestart = 2;
+	sb->bmapstart = sb->inodestart + sb->ninodes/IPB;
+	nmeta = sb->bmapstart + nblock/BPB + 1;
+	sb->nblocks = nblock - nmeta;
+
+	// The root directory's data block and everything before it.
+	root = nmeta;
+	for(b = 0; b <= root; b++){
+		bits = rdmap(BBLOCK(b, (*sb)));
+		bits[b%BPB/8] |= 1 << (b%8);
+	}
+
+	dip = (struct dinode*)rdmap(IBLOCK(ROOTINO, (*sb))) + ROOTINO%IPB;
+	dip->type = T_DIR;
+	dip->nlink = 1;
+	dip->size = 2*sizeof(struct dirent);
+	dip->ext[0].start = root;
+	dip->ext[0].len = 1;
+
+	de = (struct dirent*)rdmap(root);
+	de[0].inum = ROOTINO;
+	safestrcpy(de[0].name, ".", DIRSIZ);
+	de[1].inum = ROOTINO;
+	safestrcpy(de[1].name, "..", DIRSIZ);
+}
+
+// Give the RAM disk 1/RAMDISKFRAC of free memory, up to RAMDISKMAX
+// blocks. Without enough memory there is no RAM disk, and
+// fsattach(RAMDEV) fails. Called after binit().
+void
+ramdiskinit(void)
+{
+	uint i, n;
+
+	n = kfreecount() / RAMDISKFRAC;
+	if(n > RAMDISKMAX/BPERPG)
+		n = RAMDISKMAX/BPERPG;
+	if(n < 8 || n > PGSIZE/sizeof(char*))
+		return;
+	if((page = (char**)kalloc()) == 0)
+		return;
+	for(i = 0; i < n; i++){
+		if((page[i] = kalloc()) == 0)
+			break;
+		memset(page[i], 0, PGSIZE);
+	}
+	if(i < n){
+		while(i > 0)
+			kfree(page[--i]);
+		kfree((char*)page);
+		page = 0;
+		return;
+	}
+	nblock = n*BPERPG;
+	rdformat();
+
+	bdevsw[RAMDEV].submit = rdsubmit;
+	bdevsw[RAMDEV].wait = rdwait;
+	bdevsw[RAMDEV].map = rdmap;
+}
@@ -0,0 +1,29 @@
+// A system call ring, shared between a process and the kernel;
+// see ringenter() in syscall.c. The process fills sq[] entries
+// and advances sqtail; ringenter() runs them in order, posting
+// each result to cq[] and advancing sqhead and cqtail. The
+// process reaps results and advances cqhead. Indexes run
+// freely and are taken mod RINGSIZE.
+
+#define RINGSIZE 32  // entries in each queue, a power of two
+
+struct sqe {
+	int op;          // SYS_open, SYS_read, SYS_write, SYS_close,
+	                 // SYS_fstat, SYS_unlink, SYS_pread or SYS_pwrite
+	int arg[4];      // as passed to the system call
+	uint data;       // copied to the cqe
+};
+
+struct cqe {
+	int res;         // what the system call returned
+	uint data;
+};
+
+struct ring {
+	uint sqhead;     // advanced by the kernel
+	uint sqtail;     // advanced by the process
+	uint cqhead;     // advanced by the process
+	uint cqtail;     // advanced by the kernel
+	struct sqe sq[RINGSIZE];
+	struct cqe cq[RINGSIZE];
+};
@@ -0,0 +1,15 @@
+// A process's accounting counters, as getrusage() reports them.
+// Ticks are charged by the timer at the end of each scheduling
+// tick the process runs for; see trap().
+struct rusage {
+	int pid;
+	int state;                // a procstate, see proc.h
+	char name[16];
+	uint utime;               // ticks running in user space
+	uint stime;               // ticks running in the kernel
+	uint nswitch;             // times it gave up the CPU
+	uint nfault;              // page faults
+	uint nread;               // disk blocks read
+	uint nwrite;              // disk blocks written
+	uint nsyscall[NSYSCALL];  // system calls made, by number
+};
@@ -0,0 +1,149 @@
+// Slab allocator.
+//
+// Hands out kernel objects smaller than a page from caches of
+// equally sized objects, so that e.g. a struct pipe does not
+// take a whole page. A slab is one page from kalloc(): a
+// struct slab followed by as many objects as fit. A cache
+// keeps its slabs that have free objects on a list; full slabs
+// are on no list, and a slab whose objects are all free again
+// goes back to kalloc() unless it is the cache's last one.
+// kmfree() finds an object's slab, and so its cache, by
+// rounding the address down to the page.
+//
+// kmalloc() takes any size up to KMALLOCMAX from caches of
+// power-of-two sizes.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "slab.h"
+
+struct slab {
+	struct kmcache *c;
+	struct slab *next;  // c->partial list
+	struct slab *prev;
+	int inuse;          // objects handed out
+	void *free;         // free objects, linked through their first word
+};
+
+#define KMALLOCMIN 16
+#define KMALLOCMAX 2048
+
+static struct kmcache kmsize[8];  // KMALLOCMIN << i
+
+void
+kmcacheinit(struct kmcache *c, char *name, uint size)
+{
+	size = (size + 3) & ~3;
+	if(size < sizeof(void*) || size > PGSIZE - sizeof(struct slab))
+		panic("kmcacheinit");
+	initlock(&c->lock, name);
+	c->name = name;
+	c->size = size;
+	c->partial = 0;
+	c->nslab = 0;
+}
+
+void
+kminit(void)
+{
+	int i;
+
+	for(i = 0; i < NELEM(kmsize); i++)
+		kmcacheinit(&kmsize[i], "kmalloc", KMALLOCMIN << i);
+}
+
+// Caller holds c->lock.
+static void
+slabunlink(struct kmcache *c, struct slab *s)
+{
+	if(s->prev)
+		s->prev->next = s->next;
+	else
+		c->partial = s->next;
+	if(s->next)
+		s->next->prev = s->prev;
+}
+
+// Caller holds c->lock.
+static void
+slabpush(struct kmcache *c, struct slab *s)
+{
+	s->prev = 0;
+	s->next = c->partial;
+	if(c->partial)
+		c->partial->prev = s;
+	c->partial = s;
+}
+
+// Allocate a zeroed object from c. Returns 0 if out of memory.
+void*
+kmcachealloc(struct kmcache *c)
+{
+	struct slab *s;
+	char *p, *obj;
+
+	acquire(&c->lock);
+	if((s = c->partial) == 0){
+		release(&c->lock);
+		if((s = (struct slab*)kalloc()) == 0)
+			return 0;
+		s->c = c;
+		s->inuse = 0;
+		s->free = 0;
+		for(p = (char*)(s + 1); p + c->size <= (char*)s + PGSIZE; p += c->size){
+			*(void**)p = s->free;
+			s->free = p;
+		}
+		acquire(&c->lock);
+		slabpush(c, s);
+		c->nslab++;
+	}
+	obj = s->free;
+	s->free = *(void**)obj;
+	s->inuse++;
+	if(s->free == 0)
+		slabunlink(c, s);  // full
+	release(&c->lock);
+	memset(obj, 0, c->size);
+	return obj;
+}
+
+// Free an object allocated by kmcachealloc() or kmalloc().
+void
+kmfree(void *obj)
+{
+	struct slab *s;
+	struct kmcache *c;
+
+	s = (struct slab*)PGROUNDDOWN((uint)obj);
+	c = s->c;
+	acquire(&c->lock);
+	if(s->free == 0)
+		slabpush(c, s);  // was full
+	*(void**)obj = s->free;
+	s->free = obj;
+	if(--s->inuse == 0 && c->nslab > 1){
+		slabunlink(c, s);
+		c->nslab--;
+		release(&c->lock);
+		kfree((char*)s);
+		return;
+	}
+	release(&c->lock);
+}
+
+// Allocate n zeroed bytes. Returns 0 if n is too large
+// or memory is out.
+void*
+kmalloc(uint n)
+{
+	int i;
+
+	for(i = 0; i < NELEM(kmsize); i++)
+		if(n <= kmsize[i].size)
+			return kmcachealloc(&kmsize[i]);
+	return 0;
+}
@@ -0,0 +1,8 @@
+// A cache of equally sized kernel objects; see slab.c.
+struct kmcache {
+	struct spinlock lock;
+	char *name;
+	uint size;              // object size, a multiple of 4
+	struct slab *partial;   // slabs with free objects
+	int nslab;              // slabs allocated
+};
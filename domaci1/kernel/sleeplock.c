@@ -1,4 +1,9 @@
 // Sleeping locks
+//
+// A sleep lock can also be held in shared mode, by any number
+// of holders at once, with acquiresleepshared(). Shared
+// holders give way to waiting exclusive ones so that a stream
+// of readers cannot starve a writer.
 
 #include "types.h"
 #include "defs.h"
@@ -16,6 +21,8 @@ initsleeplock(struct sleeplock *lk, char *name)
 	initlock(&lk->lk, "sleep lock");
 	lk->name = name;
 	lk->locked = 0;
+	lk->readers = 0;
+	lk->wwait = 0;
 	lk->pid = 0;
 }
 
@@ -23,9 +30,11 @@ void
 acquiresleep(struct sleeplock *lk)
 {
 	acquire(&lk->lk);
-	while (lk->locked) {
+	lk->wwait++;
+	while (lk->locked || lk->readers) {
 		sleep(lk, &lk->lk);
 	}
+	lk->wwait--;
 	lk->locked = 1;
 	lk->pid = myproc()->pid;
 	release(&lk->lk);
@@ -41,6 +50,28 @@ releasesleep(struct sleeplock *lk)
 	release(&lk->lk);
 }
 
+void
+acquiresleepshared(struct sleeplock *lk)
+{
+	acquire(&lk->lk);
+	while (lk->locked || lk->wwait) {
+		sleep(lk, &lk->lk);
+	}
+	lk->readers++;
+	release(&lk->lk);
+}
+
+void
+releasesleepshared(struct sleeplock *lk)
+{
+	acquire(&lk->lk);
+	if(lk->readers <= 0)
+		panic("releasesleepshared");
+	if(--lk->readers == 0)
+		wakeup(lk);
+	release(&lk->lk);
+}
+
 int
 holdingsleep(struct sleeplock *lk)
 {
@@ -1,6 +1,8 @@
 // Long-term locks for processes
 struct sleeplock {
 	uint locked;       // Is the lock held?
+	int readers;       // Holders in shared mode
+	int wwait;         // acquiresleep() callers waiting
 	struct spinlock lk; // spinlock protecting this sleep lock
 
 	// For debugging:
@@ -9,12 +9,37 @@
 #include "proc.h"
 #include "spinlock.h"
 
+extern char end[]; // first address after kernel loaded from ELF file
+
+// The statically allocated locks, for lockstat(). Locks inside
+// allocated objects (pipes, sleep locks) come and go, so they
+// keep statistics but are not listed.
+static struct {
+	struct spinlock *lk[NLOCKSTAT];
+	uint n;
+} locks;
+
 void
 initlock(struct spinlock *lk, char *name)
 {
+	uint i;
+
 	lk->name = name;
-	lk->locked = 0;
+	lk->next = 0;
+	lk->owner = 0;
 	lk->cpu = 0;
+	lk->nacquire = 0;
+	lk->ncontend = 0;
+	lk->spin = 0;
+	lk->maxhold = 0;
+
+	if((char*)lk >= end)
+		return;
+	for(i = 0; i < locks.n && i < NLOCKSTAT; i++)
+		if(locks.lk[i] == lk)
+			return;
+	if((i = __sync_fetch_and_add(&locks.n, 1)) < NLOCKSTAT)
+		locks.lk[i] = lk;
 }
 
 // Acquire the lock.
@@ -24,13 +49,24 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+	uint ticket;
+	uint64 t0;
+	int waited;
+
 	pushcli(); // disable interrupts to avoid deadlock.
 	if(holding(lk))
 		panic("acquire");
 
-	// The xchg is atomic.
-	while(xchg(&lk->locked, 1) != 0)
-		;
+	// The fetch-and-add is atomic. Each waiter spins reading
+	// owner, which changes once per release.
+	ticket = __sync_fetch_and_add(&lk->next, 1);
+	waited = 0;
+	if(*(volatile uint*)&lk->owner != ticket){
+		waited = 1;
+		t0 = rdtsc();
+		while(*(volatile uint*)&lk->owner != ticket)
+			pause();
+	}
 
 	// Tell the C compiler and the processor to not move loads or stores
 	// past this point, to ensure that the critical section's memory
@@ -39,16 +75,29 @@ acquire(struct spinlock *lk)
 
 	// Record info about lock acquisition for debugging.
 	lk->cpu = mycpu();
-	getcallerpcs(&lk, lk->pcs);
+	if(LOCKDEBUG)
+		getcallerpcs(&lk, lk->pcs);
+
+	lk->tacquire = rdtsc();
+	lk->nacquire++;
+	if(waited){
+		lk->ncontend++;
+		lk->spin += lk->tacquire - t0;
+	}
 }
 
 // Release the lock.
 void
 release(struct spinlock *lk)
 {
+	uint64 held;
+
 	if(!holding(lk))
 		panic("release");
 
+	held = rdtsc() - lk->tacquire;
+	if(held > lk->maxhold)
+		lk->maxhold = held;
 	lk->pcs[0] = 0;
 	lk->cpu = 0;
 
@@ -59,10 +108,11 @@ release(struct spinlock *lk)
 	// stores; __sync_synchronize() tells them both not to.
 	__sync_synchronize();
 
-	// Release the lock, equivalent to lk->locked = 0.
-	// This code can't use a C assignment, since it might
-	// not be atomic. A real OS would use C atomics here.
-	asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+	// Release the lock, equivalent to lk->owner++. Only the
+	// holder writes owner, so a plain store will do, but it
+	// can't be a C assignment, since that might not be atomic.
+	// A real OS would use C atomics here.
+	asm volatile("movl %1, %0" : "+m" (lk->owner) : "r" (lk->owner + 1));
 
 	popcli();
 }
@@ -91,11 +141,31 @@ holding(struct spinlock *lock)
 {
 	int r;
 	pushcli();
-	r = lock->locked && lock->cpu == mycpu();
+	r = lock->owner != lock->next && lock->cpu == mycpu();
 	popcli();
 	return r;
 }
 
+// Copy the statistics of up to n statically allocated locks
+// to st; return how many. The holders may be changing them,
+// so a figure can be a little stale.
+int
+lockstats(struct lockstat *st, int n)
+{
+	struct spinlock *lk;
+	int i;
+
+	for(i = 0; i < n && i < locks.n && i < NLOCKSTAT; i++){
+		lk = locks.lk[i];
+		safestrcpy(st[i].name, lk->name, sizeof(st[i].name));
+		st[i].nacquire = lk->nacquire;
+		st[i].ncontend = lk->ncontend;
+		st[i].spin = lk->spin;
+		st[i].maxhold = lk->maxhold;
+	}
+	return i;
+}
+
 
 // Pushcli/popcli are like cli/sti except that they are matched:
 // it takes two popcli to undo two pushcli.  Also, if interrupts
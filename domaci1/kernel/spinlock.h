@@ -1,11 +1,30 @@
-// Mutual exclusion lock.
+// Mutual exclusion lock: a ticket lock, so that waiting CPUs
+// get the lock in the order they asked for it. acquire() takes
+// the next ticket and spins until owner reaches it; release()
+// advances owner.
 struct spinlock {
-	uint locked;       // Is the lock held?
+	uint next;         // Next ticket to hand out
+	uint owner;        // Ticket now holding the lock; free if == next
 
 	// For debugging:
 	char *name;        // Name of lock.
 	struct cpu *cpu;   // The cpu holding the lock.
 	uint pcs[10];      // The call stack (an array of program counters)
-			   // that locked the lock.
+			   // that locked the lock; only kept if LOCKDEBUG.
+
+	// Contention statistics, changed only by the holder.
+	uint nacquire;     // Times acquired
+	uint ncontend;     // Times acquire() had to wait
+	uint64 spin;       // Cycles spent waiting
+	uint64 maxhold;    // Longest time held, in cycles
+	uint64 tacquire;   // When the holder got it
 };
 
+// Statistics of one lock as reported by lockstat().
+struct lockstat {
+	char name[16];
+	uint nacquire;
+	uint ncontend;
+	uint64 spin;
+	uint64 maxhold;
+};
@@ -0,0 +1,54 @@
+// Kernel event counters.
+//
+// Each CPU counts in its own row of stat[], with interrupts
+// off and no lock, so counting costs a few instructions and
+// CPUs never write each other's cache lines. Reading /dev/stats
+// adds the rows up; the total may be a moment old, but no count
+// is ever lost.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "stats.h"
+
+// A row per cache line.
+static struct {
+	uint n[NSTAT];
+} __attribute__((aligned(64))) stat[NCPU];
+
+// Add n to counter i. Callable from anywhere, interrupt
+// handlers included.
+void
+statadd(int i, uint n)
+{
+	pushcli();
+	stat[cpuid()].n[i] += n;
+	popcli();
+}
+
+// Read the totals, or as many of them as fit in n bytes.
+static int
+statread(struct inode *ip, char *dst, int n)
+{
+	uint sum[NSTAT];
+	int c, i;
+
+	memset(sum, 0, sizeof(sum));
+	for(c = 0; c < NCPU; c++)
+		for(i = 0; i < NSTAT; i++)
+			sum[i] += stat[c].n[i];
+	if(n > sizeof(sum))
+		n = sizeof(sum);
+	memmove(dst, sum, n);
+	return n;
+}
+
+void
+statinit(void)
+{
+	devsw[STATS].read = statread;
+}
@@ -0,0 +1,16 @@
+// Kernel event counters; see stats.c. Reading /dev/stats
+// (major STATS) returns uint[NSTAT], indexed by these.
+#define ST_BGET       0   // buffer cache lookups
+#define ST_BHIT       1   //   found in the cache
+#define ST_COMMIT     2   // log commits that wrote blocks
+#define ST_COMMITBLK  3   //   blocks they wrote to the log
+#define ST_IDEREQ     4   // bufs queued for the IDE disk
+#define ST_IDEQLEN    5   //   sum of bufs already queued ahead of them
+#define ST_IDEINTR    6   // IDE transfers finished
+#define ST_PIPEWRITE  7   // pipewrite() calls
+#define ST_PIPEWAKE   8   //   wakeups of a waiting reader
+#define ST_KALLOC     9   // kalloc() calls
+#define ST_KALLOCFAIL 10  //   that found no memory
+#define ST_SWITCH     11  // processes the scheduler switched to
+#define ST_IDLE       12  // times a CPU halted with nothing to run
+#define NSTAT         13
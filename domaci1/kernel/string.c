@@ -19,6 +19,15 @@ memcmp(const void *v1, const void *v2, uint n)
 
 	s1 = v1;
 	s2 = v2;
+	// Skip equal words when s1 and s2 can both be aligned;
+	// the bytes of the first unequal one are compared below.
+	if(((uint)s1 ^ (uint)s2) % 4 == 0){
+		for(; n > 0 && (uint)s1 % 4; n--, s1++, s2++)
+			if(*s1 != *s2)
+				return *s1 - *s2;
+		for(; n >= 4 && *(uint*)s1 == *(uint*)s2; n -= 4)
+			s1 += 4, s2 += 4;
+	}
 	while(n-- > 0){
 		if(*s1 != *s2)
 			return *s1 - *s2;
@@ -28,22 +37,42 @@ memcmp(const void *v1, const void *v2, uint n)
 	return 0;
 }
 
+// Copies a word at a time when dst and src can both be
+// aligned, which is the case for the block, page and console
+// copies that matter.
 void*
 memmove(void *dst, const void *src, uint n)
 {
 	const char *s;
 	char *d;
+	uint k;
 
 	s = src;
 	d = dst;
 	if(s < d && s + n > d){
+		// Overlapping with dst above src: copy from the end.
+		// Aligned alike, they are at least a word apart.
 		s += n;
 		d += n;
+		if(((uint)s ^ (uint)d) % 4 == 0){
+			for(; n > 0 && (uint)d % 4; n--)
+				*--d = *--s;
+			for(; n >= 4; n -= 4){
+				d -= 4;
+				s -= 4;
+				*(uint*)d = *(uint*)s;
+			}
+		}
 		while(n-- > 0)
 			*--d = *--s;
+	} else if(((uint)s ^ (uint)d) % 4 == 0 && n >= 16){
+		k = -(uint)d % 4;
+		movsb(d, s, k);
+		movsl(d + k, s + k, (n - k) / 4);
+		k += (n - k) & ~3;
+		movsb(d + k, s + k, n - k);
 	} else
-		while(n-- > 0)
-			*d++ = *s++;
+		movsb(d, s, n);
 
 	return dst;
 }
@@ -6,8 +6,10 @@
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
+#include "ring.h"
+#include "trace.h"
 
-// User code makes a system call with INT T_SYSCALL.
+// User code makes a system call with SYSENTER or INT T_SYSCALL.
 // System call number in %eax.
 // Arguments on the stack, from the user call to the C
 // library system call function. The saved user %esp points
@@ -17,32 +19,17 @@
 int
 fetchint(uint addr, int *ip)
 {
-	struct proc *curproc = myproc();
-
-	if(addr >= curproc->sz || addr+4 > curproc->sz)
-		return -1;
-	*ip = *(int*)(addr);
-	return 0;
+	return copyin(myproc()->mm, ip, addr, sizeof(*ip));
 }
 
-// Fetch the nul-terminated string at addr from the current process.
-// Doesn't actually copy the string - just sets *pp to point at it.
+// Copy the nul-terminated string at addr from the current
+// process into buf, which has room for max bytes. A copy, since
+// another thread may change the string while the kernel uses it.
 // Returns length of string, not including nul.
 int
-fetchstr(uint addr, char **pp)
+fetchstr(uint addr, char *buf, int max)
 {
-	char *s, *ep;
-	struct proc *curproc = myproc();
-
-	if(addr >= curproc->sz)
-		return -1;
-	*pp = (char*)addr;
-	ep = (char*)curproc->sz;
-	for(s = *pp; s < ep; s++){
-		if(*s == 0)
-			return s - *pp;
-	}
-	return -1;
+	return copyinstr(myproc()->mm, buf, addr, max);
 }
 
 // Fetch the nth 32-bit system call argument.
@@ -63,23 +50,21 @@ argptr(int n, char **pp, int size)
 
 	if(argint(n, &i) < 0)
 		return -1;
-	if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+	if(size < 0 || uvmaccess(curproc->mm, (uint)i, size) < 0)
 		return -1;
 	*pp = (char*)i;
 	return 0;
 }
 
-// Fetch the nth word-sized system call argument as a string pointer.
-// Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// Fetch the nth word-sized system call argument as a string
+// pointer, and copy the string into buf, as fetchstr().
 int
-argstr(int n, char **pp)
+argstr(int n, char *buf, int max)
 {
 	int addr;
 	if(argint(n, &addr) < 0)
 		return -1;
-	return fetchstr(addr, pp);
+	return fetchstr(addr, buf, max);
 }
 
 extern int sys_chdir(void);
@@ -103,6 +88,39 @@ extern int sys_unlink(void);
 extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
+extern int sys_dmesg(void);
+extern int sys_ioctl(void);
+extern int sys_fsync(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_nice(void);
+extern int sys_setpriority(void);
+extern int sys_nanosleep(void);
+extern int sys_nanouptime(void);
+extern int sys_clone(void);
+extern int sys_join(void);
+extern int sys_futexwait(void);
+extern int sys_futexwake(void);
+extern int sys_splice(void);
+extern int sys_copy_file_range(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_poll(void);
+extern int sys_ringsetup(void);
+extern int sys_ringenter(void);
+extern int sys_lockstat(void);
+extern int sys_mount(void);
+extern int sys_profile(void);
+extern int sys_profread(void);
+extern int sys_getrusage(void);
+extern int sys_vfork(void);
+extern int sys_irqaffinity(void);
+extern int sys_irqbalance(void);
+extern int sys_irqstat(void);
+extern int sys_trace(void);
+extern int sys_traceread(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -126,8 +144,108 @@ static int (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_dmesg]   sys_dmesg,
+[SYS_ioctl]   sys_ioctl,
+[SYS_fsync]   sys_fsync,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_nice]    sys_nice,
+[SYS_setpriority] sys_setpriority,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_nanouptime] sys_nanouptime,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futexwait] sys_futexwait,
+[SYS_futexwake] sys_futexwake,
+[SYS_splice]  sys_splice,
+[SYS_copy_file_range] sys_copy_file_range,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_poll]    sys_poll,
+[SYS_ringsetup] sys_ringsetup,
+[SYS_ringenter] sys_ringenter,
+[SYS_lockstat]  sys_lockstat,
+[SYS_mount]     sys_mount,
+[SYS_profile]   sys_profile,
+[SYS_profread]  sys_profread,
+[SYS_getrusage] sys_getrusage,
+[SYS_vfork]   sys_vfork,
+[SYS_irqaffinity] sys_irqaffinity,
+[SYS_irqbalance]  sys_irqbalance,
+[SYS_irqstat]     sys_irqstat,
+[SYS_trace]       sys_trace,
+[SYS_traceread]   sys_traceread,
+};
+
+// The system calls a ring may queue: ones that take no more
+// than four arguments and leave the process's memory alone.
+static char ringok[] = {
+[SYS_open]    1,
+[SYS_read]    1,
+[SYS_write]   1,
+[SYS_close]   1,
+[SYS_fstat]   1,
+[SYS_unlink]  1,
+[SYS_pread]   1,
+[SYS_pwrite]  1,
 };
 
+// Register the struct ring at user address ring, or none if 0.
+int
+sys_ringsetup(void)
+{
+	int ring;
+
+	if(argint(0, &ring) < 0)
+		return -1;
+	if(ring && (ring % 4 || uvmaccess(myproc()->mm, ring, sizeof(struct ring)) < 0))
+		return -1;
+	myproc()->ring = ring;
+	return 0;
+}
+
+// Run the system calls queued in the current process's ring,
+// in order, through the same handlers as a trap would, until
+// the submission queue is empty or the completion queue full.
+// A handler finds its arguments in the entry: argint() reads
+// from tf->esp + 4, so tf->esp is pointed just below them.
+// Returns the number of results posted.
+int
+sys_ringenter(void)
+{
+	struct proc *curproc = myproc();
+	struct ring *r;
+	struct sqe *e;
+	uint esp, tail;
+	int op, n, res;
+
+	if(curproc->ring == 0 ||
+	   uvmaccess(curproc->mm, curproc->ring, sizeof(struct ring)) < 0)
+		return -1;
+	r = (struct ring*)curproc->ring;
+	esp = curproc->tf->esp;
+	tail = r->sqtail;
+	for(n = 0; r->sqhead != tail && r->cqtail - r->cqhead < RINGSIZE; n++){
+		e = &r->sq[r->sqhead % RINGSIZE];
+		op = e->op;
+		res = -1;
+		if(op > 0 && op < NELEM(ringok) && ringok[op]){
+			curproc->tf->esp = (uint)e->arg - 4;
+			res = syscalls[op]();
+		}
+		r->cq[r->cqtail % RINGSIZE].res = res;
+		r->cq[r->cqtail % RINGSIZE].data = e->data;
+		r->cqtail++;
+		r->sqhead++;
+		if(curproc->killed)
+			break;
+	}
+	curproc->tf->esp = esp;
+	return n;
+}
+
 void
 syscall(void)
 {
@@ -136,7 +254,11 @@ syscall(void)
 
 	num = curproc->tf->eax;
 	if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
+		if(num < NSYSCALL)
+			curproc->nsyscall[num]++;
+		TRACE(TC_SYSCALL, TE_SYSCALL, num);
 		curproc->tf->eax = syscalls[num]();
+		TRACE(TC_SYSCALL, TE_SYSRET, curproc->tf->eax);
 	} else {
 		cprintf("%d %s: unknown sys call %d\n",
 			curproc->pid, curproc->name, num);
@@ -20,3 +20,36 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_dmesg  22
+#define SYS_ioctl  23
+#define SYS_fsync  24
+#define SYS_mmap   25
+#define SYS_munmap 26
+#define SYS_nice   27
+#define SYS_setpriority 28
+#define SYS_nanosleep 29
+#define SYS_nanouptime 30
+#define SYS_clone  31
+#define SYS_join   32
+#define SYS_futexwait 33
+#define SYS_futexwake 34
+#define SYS_splice 35
+#define SYS_copy_file_range 36
+#define SYS_readv  37
+#define SYS_writev 38
+#define SYS_pread  39
+#define SYS_pwrite 40
+#define SYS_poll   41
+#define SYS_ringsetup 42
+#define SYS_ringenter 43
+#define SYS_lockstat  44
+#define SYS_mount     45
+#define SYS_profile   46
+#define SYS_profread  47
+#define SYS_getrusage 48
+#define SYS_vfork   49
+#define SYS_irqaffinity 50
+#define SYS_irqbalance  51
+#define SYS_irqstat     52
+#define SYS_trace       53
+#define SYS_traceread   54
@@ -15,6 +15,9 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
+#include "poll.h"
+#include "mman.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -90,6 +93,186 @@ sys_write(void)
 	return filewrite(f, p, n);
 }
 
+int
+sys_pread(void)
+{
+	struct file *f;
+	struct iovec iov;
+	int n, off;
+	uint pos;
+	char *p;
+
+	if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+	   argint(3, &off) < 0 || off < 0)
+		return -1;
+	iov.base = p;
+	iov.len = n;
+	pos = off;
+	return filereadv(f, &iov, 1, &pos);
+}
+
+int
+sys_pwrite(void)
+{
+	struct file *f;
+	struct iovec iov;
+	int n, off;
+	uint pos;
+	char *p;
+
+	if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+	   argint(3, &off) < 0 || off < 0)
+		return -1;
+	iov.base = p;
+	iov.len = n;
+	pos = off;
+	return filewritev(f, &iov, 1, &pos);
+}
+
+// poll(fds, nfds, timeout): timeout is in milliseconds, or
+// negative to wait for as long as it takes.
+int
+sys_poll(void)
+{
+	struct pollfd fds[NOFILE];
+	int n, ms, r;
+	uint64 when;
+	char *p;
+
+	if(argint(1, &n) < 0 || n < 0 || n > NOFILE ||
+	   argptr(0, &p, n*sizeof(struct pollfd)) < 0 || argint(2, &ms) < 0)
+		return -1;
+	memmove(fds, p, n*sizeof(struct pollfd));
+	if(ms < 0)
+		when = 0;
+	else if(ms == 0)
+		when = 1;
+	else
+		when = nanouptime() + (uint64)ms * 1000000;
+	if((r = poll(fds, n, when)) >= 0)
+		memmove(p, fds, n*sizeof(struct pollfd));
+	return r;
+}
+
+// Fetch the iovec array of readv() or writev() into iov, and
+// check its segments as argptr() would. Returns the count.
+static int
+argiov(struct iovec *iov)
+{
+	int cnt, i, n, p;
+
+	if(argint(2, &cnt) < 0 || cnt < 0 || cnt > IOV_MAX || argint(1, &p) < 0 ||
+	   copyin(myproc()->mm, iov, p, cnt*sizeof(struct iovec)) < 0)
+		return -1;
+	n = 0;
+	for(i = 0; i < cnt; i++){
+		if(iov[i].len < 0 || n + iov[i].len < n)
+			return -1;
+		n += iov[i].len;
+		if(uvmaccess(myproc()->mm, (uint)iov[i].base, iov[i].len) < 0)
+			return -1;
+	}
+	return cnt;
+}
+
+int
+sys_readv(void)
+{
+	struct file *f;
+	struct iovec iov[IOV_MAX];
+	int cnt;
+
+	if(argfd(0, 0, &f) < 0 || (cnt = argiov(iov)) < 0)
+		return -1;
+	return filereadv(f, iov, cnt, 0);
+}
+
+int
+sys_writev(void)
+{
+	struct file *f;
+	struct iovec iov[IOV_MAX];
+	int cnt;
+
+	if(argfd(0, 0, &f) < 0 || (cnt = argiov(iov)) < 0)
+		return -1;
+	return filewritev(f, iov, cnt, 0);
+}
+
+int
+sys_ioctl(void)
+{
+	struct file *f;
+	int req, arg;
+
+	if(argfd(0, 0, &f) < 0 || argint(1, &req) < 0 || argint(2, &arg) < 0)
+		return -1;
+	return fileioctl(f, req, arg);
+}
+
+// Commits are grouped, so a write may not be on disk yet when
+// write() returns. fsync() waits until it is. There is one log
+// for the whole file system, so this makes every earlier
+// update durable, not just those to fd.
+int
+sys_fsync(void)
+{
+	struct file *f;
+
+	if(argfd(0, 0, &f) < 0)
+		return -1;
+	log_sync();
+	return 0;
+}
+
+int
+sys_splice(void)
+{
+	struct file *in, *out;
+	int n;
+
+	if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+		return -1;
+	return filesplice(in, out, n);
+}
+
+int
+sys_copy_file_range(void)
+{
+	struct file *in, *out;
+	int n;
+
+	if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+		return -1;
+	return filecopy(in, out, n);
+}
+
+// The address argument is only a hint, and is ignored.
+int
+sys_mmap(void)
+{
+	int len, prot, flags, off;
+	struct file *f;
+
+	if(argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+	   argint(3, &flags) < 0 || argint(5, &off) < 0)
+		return -1;
+	f = 0;
+	if((flags & MAP_ANON) == 0 && argfd(4, 0, &f) < 0)
+		return -1;
+	return mmap(len, prot, flags, f, off);
+}
+
+int
+sys_munmap(void)
+{
+	int addr, len;
+
+	if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+		return -1;
+	return munmap(addr, len);
+}
+
 int
 sys_close(void)
 {
@@ -118,10 +301,10 @@ sys_fstat(void)
 int
 sys_link(void)
 {
-	char name[DIRSIZ], *new, *old;
+	char name[DIRSIZ], new[MAXPATH], old[MAXPATH];
 	struct inode *dp, *ip;
 
-	if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
+	if(argstr(0, old, sizeof(old)) < 0 || argstr(1, new, sizeof(new)) < 0)
 		return -1;
 
 	begin_op();
@@ -171,6 +354,8 @@ isdirempty(struct inode *dp)
 	int off;
 	struct dirent de;
 
+	if((off = dirnent(dp)) >= 0)
+		return off <= 2;
 	for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
 		if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
 			panic("isdirempty: readi");
@@ -184,11 +369,10 @@ int
 sys_unlink(void)
 {
 	struct inode *ip, *dp;
-	struct dirent de;
-	char name[DIRSIZ], *path;
+	char name[DIRSIZ], path[MAXPATH];
 	uint off;
 
-	if(argstr(0, &path) < 0)
+	if(argstr(0, path, sizeof(path)) < 0)
 		return -1;
 
 	begin_op();
@@ -209,14 +393,12 @@ sys_unlink(void)
 
 	if(ip->nlink < 1)
 		panic("unlink: nlink < 1");
-	if(ip->type == T_DIR && !isdirempty(ip)){
+	if(ip->type == T_DIR && (!isdirempty(ip) || mounted(ip))){
 		iunlockput(ip);
 		goto bad;
 	}
 
-	memset(&de, 0, sizeof(de));
-	if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-		panic("unlink: writei");
+	dirunlink(dp, name, off);
 	if(ip->type == T_DIR){
 		dp->nlink--;
 		iupdate(dp);
@@ -256,8 +438,10 @@ create(char *path, short type, short major, short minor)
 		return 0;
 	}
 
-	if((ip = ialloc(dp->dev, type)) == 0)
-		panic("create: ialloc");
+	if((ip = ialloc(dp->dev, type, dp->inum)) == 0){
+		iunlockput(dp);  // tmpfs is out of inodes
+		return 0;
+	}
 
 	ilock(ip);
 	ip->major = major;
@@ -284,12 +468,12 @@ create(char *path, short type, short major, short minor)
 int
 sys_open(void)
 {
-	char *path;
+	char path[MAXPATH];
 	int fd, omode;
 	struct file *f;
 	struct inode *ip;
 
-	if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
+	if(argstr(0, path, sizeof(path)) < 0 || argint(1, &omode) < 0)
 		return -1;
 
 	begin_op();
@@ -312,6 +496,12 @@ sys_open(void)
 			return -1;
 		}
 	}
+	if(ip->textbusy && (omode & (O_WRONLY|O_RDWR))){
+		// A running program; see itext().
+		iunlockput(ip);
+		end_op();
+		return -1;
+	}
 
 	if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
 		if(f)
@@ -334,11 +524,11 @@ sys_open(void)
 int
 sys_mkdir(void)
 {
-	char *path;
+	char path[MAXPATH];
 	struct inode *ip;
 
 	begin_op();
-	if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+	if(argstr(0, path, sizeof(path)) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
 		end_op();
 		return -1;
 	}
@@ -351,11 +541,11 @@ int
 sys_mknod(void)
 {
 	struct inode *ip;
-	char *path;
+	char path[MAXPATH];
 	int major, minor;
 
 	begin_op();
-	if((argstr(0, &path)) < 0 ||
+	if((argstr(0, path, sizeof(path))) < 0 ||
 			argint(1, &major) < 0 ||
 			argint(2, &minor) < 0 ||
 			(ip = create(path, T_DEV, major, minor)) == 0){
@@ -370,12 +560,12 @@ sys_mknod(void)
 int
 sys_chdir(void)
 {
-	char *path;
+	char path[MAXPATH];
 	struct inode *ip;
 	struct proc *curproc = myproc();
 
 	begin_op();
-	if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
+	if(argstr(0, path, sizeof(path)) < 0 || (ip = namei(path)) == 0){
 		end_op();
 		return -1;
 	}
@@ -392,30 +582,60 @@ sys_chdir(void)
 	return 0;
 }
 
+int
+sys_mount(void)
+{
+	char type[16], path[MAXPATH];
+	struct inode *ip;
+
+	if(argstr(0, type, sizeof(type)) < 0 || argstr(1, path, sizeof(path)) < 0)
+		return -1;
+	begin_op();
+	if((ip = namei(path)) == 0){
+		end_op();
+		return -1;
+	}
+	if(mount(ip, type) < 0){
+		iput(ip);
+		end_op();
+		return -1;
+	}
+	end_op();
+	return 0;
+}
+
 int
 sys_exec(void)
 {
-	char *path, *argv[MAXARG];
-	int i;
+	char path[MAXPATH], *argv[MAXARG], *strs;
+	int i, n, r;
 	uint uargv, uarg;
 
-	if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+	if(argstr(0, path, sizeof(path)) < 0 || argint(1, (int*)&uargv) < 0){
 		return -1;
 	}
+	// The argument strings are copied into one page, which
+	// they must fit in anyway to go on the new stack.
+	if((strs = kalloc()) == 0)
+		return -1;
 	memset(argv, 0, sizeof(argv));
-	for(i=0;; i++){
-		if(i >= NELEM(argv))
-			return -1;
-		if(fetchint(uargv+4*i, (int*)&uarg) < 0)
-			return -1;
+	for(i=0, n=0;; i++){
+		r = -1;
+		if(i >= NELEM(argv) || fetchint(uargv+4*i, (int*)&uarg) < 0)
+			goto out;
 		if(uarg == 0){
 			argv[i] = 0;
 			break;
 		}
-		if(fetchstr(uarg, &argv[i]) < 0)
-			return -1;
+		argv[i] = strs + n;
+		if((r = fetchstr(uarg, argv[i], PGSIZE - n)) < 0)
+			goto out;
+		n += r + 1;
 	}
-	return exec(path, argv);
+	r = exec(path, argv);
+out:
+	kfree(strs);
+	return r;
 }
 
 int
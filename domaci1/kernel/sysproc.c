@@ -6,6 +6,12 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "prof.h"
+#include "rusage.h"
+#include "irq.h"
+#include "trace.h"
 
 int
 sys_fork(void)
@@ -13,6 +19,12 @@ sys_fork(void)
 	return fork();
 }
 
+int
+sys_vfork(void)
+{
+	return vfork();
+}
+
 int
 sys_exit(void)
 {
@@ -26,6 +38,31 @@ sys_wait(void)
 	return wait();
 }
 
+int
+sys_clone(void)
+{
+	int fn, arg, stack, size;
+
+	if(argint(0, &fn) < 0 || argint(1, &arg) < 0 ||
+	   argint(2, &stack) < 0 || argint(3, &size) < 0)
+		return -1;
+	return clone(fn, arg, stack, size);
+}
+
+int
+sys_join(void)
+{
+	char *stack;
+	uint ustack;
+	int pid;
+
+	if(argptr(0, &stack, sizeof(uint)) < 0)
+		return -1;
+	if((pid = join(&ustack)) >= 0)
+		*(uint*)stack = ustack;
+	return pid;
+}
+
 int
 sys_kill(void)
 {
@@ -42,6 +79,31 @@ sys_getpid(void)
 	return myproc()->pid;
 }
 
+// Add inc to the caller's nice value; returns the new value.
+int
+sys_nice(void)
+{
+	int inc;
+	struct proc *p = myproc();
+
+	if(argint(0, &inc) < 0)
+		return -1;
+	setpriority(p->pid, p->nice + inc);
+	return p->nice;
+}
+
+int
+sys_setpriority(void)
+{
+	int pid, nice;
+
+	if(argint(0, &pid) < 0 || argint(1, &nice) < 0)
+		return -1;
+	if(pid == 0)
+		pid = myproc()->pid;
+	return setpriority(pid, nice);
+}
+
 int
 sys_sbrk(void)
 {
@@ -50,8 +112,7 @@ sys_sbrk(void)
 
 	if(argint(0, &n) < 0)
 		return -1;
-	addr = myproc()->sz;
-	if(growproc(n) < 0)
+	if((addr = growproc(n)) < 0)
 		return -1;
 	return addr;
 }
@@ -60,32 +121,188 @@ int
 sys_sleep(void)
 {
 	int n;
-	uint ticks0;
 
 	if(argint(0, &n) < 0)
 		return -1;
-	acquire(&tickslock);
-	ticks0 = ticks;
-	while(ticks - ticks0 < n){
-		if(myproc()->killed){
-			release(&tickslock);
-			return -1;
-		}
-		sleep(&ticks, &tickslock);
-	}
-	release(&tickslock);
+	if(n > 0)
+		sleepuntil(nanouptime() + (uint64)n * TICKNS, 0);
+	return myproc()->killed ? -1 : 0;
+}
+
+// Sleep for sec seconds and nsec nanoseconds; not limited to
+// whole ticks.
+int
+sys_nanosleep(void)
+{
+	int sec, nsec;
+
+	if(argint(0, &sec) < 0 || argint(1, &nsec) < 0)
+		return -1;
+	if(sec < 0 || nsec < 0 || nsec >= 1000000000)
+		return -1;
+	sleepuntil(nanouptime() + (uint64)sec * 1000000000 + nsec, 0);
+	return myproc()->killed ? -1 : 0;
+}
+
+// Store the nanoseconds since boot at the user address in arg 0.
+int
+sys_nanouptime(void)
+{
+	uint64 *t;
+
+	if(argptr(0, (char**)&t, sizeof(*t)) < 0)
+		return -1;
+	*t = nanouptime();
 	return 0;
 }
 
+// Copy the most recent kernel log output to the user buffer.
+// Returns the number of bytes copied.
+int
+sys_dmesg(void)
+{
+	char *buf;
+	int n;
+
+	if(argint(1, &n) < 0 || argptr(0, &buf, n) < 0)
+		return -1;
+	return klogread(buf, n);
+}
+
+// Copy the statistics of at most n spinlocks into an array
+// of struct lockstat; return how many.
+int
+sys_lockstat(void)
+{
+	char *buf;
+	int n;
+
+	if(argint(1, &n) < 0 || n < 0 || n > NLOCKSTAT ||
+	   argptr(0, &buf, n*sizeof(struct lockstat)) < 0)
+		return -1;
+	return lockstats((struct lockstat*)buf, n);
+}
+
+int
+sys_getrusage(void)
+{
+	char *buf;
+	int pid, n;
+
+	if(argint(0, &pid) < 0 || argint(2, &n) < 0 || n < 0 || n > NPROC ||
+	   argptr(1, &buf, n*sizeof(struct rusage)) < 0)
+		return -1;
+	return getrusage(pid, (struct rusage*)buf, n);
+}
+
+// Turn the profiler on (1) or off (0).
+int
+sys_profile(void)
+{
+	int on;
+
+	if(argint(0, &on) < 0)
+		return -1;
+	return profctl(on != 0);
+}
+
+int
+sys_profread(void)
+{
+	char *buf;
+	int n;
+
+	if(argint(1, &n) < 0 || n < 0 || n > NCPU*NPROFSAMPLE ||
+	   argptr(0, &buf, n*sizeof(struct profsample)) < 0)
+		return -1;
+	return profread((struct profsample*)buf, n);
+}
+
+int
+sys_irqaffinity(void)
+{
+	int irq, cpu;
+
+	if(argint(0, &irq) < 0 || argint(1, &cpu) < 0)
+		return -1;
+	return irqaffinity(irq, cpu);
+}
+
+// Turn interrupt balancing on (1) or off (0).
+int
+sys_irqbalance(void)
+{
+	int on;
+
+	if(argint(0, &on) < 0)
+		return -1;
+	return irqbalance(on != 0);
+}
+
+int
+sys_irqstat(void)
+{
+	char *buf;
+	int n;
+
+	if(argint(1, &n) < 0 || n < 0 || n > NIRQ ||
+	   argptr(0, &buf, n*sizeof(struct irqstat)) < 0)
+		return -1;
+	return irqstat((struct irqstat*)buf, n);
+}
+
+// Trace the categories in mask (TC_*), or stop if it is 0.
+int
+sys_trace(void)
+{
+	int mask;
+
+	if(argint(0, &mask) < 0 || (mask & ~TC_ALL))
+		return -1;
+	return tracectl(mask);
+}
+
+int
+sys_traceread(void)
+{
+	char *buf;
+	int n;
+
+	if(argint(1, &n) < 0 || n < 0 || n > NCPU*NTRACE ||
+	   argptr(0, &buf, n*sizeof(struct traceev)) < 0)
+		return -1;
+	return traceread((struct traceev*)buf, n);
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 int
 sys_uptime(void)
 {
-	uint xticks;
+	// ticks is not counted on idle CPUs; go to the clock.
+	return div64(nanouptime(), TICKNS);
+}
+
+int
+sys_futexwait(void)
+{
+	char *addr;
+	int val;
 
-	acquire(&tickslock);
-	xticks = ticks;
-	release(&tickslock);
-	return xticks;
+	if(argptr(0, &addr, sizeof(int)) < 0 || argint(1, &val) < 0)
+		return -1;
+	if((uint)addr % sizeof(int))
+		return -1;
+	return futexwait((uint)addr, val);
+}
+
+int
+sys_futexwake(void)
+{
+	char *addr;
+
+	if(argptr(0, &addr, sizeof(int)) < 0)
+		return -1;
+	futexwake((uint)addr);
+	return 0;
 }
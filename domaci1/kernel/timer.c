@@ -0,0 +1,222 @@
+// Timer queue.
+//
+// The local APIC timer of each CPU is one-shot: it is started
+// for the earlier of the first deadline in the timer queue and,
+// while the CPU runs a process, the end of its current tick,
+// when the scheduler needs to look at it. An idle CPU takes no
+// interrupts until a timer is due, and a sleep can end at any
+// time, not only on a tick. While the profiler is on, the timer
+// also goes off every PROFNS.
+//
+// A sleeping process puts a struct timer on its own stack into
+// the queue, kept sorted by deadline; the timer interrupt of
+// any CPU takes off the timers that are due and wakes their
+// sleepers. tq.lock guards the queue.
+// Lock order: a caller's lock, tq.lock, then wakeup()'s locks.
+//
+// sleepseq() waits, with a deadline, for a counter that
+// wakeseq() bumps; tq.lock guards the counter too, so a wakeup
+// can come from either without one being lost.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+
+struct timer {
+	uint64 when;         // deadline, nanoseconds since boot
+	int queued;
+	void *chan;          // what the sleeper sleeps on
+	struct timer *next;
+};
+
+static struct {
+	struct spinlock lock;
+	struct timer *head;
+} tq;
+
+void
+timerinit(void)
+{
+	initlock(&tq.lock, "timer");
+}
+
+// Start this CPU's timer for its next deadline, unless it is
+// already due to go off no later. Caller has interrupts off.
+static void
+timerarm(struct cpu *c, uint64 now)
+{
+	uint64 when;
+
+	when = 0;
+	if(tq.head)
+		when = tq.head->when;
+	if(c->proc && (when == 0 || c->nexttick < when))
+		when = c->nexttick;
+	if(profiling && (when == 0 || now + PROFNS < when))
+		when = now + PROFNS;
+	if(when == 0 || (c->deadline > now && c->deadline <= when))
+		return;
+	c->deadline = when;
+	lapictimer(when > now ? when - now : 0);
+}
+
+// Bring ticks up to date with the clock.
+void
+clockupdate(void)
+{
+	uint t;
+
+	t = div64(nanouptime(), TICKNS);
+	acquire(&tickslock);
+	if((int)(t - ticks) > 0)
+		ticks = t;
+	release(&tickslock);
+}
+
+// Timer interrupt on this CPU. Wakes the sleepers whose
+// deadline has passed and starts the timer for the next one.
+// Returns 1 if a scheduling tick of the running process is up.
+int
+timerintr(void)
+{
+	struct cpu *c;
+	struct timer *t;
+	uint64 now;
+	int tick;
+
+	c = mycpu();
+	now = nanouptime();
+	c->deadline = 0;
+	clockupdate();
+	klogkick();
+
+	acquire(&tq.lock);
+	while((t = tq.head) != 0 && t->when <= now){
+		tq.head = t->next;
+		t->queued = 0;
+		wakeup(t->chan);
+	}
+	tick = 0;
+	if(c->proc && c->nexttick <= now){
+		c->nexttick = now + TICKNS;
+		tick = 1;
+	}
+	timerarm(c, now);
+	release(&tq.lock);
+	return tick;
+}
+
+// Called by scheduler() before running a process: give it the
+// rest of the current tick, or a new one.
+void
+timerresume(void)
+{
+	struct cpu *c;
+	uint64 now;
+
+	c = mycpu();
+	now = nanouptime();
+	if(c->nexttick <= now)
+		c->nexttick = now + TICKNS;
+	acquire(&tq.lock);
+	timerarm(c, now);
+	release(&tq.lock);
+}
+
+// Put t in the queue to wake chan at when.
+// Caller holds tq.lock.
+static void
+timeradd(struct timer *t, uint64 when, void *chan, uint64 now)
+{
+	struct timer **pp;
+
+	t->when = when;
+	t->chan = chan;
+	for(pp = &tq.head; *pp && (*pp)->when <= when; pp = &(*pp)->next)
+		;
+	t->next = *pp;
+	*pp = t;
+	t->queued = 1;
+	timerarm(mycpu(), now);
+}
+
+// Take t out of the queue if it has not gone off.
+// Caller holds tq.lock.
+static void
+timerdel(struct timer *t)
+{
+	struct timer **pp;
+
+	if(t->queued){
+		for(pp = &tq.head; *pp != t; pp = &(*pp)->next)
+			;
+		*pp = t->next;
+		t->queued = 0;
+	}
+}
+
+// Sleep until nanouptime() reaches when, or the process is
+// killed. If lk is not 0, release it while sleeping, as sleep().
+void
+sleepuntil(uint64 when, struct spinlock *lk)
+{
+	struct timer t;
+	uint64 now;
+
+	acquire(&tq.lock);
+	if(lk)
+		release(lk);
+	now = nanouptime();
+	if(when > now && !myproc()->killed){
+		timeradd(&t, when, &t, now);
+		while(t.queued && !myproc()->killed)
+			sleep(&t, &tq.lock);
+		timerdel(&t);
+	}
+	release(&tq.lock);
+	if(lk)
+		acquire(lk);
+}
+
+// Sleep until *seq is no longer old, nanouptime() reaches when
+// (never, if when is 0), or the process is killed. Returns 0
+// if the time ran out first, 1 otherwise.
+int
+sleepseq(uint *seq, uint old, uint64 when)
+{
+	struct timer t;
+	uint64 now;
+	int r;
+
+	acquire(&tq.lock);
+	t.queued = 0;
+	if(when){
+		now = nanouptime();
+		if(when <= now){
+			release(&tq.lock);
+			return *seq != old;
+		}
+		timeradd(&t, when, seq, now);
+	}
+	while(*seq == old && (t.queued || when == 0) && !myproc()->killed)
+		sleep(seq, &tq.lock);
+	r = *seq != old || t.queued || when == 0;
+	timerdel(&t);
+	release(&tq.lock);
+	return r;
+}
+
+// Change *seq and wake its sleepseq() callers.
+void
+wakeseq(uint *seq)
+{
+	acquire(&tq.lock);
+	(*seq)++;
+	wakeup(seq);
+	release(&tq.lock);
+}
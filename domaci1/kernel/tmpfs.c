@@ -0,0 +1,250 @@
+// tmpfs: a file system kept in memory.
+//
+// Its inodes carry device number TMPDEV and go through the inode
+// cache like any others, but fs.c hands their on-disk part to
+// the functions here: an inode is a struct tnode in tmpfs.node[],
+// and its data is in pages from kalloc(), found through an index
+// page. Nothing goes through the buffer cache or the log, so
+// callers need no transaction for tmpfs inodes. Every mount of a
+// tmpfs makes a new root directory; all of them share node[].
+//
+// tmpfs.lock protects type 0 (free) nodes and npage; the fields
+// of a node in use are protected by its inode's lock.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "stat.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define NINDEX (PGSIZE/sizeof(char*))
+
+struct tnode {
+	short type;     // 0 if free
+	short major;
+	short minor;
+	short nlink;
+	uint size;
+	char **page;    // page[i] holds bytes i*PGSIZE on; 0 if empty
+};
+
+static struct {
+	struct spinlock lock;
+	struct tnode node[NTMPNODE];  // node[0] is never used
+	int npage;                    // data pages in use
+} tmpfs;
+
+void
+tmpinit(void)
+{
+	initlock(&tmpfs.lock, "tmpfs");
+}
+
+// Claim a free node and give it type type.
+// Returns its inode number, or 0 if every node is in use.
+uint
+tmpalloc(short type)
+{
+	struct tnode *t;
+
+	acquire(&tmpfs.lock);
+	for(t = tmpfs.node+1; t < tmpfs.node+NTMPNODE; t++){
+		if(t->type == 0){
+			memset(t, 0, sizeof(*t));
+			t->type = type;
+			release(&tmpfs.lock);
+			return t - tmpfs.node;
+		}
+	}
+	release(&tmpfs.lock);
+	return 0;
+}
+
+// Fill in ip from its node, as ilock() does from the disk.
+void
+tmpload(struct inode *ip)
+{
+	struct tnode *t;
+
+	t = &tmpfs.node[ip->inum];
+	ip->type = t->type;
+	ip->major = t->major;
+	ip->minor = t->minor;
+	ip->nlink = t->nlink;
+	ip->size = t->size;
+}
+
+// Copy ip back to its node, as iupdate() does to the disk.
+// Type 0 frees the node.
+void
+tmpupdate(struct inode *ip)
+{
+	struct tnode *t;
+
+	t = &tmpfs.node[ip->inum];
+	t->major = ip->major;
+	t->minor = ip->minor;
+	t->nlink = ip->nlink;
+	t->size = ip->size;
+	if(ip->type == 0){
+		acquire(&tmpfs.lock);
+		t->type = 0;
+		release(&tmpfs.lock);
+	} else
+		t->type = ip->type;
+}
+
+// Return the kernel address of page pn of ip's data. If alloc,
+// allocate a missing page, zeroed, if the limit allows.
+static char*
+tmppage(struct inode *ip, uint pn, int alloc)
+{
+	struct tnode *t;
+	char *mem;
+
+	t = &tmpfs.node[ip->inum];
+	if(pn >= NINDEX)
+		return 0;
+	if(t->page == 0){
+		if(!alloc || (t->page = (char**)kalloc()) == 0)
+			return 0;
+		memset(t->page, 0, PGSIZE);
+	}
+	if(t->page[pn] || !alloc)
+		return t->page[pn];
+
+	acquire(&tmpfs.lock);
+	if(tmpfs.npage >= TMPFSMAX){
+		release(&tmpfs.lock);
+		return 0;
+	}
+	tmpfs.npage++;
+	release(&tmpfs.lock);
+	if((mem = kalloc()) == 0){
+		acquire(&tmpfs.lock);
+		tmpfs.npage--;
+		release(&tmpfs.lock);
+		return 0;
+	}
+	memset(mem, 0, PGSIZE);
+	t->page[pn] = mem;
+	return mem;
+}
+
+// Free ip's data.
+void
+tmptrunc(struct inode *ip)
+{
+	struct tnode *t;
+	int i, n;
+
+	t = &tmpfs.node[ip->inum];
+	if(t->page){
+		n = 0;
+		for(i = 0; i < NINDEX; i++){
+			if(t->page[i]){
+				kfree(t->page[i]);
+				n++;
+			}
+		}
+		kfree((char*)t->page);
+		t->page = 0;
+		acquire(&tmpfs.lock);
+		tmpfs.npage -= n;
+		release(&tmpfs.lock);
+	}
+	ip->size = 0;
+	tmpupdate(ip);
+}
+
+// readi() for tmpfs; off and n are already checked.
+int
+tmpread(struct inode *ip, char *dst, uint off, uint n)
+{
+	uint tot, m;
+
+	for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+		m = min(n - tot, PGSIZE - off%PGSIZE);
+		memmove(dst, tmppage(ip, off/PGSIZE, 0) + off%PGSIZE, m);
+	}
+	return n;
+}
+
+// writei() for tmpfs; off and n are already checked.
+int
+tmpwrite(struct inode *ip, char *src, uint off, uint n)
+{
+	uint tot, m;
+	char *p;
+
+	for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+		if((p = tmppage(ip, off/PGSIZE, 1)) == 0)
+			break;  // tmpfs is full
+		m = min(n - tot, PGSIZE - off%PGSIZE);
+		memmove(p + off%PGSIZE, src, m);
+	}
+
+	if(tot > 0 && off > ip->size){
+		ip->size = off;
+		tmpupdate(ip);
+	}
+	return tot > 0 || n == 0 ? tot : -1;
+}
+
+// copyi() when ip or dp is on tmpfs: the tmpfs side's pages are
+// the other side's source or destination, so nothing is copied
+// twice. off, doff and n are already checked.
+int
+tmpcopyi(struct inode *ip, uint off, struct inode *dp, uint doff, uint n)
+{
+	uint tot, m;
+	char *p;
+	int r;
+
+	for(tot=0; tot<n; tot+=m, off+=m, doff+=m){
+		if(ip->dev == TMPDEV){
+			m = min(n - tot, PGSIZE - off%PGSIZE);
+			p = tmppage(ip, off/PGSIZE, 0) + off%PGSIZE;
+			if((r = writei(dp, p, doff, m)) != m){
+				if(r > 0)
+					tot += r;
+				break;
+			}
+		} else {
+			if((p = tmppage(dp, doff/PGSIZE, 1)) == 0)
+				break;
+			m = min(n - tot, PGSIZE - doff%PGSIZE);
+			readi(ip, p + doff%PGSIZE, off, m);
+			if(doff + m > dp->size){
+				dp->size = doff + m;
+				tmpupdate(dp);
+			}
+		}
+	}
+	return tot > 0 || n == 0 ? tot : -1;
+}
+
+// Make the root directory of a new tmpfs.
+// Returns it unlocked and referenced, or 0.
+struct inode*
+tmproot(void)
+{
+	struct inode *ip;
+
+	if((ip = ialloc(TMPDEV, T_DIR, 0)) == 0)
+		return 0;
+	ilock(ip);
+	ip->nlink = 1;
+	iupdate(ip);
+	// ".." here is never used: namex() goes up from the
+	// directory the tmpfs is mounted on.
+	if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", ip->inum) < 0)
+		panic("tmproot");
+	iunlock(ip);
+	return ip;
+}
@@ -0,0 +1,107 @@
+// Event tracing.
+//
+// Tracepoints in the kernel (TRACE() in trace.h) record events
+// of the categories in tracemask, with the TSC, in a ring per
+// CPU. A CPU writes only its own ring, with interrupts off, and
+// takes no lock: it publishes a record by advancing w, and the
+// reader frees records by advancing r. A full ring drops new
+// records and counts them. While tracemask is 0, a tracepoint is
+// one load and a branch.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "trace.h"
+
+uint tracemask;
+
+static struct {
+	struct traceev ev[NTRACE];
+	volatile uint r;     // next record to read; only traceread() moves it
+	volatile uint w;     // next record to write; only the CPU moves it
+	uint lost;           // records dropped because the ring was full
+} __attribute__((aligned(64))) ring[NCPU];
+
+static struct spinlock readlock;  // one reader at a time
+
+void
+traceinit(void)
+{
+	initlock(&readlock, "trace");
+}
+
+// Record an event on this CPU. Callable from anywhere.
+void
+traceev(int type, uint arg)
+{
+	struct traceev *e;
+	struct proc *p;
+	int c;
+
+	pushcli();
+	c = cpuid();
+	if(ring[c].w - ring[c].r == NTRACE)
+		ring[c].lost++;
+	else {
+		e = &ring[c].ev[ring[c].w % NTRACE];
+		e->tsc = rdtsc();
+		e->arg = arg;
+		p = mycpu()->proc;
+		e->pid = p ? p->pid : 0;
+		e->cpu = c;
+		e->type = type;
+		__sync_synchronize();
+		ring[c].w++;
+	}
+	popcli();
+}
+
+// Trace the categories in mask, or nothing if mask is 0. Turning
+// tracing on empties the rings. Turning it off returns the number
+// of records dropped since it was turned on.
+int
+tracectl(uint mask)
+{
+	int i, lost;
+
+	acquire(&readlock);
+	if(mask && !tracemask){
+		for(i = 0; i < NCPU; i++){
+			ring[i].r = ring[i].w;
+			ring[i].lost = 0;
+		}
+	}
+	lost = 0;
+	for(i = 0; i < NCPU; i++)
+		lost += ring[i].lost;
+	tracemask = mask;
+	release(&readlock);
+	return mask ? 0 : lost;
+}
+
+// Move up to n records into dst, which argptr() has checked,
+// each CPU's in order. Returns the number moved.
+int
+traceread(struct traceev *dst, int n)
+{
+	uint r, w;
+	int i, m;
+
+	m = 0;
+	acquire(&readlock);
+	for(i = 0; i < NCPU && m < n; i++){
+		r = ring[i].r;
+		w = ring[i].w;
+		__sync_synchronize();
+		while(r != w && m < n)
+			dst[m++] = ring[i].ev[r++ % NTRACE];
+		__sync_synchronize();
+		ring[i].r = r;
+	}
+	release(&readlock);
+	return m;
+}
@@ -0,0 +1,36 @@
+// Kernel event tracing; see trace.c. trace(mask) turns on the
+// categories in mask, and traceread() returns struct traceevs.
+
+// Categories.
+#define TC_SCHED    0x01  // context switches
+#define TC_SLEEP    0x02  // sleep() and wakeup()
+#define TC_DISK     0x04  // IDE requests
+#define TC_LOG      0x08  // begin_op() and log commits
+#define TC_SYSCALL  0x10  // system call entry and exit
+#define TC_ALL      0x1f
+
+// Events, and what arg is for each.
+#define TE_SWITCH   1   // scheduler() runs pid
+#define TE_SCHED    2   // pid gives up the CPU; arg: its new state
+#define TE_SLEEP    3   // pid sleeps; arg: the channel
+#define TE_WAKEUP   4   // arg: the pid made runnable
+#define TE_IDEREQ   5   // arg: block queued for the disk
+#define TE_IDEDONE  6   // arg: block whose transfer finished
+#define TE_BEGINOP  7   // arg: operations already outstanding
+#define TE_COMMIT   8   // arg: blocks in the log
+#define TE_SYSCALL  9   // arg: system call number
+#define TE_SYSRET   10  // arg: the value returned
+
+struct traceev {
+	uint64 tsc;   // rdtsc() when it happened
+	uint arg;
+	ushort pid;   // 0 if no process was running
+	uchar cpu;
+	uchar type;   // TE_*
+};
+
+// A tracepoint: a load and a test while its category is off.
+#define TRACE(cat, type, arg) do { \
+	if(tracemask & (cat)) \
+		traceev((type), (uint)(arg)); \
+} while(0)
@@ -32,10 +32,30 @@ idtinit(void)
 	lidt(idt, sizeof(idt));
 }
 
+// An invalid opcode trap from a SYSENTER in a usys.S stub, on a
+// CPU without it: set tf up as sysentry would have and return 1.
+static int
+sysenterfault(struct trapframe *tf)
+{
+	if((tf->cs&3) != DPL_USER)
+		return 0;
+	sti();  // as for int $T_SYSCALL, a trap gate
+	if(uvmaccess(myproc()->mm, tf->eip, 2) < 0 || *(ushort*)tf->eip != 0x340f){
+		cli();
+		return 0;
+	}
+	tf->eip = tf->edx;
+	tf->esp = tf->ecx;
+	return 1;
+}
+
 void
 trap(struct trapframe *tf)
 {
-	if(tf->trapno == T_SYSCALL){
+	int tick;
+	uint va;
+
+	if(tf->trapno == T_SYSCALL || (tf->trapno == T_ILLOP && sysenterfault(tf))){
 		if(myproc()->killed)
 			exit();
 		myproc()->tf = tf;
@@ -45,15 +65,24 @@ trap(struct trapframe *tf)
 		return;
 	}
 
+	tick = 0;
+	if(tf->trapno >= T_IRQ0 && tf->trapno < T_IRQ0 + NIRQ)
+		irqcount(tf->trapno - T_IRQ0);
 	switch(tf->trapno){
 	case T_IRQ0 + IRQ_TIMER:
-		if(cpuid() == 0){
-			acquire(&tickslock);
-			ticks++;
-			wakeup(&ticks);
-			release(&tickslock);
+		if(profiling)
+			profsample(tf);
+		tick = timerintr();
+		if(tick && myproc()){
+			if((tf->cs&3) == DPL_USER)
+				myproc()->utime++;
+			else
+				myproc()->stime++;
+			mycpu()->busyticks++;
 		}
 		lapiceoi();
+		if(tick)
+			irqbalancer();
 		break;
 	case T_IRQ0 + IRQ_IDE:
 		ideintr();
@@ -70,6 +99,14 @@ trap(struct trapframe *tf)
 		uartintr();
 		lapiceoi();
 		break;
+	case T_IRQ0 + IRQ_WAKEUP:
+		// Only wakes a halted scheduler().
+		lapiceoi();
+		break;
+	case T_IRQ0 + IRQ_TLB:
+		tlbintr();
+		lapiceoi();
+		break;
 	case T_IRQ0 + 7:
 	case T_IRQ0 + IRQ_SPURIOUS:
 		cprintf("cpu%d: spurious interrupt at %x:%x\n",
@@ -77,6 +114,22 @@ trap(struct trapframe *tf)
 		lapiceoi();
 		break;
 
+	case T_PGFLT:
+		// A store to a copy-on-write page or the first touch
+		// of a mapped page, by the process or by the kernel
+		// using the process's memory. A fault from user space
+		// is handled with interrupts on, as a system call is,
+		// so that tlbshoot() can wait for the other CPUs.
+		va = rcr2();
+		if(myproc())
+			myproc()->nfault++;
+		if((tf->cs&3) == DPL_USER)
+			sti();
+		if(myproc() && pagefault(myproc()->mm, va, tf->err,
+		   (tf->cs&3) == DPL_USER) == 0)
+			break;
+		cli();
+		// fall through
 	default:
 		if(myproc() == 0 || (tf->cs&3) == 0){
 			// In kernel, it must be our mistake.
@@ -100,9 +153,8 @@ trap(struct trapframe *tf)
 
 	// Force process to give up CPU on clock tick.
 	// If interrupts were on while locks held, would need to check nlock.
-	if(myproc() && myproc()->state == RUNNING &&
-			tf->trapno == T_IRQ0+IRQ_TIMER)
-		yield();
+	if(myproc() && myproc()->state == RUNNING && tick)
+		schedtick();
 
 	// Check if the process has been killed since we yielded
 	if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
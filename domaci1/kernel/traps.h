@@ -34,5 +34,9 @@
 #define IRQ_COM1         4
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
+#define IRQ_WAKEUP      20  // IPI to a halted CPU: there is work
+#define IRQ_TLB         21  // IPI: flush the TLB, see tlbshoot()
 #define IRQ_SPURIOUS    31
 
+#define NIRQ            24  // I/O APIC interrupts the kernel keeps track of
+
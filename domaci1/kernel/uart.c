@@ -1,4 +1,10 @@
 // Intel 8250 serial port (UART).
+//
+// Output is queued in uarttx and fed to the transmitter from the
+// THR-empty interrupt, so writers only wait when the queue is full.
+// Kernel printing (uartputc) never sleeps: with a full queue it
+// falls back to polling the transmitter. consolewrite() uses
+// uartwrite(), which sleeps until uartintr() makes room.
 
 #include "types.h"
 #include "defs.h"
@@ -14,15 +20,29 @@
 
 #define COM1    0x3f8
 
+#define UART_TXBUF  1024  // size of transmit queue
+
 static int uart;    // is there a uart?
+static int fifo;    // bytes the transmitter takes per THR-empty
+static int polling; // set by uartsync(): bypass the queue
+
+static struct {
+	struct spinlock lock;
+	char buf[UART_TXBUF];
+	uint r;  // Next byte to send
+	uint w;  // Next free slot
+} uarttx;
 
 void
 uartinit(void)
 {
 	char *p;
 
-	// Turn off the FIFO
-	outb(COM1+2, 0);
+	initlock(&uarttx.lock, "uart");
+
+	// Enable and reset the FIFOs; a 16550 then takes 16 bytes
+	// per THR-empty instead of one.
+	outb(COM1+2, 0x07);
 
 	// 9600 baud, 8 data bits, 1 stop bit, parity off.
 	outb(COM1+3, 0x80);    // Unlock divisor
@@ -30,12 +50,13 @@ uartinit(void)
 	outb(COM1+1, 0);
 	outb(COM1+3, 0x03);    // Lock divisor, 8 data bits.
 	outb(COM1+4, 0);
-	outb(COM1+1, 0x01);    // Enable receive interrupts.
+	outb(COM1+1, 0x03);    // Enable receive and THR-empty interrupts.
 
 	// If status is 0xFF, no serial port.
 	if(inb(COM1+5) == 0xFF)
 		return;
 	uart = 1;
+	fifo = (inb(COM1+2) & 0xC0) == 0xC0 ? 16 : 1;
 
 	// Acknowledge pre-existing interrupt conditions;
 	// enable interrupts.
@@ -48,6 +69,21 @@ uartinit(void)
 		uartputc(*p);
 }
 
+// Move queued bytes into the transmitter while it has room.
+// Caller holds uarttx.lock (or has interrupts off and is panicking).
+static void
+uartstart(void)
+{
+	int i;
+
+	if(uarttx.r == uarttx.w || !(inb(COM1+5) & 0x20))
+		return;
+	for(i = 0; i < fifo && uarttx.r != uarttx.w; i++)
+		outb(COM1+0, uarttx.buf[uarttx.r++ % UART_TXBUF]);
+}
+
+// Queue c for output without sleeping. Used by cprintf and
+// console echo, which run with cons.lock held.
 void
 uartputc(int c)
 {
@@ -55,9 +91,73 @@ uartputc(int c)
 
 	if(!uart)
 		return;
-	for(i = 0; i < 128 && !(inb(COM1+5) & 0x20); i++)
-		microdelay(10);
-	outb(COM1+0, c);
+	if(polling){
+		for(i = 0; i < 128 && !(inb(COM1+5) & 0x20); i++)
+			microdelay(10);
+		outb(COM1+0, c);
+		return;
+	}
+	acquire(&uarttx.lock);
+	for(i = 0; uarttx.w == uarttx.r + UART_TXBUF; i++){
+		// Queue full: wait for the transmitter by polling,
+		// as the original driver did for every byte.
+		uartstart();
+		if(uarttx.w == uarttx.r + UART_TXBUF){
+			if(i >= 128){
+				uarttx.r++;  // Transmitter wedged; drop the oldest byte.
+				break;
+			}
+			microdelay(10);
+		}
+	}
+	uarttx.buf[uarttx.w++ % UART_TXBUF] = c;
+	uartstart();
+	release(&uarttx.lock);
+}
+
+// Queue n bytes of process output, sleeping while the queue is full.
+// The caller must not hold any other spinlock.
+void
+uartwrite(char *s, int n)
+{
+	int i;
+
+	if(!uart)
+		return;
+	acquire(&uarttx.lock);
+	for(i = 0; i < n; i++){
+		while(uarttx.w == uarttx.r + UART_TXBUF){
+			uartstart();
+			if(uarttx.w != uarttx.r + UART_TXBUF)
+				break;
+			if(myproc() == 0 || myproc()->killed){
+				release(&uarttx.lock);
+				return;
+			}
+			sleep(&uarttx.r, &uarttx.lock);
+		}
+		uarttx.buf[uarttx.w++ % UART_TXBUF] = s[i];
+	}
+	uartstart();
+	release(&uarttx.lock);
+}
+
+// Push everything still queued out by polling, and have
+// uartputc() poll from now on. Called by panic() with
+// interrupts off; takes no lock in case this CPU holds it.
+void
+uartsync(void)
+{
+	int i;
+
+	if(!uart)
+		return;
+	polling = 1;
+	while(uarttx.r != uarttx.w){
+		for(i = 0; i < 128 && !(inb(COM1+5) & 0x20); i++)
+			microdelay(10);
+		outb(COM1+0, uarttx.buf[uarttx.r++ % UART_TXBUF]);
+	}
 }
 
 static int
@@ -73,5 +173,19 @@ uartgetc(void)
 void
 uartintr(void)
 {
-	consoleintr(uartgetc);
+	int i;
+
+	// The IRQ is edge triggered, so service every pending
+	// cause (IIR bit 0 clear) or the line stays raised and
+	// no further interrupt arrives. Reading IIR acknowledges
+	// THR-empty; reading the data register acknowledges input.
+	for(i = 0; i < 16 && uart && !(inb(COM1+2) & 0x01); i++){
+		consoleintr(uartgetc);
+		acquire(&uarttx.lock);
+		uartstart();
+		wakeup(&uarttx.r);
+		release(&uarttx.lock);
+	}
+	if(i == 0)
+		consoleintr(uartgetc);
 }
@@ -0,0 +1,7 @@
+#define IOV_MAX 16  // max segments per readv() or writev()
+
+// One segment of a readv() or writev().
+struct iovec {
+	void *base;  // Start of the segment
+	int len;     // Bytes in it
+};
@@ -5,10 +5,23 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "mm.h"
+#include "traps.h"
 #include "elf.h"
 
 extern char data[];  // defined by kernel.ld
+extern void sysentry(void);  // in trapasm.S
 pde_t *kpgdir;  // for use in scheduler()
+static int sysenterok;  // the CPUs have SYSENTER
+
+// Pages uvmunmap() frees per tlbshoot().
+#define NUNMAP 64
+
+// The page table for PGMAPBASE..PGMAPBASE+4MB, so a pgmap()
+// window is seen in every page table.
+static pte_t *pgmappt;
 
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
@@ -16,6 +29,7 @@ void
 seginit(void)
 {
 	struct cpu *c;
+	uint a, b, cc, d;
 
 	// Map "logical" addresses to virtual addresses using identity map.
 	// Cannot share a CODE descriptor for both kernel and user
@@ -27,6 +41,18 @@ seginit(void)
 	c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
 	c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
 	lgdt(c->gdt, sizeof(c->gdt));
+
+	// SYSENTER loads cs from MSR_SYSENTER_CS and ss from the
+	// descriptor after it, and SYSEXIT the user ones from the
+	// two after that, which is the order of the segments above.
+	// switchuvm() points MSR_SYSENTER_ESP at the kernel stack.
+	cpuidx(1, &a, &b, &cc, &d);
+	if(d & CPUID_SEP){
+		sysenterok = 1;
+		wrmsr(MSR_SYSENTER_CS, SEG_KCODE<<3);
+		wrmsr(MSR_SYSENTER_ESP, 0);
+		wrmsr(MSR_SYSENTER_EIP, (uint)sysentry);
+	}
 }
 
 // Return the address of the PTE in page table pgdir
@@ -48,8 +74,12 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
 		memset(pgtab, 0, PGSIZE);
 		// The permissions here are overly generous, but they can
 		// be further restricted by the permissions in the page table
-		// entries, if necessary.
-		*pde = V2P(pgtab) | PTE_P | PTE_W | PTE_U;
+		// entries, if necessary. Another thread of the process
+		// may be filling in the same table.
+		if(!__sync_bool_compare_and_swap(pde, 0, V2P(pgtab) | PTE_P | PTE_W | PTE_U)){
+			kfree((char*)pgtab);
+			pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
+		}
 	}
 	return &pgtab[PTX(va)];
 }
@@ -85,6 +115,9 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 // page protection bits prevent user code from using the kernel's
 // mappings.
 //
+// kvmalloc() builds the kernel's part once, in kpgdir, using 4MB
+// pages where the mapping allows; setupkvm() copies its PDEs, so
+// all page tables share the kernel's page table pages.
 // setupkvm() and exec() set up every page table like this:
 //
 //   0..KERNBASE: user memory (text+data+stack+heap), mapped to
@@ -94,14 +127,17 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //                for the kernel's instructions and r/o data
 //   data..KERNBASE+PHYSTOP: mapped to V2P(data)..PHYSTOP,
 //                                  rw data + free physical memory
+//   PGMAPBASE..PGMAPBASE+4MB: pgmap() windows onto high memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
 // The kernel allocates physical memory for its heap and for user memory
-// between V2P(end) and the end of physical memory (PHYSTOP)
-// (directly addressable from end..P2V(PHYSTOP)).
+// between V2P(end) and PHYSTOP (directly addressable from
+// end..P2V(PHYSTOP)). RAM above PHYSTOP holds only user pages,
+// which the kernel reaches through pgmap().
 
 // This table defines the kernel's mappings, which are present in
-// every process's page table.
+// every process's page table. They are global (PTE_G), so their
+// TLB entries survive the cr3 load of a context switch.
 static struct kmap {
 	void *virt;
 	uint phys_start;
@@ -114,24 +150,44 @@ static struct kmap {
 	{ (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
+// Like mappages(), for the kernel's part of kpgdir: each 4MB
+// of the range that va and pa are both aligned to gets a single
+// large page (PTE_PS) instead of a page table page.
+static int
+kmappages(pde_t *pgdir, char *va, uint size, uint pa, int perm)
+{
+	uint n;
+
+	while(size > 0){
+		if((uint)va % (1<<PDXSHIFT) == 0 && pa % (1<<PDXSHIFT) == 0 &&
+		   size >= (1<<PDXSHIFT)){
+			if(pgdir[PDX(va)] & PTE_P)
+				panic("remap");
+			pgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS;
+			n = 1<<PDXSHIFT;
+		} else {
+			if(mappages(pgdir, va, PGSIZE, pa, perm) < 0)
+				return -1;
+			n = PGSIZE;
+		}
+		va += n;
+		pa += n;
+		size -= n;
+	}
+	return 0;
+}
+
 // Set up kernel part of a page table.
 pde_t*
 setupkvm(void)
 {
 	pde_t *pgdir;
-	struct kmap *k;
 
 	if((pgdir = (pde_t*)kalloc()) == 0)
 		return 0;
 	memset(pgdir, 0, PGSIZE);
-	if (P2V(PHYSTOP) > (void*)DEVSPACE)
-		panic("PHYSTOP too high");
-	for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-		if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-		            (uint)k->phys_start, k->perm) < 0) {
-			freevm(pgdir);
-			return 0;
-		}
+	memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+	        (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
 	return pgdir;
 }
 
@@ -140,16 +196,109 @@ setupkvm(void)
 void
 kvmalloc(void)
 {
-	kpgdir = setupkvm();
+	struct kmap *k;
+
+	if (P2V(PHYSTOP) > (void*)PGMAPBASE)
+		panic("PHYSTOP too high");
+	if((kpgdir = (pde_t*)kalloc()) == 0 || (pgmappt = (pte_t*)kalloc()) == 0)
+		panic("kvmalloc");
+	memset(kpgdir, 0, PGSIZE);
+	memset(pgmappt, 0, PGSIZE);
+	for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+		if(kmappages(kpgdir, k->virt, k->phys_end - k->phys_start,
+		             (uint)k->phys_start, k->perm | PTE_G) < 0)
+			panic("kvmalloc: map");
+	kpgdir[PDX(PGMAPBASE)] = V2P(pgmappt) | PTE_P | PTE_W;
+	kvmstart();
+}
+
+// Turn on global pages and switch to kpgdir on this CPU.
+void
+kvmstart(void)
+{
+	lcr4(rcr4() | CR4_PGE);
 	switchkvm();
 }
 
+// Load pgdir into %cr3, which also does every TLB flush asked
+// of this CPU so far. Interrupts must be off.
+static void
+loadpgdir(pde_t *pgdir)
+{
+	struct cpu *c;
+	uint req;
+
+	c = mycpu();
+	req = c->tlbreq;
+	c->pgdir = pgdir;
+	lcr3(V2P(pgdir));
+	c->tlbdone = req;
+}
+
+// Flush the TLB entries for the user part of pgdir, whose
+// entries were just changed, on every CPU that is using it.
+// With interrupts on, wait until all have done so; the caller
+// may then free the pages that were unmapped. With interrupts
+// off, as for a store by the kernel holding a spinlock, the
+// others are only asked: two CPUs waiting for each other with
+// interrupts off would never finish.
+void
+tlbshoot(pde_t *pgdir)
+{
+	struct cpu *c, *me;
+	uint want[NCPU], sent;
+	int wait;
+
+	wait = (readeflags() & FL_IF) != 0;
+	pushcli();
+	me = mycpu();
+	if(me->pgdir == pgdir)
+		lcr3(V2P(pgdir));
+	__sync_synchronize();
+	sent = 0;
+	for(c = cpus; c < cpus+ncpu; c++){
+		if(c == me || c->pgdir != pgdir)
+			continue;
+		want[c-cpus] = __sync_add_and_fetch(&c->tlbreq, 1);
+		sent |= 1u << (c-cpus);
+		lapicipi(c->apicid, T_IRQ0 + IRQ_TLB);
+	}
+	popcli();
+	if(!wait)
+		return;
+	// Wait only for the CPUs asked above: one that loaded pgdir
+	// since did so after the change, and me may be stale now.
+	for(c = cpus; c < cpus+ncpu; c++){
+		if(!(sent & (1u << (c-cpus))))
+			continue;
+		// A CPU that loads another page table meanwhile has
+		// flushed its TLB too.
+		while(c->pgdir == pgdir && (int)(c->tlbdone - want[c-cpus]) < 0)
+			;
+	}
+}
+
+// Interrupt from tlbshoot().
+void
+tlbintr(void)
+{
+	struct cpu *c;
+	uint req;
+
+	c = mycpu();
+	req = c->tlbreq;
+	lcr3(rcr3());
+	c->tlbdone = req;
+}
+
 // Switch h/w page table register to the kernel-only page table,
 // for when no process is running.
 void
 switchkvm(void)
 {
-	lcr3(V2P(kpgdir));   // switch to the kernel page table
+	pushcli();
+	loadpgdir(kpgdir);   // switch to the kernel page table
+	popcli();
 }
 
 // Switch TSS and h/w page table to correspond to process p.
@@ -160,7 +309,7 @@ switchuvm(struct proc *p)
 		panic("switchuvm: no process");
 	if(p->kstack == 0)
 		panic("switchuvm: no kstack");
-	if(p->pgdir == 0)
+	if(p->mm == 0 || p->mm->pgdir == 0)
 		panic("switchuvm: no pgdir");
 
 	pushcli();
@@ -173,7 +322,9 @@ switchuvm(struct proc *p)
 	// forbids I/O instructions (e.g., inb and outb) from user space
 	mycpu()->ts.iomb = (ushort) 0xFFFF;
 	ltr(SEG_TSS << 3);
-	lcr3(V2P(p->pgdir));  // switch to process's address space
+	if(sysenterok)
+		wrmsr(MSR_SYSENTER_ESP, (uint)p->kstack + KSTACKSIZE);
+	loadpgdir(p->mm->pgdir);  // switch to process's address space
 	popcli();
 }
 
@@ -192,30 +343,6 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 	memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
-int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
-{
-	uint i, pa, n;
-	pte_t *pte;
-
-	if((uint) addr % PGSIZE != 0)
-		panic("loaduvm: addr must be page aligned");
-	for(i = 0; i < sz; i += PGSIZE){
-		if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
-			panic("loaduvm: address should exist");
-		pa = PTE_ADDR(*pte);
-		if(sz - i < PGSIZE)
-			n = sz - i;
-		else
-			n = PGSIZE;
-		if(readi(ip, P2V(pa), offset+i, n) != n)
-			return -1;
-	}
-	return 0;
-}
-
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 int
@@ -270,16 +397,39 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 			pa = PTE_ADDR(*pte);
 			if(pa == 0)
 				panic("kfree");
-			char *v = P2V(pa);
-			kfree(v);
+			pfree(pa);
 			*pte = 0;
 		}
 	}
 	return newsz;
 }
 
+// Remove the user pages in [start, end) from pgdir, which
+// other CPUs may be using, and free them once no TLB can still
+// hold them. Must be called with interrupts on.
+void
+uvmunmap(pde_t *pgdir, uint start, uint end)
+{
+	pte_t *pte;
+	uint a, pa[NUNMAP];
+	int i, n;
+
+	a = PGROUNDUP(start);
+	while(a < end){
+		for(n = 0; a < end && n < NUNMAP; a += PGSIZE){
+			if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0)
+				a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+			else if((*pte & PTE_P) && (pa[n] = PTE_ADDR(xchg(pte, 0))) != 0)
+				n++;
+		}
+		tlbshoot(pgdir);
+		for(i = 0; i < n; i++)
+			pfree(pa[i]);
+	}
+}
+
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part. The kernel part belongs to kpgdir.
 void
 freevm(pde_t *pgdir)
 {
@@ -288,7 +438,7 @@ freevm(pde_t *pgdir)
 	if(pgdir == 0)
 		panic("freevm: no pgdir");
 	deallocuvm(pgdir, KERNBASE, 0);
-	for(i = 0; i < NPDENTRIES; i++){
+	for(i = 0; i < PDX(KERNBASE); i++){
 		if(pgdir[i] & PTE_P){
 			char * v = P2V(PTE_ADDR(pgdir[i]));
 			kfree(v);
@@ -311,75 +461,258 @@ clearpteu(pde_t *pgdir, char *uva)
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. The pages are shared copy-on-write.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
 	pde_t *d;
-	pte_t *pte;
-	uint pa, i, flags;
-	char *mem;
 
 	if((d = setupkvm()) == 0)
 		return 0;
-	for(i = 0; i < sz; i += PGSIZE){
-		if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-			panic("copyuvm: pte should exist");
+	if(uvmcopy(pgdir, d, 0, sz) < 0){
+		freevm(d);
+		return 0;
+	}
+	return d;
+}
+
+// Share the pages present in [start, end) of pgdir, which
+// must be the current page table, with d at the same
+// addresses. Writable pages become read-only and PTE_COW in
+// both, so that the first store to one copies it.
+int
+uvmcopy(pde_t *pgdir, pde_t *d, uint start, uint end)
+{
+	pte_t *pte, *npte;
+	uint a, old, new;
+
+	for(a = start; a < end; a += PGSIZE){
+		if((pte = walkpgdir(pgdir, (void*)a, 0)) == 0){
+			a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+			continue;
+		}
 		if(!(*pte & PTE_P))
-			panic("copyuvm: page not present");
-		pa = PTE_ADDR(*pte);
-		flags = PTE_FLAGS(*pte);
-		if((mem = kalloc()) == 0)
-			goto bad;
-		memmove(mem, (char*)P2V(pa), PGSIZE);
-		if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-			kfree(mem);
-			goto bad;
+			continue;
+		if((npte = walkpgdir(d, (void*)a, 1)) == 0){
+			tlbshoot(pgdir);
+			return -1;
 		}
+		do {
+			old = *pte;
+			new = old & PTE_W ? (old & ~PTE_W) | PTE_COW : old;
+		} while(!__sync_bool_compare_and_swap(pte, old, new));
+		*npte = new;
+		pincref(PTE_ADDR(new));
 	}
-	return d;
+	tlbshoot(pgdir);
+	return 0;
+}
 
-bad:
-	freevm(d);
+// Map the physical page pa at page-aligned user address va
+// with permissions perm, unless va is mapped already. Returns
+// 0 if pa was mapped, 1 if va was mapped already, and -1 if
+// there was no memory for a page table.
+int
+uvmmap(pde_t *pgdir, uint va, uint pa, int perm)
+{
+	pte_t *pte, old;
+
+	if((pte = walkpgdir(pgdir, (void*)va, 1)) == 0)
+		return -1;
+	old = *pte;
+	if((old & PTE_P) ||
+	   !__sync_bool_compare_and_swap(pte, old, pa | perm | PTE_P))
+		return 1;
 	return 0;
 }
 
-// Map user virtual address to kernel address.
-char*
-uva2ka(pde_t *pgdir, char *uva)
+// Is there a page at user address va?
+int
+uvmpresent(pde_t *pgdir, uint va)
 {
 	pte_t *pte;
 
+	pte = walkpgdir(pgdir, (void*)va, 0);
+	return pte != 0 && (*pte & PTE_P) != 0;
+}
+
+// Replace the user page at page-aligned uva with the page
+// mem, shared read-only and copy-on-write. Takes over the
+// caller's reference to mem. The caller flushes the TLB.
+// Returns -1 if uva is not a present user page.
+int
+mapcow(pde_t *pgdir, char *uva, char *mem)
+{
+	pte_t *pte;
+	uint pa;
+
 	pte = walkpgdir(pgdir, uva, 0);
-	if((*pte & PTE_P) == 0)
+	if(pte == 0 || (*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+		return -1;
+	pa = PTE_ADDR(*pte);
+	*pte = V2P(mem) | PTE_P | PTE_U | PTE_COW;
+	pfree(pa);
+	return 0;
+}
+
+// Handle a store to the copy-on-write page at va, in the
+// current page table pgdir, by giving it a private writable
+// copy. Returns -1 if va is not such a page or memory ran out.
+// Another thread may have done it first, from its stale
+// read-only TLB entry; then there is nothing left to do.
+int
+cowfault(pde_t *pgdir, uint va)
+{
+	pte_t *pte, old;
+	uint pa, npa, flags;
+
+	pte = walkpgdir(pgdir, (void*)va, 0);
+	if(pte == 0)
+		return -1;
+	old = *pte;
+	if((old & (PTE_P|PTE_U|PTE_W)) == (PTE_P|PTE_U|PTE_W)){
+		lcr3(V2P(pgdir));
+		return 0;
+	}
+	if((old & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U|PTE_COW))
+		return -1;
+	pa = PTE_ADDR(old);
+	flags = (PTE_FLAGS(old) | PTE_W) & ~PTE_COW;
+	if(pref(pa) == 1){
+		// Last user of the page: take it over.
+		__sync_bool_compare_and_swap(pte, old, pa | flags);
+		lcr3(V2P(pgdir));
+		return 0;
+	}
+	if((npa = palloc()) == 0)
+		return -1;
+	pgcopy(npa, pa);
+	if(!__sync_bool_compare_and_swap(pte, old, npa | flags)){
+		pfree(npa);
+		lcr3(V2P(pgdir));
+		return 0;
+	}
+	// Other threads must stop reading pa before it is given
+	// back, since its other user may then write it in place.
+	tlbshoot(pgdir);
+	pfree(pa);
+	return 0;
+}
+
+// Map user virtual address to physical address, or 0
+// if uva is not a present PTE_U page.
+static uint
+uva2pa(pde_t *pgdir, char *uva)
+{
+	pte_t *pte;
+
+	pte = walkpgdir(pgdir, uva, 0);
+	if(pte == 0 || (*pte & PTE_P) == 0)
 		return 0;
 	if((*pte & PTE_U) == 0)
 		return 0;
-	return (char*)P2V(PTE_ADDR(*pte));
+	return PTE_ADDR(*pte);
+}
+
+// Map user virtual address to kernel address. Returns 0 for
+// pages in high memory, which the kernel does not map.
+char*
+uva2ka(pde_t *pgdir, char *uva)
+{
+	uint pa;
+
+	if((pa = uva2pa(pgdir, uva)) == 0 || pa >= PHYSTOP)
+		return 0;
+	return (char*)P2V(pa);
 }
 
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
-// uva2ka ensures this only works for PTE_U pages.
+// uva2pa ensures this only works for PTE_U pages.
 int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
-	char *buf, *pa0;
-	uint n, va0;
+	char *buf, *ka0;
+	uint n, va0, pa0;
 
 	buf = (char*)p;
 	while(len > 0){
 		va0 = (uint)PGROUNDDOWN(va);
-		pa0 = uva2ka(pgdir, (char*)va0);
+		pa0 = uva2pa(pgdir, (char*)va0);
 		if(pa0 == 0)
 			return -1;
 		n = PGSIZE - (va - va0);
 		if(n > len)
 			n = len;
-		memmove(pa0 + (va - va0), buf, n);
+		ka0 = pgmap(pa0);
+		memmove(ka0 + (va - va0), buf, n);
+		pgunmap(ka0);
 		len -= n;
 		buf += n;
 		va = va0 + PGSIZE;
 	}
 	return 0;
 }
+
+// Return a kernel address for the physical page pa. Pages
+// below PHYSTOP are always mapped; a page above it gets one of
+// this CPU's PGMAPSLOTS windows. Interrupts stay off until the
+// matching pgunmap(), so the caller must not sleep in between.
+char*
+pgmap(uint pa)
+{
+	struct cpu *c;
+	char *v;
+
+	pushcli();
+	if(pa < PHYSTOP)
+		return P2V(pa);
+	c = mycpu();
+	if(c->npgmap >= PGMAPSLOTS)
+		panic("pgmap");
+	v = (char*)PGMAPBASE + ((c - cpus)*PGMAPSLOTS + c->npgmap++)*PGSIZE;
+	pgmappt[PTX(v)] = pa | PTE_P | PTE_W;
+	return v;
+}
+
+// Give back the address v returned by the last pgmap().
+void
+pgunmap(char *v)
+{
+	struct cpu *c;
+
+	if((uint)v >= PGMAPBASE && (uint)v < PGMAPBASE + (1<<PDXSHIFT)){
+		c = mycpu();
+		if(c->npgmap == 0 || v != (char*)PGMAPBASE +
+		   ((c - cpus)*PGMAPSLOTS + c->npgmap - 1)*PGSIZE)
+			panic("pgunmap");
+		c->npgmap--;
+		pgmappt[PTX(v)] = 0;
+		invlpg(v);
+	}
+	popcli();
+}
+
+// Fill the physical page pa with zeros.
+void
+pgzero(uint pa)
+{
+	char *v;
+
+	v = pgmap(pa);
+	memset(v, 0, PGSIZE);
+	pgunmap(v);
+}
+
+// Copy the physical page src to dst.
+void
+pgcopy(uint dst, uint src)
+{
+	char *d, *s;
+
+	d = pgmap(dst);
+	s = pgmap(src);
+	memmove(d, s, PGSIZE);
+	pgunmap(s);
+	pgunmap(d);
+}
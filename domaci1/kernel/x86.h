@@ -9,6 +9,15 @@ inb(ushort port)
 	return data;
 }
 
+static inline uint
+inl(ushort port)
+{
+	uint data;
+
+	asm volatile("in %1,%0" : "=a" (data) : "d" (port));
+	return data;
+}
+
 static inline void
 insl(int port, void *addr, int cnt)
 {
@@ -30,6 +39,12 @@ outw(ushort port, ushort data)
 	asm volatile("out %0,%1" : : "a" (data), "d" (port));
 }
 
+static inline void
+outl(ushort port, uint data)
+{
+	asm volatile("out %0,%1" : : "a" (data), "d" (port));
+}
+
 static inline void
 outsl(int port, const void *addr, int cnt)
 {
@@ -57,6 +72,24 @@ stosl(void *addr, int data, int cnt)
 		     "memory", "cc");
 }
 
+static inline void
+movsb(void *dst, const void *src, int cnt)
+{
+	asm volatile("cld; rep movsb" :
+		     "=D" (dst), "=S" (src), "=c" (cnt) :
+		     "0" (dst), "1" (src), "2" (cnt) :
+		     "memory", "cc");
+}
+
+static inline void
+movsl(void *dst, const void *src, int cnt)
+{
+	asm volatile("cld; rep movsl" :
+		     "=D" (dst), "=S" (src), "=c" (cnt) :
+		     "0" (dst), "1" (src), "2" (cnt) :
+		     "memory", "cc");
+}
+
 static inline void
 lgdt(segdesc *p, int size)
 {
@@ -113,6 +146,14 @@ sti(void)
 	asm volatile("sti");
 }
 
+// Enable interrupts and wait for one. sti takes effect after
+// the next instruction, so none can slip in before the hlt.
+static inline void
+stihlt(void)
+{
+	asm volatile("sti; hlt");
+}
+
 static inline uint
 xchg(volatile uint *addr, uint newval)
 {
@@ -126,6 +167,13 @@ xchg(volatile uint *addr, uint newval)
 	return result;
 }
 
+// Hint to the processor that this is a spin-wait loop.
+static inline void
+pause(void)
+{
+	asm volatile("pause");
+}
+
 static inline uint
 rcr2(void)
 {
@@ -140,6 +188,74 @@ lcr3(uint val)
 	asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+static inline uint
+rcr3(void)
+{
+	uint val;
+	asm volatile("movl %%cr3,%0" : "=r" (val));
+	return val;
+}
+
+static inline uint64
+rdtsc(void)
+{
+	uint64 val;
+	asm volatile("rdtsc" : "=A" (val));
+	return val;
+}
+
+// n / d, with two 32-bit divides, for the kernel has no libgcc.
+static inline uint64
+div64(uint64 n, uint d)
+{
+	uint hi, lo, rem;
+
+	hi = (uint)(n >> 32) / d;
+	rem = (uint)(n >> 32) % d;
+	asm("divl %4" : "=a" (lo), "=d" (rem) : "a" ((uint)n), "d" (rem), "rm" (d));
+	return (uint64)hi << 32 | lo;
+}
+
+static inline uint
+rcr4(void)
+{
+	uint val;
+	asm volatile("movl %%cr4,%0" : "=r" (val));
+	return val;
+}
+
+static inline void
+lcr4(uint val)
+{
+	asm volatile("movl %0,%%cr4" : : "r" (val));
+}
+
+// Registers eax, ebx, ecx, edx of CPUID leaf op.
+static inline void
+cpuidx(uint op, uint *a, uint *b, uint *c, uint *d)
+{
+	asm volatile("cpuid" : "=a" (*a), "=b" (*b), "=c" (*c), "=d" (*d) : "a" (op), "c" (0));
+}
+
+#define CPUID_SEP 0x800  // leaf 1 edx: SYSENTER and SYSEXIT
+
+// Model-specific registers for SYSENTER.
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+static inline void
+wrmsr(uint msr, uint64 val)
+{
+	asm volatile("wrmsr" : : "c" (msr), "A" (val));
+}
+
+static inline void
+invlpg(void *addr)
+{
+	asm volatile("invlpg (%0)" : : "r" (addr) : "memory");
+}
+
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().
 struct trapframe {
@@ -19,24 +19,37 @@
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+//
+// The image is built in memory and written out in one pass at the
+// end. Each file's data is appended in one piece, so it takes
+// consecutive blocks and a single extent, and the entries of /bin
+// and /home are added after all the files, so that those
+// directories do not break the files up.
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = LOGSIZE;  // log blocks, header included; -l overrides
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
+char *img;    // the whole image, FSSIZE blocks
 struct superblock sb;
-char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 
+char *hashdirs[8];  // -d names
+int nhashdir;
+
 uint rootino;
 uint homeino;
 uint binino;
 uint devino;
 
+struct dirent binents[NINODES];   // entries of /bin, added last
+struct dirent homeents[NINODES];  // and of /home
+int nbinent, nhomeent;
+
 void balloc(int);
 void wsect(uint, void*);
 void winode(uint, struct dinode*);
@@ -142,19 +155,81 @@ makedirs(void)
 	iappend(rootino, &de, sizeof(de));
 }
 
+// Put (name, inum) in a free slot of hash table tab.
+void
+hashput(char *tab, uint nblock, char *name, uint inum)
+{
+	struct dirent *de;
+	uint bn, j;
+
+	bn = dirhash(name) % nblock;
+	de = (struct dirent*)(tab + bn*BSIZE);
+	for(j = 1; j < DPB && de[j].inum; j++)
+		;
+	assert(j < DPB);
+	de[j].inum = xshort(inum);
+	strncpy(de[j].name, name, DIRSIZ);
+}
+
+// Make an empty hashed directory /name.
+void
+makehashdir(char *name)
+{
+	char *tab;
+	struct dirhdr *h;
+	struct dirent de;
+	uint inum, i;
+
+	tab = calloc(DIRHASHBLOCKS, BSIZE);
+	assert(tab);
+	for(i = 0; i < DIRHASHBLOCKS; i++){
+		h = (struct dirhdr*)(tab + i*BSIZE);
+		h->magic = xshort(DIRMAGIC);
+	}
+	h = (struct dirhdr*)tab;
+	h->nblock = xshort(DIRHASHBLOCKS);
+	h->nent = xint(2);
+
+	inum = ialloc(T_DIR);
+	hashput(tab, DIRHASHBLOCKS, ".", inum);
+	hashput(tab, DIRHASHBLOCKS, "..", rootino);
+	iappend(inum, tab, DIRHASHBLOCKS*BSIZE);
+	free(tab);
+
+	bzero(&de, sizeof(de));
+	de.inum = xshort(inum);
+	strncpy(de.name, name, DIRSIZ);
+	iappend(rootino, &de, sizeof(de));
+}
+
 int
 main(int argc, char *argv[])
 {
-	int i, cc, fd;
-	uint dirino, inum;
-	struct dirent de;
+	int i, cc, fd, n, max;
+	uint inum;
+	struct dirent *de;
 	char buf[BSIZE];
-	char *shortname;
+	char *shortname, *data;
 
 	static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-	if(argc < 2){
-		fprintf(stderr, "Usage: mkfs fs.img files...\n");
+	while(argc >= 3 && argv[1][0] == '-'){
+		if(strcmp(argv[1], "-l") == 0)
+			nlog = atoi(argv[2]);
+		else if(strcmp(argv[1], "-d") == 0 && nhashdir < sizeof(hashdirs)/sizeof(hashdirs[0]))
+			hashdirs[nhashdir++] = argv[2];
+		else
+			break;
+		argc -= 2;
+		argv += 2;
+	}
+	if(argc < 2 || argv[1][0] == '-'){
+		fprintf(stderr, "Usage: mkfs [-l nlog] [-d hasheddir]... fs.img files...\n");
+		exit(1);
+	}
+	if(nlog - 1 < MAXWRITEBLOCKS || nlog - 1 > MAXLOGBLOCKS){
+		fprintf(stderr, "mkfs: log must hold %d to %d blocks plus a header\n",
+		        MAXWRITEBLOCKS, (int)MAXLOGBLOCKS);
 		exit(1);
 	}
 
@@ -184,31 +259,32 @@ main(int argc, char *argv[])
 
 	freeblock = nmeta;     // the first free block that we can allocate
 
-	for(i = 0; i < FSSIZE; i++)
-		wsect(i, zeroes);
+	img = calloc(FSSIZE, BSIZE);
+	if(img == 0){
+		perror("calloc");
+		exit(1);
+	}
 
 	memset(buf, 0, sizeof(buf));
 	memmove(buf, &sb, sizeof(sb));
 	wsect(1, buf);
 
 	makedirs();
+	for(i = 0; i < nhashdir; i++)
+		makehashdir(hashdirs[i]);
 
 	for(i = 2; i < argc; i++){
-		// get rid of "user/"
-		if(strncmp(argv[i], "user/", 5) == 0)
-			shortname = argv[i] + 5;
+		// get rid of "user/", "kernel/"
+		if((shortname = rindex(argv[i], '/')) != 0)
+			shortname++;
 		else
 			shortname = argv[i];
 
-		assert(index(shortname, '/') == 0);
-
 		if((fd = open(argv[i], 0)) < 0){
 			perror(argv[i]);
 			exit(1);
 		}
 
-		dirino = homeino;
-
 		// Skip leading _ in name when writing to file system.
 		// The binaries are named _rm, _cat, etc. to keep the
 		// build operating system from trying to execute them
@@ -217,78 +293,94 @@ main(int argc, char *argv[])
 			shortname += 1;
 			// Binaries get copied into /bin, everything
 			// else goes into /home.
-			dirino = binino;
+			assert(nbinent < NINODES);
+			de = &binents[nbinent++];
+		} else {
+			assert(nhomeent < NINODES);
+			de = &homeents[nhomeent++];
 		}
 
 		inum = ialloc(T_FILE);
 
-		bzero(&de, sizeof(de));
-		de.inum = xshort(inum);
-		strncpy(de.name, shortname, DIRSIZ);
-		iappend(dirino, &de, sizeof(de));
+		bzero(de, sizeof(*de));
+		de->inum = xshort(inum);
+		strncpy(de->name, shortname, DIRSIZ);
 
-		while((cc = read(fd, buf, sizeof(buf))) > 0)
-			iappend(inum, buf, cc);
+		// Read the whole file, to append it at once.
+		n = 0;
+		max = BSIZE;
+		if((data = malloc(max)) == 0){
+			perror("malloc");
+			exit(1);
+		}
+		while((cc = read(fd, data + n, max - n)) > 0){
+			n += cc;
+			if(n == max && (data = realloc(data, max *= 2)) == 0){
+				perror("realloc");
+				exit(1);
+			}
+		}
+		if(cc < 0){
+			perror(argv[i]);
+			exit(1);
+		}
+		iappend(inum, data, n);
+		free(data);
 
 		close(fd);
 	}
 
+	iappend(binino, binents, nbinent * sizeof(binents[0]));
+	iappend(homeino, homeents, nhomeent * sizeof(homeents[0]));
+
 	balloc(freeblock);
 
+	for(n = 0; n < FSSIZE * BSIZE; n += cc){
+		if((cc = write(fsfd, img + n, FSSIZE * BSIZE - n)) <= 0){
+			perror("write");
+			exit(1);
+		}
+	}
+	close(fsfd);
+
 	exit(0);
 }
 
 void
 wsect(uint sec, void *buf)
 {
-	if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-		perror("lseek");
-		exit(1);
-	}
-	if(write(fsfd, buf, BSIZE) != BSIZE){
-		perror("write");
-		exit(1);
-	}
+	assert(sec < FSSIZE);
+	memmove(img + sec * BSIZE, buf, BSIZE);
 }
 
-void
-winode(uint inum, struct dinode *ip)
+// Inode inum's place in the image.
+struct dinode*
+dinode(uint inum)
 {
-	char buf[BSIZE];
 	uint bn;
-	struct dinode *dip;
 
 	bn = IBLOCK(inum, sb);
-	rsect(bn, buf);
-	dip = ((struct dinode*)buf) + (inum % IPB);
-	*dip = *ip;
-	wsect(bn, buf);
+	assert(bn < FSSIZE);
+	return ((struct dinode*)(img + bn * BSIZE)) + (inum % IPB);
 }
 
 void
-rinode(uint inum, struct dinode *ip)
+winode(uint inum, struct dinode *ip)
 {
-	char buf[BSIZE];
-	uint bn;
-	struct dinode *dip;
+	*dinode(inum) = *ip;
+}
 
-	bn = IBLOCK(inum, sb);
-	rsect(bn, buf);
-	dip = ((struct dinode*)buf) + (inum % IPB);
-	*ip = *dip;
+void
+rinode(uint inum, struct dinode *ip)
+{
+	*ip = *dinode(inum);
 }
 
 void
 rsect(uint sec, void *buf)
 {
-	if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-		perror("lseek");
-		exit(1);
-	}
-	if(read(fsfd, buf, BSIZE) != BSIZE){
-		perror("read");
-		exit(1);
-	}
+	assert(sec < FSSIZE);
+	memmove(buf, img + sec * BSIZE, BSIZE);
 }
 
 uint
@@ -323,14 +415,62 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the disk block holding block fbn of the file, and
+// allocate it from freeblock when fbn is just past the end.
+// Blocks come out consecutively, so appending to the file
+// last written lengthens its last extent.
+uint
+xbmap(struct dinode *din, uint fbn)
+{
+	struct extent x[NXEXTENT], *e, *last;
+	uint xb, b;
+	int i;
+
+	xb = xint(din->xblock);
+	if(xb)
+		rsect(xb, (char*)x);
+	last = 0;
+	for(i = 0; i < NEXTENT + NXEXTENT; i++){
+		if(i < NEXTENT)
+			e = &din->ext[i];
+		else if(xb)
+			e = &x[i - NEXTENT];
+		else
+			break;
+		if(xint(e->len) == 0)
+			break;
+		if(fbn < xint(e->len))
+			return xint(e->start) + fbn;
+		fbn -= xint(e->len);
+		last = e;
+	}
+	assert(fbn == 0);
+
+	b = freeblock++;
+	if(last && xint(last->start) + xint(last->len) == b){
+		last->len = xint(xint(last->len) + 1);
+	} else {
+		assert(i < NEXTENT + NXEXTENT);
+		if(i >= NEXTENT && xb == 0){
+			xb = freeblock++;
+			din->xblock = xint(xb);
+			bzero(x, sizeof(x));
+		}
+		e = i < NEXTENT ? &din->ext[i] : &x[i - NEXTENT];
+		e->start = xint(b);
+		e->len = xint(1);
+	}
+	if(xb)
+		wsect(xb, (char*)x);
+	return b;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
 	char *p = (char*)xp;
 	uint fbn, off, n1;
 	struct dinode din;
-	char buf[BSIZE];
-	uint indirect[NINDIRECT];
 	uint x;
 
 	rinode(inum, &din);
@@ -339,26 +479,10 @@ iappend(uint inum, void *xp, int n)
 	while(n > 0){
 		fbn = off / BSIZE;
 		assert(fbn < MAXFILE);
-		if(fbn < NDIRECT){
-			if(xint(din.addrs[fbn]) == 0){
-				din.addrs[fbn] = xint(freeblock++);
-			}
-			x = xint(din.addrs[fbn]);
-		} else {
-			if(xint(din.addrs[NDIRECT]) == 0){
-				din.addrs[NDIRECT] = xint(freeblock++);
-			}
-			rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-			if(indirect[fbn - NDIRECT] == 0){
-				indirect[fbn - NDIRECT] = xint(freeblock++);
-				wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-			}
-			x = xint(indirect[fbn-NDIRECT]);
-		}
+		x = xbmap(&din, fbn);
 		n1 = min(n, (fbn + 1) * BSIZE - off);
-		rsect(x, buf);
-		bcopy(p, buf + off - (fbn * BSIZE), n1);
-		wsect(x, buf);
+		assert(x < FSSIZE);
+		bcopy(p, img + x * BSIZE + off - (fbn * BSIZE), n1);
 		n -= n1;
 		off += n1;
 		p += n1;
@@ -0,0 +1,312 @@
+// Kernel microbenchmarks.
+//
+// bench [name...]
+//
+// Runs the named benchmarks, or all of them, timing each with
+// nanouptime(). Every result is one line on fd 1,
+//
+//	bench <name> <ops> <ns/op> <KB/s>
+//
+// with KB/s 0 for benchmarks that move no data, so the output
+// of two kernels can be compared line by line. Files are made
+// in the current directory.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/x86.h"
+#include "user.h"
+
+#define BIGFILE (512*1024)  // bytes in the sequential file tests
+#define CHUNK   8192        // bytes per read() or write()
+
+char buf[CHUNK];
+
+static uint64
+now(void)
+{
+	uint64 t;
+
+	nanouptime(&t);
+	return t;
+}
+
+static void
+fail(char *what)
+{
+	fprintf(2, "bench: %s failed\n", what);
+	exit();
+}
+
+// Report ops operations, moving bytes bytes, done since start.
+static void
+report(char *name, int ops, uint bytes, uint64 start)
+{
+	uint64 ns;
+	uint us;
+
+	ns = now() - start;
+	us = div64(ns, 1000);
+	printf("bench %s %d %d %d\n", name, ops, (uint)div64(ns, ops),
+	       bytes && us ? (uint)div64((uint64)bytes * 15625 >> 4, us) : 0);
+}
+
+static void
+nullsys(char *name)
+{
+	uint64 start;
+	int i, n;
+
+	n = 10000;
+	start = now();
+	for(i = 0; i < n; i++)
+		getpid();
+	report(name, n, 0, start);
+}
+
+static void
+forkexit(char *name)
+{
+	uint64 start;
+	int i, n, pid;
+
+	n = 200;
+	start = now();
+	for(i = 0; i < n; i++){
+		if((pid = fork()) < 0)
+			fail("fork");
+		if(pid == 0)
+			exit();
+		wait();
+	}
+	report(name, n, 0, start);
+}
+
+static void
+forkexec(char *name)
+{
+	char *argv[] = { "bench", "-exit", 0 };
+	uint64 start;
+	int i, n, pid;
+
+	n = 50;
+	start = now();
+	for(i = 0; i < n; i++){
+		if((pid = fork()) < 0)
+			fail("fork");
+		if(pid == 0){
+			exec("/bin/bench", argv);
+			fail("exec /bin/bench");
+		}
+		wait();
+	}
+	report(name, n, 0, start);
+}
+
+// Bounce a byte between two processes: one op is a round trip.
+static void
+pipelat(char *name)
+{
+	uint64 start;
+	int i, n, pid, ping[2], pong[2];
+	char c;
+
+	n = 2000;
+	if(pipe(ping) < 0 || pipe(pong) < 0)
+		fail("pipe");
+	if((pid = fork()) < 0)
+		fail("fork");
+	if(pid == 0){
+		for(i = 0; i < n; i++)
+			if(read(ping[0], &c, 1) != 1 || write(pong[1], &c, 1) != 1)
+				break;
+		exit();
+	}
+	start = now();
+	for(i = 0; i < n; i++)
+		if(write(ping[1], "x", 1) != 1 || read(pong[0], &c, 1) != 1)
+			fail("pipe round trip");
+	report(name, n, 0, start);
+	wait();
+	close(ping[0]);
+	close(ping[1]);
+	close(pong[0]);
+	close(pong[1]);
+}
+
+static void
+pipebw(char *name)
+{
+	uint64 start;
+	int i, n, m, pid, p[2];
+
+	n = 4*1024*1024 / CHUNK;
+	if(pipe(p) < 0)
+		fail("pipe");
+	if((pid = fork()) < 0)
+		fail("fork");
+	if(pid == 0){
+		close(p[0]);
+		for(i = 0; i < n; i++)
+			if(write(p[1], buf, CHUNK) != CHUNK)
+				break;
+		exit();
+	}
+	close(p[1]);
+	start = now();
+	for(i = 0; (m = read(p[0], buf, CHUNK)) > 0; i += m)
+		;
+	if(i != n*CHUNK)
+		fail("pipe read");
+	report(name, n, n*CHUNK, start);
+	close(p[0]);
+	wait();
+}
+
+static void
+smallfile(char *name)
+{
+	char path[] = "benchf00";
+	uint64 start;
+	int i, n, fd;
+
+	n = 100;
+	start = now();
+	for(i = 0; i < n; i++){
+		path[6] = '0' + i/10;
+		path[7] = '0' + i%10;
+		if((fd = open(path, O_CREATE|O_WRONLY)) < 0 || write(fd, buf, 100) != 100)
+			fail("create");
+		close(fd);
+	}
+	for(i = 0; i < n; i++){
+		path[6] = '0' + i/10;
+		path[7] = '0' + i%10;
+		if(unlink(path) < 0)
+			fail("unlink");
+	}
+	report(name, n, 0, start);
+}
+
+static void
+seqwrite(char *name)
+{
+	uint64 start;
+	int i, fd;
+
+	unlink("benchbig");
+	start = now();
+	if((fd = open("benchbig", O_CREATE|O_WRONLY)) < 0)
+		fail("create benchbig");
+	for(i = 0; i < BIGFILE; i += CHUNK)
+		if(write(fd, buf, CHUNK) != CHUNK)
+			fail("write benchbig");
+	fsync(fd);
+	close(fd);
+	report(name, BIGFILE/CHUNK, BIGFILE, start);
+}
+
+static void
+seqread(char *name)
+{
+	uint64 start;
+	int fd, n, tot;
+
+	if((fd = open("benchbig", O_RDONLY)) < 0)
+		seqwrite("seqwrite");
+	else
+		close(fd);
+	start = now();
+	if((fd = open("benchbig", O_RDONLY)) < 0)
+		fail("open benchbig");
+	for(tot = 0; (n = read(fd, buf, CHUNK)) > 0; tot += n)
+		;
+	close(fd);
+	if(tot != BIGFILE)
+		fail("read benchbig");
+	report(name, BIGFILE/CHUNK, BIGFILE, start);
+	unlink("benchbig");
+}
+
+// Grow the heap a page at a time, touching each page.
+static void
+sbrkgrow(char *name)
+{
+	uint64 start;
+	int i, n;
+	char *p;
+
+	n = 256;
+	start = now();
+	for(i = 0; i < n; i++){
+		if((p = sbrk(4096)) == (char*)-1)
+			fail("sbrk");
+		*p = 1;
+	}
+	report(name, n, n*4096, start);
+	sbrk(-n*4096);
+}
+
+// Write 80-column lines to the console; one op is a line.
+static void
+console(char *name)
+{
+	uint64 start;
+	int i, n, fd;
+
+	n = 200;
+	for(i = 0; i < 80; i++)
+		buf[i] = i == 79 ? '\n' : '.';
+	if((fd = open("/dev/console", O_WRONLY)) < 0)
+		fail("open /dev/console");
+	start = now();
+	for(i = 0; i < n; i++)
+		write(fd, buf, 80);
+	report(name, n, n*80, start);
+	close(fd);
+}
+
+struct {
+	char *name;
+	void (*fn)(char*);
+} benches[] = {
+	{ "nullsys", nullsys },
+	{ "forkexit", forkexit },
+	{ "forkexec", forkexec },
+	{ "pipelat", pipelat },
+	{ "pipebw", pipebw },
+	{ "smallfile", smallfile },
+	{ "seqwrite", seqwrite },
+	{ "seqread", seqread },
+	{ "sbrk", sbrkgrow },
+	{ "console", console },
+};
+
+#define NBENCH (sizeof(benches)/sizeof(benches[0]))
+
+int
+main(int argc, char *argv[])
+{
+	int i, j;
+
+	// Run by forkexec.
+	if(argc == 2 && strcmp(argv[1], "-exit") == 0)
+		exit();
+
+	if(argc == 1){
+		for(i = 0; i < NBENCH; i++)
+			benches[i].fn(benches[i].name);
+		exit();
+	}
+	for(j = 1; j < argc; j++){
+		for(i = 0; i < NBENCH; i++)
+			if(strcmp(argv[j], benches[i].name) == 0)
+				break;
+		if(i == NBENCH){
+			fprintf(2, "bench: no benchmark %s\n", argv[j]);
+			exit();
+		}
+		benches[i].fn(benches[i].name);
+	}
+	exit();
+}
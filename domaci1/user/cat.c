@@ -9,14 +9,26 @@ cat(int fd)
 {
 	int n;
 
+	// When both are regular files the kernel can copy
+	// without going through buf.
+	if((n = copy_file_range(fd, 1, 64*1024)) >= 0){
+		while(n > 0)
+			n = copy_file_range(fd, 1, 64*1024);
+		if(n < 0){
+			fprintf(2, "cat: write error\n");
+			exit();
+		}
+		return;
+	}
+
 	while((n = read(fd, buf, sizeof(buf))) > 0) {
 		if (write(1, buf, n) != n) {
-			printf("cat: write error\n");
+			fprintf(2, "cat: write error\n");
 			exit();
 		}
 	}
 	if(n < 0){
-		printf("cat: read error\n");
+		fprintf(2, "cat: read error\n");
 		exit();
 	}
 }
@@ -33,7 +45,7 @@ main(int argc, char *argv[])
 
 	for(i = 1; i < argc; i++){
 		if((fd = open(argv[i], 0)) < 0){
-			printf("cat: cannot open %s\n", argv[i]);
+			fprintf(2, "cat: cannot open %s\n", argv[i]);
 			exit();
 		}
 		cat(fd);
@@ -0,0 +1,110 @@
+// Console output benchmark.
+//
+// conbench [kbytes]
+//
+// Writes kbytes (default 64) KB each of plain text, ANSI coloured
+// text and bare newlines to fd 1, timing each with uptime(), and
+// then reports bytes per second and ticks per scrolled line on fd 2.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user.h"
+
+#define CHUNK 2000  // bytes per write()
+
+char buf[CHUNK];
+
+// Fill buf with 80-column lines of printable text.
+static void
+fillplain(void)
+{
+	int i;
+
+	for(i = 0; i < CHUNK; i++)
+		buf[i] = i % 80 == 79 ? '\n' : 'a' + i % 26;
+}
+
+// Fill buf with words in changing ANSI colours.
+static void
+fillcolor(void)
+{
+	int i, n;
+
+	n = 0;
+	for(i = 0; n + 14 <= CHUNK; i++){
+		buf[n++] = '\x1b';
+		buf[n++] = '[';
+		buf[n++] = '3';
+		buf[n++] = '1' + i % 7;
+		buf[n++] = 'm';
+		memmove(buf + n, "word", 4);
+		n += 4;
+		buf[n++] = '\x1b';
+		buf[n++] = '[';
+		buf[n++] = '0';
+		buf[n++] = 'm';
+		buf[n++] = i % 8 == 7 ? '\n' : ' ';
+	}
+	while(n < CHUNK)
+		buf[n++] = ' ';
+}
+
+static void
+fillnewlines(void)
+{
+	memset(buf, '\n', CHUNK);
+}
+
+// Write total bytes of buf to fd 1 and return the ticks it took.
+static int
+run(int total)
+{
+	int start, n;
+
+	start = uptime();
+	for(n = 0; n < total; n += CHUNK)
+		write(1, buf, CHUNK);
+	return uptime() - start;
+}
+
+static void
+report(char *name, int bytes, int ticks, int lines)
+{
+	// One tick is 10 ms.
+	if(ticks == 0){
+		fprintf(2, "conbench %s: %d bytes in <1 tick\n", name, bytes);
+		return;
+	}
+	fprintf(2, "conbench %s: %d bytes %d ticks %d bytes/sec",
+	        name, bytes, ticks, bytes / ticks * 100);
+	if(lines > 0)
+		fprintf(2, " %d ticks/1000 scrolls", ticks * 1000 / lines);
+	fprintf(2, "\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	int total, plain, color, scroll;
+
+	total = 64 * 1024;
+	if(argc > 1)
+		total = atoi(argv[1]) * 1024;
+	total = (total + CHUNK - 1) / CHUNK * CHUNK;
+	if(total <= 0){
+		fprintf(2, "usage: conbench [kbytes]\n");
+		exit();
+	}
+
+	fillplain();
+	plain = run(total);
+	fillcolor();
+	color = run(total);
+	fillnewlines();
+	scroll = run(total);
+
+	report("plain", total, plain, total / 80);
+	report("color", total, color, 0);
+	report("scroll", total, scroll, total);
+	exit();
+}
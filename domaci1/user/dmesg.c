@@ -0,0 +1,19 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "user.h"
+
+char buf[KLOGHIST];
+
+int
+main(int argc, char *argv[])
+{
+	int n;
+
+	if((n = dmesg(buf, sizeof(buf))) < 0){
+		fprintf(2, "dmesg: cannot read kernel log\n");
+		exit();
+	}
+	write(1, buf, n);
+	exit();
+}
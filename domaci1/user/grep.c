@@ -1,109 +1,255 @@
 // Simple grep.  Only supports ^ . * $ operators.
+//
+// The pattern becomes a deterministic automaton, built a state
+// at a time as the input needs them, that looks at each byte
+// once. Input is read, and matching lines written, in large
+// blocks.
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user.h"
 
-char buf[1024];
-int match(char*, char*);
+#define NITEM   31    // pattern items, not counting ^ and $
+#define NSTATE  255   // automaton states kept at once
+#define NONE    255   // transition not yet computed
+
+char buf[16384+1];   // one more for a final line without a newline
+char obuf[8192];
+int on;
+
+// The pattern, as items that each match one character: c, or
+// any character if c is -1, and any number of them if star.
+struct item {
+	int c;
+	int star;
+} item[NITEM];
+int nitem;
+int anchored;  // ^: matches only at the start of a line
+int dollar;    // $: matches only at the end of a line
+
+// A state of the automaton is the set of items the matcher can
+// be at, as a mask: bit i for item i, bit nitem for the end of
+// the pattern.
+struct state {
+	uint mask;
+	uchar next[256];
+} dfa[NSTATE];
+int nstate;
+
+void
+compile(char *re)
+{
+	if(*re == '^'){
+		anchored = 1;
+		re++;
+	}
+	while(*re){
+		if(re[0] == '$' && re[1] == '\0'){
+			dollar = 1;
+			break;
+		}
+		if(nitem == NITEM){
+			fprintf(2, "grep: pattern too long\n");
+			exit();
+		}
+		item[nitem].c = *re == '.' ? -1 : (uchar)*re;
+		re++;
+		if(*re == '*'){
+			item[nitem].star = 1;
+			re++;
+		}
+		nitem++;
+	}
+}
+
+// Add the items reachable by skipping starred items.
+uint
+closure(uint mask)
+{
+	int i;
+
+	for(i = 0; i < nitem; i++)
+		if((mask & (1u << i)) && item[i].star)
+			mask |= 1u << (i+1);
+	return mask;
+}
+
+// The items after reading c at the items in mask.
+uint
+move(uint mask, int c)
+{
+	uint m;
+	int i;
+
+	m = 0;
+	for(i = 0; i < nitem; i++){
+		if(!(mask & (1u << i)) || (item[i].c != -1 && item[i].c != c))
+			continue;
+		m |= 1u << (item[i].star ? i : i+1);
+	}
+	if(!anchored)
+		m |= 1;  // a match may start at any character
+	return closure(m);
+}
+
+int
+addstate(uint mask)
+{
+	int s;
+
+	for(s = 0; s < nstate; s++)
+		if(dfa[s].mask == mask)
+			return s;
+	s = nstate++;
+	dfa[s].mask = mask;
+	memset(dfa[s].next, NONE, sizeof(dfa[s].next));
+	return s;
+}
+
+// The state after reading c in state s. When the table fills
+// up it is emptied, keeping the start state as state 0.
+int
+step(int s, int c)
+{
+	uint mask, from;
+	int t;
+
+	if((t = dfa[s].next[c]) != NONE)
+		return t;
+	from = dfa[s].mask;
+	mask = move(from, c);
+	if(nstate >= NSTATE - 1){
+		nstate = 0;
+		addstate(closure(1));
+		s = addstate(from);
+	}
+	t = addstate(mask);
+	dfa[s].next[c] = t;
+	return t;
+}
+
+void
+output(char *p, int n)
+{
+	if(on + n > sizeof(obuf)){
+		write(1, obuf, on);
+		on = 0;
+	}
+	if(n > sizeof(obuf)){
+		write(1, p, n);
+		return;
+	}
+	memmove(obuf + on, p, n);
+	on += n;
+}
+
+// Write out the matching lines among the m bytes at buf.
+// Returns where the last, unfinished, line starts.
+char*
+scan(char *buf, int m)
+{
+	char *p, *e, *line;
+	uint end;
+	int s;
+
+	end = 1u << nitem;
+	line = p = buf;
+	e = buf + m;
+	s = 0;
+	while(p < e){
+		if(*p == '\n'){
+			p++;
+			if(dfa[s].mask & end)
+				output(line, p - line);
+			line = p;
+			s = 0;
+			continue;
+		}
+		if(dollar || !(dfa[s].mask & end)){
+			s = step(s, (uchar)*p++);
+			if(dfa[s].mask != 0)
+				continue;
+		}
+		// Matched, or cannot: the rest of the line does not count.
+		while(p < e && *p != '\n')
+			p++;
+		if(p == e)
+			break;
+		p++;
+		if(dfa[s].mask)
+			output(line, p - line);
+		line = p;
+		s = 0;
+	}
+	return line;
+}
 
 void
-grep(char *pattern, int fd)
+grep(int fd)
 {
-	int n, m;
-	char *p, *q;
+	int n, m, skip;
+	char *p;
 
 	m = 0;
-	while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
+	skip = 0;
+	while((n = read(fd, buf+m, sizeof(buf)-1-m)) > 0){
+		p = buf + m;
 		m += n;
-		buf[m] = '\0';
-		p = buf;
-		while((q = strchr(p, '\n')) != 0){
-			*q = 0;
-			if(match(pattern, p)){
-				*q = '\n';
-				write(1, p, q+1 - p);
+		if(skip){
+			// Drop the rest of a line too long for buf.
+			while(p < buf + m && *p != '\n')
+				p++;
+			if(p == buf + m){
+				m = 0;
+				continue;
 			}
-			p = q+1;
+			p++;
+			m -= p - buf;
+			memmove(buf, p, m);
+			skip = 0;
 		}
-		if(p == buf)
+		p = scan(buf, m);
+		if(p == buf && m == sizeof(buf)-1){
 			m = 0;
-		if(m > 0){
+			skip = 1;
+		} else {
 			m -= p - buf;
 			memmove(buf, p, m);
 		}
 	}
+	if(skip)
+		return;
+	if(m > 0){
+		buf[m++] = '\n';
+		scan(buf, m);
+	}
 }
 
 int
 main(int argc, char *argv[])
 {
 	int fd, i;
-	char *pattern;
 
 	if(argc <= 1){
 		fprintf(2, "usage: grep pattern [file ...]\n");
 		exit();
 	}
-	pattern = argv[1];
+	compile(argv[1]);
+	nstate = 0;
+	addstate(closure(1));
 
 	if(argc <= 2){
-		grep(pattern, 0);
-		exit();
-	}
-
-	for(i = 2; i < argc; i++){
-		if((fd = open(argv[i], 0)) < 0){
-			printf("grep: cannot open %s\n", argv[i]);
-			exit();
+		grep(0);
+	} else {
+		for(i = 2; i < argc; i++){
+			if((fd = open(argv[i], 0)) < 0){
+				fprintf(2, "grep: cannot open %s\n", argv[i]);
+				break;
+			}
+			grep(fd);
+			close(fd);
 		}
-		grep(pattern, fd);
-		close(fd);
 	}
+	write(1, obuf, on);
 	exit();
 }
-
-// Regexp matcher from Kernighan & Pike,
-// The Practice of Programming, Chapter 9.
-
-int matchhere(char*, char*);
-int matchstar(int, char*, char*);
-
-int
-match(char *re, char *text)
-{
-	if(re[0] == '^')
-		return matchhere(re+1, text);
-	do{  // must look at empty string
-		if(matchhere(re, text))
-			return 1;
-	}while(*text++ != '\0');
-	return 0;
-}
-
-// matchhere: search for re at beginning of text
-int
-matchhere(char *re, char *text)
-{
-	if(re[0] == '\0')
-		return 1;
-	if(re[1] == '*')
-		return matchstar(re[0], re+2, text);
-	if(re[0] == '$' && re[1] == '\0')
-		return *text == '\0';
-	if(*text!='\0' && (re[0]=='.' || re[0]==*text))
-		return matchhere(re+1, text+1);
-	return 0;
-}
-
-// matchstar: search for c*re at beginning of text
-int
-matchstar(int c, char *re, char *text)
-{
-	do{  // a * matches zero or more instances
-		if(matchhere(re, text))
-			return 1;
-	}while(*text!='\0' && (*text++==c || c=='.'));
-	return 0;
-}
-
@@ -23,6 +23,11 @@ main(void)
 	}
 	dup(0);  // stdout
 	dup(0);  // stderr
+	mknod("/dev/stats", 2, 0);  // fails if it is already there
+
+	mkdir("/tmp");
+	if(mount("tmpfs", "/tmp") < 0)
+		printf("init: cannot mount /tmp\n");
 
 	for(;;){
 		printf("init: starting sh\n");
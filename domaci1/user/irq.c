@@ -0,0 +1,72 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/traps.h"
+#include "kernel/irq.h"
+#include "user.h"
+
+// irq: show and steer device interrupts.
+//
+//	irq                  list each interrupt, its CPU and counts
+//	irq n cpu            send interrupt n to cpu and keep it there
+//	irq n auto           let the balancer move interrupt n again
+//	irq balance on|off   turn interrupt balancing on or off
+
+struct irqstat st[NIRQ];
+
+void
+usage(void)
+{
+	fprintf(2, "usage: irq [n cpu|n auto|balance on|off]\n");
+	exit();
+}
+
+void
+list(void)
+{
+	int i, c, n, last;
+
+	n = irqstat(st, NIRQ);
+	if(n < 0){
+		fprintf(2, "irq: irqstat failed\n");
+		exit();
+	}
+	printf("irq cpu counts by cpu\n");
+	for(i = 0; i < n; i++){
+		last = st[i].cpu;
+		for(c = 0; c < NCPU; c++)
+			if(st[i].count[c])
+				last = c > last ? c : last;
+		printf("%d %d%s", st[i].irq, st[i].cpu, st[i].pinned ? " pinned" : "");
+		for(c = 0; c <= last; c++)
+			printf(" %d", st[i].count[c]);
+		printf("\n");
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	int irq, cpu;
+
+	if(argc == 1){
+		list();
+		exit();
+	}
+	if(argc != 3)
+		usage();
+	if(strcmp(argv[1], "balance") == 0){
+		if(strcmp(argv[2], "on") == 0)
+			irqbalance(1);
+		else if(strcmp(argv[2], "off") == 0)
+			irqbalance(0);
+		else
+			usage();
+		exit();
+	}
+	irq = atoi(argv[1]);
+	cpu = strcmp(argv[2], "auto") == 0 ? -1 : atoi(argv[2]);
+	if(irqaffinity(irq, cpu) < 0)
+		fprintf(2, "irq: cannot send %s to %s\n", argv[1], argv[2]);
+	exit();
+}
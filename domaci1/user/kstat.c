@@ -0,0 +1,64 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/stats.h"
+#include "user.h"
+
+// kstat: print the kernel's event counters from /dev/stats.
+// "kstat n" prints them again every n ticks, as the change
+// since the last time, with the buffer cache hit rate and the
+// average IDE queue depth; "kstat n count" stops after count.
+
+char *names[NSTAT] = {
+[ST_BGET]       "bget",
+[ST_BHIT]       "bhit",
+[ST_COMMIT]     "commit",
+[ST_COMMITBLK]  "commitblk",
+[ST_IDEREQ]     "idereq",
+[ST_IDEQLEN]    "ideqlen",
+[ST_IDEINTR]    "ideintr",
+[ST_PIPEWRITE]  "pipewrite",
+[ST_PIPEWAKE]   "pipewake",
+[ST_KALLOC]     "kalloc",
+[ST_KALLOCFAIL] "kallocfail",
+[ST_SWITCH]     "switch",
+[ST_IDLE]       "idle",
+};
+
+uint old[NSTAT], cur[NSTAT];
+
+int
+main(int argc, char *argv[])
+{
+	int fd, i, interval, count;
+	uint d[NSTAT];
+
+	interval = argc > 1 ? atoi(argv[1]) : 0;
+	count = argc > 2 ? atoi(argv[2]) : -1;
+	if((fd = open("/dev/stats", O_RDONLY)) < 0 ||
+	   read(fd, cur, sizeof(cur)) != sizeof(cur)){
+		fprintf(2, "kstat: cannot read /dev/stats\n");
+		exit();
+	}
+	if(interval <= 0){
+		for(i = 0; i < NSTAT; i++)
+			printf("%s\t%d\n", names[i], cur[i]);
+		exit();
+	}
+
+	for(i = 0; i < NSTAT; i++)
+		printf("%s\t", names[i]);
+	printf("hit%%\tqlen\n");
+	while(count < 0 || count-- > 0){
+		memmove(old, cur, sizeof(cur));
+		sleep(interval);
+		read(fd, cur, sizeof(cur));
+		for(i = 0; i < NSTAT; i++){
+			d[i] = cur[i] - old[i];
+			printf("%d\t", d[i]);
+		}
+		printf("%d\t%d\n", d[ST_BGET] ? d[ST_BHIT]*100/d[ST_BGET] : 0,
+		       d[ST_IDEREQ] ? d[ST_IDEQLEN]/d[ST_IDEREQ] : 0);
+	}
+	exit();
+}
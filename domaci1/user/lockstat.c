@@ -0,0 +1,38 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/spinlock.h"
+#include "user.h"
+
+// lockstat: list the kernel's spinlocks that have had to wait,
+// the most contended first. Cycle counts are in thousands
+// (units of 1024).
+
+struct lockstat st[NLOCKSTAT];
+
+int
+main(int argc, char *argv[])
+{
+	struct lockstat t;
+	int i, j, n;
+
+	if((n = lockstat(st, NLOCKSTAT)) < 0){
+		fprintf(2, "lockstat: cannot read lock statistics\n");
+		exit();
+	}
+	for(i = 1; i < n; i++){
+		t = st[i];
+		for(j = i; j > 0 && st[j-1].spin < t.spin; j--)
+			st[j] = st[j-1];
+		st[j] = t;
+	}
+	printf("lock\tacquired\twaited\tspin\tmaxhold (kcycles)\n");
+	for(i = 0; i < n; i++){
+		if(st[i].ncontend == 0)
+			continue;
+		printf("%s\t%d\t%d\t%d\t%d\n", st[i].name, st[i].nacquire,
+		       st[i].ncontend, (uint)(st[i].spin >> 10),
+		       (uint)(st[i].maxhold >> 10));
+	}
+	exit();
+}
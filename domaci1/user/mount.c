@@ -0,0 +1,15 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user.h"
+
+int
+main(int argc, char *argv[])
+{
+	if(argc != 3){
+		fprintf(2, "Usage: mount tmpfs|ramdisk dir\n");
+		exit();
+	}
+	if(mount(argv[1], argv[2]) < 0)
+		fprintf(2, "mount: cannot mount %s on %s\n", argv[1], argv[2]);
+	exit();
+}
@@ -0,0 +1,17 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user.h"
+
+// nice n cmd [arg...]: run cmd with its nice value raised by n.
+int
+main(int argc, char **argv)
+{
+	if(argc < 3){
+		fprintf(2, "usage: nice n cmd [arg...]\n");
+		exit();
+	}
+	nice(atoi(argv[1]));
+	exec(argv[2], argv + 2);
+	fprintf(2, "nice: exec %s failed\n", argv[2]);
+	exit();
+}
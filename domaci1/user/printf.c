@@ -1,19 +1,136 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/param.h"
 #include "user.h"
 
 #include <stdarg.h>
 
+// Buffered streams, one for each file descriptor, under
+// printf(), fprintf() and gets().
+//
+// A stream picks its buffering when first used: none for fd 2,
+// by line for a device such as the console, and full otherwise,
+// for files and pipes. Unbuffered output still takes one write()
+// per printf(), and line-buffered output one per printf() that
+// ends a line. exit(), fork(), exec() and close() in ulib.c flush
+// through streamhook, which is set once a stream is used, so that
+// forktest, linked without this file, need not have it. Reading
+// from a stream flushes line-buffered output first, so a prompt
+// shows before its answer is read.
+
+#define BUFSIZ 512
+
+#define SNONE 1
+#define SLINE 2
+#define SFULL 3
+
+struct stream {
+	int mode;             // 0 until first used
+	int n;                // bytes in buf
+	int r;                // next byte of buf to read; -1 if writing
+	struct lock lock;
+	char buf[BUFSIZ];
+};
+
+static struct stream streams[NOFILE];
+extern void (*streamhook)(int);
+
 static char digits[] = "0123456789ABCDEF";
 
+// Write out s's buffered output. Caller holds s->lock.
+static void
+sflush(int fd, struct stream *s)
+{
+	if(s->r < 0){
+		if(s->n > 0)
+			write(fd, s->buf, s->n);
+		s->n = 0;
+	}
+}
+
+static void streamclose(int);
+
+// Lock fd's stream, setting it up on first use, and make it
+// ready for rw: 'r' to read or 'w' to write. Returns 0 if fd
+// is out of range.
+static struct stream*
+slock(int fd, int rw)
+{
+	struct stream *s;
+	struct stat st;
+
+	if(fd < 0 || fd >= NOFILE)
+		return 0;
+	s = &streams[fd];
+	lock_acquire(&s->lock);
+	if(s->mode == 0){
+		if(fd == 2 || fstat(fd, &st) < 0)
+			s->mode = SNONE;
+		else if(st.type == T_DEV)
+			s->mode = SLINE;
+		else
+			s->mode = SFULL;
+		s->n = 0;
+		s->r = -1;
+	}
+	if(rw == 'w' && s->r >= 0){
+		s->n = 0;  // drop unread input
+		s->r = -1;
+	} else if(rw == 'r' && s->r < 0){
+		sflush(fd, s);
+		s->r = 0;
+	}
+	streamhook = streamclose;
+	return s;
+}
+
+// Write out fd's buffered output, or every stream's if fd is -1.
+void
+fflush(int fd)
+{
+	struct stream *s;
+
+	if(fd == -1){
+		for(fd = 0; fd < NOFILE; fd++)
+			fflush(fd);
+		return;
+	}
+	if(fd < 0 || fd >= NOFILE)
+		return;
+	s = &streams[fd];
+	lock_acquire(&s->lock);
+	sflush(fd, s);
+	lock_release(&s->lock);
+}
+
+// Called by ulib.c before fd is closed, or with -1 before the
+// program exits or forks or execs. Buffered input is kept
+// across fork(), for the parent goes on reading.
+static void
+streamclose(int fd)
+{
+	struct stream *s;
+
+	fflush(fd);
+	if(fd >= 0 && fd < NOFILE){
+		s = &streams[fd];
+		lock_acquire(&s->lock);
+		s->mode = 0;
+		s->n = 0;
+		lock_release(&s->lock);
+	}
+}
+
 static void
-putc(int fd, char c)
+putc(int fd, struct stream *s, char c)
 {
-	write(fd, &c, 1);
+	if(s->n == sizeof(s->buf))
+		sflush(fd, s);
+	s->buf[s->n++] = c;
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(int fd, struct stream *s, int xx, int base, int sgn)
 {
 	char buf[16];
 	int i, neg;
@@ -35,50 +152,60 @@ printint(int fd, int xx, int base, int sgn)
 		buf[i++] = '-';
 
 	while(--i >= 0)
-		putc(fd, buf[i]);
+		putc(fd, s, buf[i]);
 }
 
 // Print to the given fd. Only understands %d, %x, %p, %s.
 void
 vprintf(int fd, const char *fmt, va_list ap)
 {
-	char *s;
-	int c, i, state;
+	struct stream *s;
+	char *p;
+	int c, i, state, nl;
 
+	if((s = slock(fd, 'w')) == 0)
+		return;
 	state = 0;
+	nl = 0;
 	for(i = 0; fmt[i]; i++){
 		c = fmt[i] & 0xff;
 		if(state == 0){
 			if(c == '%'){
 				state = '%';
 			} else {
-				putc(fd, c);
+				putc(fd, s, c);
+				if(c == '\n')
+					nl = 1;
 			}
 		} else if(state == '%'){
 			if(c == 'd'){
-				printint(fd, va_arg(ap, int), 10, 1);
+				printint(fd, s, va_arg(ap, int), 10, 1);
 			} else if(c == 'x' || c == 'p') {
-				printint(fd, va_arg(ap, int), 16, 0);
+				printint(fd, s, va_arg(ap, int), 16, 0);
 			} else if(c == 's'){
-				s = va_arg(ap, char*);
-				if(s == 0)
-					s = "(null)";
-				while(*s != 0){
-					putc(fd, *s);
-					s++;
+				p = va_arg(ap, char*);
+				if(p == 0)
+					p = "(null)";
+				for(; *p != 0; p++){
+					putc(fd, s, *p);
+					if(*p == '\n')
+						nl = 1;
 				}
 			} else if(c == 'c'){
-				putc(fd, va_arg(ap, uint));
+				putc(fd, s, va_arg(ap, uint));
 			} else if(c == '%'){
-				putc(fd, c);
+				putc(fd, s, c);
 			} else {
 				// Unknown % sequence.  Print it to draw attention.
-				putc(fd, '%');
-				putc(fd, c);
+				putc(fd, s, '%');
+				putc(fd, s, c);
 			}
 			state = 0;
 		}
 	}
+	if(s->mode == SNONE || (s->mode == SLINE && nl))
+		sflush(fd, s);
+	lock_release(&s->lock);
 }
 
 void
@@ -98,3 +225,36 @@ printf(const char *fmt, ...)
 	va_start(ap, fmt);
 	vprintf(1, fmt, ap);
 }
+
+// Read a line from fd 0, of at most max-1 bytes and its newline.
+char*
+gets(char *buf, int max)
+{
+	struct stream *s;
+	int i;
+	char c;
+
+	if(streams[1].mode == SLINE)
+		fflush(1);
+	s = slock(0, 'r');
+	for(i=0; i+1 < max; ){
+		if(s->r == s->n){
+			if(s->mode == SNONE)
+				s->n = read(0, s->buf, 1);
+			else
+				s->n = read(0, s->buf, sizeof(s->buf));
+			s->r = 0;
+			if(s->n < 1){
+				s->n = 0;
+				break;
+			}
+		}
+		c = s->buf[s->r++];
+		buf[i++] = c;
+		if(c == '\n' || c == '\r')
+			break;
+	}
+	buf[i] = '\0';
+	lock_release(&s->lock);
+	return buf;
+}
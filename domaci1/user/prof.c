@@ -0,0 +1,285 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memlayout.h"
+#include "kernel/elf.h"
+#include "kernel/poll.h"
+#include "kernel/prof.h"
+#include "user.h"
+
+// prof: run a command with the sampling profiler on, then list
+// the functions the samples fell in, most first. The profile is
+// of the whole machine: kernel functions, named from
+// /home/kernel.sym, have the samples of every process and of
+// idle CPUs. The command's own functions are named from its
+// symbol table; user time of other processes is counted by
+// itself.
+
+#define NSYM 2048
+#define NTOP 30
+
+struct sym {
+	uint addr;
+	char *name;
+	uint n;
+};
+
+struct sym ksym[NSYM], usym[NSYM];
+int nksym, nusym;
+uint total, kunknown, uunknown, other;
+
+struct profsample samples[512];
+
+// Sort syms by address.
+void
+symsort(struct sym *s, int n)
+{
+	struct sym t;
+	int i, j, gap;
+
+	for(gap = n/2; gap > 0; gap /= 2){
+		for(i = gap; i < n; i++){
+			t = s[i];
+			for(j = i; j >= gap && s[j-gap].addr > t.addr; j -= gap)
+				s[j] = s[j-gap];
+			s[j] = t;
+		}
+	}
+}
+
+// The symbol addr is in: the last one at or below it.
+struct sym*
+symfind(struct sym *s, int n, uint addr)
+{
+	int lo, hi, mid;
+
+	if(n == 0 || addr < s[0].addr)
+		return 0;
+	lo = 0;
+	hi = n;
+	while(hi - lo > 1){
+		mid = (lo + hi) / 2;
+		if(s[mid].addr <= addr)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return &s[lo];
+}
+
+int
+hexval(char c)
+{
+	if(c >= '0' && c <= '9')
+		return c - '0';
+	if(c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+// Read kernel.sym: one "address name" line per function.
+void
+loadksyms(char *path)
+{
+	struct stat st;
+	char *buf, *p, *e, *name;
+	int fd, d;
+	uint addr;
+
+	if((fd = open(path, 0)) < 0 || fstat(fd, &st) < 0){
+		fprintf(2, "prof: cannot read %s\n", path);
+		return;
+	}
+	buf = malloc(st.size + 1);
+	if(read(fd, buf, st.size) != st.size){
+		fprintf(2, "prof: cannot read %s\n", path);
+		close(fd);
+		return;
+	}
+	close(fd);
+	buf[st.size] = '\n';
+	e = buf + st.size;
+	p = buf;
+	while(p < e && nksym < NSYM){
+		for(addr = 0; (d = hexval(*p)) >= 0; p++)
+			addr = addr*16 + d;
+		if(*p == ' ')
+			p++;
+		name = p;
+		while(*p != '\n')
+			p++;
+		*p++ = 0;
+		if(addr && *name){
+			ksym[nksym].addr = addr;
+			ksym[nksym].name = name;
+			nksym++;
+		}
+	}
+	symsort(ksym, nksym);
+}
+
+// Read the function symbols from the ELF file path.
+void
+loadusyms(char *path)
+{
+	struct elfhdr elf;
+	struct secthdr sh, strsh;
+	struct elfsym *syms;
+	char *strs;
+	int fd, i, n;
+
+	if((fd = open(path, 0)) < 0)
+		return;
+	if(pread(fd, &elf, sizeof(elf), 0) != sizeof(elf) || elf.magic != ELF_MAGIC)
+		goto out;
+	for(i = 0; i < elf.shnum; i++){
+		if(pread(fd, &sh, sizeof(sh), elf.shoff + i*elf.shentsize) != sizeof(sh))
+			goto out;
+		if(sh.type == ELF_SECT_SYMTAB)
+			break;
+	}
+	if(i == elf.shnum ||
+	   pread(fd, &strsh, sizeof(strsh), elf.shoff + sh.link*elf.shentsize) != sizeof(strsh))
+		goto out;
+	syms = malloc(sh.size);
+	strs = malloc(strsh.size);
+	if(pread(fd, syms, sh.size, sh.off) != sh.size ||
+	   pread(fd, strs, strsh.size, strsh.off) != strsh.size)
+		goto out;
+	n = sh.size / sizeof(struct elfsym);
+	for(i = 0; i < n && nusym < NSYM; i++){
+		if(ELF_SYM_TYPE(syms[i].info) != ELF_SYM_FUNC)
+			continue;
+		usym[nusym].addr = syms[i].value;
+		usym[nusym].name = strs + syms[i].name;
+		nusym++;
+	}
+	symsort(usym, nusym);
+out:
+	close(fd);
+}
+
+// Count the samples waiting in the kernel against their symbols.
+void
+drain(int pid)
+{
+	struct profsample *s;
+	struct sym *y;
+	int i, n;
+
+	while((n = profread(samples, sizeof(samples)/sizeof(samples[0]))) > 0){
+		for(i = 0; i < n; i++){
+			s = &samples[i];
+			total++;
+			if(s->eip >= KERNBASE){
+				if((y = symfind(ksym, nksym, s->eip)) != 0)
+					y->n++;
+				else
+					kunknown++;
+			} else if(s->pid == pid){
+				if((y = symfind(usym, nusym, s->eip)) != 0)
+					y->n++;
+				else
+					uunknown++;
+			} else
+				other++;
+		}
+	}
+}
+
+struct sym *top[NTOP];
+int ntop;
+
+// Put the symbols with the most samples in top[], most first.
+void
+rank(struct sym *s, int n)
+{
+	int i;
+
+	for(; n > 0; s++, n--){
+		if(s->n == 0)
+			continue;
+		for(i = ntop; i > 0 && top[i-1]->n < s->n; i--)
+			if(i < NTOP)
+				top[i] = top[i-1];
+		if(i < NTOP){
+			top[i] = s;
+			if(ntop < NTOP)
+				ntop++;
+		}
+	}
+}
+
+void
+report(char *cmd, int lost)
+{
+	int j;
+
+	rank(ksym, nksym);
+	rank(usym, nusym);
+	printf("%d samples, %d lost\n", total, lost);
+	if(total == 0)
+		return;
+	printf("samples\t%%\tfunction\n");
+	for(j = 0; j < ntop; j++)
+		printf("%d\t%d\t%s%s\n", top[j]->n, top[j]->n*100/total, top[j]->name,
+		       top[j] >= ksym && top[j] < ksym + nksym ? " [kernel]" : "");
+	if(kunknown)
+		printf("%d\t%d\t(unknown kernel address)\n", kunknown, kunknown*100/total);
+	if(uunknown)
+		printf("%d\t%d\t(unknown address in %s)\n", uunknown, uunknown*100/total, cmd);
+	if(other)
+		printf("%d\t%d\t(other processes, user space)\n", other, other*100/total);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char path[64];
+	struct pollfd pfd;
+	int p[2], pid, lost;
+
+	if(argc < 2){
+		fprintf(2, "Usage: prof command [args...]\n");
+		exit();
+	}
+	if(strchr(argv[1], '/'))
+		safestrcpy(path, argv[1], sizeof(path));
+	else {
+		strcpy(path, "/bin/");
+		safestrcpy(path + 5, argv[1], sizeof(path) - 5);
+	}
+	loadksyms("/home/kernel.sym");
+	loadusyms(path);
+
+	// The command holds the pipe's write end until it exits;
+	// meanwhile the rings are drained every 100 ms.
+	if(pipe(p) < 0){
+		fprintf(2, "prof: pipe failed\n");
+		exit();
+	}
+	profile(1);
+	if((pid = fork()) < 0){
+		fprintf(2, "prof: fork failed\n");
+		exit();
+	}
+	if(pid == 0){
+		close(p[0]);
+		exec(path, argv + 1);
+		fprintf(2, "prof: exec %s failed\n", path);
+		exit();
+	}
+	close(p[1]);
+	pfd.fd = p[0];
+	pfd.events = POLLIN;
+	for(;;){
+		pfd.revents = 0;
+		if(poll(&pfd, 1, 100) != 0)
+			break;  // end of file: the command is done
+		drain(pid);
+	}
+	wait();
+	lost = profile(0);
+	drain(pid);
+	report(argv[1], lost);
+	exit();
+}
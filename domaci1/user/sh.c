@@ -1,8 +1,10 @@
 // Shell.
 
 #include "kernel/types.h"
+#include "kernel/stat.h"
 #include "user.h"
 #include "kernel/fcntl.h"
+#include "kernel/fs.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -10,10 +12,13 @@
 #define PIPE  3
 #define LIST  4
 #define BACK  5
+#define AND   6
+#define OR    7
 
 #define MAXARGS 10
 
 #define BINPATHLEN 20
+#define NPATHCACHE 32
 
 struct cmd {
 	int type;
@@ -40,6 +45,7 @@ struct pipecmd {
 	struct cmd *right;
 };
 
+// LIST, AND or OR.
 struct listcmd {
 	int type;
 	struct cmd *left;
@@ -54,16 +60,244 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
+int run(struct cmd*);
+
+// Command path cache: where each command found in /bin is,
+// hashed by name, so that running it again needs no lookup.
+// Only commands that were found are kept.
+struct {
+	char name[DIRSIZ+1];
+	char path[BINPATHLEN];
+} pathcache[NPATHCACHE];
+
+// Return the program file to run for command name, or 0 if
+// there is none. A name with a / in it is used as it is.
+char*
+lookpath(char *name)
+{
+	struct stat st;
+	uint h;
+	char *p;
+	int n;
+
+	if(strchr(name, '/'))
+		return name;
+	n = strlen(name);
+	if(n > DIRSIZ)
+		return 0;
+	h = 0;
+	for(p = name; *p; p++)
+		h = h*31 + *p;
+	h %= NPATHCACHE;
+	if(strcmp(pathcache[h].name, name) == 0)
+		return pathcache[h].path;
+
+	strcpy(pathcache[h].path, "/bin/");
+	strcpy(pathcache[h].path + 5, name);
+	if(stat(pathcache[h].path, &st) < 0 || st.type != T_FILE){
+		pathcache[h].name[0] = 0;
+		return 0;
+	}
+	strcpy(pathcache[h].name, name);
+	return pathcache[h].path;
+}
+
+// Builtins, run by the shell itself. Each returns 0 for
+// success, as a command run with && and || would.
+
+int
+echo(char **argv)
+{
+	char buf[128];
+	int i, n, m;
+
+	// One write(), so that the line is not split up on a
+	// pipe, nor held back in printf()'s buffers.
+	n = 0;
+	for(i = 1; argv[i]; i++){
+		m = strlen(argv[i]);
+		if(n + m + 1 > sizeof(buf)){
+			write(1, buf, n);
+			n = 0;
+		}
+		if(m + 1 > sizeof(buf)){
+			write(1, argv[i], m);
+			m = 0;
+		}
+		memmove(buf + n, argv[i], m);
+		n += m;
+		buf[n++] = argv[i+1] ? ' ' : '\n';
+	}
+	if(i == 1)
+		buf[n++] = '\n';
+	write(1, buf, n);
+	return 0;
+}
+
+int
+cd(char **argv)
+{
+	char *dir;
+
+	dir = argv[1] ? argv[1] : "/";
+	if(chdir(dir) < 0){
+		fprintf(2, "cannot cd %s\n", dir);
+		return 1;
+	}
+	return 0;
+}
+
+// Find the name in directory up ("..", "../..", ...) of the
+// file whose stat is st. Returns 0 if there is none.
+static char*
+nameof(char *up, struct stat *st, struct stat *upst)
+{
+	static struct dirent de;
+	char path[64];
+	struct stat s;
+	int fd, n;
+
+	if((fd = open(up, O_RDONLY)) < 0)
+		return 0;
+	n = strlen(up);
+	while(read(fd, &de, sizeof(de)) == sizeof(de)){
+		if(de.inum == 0 || strcmp(de.name, ".") == 0 || strcmp(de.name, "..") == 0)
+			continue;
+		if(upst->dev == st->dev){
+			if(de.inum != st->ino)
+				continue;
+		} else {
+			// A file system is mounted here: only the name
+			// leads into it.
+			memmove(path, up, n);
+			path[n] = '/';
+			memmove(path + n + 1, de.name, DIRSIZ);
+			path[n + 1 + DIRSIZ] = 0;
+			if(stat(path, &s) < 0 || s.dev != st->dev || s.ino != st->ino)
+				continue;
+		}
+		close(fd);
+		return de.name;
+	}
+	close(fd);
+	return 0;
+}
+
+int
+pwd(char **argv)
+{
+	char up[64], cwd[128], *name;
+	struct stat st, upst;
+	int n, m;
+
+	// Build cwd from the end, going up until ".." is ".".
+	n = sizeof(cwd) - 1;
+	cwd[n] = 0;
+	strcpy(up, ".");
+	if(stat(up, &st) < 0)
+		goto bad;
+	for(;;){
+		if(strlen(up) + 4 > sizeof(up))
+			goto bad;
+		strcpy(up + strlen(up), strcmp(up, ".") == 0 ? "." : "/..");
+		if(stat(up, &upst) < 0)
+			goto bad;
+		if(upst.dev == st.dev && upst.ino == st.ino)
+			break;
+		if((name = nameof(up, &st, &upst)) == 0)
+			goto bad;
+		for(m = 0; m < DIRSIZ && name[m]; m++)
+			;
+		if(n < m + 1)
+			goto bad;
+		n -= m;
+		memmove(cwd + n, name, m);
+		cwd[--n] = '/';
+		st = upst;
+	}
+	if(n == sizeof(cwd) - 1)
+		cwd[--n] = '/';
+	cwd[sizeof(cwd) - 1] = '\n';
+	write(1, cwd + n, sizeof(cwd) - n);
+	return 0;
+
+bad:
+	fprintf(2, "pwd: cannot find the current directory\n");
+	return 1;
+}
+
+// test: -e/-f/-d file, s1 = s2, s1 != s2, with ! before any.
+int
+test(char **argv)
+{
+	struct stat st;
+	int not, r;
+
+	argv++;
+	not = 0;
+	if(argv[0] && strcmp(argv[0], "!") == 0){
+		not = 1;
+		argv++;
+	}
+	if(argv[0] == 0)
+		r = 0;
+	else if(argv[1] == 0)
+		r = argv[0][0] != 0;
+	else if(argv[0][0] == '-' && argv[2] == 0){
+		if(stat(argv[1], &st) < 0)
+			r = 0;
+		else if(strcmp(argv[0], "-d") == 0)
+			r = st.type == T_DIR;
+		else if(strcmp(argv[0], "-f") == 0)
+			r = st.type == T_FILE;
+		else if(strcmp(argv[0], "-e") == 0)
+			r = 1;
+		else
+			goto bad;
+	} else if(argv[2] && argv[3] == 0 && strcmp(argv[1], "=") == 0)
+		r = strcmp(argv[0], argv[2]) == 0;
+	else if(argv[2] && argv[3] == 0 && strcmp(argv[1], "!=") == 0)
+		r = strcmp(argv[0], argv[2]) != 0;
+	else
+		goto bad;
+	return r == not;
+
+bad:
+	fprintf(2, "test: bad expression\n");
+	return 2;
+}
+
+struct {
+	char *name;
+	int (*fn)(char**);
+} builtins[] = {
+	{ "cd", cd },
+	{ "echo", echo },
+	{ "pwd", pwd },
+	{ "test", test },
+	{ "[", test },
+};
+
+int (*builtin(char *name))(char**)
+{
+	int i;
+
+	for(i = 0; i < sizeof(builtins)/sizeof(builtins[0]); i++)
+		if(strcmp(builtins[i].name, name) == 0)
+			return builtins[i].fn;
+	return 0;
+}
 
 // Execute cmd.  Never returns.
 void
 runcmd(struct cmd *cmd)
 {
 	int p[2];
-	char binpath[BINPATHLEN];
+	char *path;
+	int (*fn)(char**);
 	struct backcmd *bcmd;
 	struct execcmd *ecmd;
-	struct listcmd *lcmd;
 	struct pipecmd *pcmd;
 	struct redircmd *rcmd;
 
@@ -78,10 +312,16 @@ runcmd(struct cmd *cmd)
 		ecmd = (struct execcmd*)cmd;
 		if(ecmd->argv[0] == 0)
 			exit();
-		strcpy(binpath, "/bin/");
-		safestrcpy(binpath + 5, ecmd->argv[0], 14);
-		exec(binpath, ecmd->argv);
-		fprintf(2, "exec %s failed\n", binpath);
+		if((fn = builtin(ecmd->argv[0])) != 0){
+			fn(ecmd->argv);
+			exit();
+		}
+		if((path = lookpath(ecmd->argv[0])) == 0){
+			fprintf(2, "%s: not found\n", ecmd->argv[0]);
+			exit();
+		}
+		exec(path, ecmd->argv);
+		fprintf(2, "exec %s failed\n", path);
 		break;
 
 	case REDIR:
@@ -95,11 +335,9 @@ runcmd(struct cmd *cmd)
 		break;
 
 	case LIST:
-		lcmd = (struct listcmd*)cmd;
-		if(fork1() == 0)
-			runcmd(lcmd->left);
-		wait();
-		runcmd(lcmd->right);
+	case AND:
+	case OR:
+		run(cmd);
 		break;
 
 	case PIPE:
@@ -135,6 +373,75 @@ runcmd(struct cmd *cmd)
 	exit();
 }
 
+// Run a program for ecmd and wait for it. The child only execs,
+// so it can borrow the shell's memory with vfork() instead of
+// copying it.
+int
+spawn(struct execcmd *ecmd)
+{
+	char *path;
+	int pid;
+
+	if((path = lookpath(ecmd->argv[0])) == 0){
+		fprintf(2, "%s: not found\n", ecmd->argv[0]);
+		return 1;
+	}
+	if((pid = vfork()) < 0)
+		pid = fork1();
+	if(pid == 0){
+		exec(path, ecmd->argv);
+		fprintf(2, "exec %s failed\n", path);
+		exit();
+	}
+	wait();
+	return 0;
+}
+
+// Run cmd in the shell, so that builtins such as cd change the
+// shell itself, and return its status: that of a builtin, 1 for
+// a command not found, and otherwise 0, for there are no exit
+// statuses. Pipes, redirections and & still fork a child to run
+// them.
+int
+run(struct cmd *cmd)
+{
+	struct execcmd *ecmd;
+	struct listcmd *lcmd;
+	int (*fn)(char**);
+	int r;
+
+	if(cmd == 0)
+		return 0;
+
+	switch(cmd->type){
+	case EXEC:
+		ecmd = (struct execcmd*)cmd;
+		if(ecmd->argv[0] == 0)
+			return 0;
+		if((fn = builtin(ecmd->argv[0])) != 0)
+			return fn(ecmd->argv);
+		return spawn(ecmd);
+
+	case LIST:
+		lcmd = (struct listcmd*)cmd;
+		run(lcmd->left);
+		return run(lcmd->right);
+
+	case AND:
+	case OR:
+		lcmd = (struct listcmd*)cmd;
+		r = run(lcmd->left);
+		if((r == 0) == (cmd->type == AND))
+			r = run(lcmd->right);
+		return r;
+	}
+
+	if(fork1() == 0)
+		runcmd(cmd);
+	wait();
+	return 0;
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -150,6 +457,7 @@ int
 main(void)
 {
 	static char buf[100];
+	struct cmd *cmd;
 	int fd;
 
 	// Ensure that three file descriptors are open.
@@ -162,16 +470,9 @@ main(void)
 
 	// Read and run input commands.
 	while(getcmd(buf, sizeof(buf)) >= 0){
-		if(buf[0] == 'c' && buf[1] == 'd' && buf[2] == ' '){
-			// Chdir must be called by the parent, not the child.
-			buf[strlen(buf)-1] = 0;  // chop \n
-			if(chdir(buf+3) < 0)
-				fprintf(2, "cannot cd %s\n", buf+3);
-			continue;
-		}
-		if(fork1() == 0)
-			runcmd(parsecmd(buf));
-		wait();
+		if((cmd = parsecmd(buf)) != 0)
+			run(cmd);
+		freecmd(cmd);
 	}
 	exit();
 }
@@ -249,6 +550,17 @@ listcmd(struct cmd *left, struct cmd *right)
 	return (struct cmd*)cmd;
 }
 
+// left && right, or left || right.
+struct cmd*
+condcmd(int type, struct cmd *left, struct cmd *right)
+{
+	struct cmd *cmd;
+
+	cmd = listcmd(left, right);
+	cmd->type = type;
+	return cmd;
+}
+
 struct cmd*
 backcmd(struct cmd *subcmd)
 {
@@ -280,14 +592,26 @@ gettoken(char **ps, char *es, char **q, char **eq)
 	switch(*s){
 	case 0:
 		break;
-	case '|':
 	case '(':
 	case ')':
 	case ';':
-	case '&':
 	case '<':
 		s++;
 		break;
+	case '&':
+		s++;
+		if(*s == '&'){
+			ret = 'A';
+			s++;
+		}
+		break;
+	case '|':
+		s++;
+		if(*s == '|'){
+			ret = 'O';
+			s++;
+		}
+		break;
 	case '>':
 		s++;
 		if(*s == '>'){
@@ -322,23 +646,49 @@ peek(char **ps, char *es, char *toks)
 	return *s && strchr(toks, *s);
 }
 
+// Like peek for the one-character token tok, & or |, but not
+// when it is doubled into && or ||.
+int
+peek1(char **ps, char *es, char *tok)
+{
+	return peek(ps, es, tok) && (*ps)[1] != tok[0];
+}
+
 struct cmd *parseline(char**, char*);
+struct cmd *parseandor(char**, char*);
 struct cmd *parsepipe(char**, char*);
 struct cmd *parseexec(char**, char*);
 struct cmd *nulterminate(struct cmd*);
 
+// Set by syntax(). The shell parses in its own process, so a
+// syntax error drops the line instead of exiting.
+int parseerr;
+
+void
+syntax(char *msg)
+{
+	if(!parseerr)
+		fprintf(2, "%s\n", msg);
+	parseerr = 1;
+}
+
 struct cmd*
 parsecmd(char *s)
 {
 	char *es;
 	struct cmd *cmd;
 
+	parseerr = 0;
 	es = s + strlen(s);
 	cmd = parseline(&s, es);
 	peek(&s, es, "");
-	if(s != es){
+	if(s != es && !parseerr){
 		fprintf(2, "leftovers: %s\n", s);
-		panic("syntax");
+		syntax("syntax");
+	}
+	if(parseerr){
+		freecmd(cmd);
+		return 0;
 	}
 	nulterminate(cmd);
 	return cmd;
@@ -349,8 +699,8 @@ parseline(char **ps, char *es)
 {
 	struct cmd *cmd;
 
-	cmd = parsepipe(ps, es);
-	while(peek(ps, es, "&")){
+	cmd = parseandor(ps, es);
+	while(peek1(ps, es, "&")){
 		gettoken(ps, es, 0, 0);
 		cmd = backcmd(cmd);
 	}
@@ -361,13 +711,28 @@ parseline(char **ps, char *es)
 	return cmd;
 }
 
+// Pipelines joined by && and ||, which bind left to right.
+struct cmd*
+parseandor(char **ps, char *es)
+{
+	struct cmd *cmd;
+	int tok;
+
+	cmd = parsepipe(ps, es);
+	while(!parseerr && peek(ps, es, "&|") && (*ps)[1] == (*ps)[0]){
+		tok = gettoken(ps, es, 0, 0);
+		cmd = condcmd(tok == 'A' ? AND : OR, cmd, parsepipe(ps, es));
+	}
+	return cmd;
+}
+
 struct cmd*
 parsepipe(char **ps, char *es)
 {
 	struct cmd *cmd;
 
 	cmd = parseexec(ps, es);
-	if(peek(ps, es, "|")){
+	if(peek1(ps, es, "|")){
 		gettoken(ps, es, 0, 0);
 		cmd = pipecmd(cmd, parsepipe(ps, es));
 	}
@@ -382,8 +747,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
 	while(peek(ps, es, "<>")){
 		tok = gettoken(ps, es, 0, 0);
-		if(gettoken(ps, es, &q, &eq) != 'a')
-			panic("missing file for redirection");
+		if(gettoken(ps, es, &q, &eq) != 'a'){
+			syntax("missing file for redirection");
+			break;
+		}
 		switch(tok){
 		case '<':
 			cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -408,8 +775,10 @@ parseblock(char **ps, char *es)
 		panic("parseblock");
 	gettoken(ps, es, 0, 0);
 	cmd = parseline(ps, es);
-	if(!peek(ps, es, ")"))
-		panic("syntax - missing )");
+	if(!peek(ps, es, ")")){
+		syntax("syntax - missing )");
+		return cmd;
+	}
 	gettoken(ps, es, 0, 0);
 	cmd = parseredirs(cmd, ps, es);
 	return cmd;
@@ -431,16 +800,20 @@ parseexec(char **ps, char *es)
 
 	argc = 0;
 	ret = parseredirs(ret, ps, es);
-	while(!peek(ps, es, "|)&;")){
+	while(!parseerr && !peek(ps, es, "|)&;")){
 		if((tok=gettoken(ps, es, &q, &eq)) == 0)
 			break;
-		if(tok != 'a')
-			panic("syntax");
+		if(tok != 'a'){
+			syntax("syntax");
+			break;
+		}
+		if(argc >= MAXARGS-1){
+			syntax("too many args");
+			break;
+		}
 		cmd->argv[argc] = q;
 		cmd->eargv[argc] = eq;
 		argc++;
-		if(argc >= MAXARGS)
-			panic("too many args");
 		ret = parseredirs(ret, ps, es);
 	}
 	cmd->argv[argc] = 0;
@@ -482,6 +855,8 @@ nulterminate(struct cmd *cmd)
 		break;
 
 	case LIST:
+	case AND:
+	case OR:
 		lcmd = (struct listcmd*)cmd;
 		nulterminate(lcmd->left);
 		nulterminate(lcmd->right);
@@ -494,3 +869,43 @@ nulterminate(struct cmd *cmd)
 	}
 	return cmd;
 }
+
+// Free cmd and everything under it, once it has run.
+void
+freecmd(struct cmd *cmd)
+{
+	struct backcmd *bcmd;
+	struct listcmd *lcmd;
+	struct pipecmd *pcmd;
+	struct redircmd *rcmd;
+
+	if(cmd == 0)
+		return;
+
+	switch(cmd->type){
+	case REDIR:
+		rcmd = (struct redircmd*)cmd;
+		freecmd(rcmd->cmd);
+		break;
+
+	case PIPE:
+		pcmd = (struct pipecmd*)cmd;
+		freecmd(pcmd->left);
+		freecmd(pcmd->right);
+		break;
+
+	case LIST:
+	case AND:
+	case OR:
+		lcmd = (struct listcmd*)cmd;
+		freecmd(lcmd->left);
+		freecmd(lcmd->right);
+		break;
+
+	case BACK:
+		bcmd = (struct backcmd*)cmd;
+		freecmd(bcmd->cmd);
+		break;
+	}
+	free(cmd);
+}
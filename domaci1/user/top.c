@@ -0,0 +1,80 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/rusage.h"
+#include "user.h"
+
+// top: every second, list the processes by the CPU time they
+// used during it, the busiest first; "top n" stops after n
+// listings. %CPU is of one CPU, so it can pass 100 with more
+// than one. Times are in ticks and counts are for the whole
+// life of the process.
+
+struct rusage old[NPROC], cur[NPROC];
+int rank[NPROC];
+int delta[NPROC];
+
+char *states[] = { "unused", "embryo", "sleep ", "runble", "run   ", "zombie" };
+
+uint
+calls(struct rusage *r)
+{
+	uint n;
+	int i;
+
+	n = 0;
+	for(i = 0; i < NSYSCALL; i++)
+		n += r->nsyscall[i];
+	return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int nold, ncur, count, start, ticks, i, j, t;
+
+	count = argc > 1 ? atoi(argv[1]) : -1;
+	nold = getrusage(-1, old, NPROC);
+	start = uptime();
+	while(count < 0 || count-- > 0){
+		sleep(100);
+		if((ncur = getrusage(-1, cur, NPROC)) < 0){
+			fprintf(2, "top: getrusage failed\n");
+			exit();
+		}
+		ticks = uptime() - start;
+		start += ticks;
+		if(ticks == 0)
+			ticks = 1;
+
+		// Time used since the last listing; a process that
+		// was not in it is new and all of its time counts.
+		for(i = 0; i < ncur; i++){
+			delta[i] = cur[i].utime + cur[i].stime;
+			for(j = 0; j < nold; j++){
+				if(old[j].pid == cur[i].pid){
+					delta[i] -= old[j].utime + old[j].stime;
+					break;
+				}
+			}
+			for(j = i; j > 0 && delta[rank[j-1]] < delta[i]; j--)
+				rank[j] = rank[j-1];
+			rank[j] = i;
+		}
+
+		printf("PID\tSTATE\tNAME\t%%CPU\tUTIME\tSTIME\tCSW\tCALLS\tFLT\tRD\tWR\n");
+		for(j = 0; j < ncur; j++){
+			i = rank[j];
+			t = cur[i].state;
+			printf("%d\t%s\t%s\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n",
+			       cur[i].pid, t >= 0 && t < sizeof(states)/sizeof(states[0]) ? states[t] : "?",
+			       cur[i].name, delta[i]*100/ticks, cur[i].utime, cur[i].stime,
+			       cur[i].nswitch, calls(&cur[i]), cur[i].nfault,
+			       cur[i].nread, cur[i].nwrite);
+		}
+		printf("\n");
+		memmove(old, cur, ncur*sizeof(cur[0]));
+		nold = ncur;
+	}
+	exit();
+}
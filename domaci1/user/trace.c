@@ -0,0 +1,179 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/poll.h"
+#include "kernel/trace.h"
+#include "kernel/x86.h"
+#include "user.h"
+
+// trace: run a command with kernel event tracing on, and print
+// the events, one a line:
+//
+//	<us> <cpu> <pid> <event> <arg>
+//
+// with the time in microseconds since the command started. Each
+// CPU's events come in order, but the CPUs' are interleaved in
+// batches: sort on the first column to merge them. Events of
+// trace itself are left out.
+//
+//	trace [-c sched,sleep,disk,log,syscall] command [args...]
+
+struct traceev evs[512];
+uint64 tsc0;
+uint tscperus;
+
+struct {
+	char *name;
+	int mask;
+} cats[] = {
+	{ "sched", TC_SCHED },
+	{ "sleep", TC_SLEEP },
+	{ "disk", TC_DISK },
+	{ "log", TC_LOG },
+	{ "syscall", TC_SYSCALL },
+	{ "all", TC_ALL },
+};
+
+char *evnames[] = {
+[TE_SWITCH]  "switch",
+[TE_SCHED]   "sched",
+[TE_SLEEP]   "sleep",
+[TE_WAKEUP]  "wakeup",
+[TE_IDEREQ]  "idereq",
+[TE_IDEDONE] "idedone",
+[TE_BEGINOP] "beginop",
+[TE_COMMIT]  "commit",
+[TE_SYSCALL] "syscall",
+[TE_SYSRET]  "sysret",
+};
+
+void
+usage(void)
+{
+	fprintf(2, "Usage: trace [-c sched,sleep,disk,log,syscall] command [args...]\n");
+	exit();
+}
+
+// The mask for a comma-separated list of categories.
+int
+parsecats(char *s)
+{
+	int i, n, mask;
+	char *e;
+
+	mask = 0;
+	while(*s){
+		if((e = strchr(s, ',')) == 0)
+			e = s + strlen(s);
+		n = e - s;
+		for(i = 0; i < sizeof(cats)/sizeof(cats[0]); i++)
+			if(strlen(cats[i].name) == n && memcmp(cats[i].name, s, n) == 0)
+				break;
+		if(i == sizeof(cats)/sizeof(cats[0])){
+			fprintf(2, "trace: no category %s\n", s);
+			exit();
+		}
+		mask |= cats[i].mask;
+		s = *e ? e + 1 : e;
+	}
+	return mask;
+}
+
+// Find the TSC rate against nanouptime(), over a tick.
+void
+calibrate(void)
+{
+	uint64 t0, t1, n0, n1;
+
+	t0 = rdtsc();
+	nanouptime(&n0);
+	sleep(1);
+	t1 = rdtsc();
+	nanouptime(&n1);
+	tscperus = div64(t1 - t0, div64(n1 - n0, 1000));
+	if(tscperus == 0)
+		tscperus = 1;
+}
+
+// Print the events in the rings, but those of pid self.
+void
+drain(int self)
+{
+	struct traceev *e;
+	int i, n;
+
+	while((n = traceread(evs, sizeof(evs)/sizeof(evs[0]))) > 0){
+		for(i = 0; i < n; i++){
+			e = &evs[i];
+			if(e->pid == self)
+				continue;
+			printf("%d %d %d %s %x\n",
+			       e->tsc < tsc0 ? 0 : (uint)div64(e->tsc - tsc0, tscperus),
+			       e->cpu, e->pid,
+			       e->type < sizeof(evnames)/sizeof(evnames[0]) && evnames[e->type] ?
+			       evnames[e->type] : "?", e->arg);
+		}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	char path[64];
+	struct pollfd pfd;
+	int p[2], pid, mask, lost, self;
+
+	mask = TC_ALL;
+	if(argc >= 3 && strcmp(argv[1], "-c") == 0){
+		mask = parsecats(argv[2]);
+		argc -= 2;
+		argv += 2;
+	}
+	if(argc < 2 || mask == 0)
+		usage();
+	if(strchr(argv[1], '/'))
+		safestrcpy(path, argv[1], sizeof(path));
+	else {
+		strcpy(path, "/bin/");
+		safestrcpy(path + 5, argv[1], sizeof(path) - 5);
+	}
+	self = getpid();
+	calibrate();
+
+	// As in prof, the command holds the pipe's write end until
+	// it exits; meanwhile the rings are drained every 10 ms.
+	if(pipe(p) < 0){
+		fprintf(2, "trace: pipe failed\n");
+		exit();
+	}
+	tsc0 = rdtsc();
+	if(trace(mask) < 0){
+		fprintf(2, "trace: cannot start tracing\n");
+		exit();
+	}
+	if((pid = fork()) < 0){
+		fprintf(2, "trace: fork failed\n");
+		exit();
+	}
+	if(pid == 0){
+		close(p[0]);
+		exec(path, argv + 1);
+		fprintf(2, "trace: exec %s failed\n", path);
+		exit();
+	}
+	close(p[1]);
+	pfd.fd = p[0];
+	pfd.events = POLLIN;
+	for(;;){
+		pfd.revents = 0;
+		if(poll(&pfd, 1, 10) != 0)
+			break;  // end of file: the command is done
+		drain(self);
+	}
+	wait();
+	lost = trace(0);
+	drain(self);
+	if(lost)
+		fprintf(2, "trace: %d events lost\n", lost);
+	exit();
+}
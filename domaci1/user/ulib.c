@@ -64,7 +64,11 @@ strlen(const char *s)
 void*
 memset(void *dst, int c, uint n)
 {
-	stosb(dst, c, n);
+	if((uint)dst % 4 == 0 && n % 4 == 0){
+		c &= 0xFF;
+		stosl(dst, (c<<24)|(c<<16)|(c<<8)|c, n/4);
+	} else
+		stosb(dst, c, n);
 	return dst;
 }
 
@@ -77,24 +81,6 @@ strchr(const char *s, char c)
 	return 0;
 }
 
-char*
-gets(char *buf, int max)
-{
-	int i, cc;
-	char c;
-
-	for(i=0; i+1 < max; ){
-		cc = read(0, &c, 1);
-		if(cc < 1)
-			break;
-		buf[i++] = c;
-		if(c == '\n' || c == '\r')
-			break;
-	}
-	buf[i] = '\0';
-	return buf;
-}
-
 int
 stat(const char *n, struct stat *st)
 {
@@ -120,15 +106,208 @@ atoi(const char *s)
 	return n;
 }
 
+// As in the kernel: a word at a time when dst and src can
+// both be aligned.
 void*
 memmove(void *vdst, const void *vsrc, int n)
 {
 	char *dst;
 	const char *src;
+	int k;
 
 	dst = vdst;
 	src = vsrc;
-	while(n-- > 0)
-		*dst++ = *src++;
+	if(n <= 0)
+		return vdst;
+	if(src < dst && src + n > dst){
+		src += n;
+		dst += n;
+		if(((uint)src ^ (uint)dst) % 4 == 0){
+			for(; n > 0 && (uint)dst % 4; n--)
+				*--dst = *--src;
+			for(; n >= 4; n -= 4){
+				dst -= 4;
+				src -= 4;
+				*(uint*)dst = *(uint*)src;
+			}
+		}
+		while(n-- > 0)
+			*--dst = *--src;
+	} else if(((uint)src ^ (uint)dst) % 4 == 0 && n >= 16){
+		k = -(uint)dst % 4;
+		movsb(dst, src, k);
+		movsl(dst + k, src + k, (n - k) / 4);
+		k += (n - k) & ~3;
+		movsb(dst + k, src + k, n - k);
+	} else
+		movsb(dst, src, n);
 	return vdst;
 }
+
+int
+memcmp(const void *v1, const void *v2, uint n)
+{
+	const uchar *s1, *s2;
+
+	s1 = v1;
+	s2 = v2;
+	if(((uint)s1 ^ (uint)s2) % 4 == 0){
+		for(; n > 0 && (uint)s1 % 4; n--, s1++, s2++)
+			if(*s1 != *s2)
+				return *s1 - *s2;
+		for(; n >= 4 && *(uint*)s1 == *(uint*)s2; n -= 4)
+			s1 += 4, s2 += 4;
+	}
+	for(; n > 0; n--, s1++, s2++)
+		if(*s1 != *s2)
+			return *s1 - *s2;
+	return 0;
+}
+
+// The system calls that must first write out printf()'s
+// buffered output; see printf.c.
+int _fork(void);
+int _exit(void) __attribute__((noreturn));
+int _exec(char*, char**);
+int _close(int);
+
+void (*streamhook)(int);
+
+int
+fork(void)
+{
+	if(streamhook)
+		streamhook(-1);
+	return _fork();
+}
+
+int
+exit(void)
+{
+	if(streamhook)
+		streamhook(-1);
+	_exit();
+}
+
+int
+exec(char *path, char **argv)
+{
+	if(streamhook)
+		streamhook(-1);
+	return _exec(path, argv);
+}
+
+int
+close(int fd)
+{
+	if(streamhook)
+		streamhook(fd);
+	return _close(fd);
+}
+
+// Threads. thread_create() gives each thread a TSTACK-byte
+// stack from malloc() and puts fn and arg at its top, where
+// threadstart() finds them; thread_join() frees it.
+#define TSTACK (4*4096)
+
+struct tstart {
+	void (*fn)(void*);
+	void *arg;
+};
+
+static void
+threadstart(void *a)
+{
+	struct tstart *t;
+
+	t = a;
+	t->fn(t->arg);
+	exit();
+}
+
+// Start a thread running fn(arg) in this process.
+// Returns its pid, or -1.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+	char *stack;
+	struct tstart *t;
+	int pid;
+
+	if((stack = malloc(TSTACK)) == 0)
+		return -1;
+	t = (struct tstart*)(stack + TSTACK) - 1;
+	t->fn = fn;
+	t->arg = arg;
+	if((pid = clone(threadstart, t, stack, (char*)t - stack)) < 0)
+		free(stack);
+	return pid;
+}
+
+// Wait for a thread made by thread_create() to exit and
+// return its pid, or -1 if there are none.
+int
+thread_join(void)
+{
+	void *stack;
+	int pid;
+
+	if((pid = join(&stack)) >= 0)
+		free(stack);
+	return pid;
+}
+
+void
+lock_init(struct lock *lk)
+{
+	lk->locked = 0;
+}
+
+void
+lock_acquire(struct lock *lk)
+{
+	while(xchg(&lk->locked, 1) != 0)
+		;
+	__sync_synchronize();
+}
+
+void
+lock_release(struct lock *lk)
+{
+	__sync_synchronize();
+	asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+}
+
+// A mutex sleeps in the kernel instead of spinning: state is
+// 0 if it is free, 1 if held, and 2 if held and there may be
+// threads in futexwait() for it. See Drepper, "Futexes Are
+// Tricky".
+void
+mutex_init(struct mutex *m)
+{
+	m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+	uint c;
+
+	if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+		return;
+	if(c != 2)
+		c = xchg(&m->state, 2);
+	while(c != 0){
+		futexwait(&m->state, 2);
+		c = xchg(&m->state, 2);
+	}
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+	if(__sync_fetch_and_sub(&m->state, 1) != 1){
+		m->state = 0;
+		futexwake(&m->state);
+	}
+}
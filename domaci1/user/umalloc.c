@@ -3,30 +3,68 @@
 #include "user.h"
 #include "kernel/param.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator.
+//
+// Small blocks, up to NBIN units with their header, come from
+// bins: bin[n] is a stack of free blocks of exactly n units, so
+// allocating and freeing them takes constant time. An empty bin
+// is refilled by cutting up a CHUNK-unit block of the large
+// pool. Small blocks go back to their bin, never to the pool.
+//
+// Larger blocks are the allocator of Kernighan and Ritchie, The
+// C Programming Language, 2nd ed., Section 8.7: a free list in
+// address order, first fit, merging neighbours on free. A free
+// block of at least TRIM units that ends at the break is given
+// back to the kernel.
+//
+// mlock makes it safe for threads.
 
 typedef long Align;
 
 union header {
 	struct {
 		union header *ptr;
-		uint size;
+		uint size;       // in units, this header included
 	} s;
 	Align x;
 };
 
 typedef union header Header;
 
+#define NBIN   32    // largest small block, in units
+#define CHUNK  512   // units cut up to refill a bin
+#define MINCORE 1024 // fewest units asked of sbrk()
+#define TRIM   4096  // free units at the break worth returning
+
 static Header base;
 static Header *freep;
+static Header *bin[NBIN+1];
+static struct lock mlock;
 
-void
-free(void *ap)
+// Give the pool's top block back to the kernel if it is big
+// enough and nothing was allocated above it since.
+// Caller holds mlock; bp is on the free list.
+static void
+trim(Header *bp)
 {
-	Header *bp, *p;
+	Header *p;
+
+	if(bp->s.size < TRIM || sbrk(0) != (char*)(bp + bp->s.size))
+		return;
+	for(p = freep; p->s.ptr != bp; p = p->s.ptr)
+		;
+	p->s.ptr = bp->s.ptr;
+	freep = p;
+	sbrk(-(int)(bp->s.size * sizeof(Header)));
+}
+
+// Put bp on the free list, merging it with its neighbours.
+// Returns the block it ended up in. Caller holds mlock.
+static Header*
+poolput(Header *bp)
+{
+	Header *p;
 
-	bp = (Header*)ap - 1;
 	for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
 		if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
 			break;
@@ -38,35 +76,52 @@ free(void *ap)
 	if(p + p->s.size == bp){
 		p->s.size += bp->s.size;
 		p->s.ptr = bp->s.ptr;
+		bp = p;
 	} else
 		p->s.ptr = bp;
 	freep = p;
+	return bp;
 }
 
+void
+free(void *ap)
+{
+	Header *bp;
+
+	bp = (Header*)ap - 1;
+	lock_acquire(&mlock);
+	if(bp->s.size <= NBIN){
+		bp->s.ptr = bin[bp->s.size];
+		bin[bp->s.size] = bp;
+	} else
+		trim(poolput(bp));
+	lock_release(&mlock);
+}
+
+// Grow the pool by at least nu units. Caller holds mlock.
 static Header*
 morecore(uint nu)
 {
 	char *p;
 	Header *hp;
 
-	if(nu < 4096)
-		nu = 4096;
+	if(nu < MINCORE)
+		nu = MINCORE;
 	p = sbrk(nu * sizeof(Header));
 	if(p == (char*)-1)
 		return 0;
 	hp = (Header*)p;
 	hp->s.size = nu;
-	free((void*)(hp + 1));
+	poolput(hp);
 	return freep;
 }
 
-void*
-malloc(uint nbytes)
+// Take a block of nunits units from the pool. Caller holds mlock.
+static Header*
+poolalloc(uint nunits)
 {
 	Header *p, *prevp;
-	uint nunits;
 
-	nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
 	if((prevp = freep) == 0){
 		base.s.ptr = freep = prevp = &base;
 		base.s.size = 0;
@@ -81,10 +136,53 @@ malloc(uint nbytes)
 				p->s.size = nunits;
 			}
 			freep = prevp;
-			return (void*)(p + 1);
+			return p;
 		}
 		if(p == freep)
 			if((p = morecore(nunits)) == 0)
 				return 0;
 	}
 }
+
+// Fill bin[n] from a CHUNK of the pool. The block at the end
+// takes the units left over, which may make it large; free()
+// then sends it to the pool. Caller holds mlock.
+static int
+binfill(uint n)
+{
+	Header *p, *end;
+
+	if((p = poolalloc(CHUNK)) == 0)
+		return -1;
+	end = p + CHUNK;
+	for(; p + 2*n <= end; p += n){
+		p->s.size = n;
+		p->s.ptr = bin[n];
+		bin[n] = p;
+	}
+	p->s.size = end - p;
+	p->s.ptr = bin[n];
+	bin[n] = p;
+	return 0;
+}
+
+void*
+malloc(uint nbytes)
+{
+	Header *p;
+	uint nunits;
+
+	nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+	lock_acquire(&mlock);
+	if(nunits <= NBIN){
+		if(bin[nunits] == 0 && binfill(nunits) < 0){
+			lock_release(&mlock);
+			return 0;
+		}
+		p = bin[nunits];
+		bin[nunits] = p->s.ptr;
+	} else
+		p = poolalloc(nunits);
+	lock_release(&mlock);
+	return p ? (void*)(p + 1) : 0;
+}
@@ -1,5 +1,13 @@
 struct stat;
 struct rtcdate;
+struct iovec;
+struct pollfd;
+struct ring;
+struct lockstat;
+struct profsample;
+struct rusage;
+struct irqstat;
+struct traceev;
 
 // system calls
 int fork(void);
@@ -23,6 +31,39 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int dmesg(char*, int);
+int ioctl(int, int, int);
+int fsync(int);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int nice(int);
+int setpriority(int, int);
+int nanosleep(int, int);
+int nanouptime(uint64*);
+int clone(void(*)(void*), void*, void*, int);
+int join(void**);
+int futexwait(volatile uint*, int);
+int futexwake(volatile uint*);
+int splice(int, int, int);
+int copy_file_range(int, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int poll(struct pollfd*, int, int);
+int ringsetup(struct ring*);
+int ringenter(void);
+int lockstat(struct lockstat*, int);
+int mount(char*, char*);
+int profile(int);
+int profread(struct profsample*, int);
+int getrusage(int, struct rusage*, int);
+int vfork(void);
+int irqaffinity(int, int);
+int irqbalance(int);
+int irqstat(struct irqstat*, int);
+int trace(int);
+int traceread(struct traceev*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -30,13 +71,31 @@ char* strcpy(char*, const char*);
 char* strncpy(char*, const char*, int);
 char* safestrcpy(char*, const char*, int);
 void *memmove(void*, const void*, int);
+int memcmp(const void*, const void*, uint);
 char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
 void fprintf(int, const char*, ...);
 void printf(const char*, ...);
+void fflush(int);
 char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+
+// threads, in ulib.c
+struct lock {
+	volatile uint locked;
+};
+struct mutex {
+	volatile uint state;
+};
+int thread_create(void(*)(void*), void*);
+int thread_join(void);
+void lock_init(struct lock*);
+void lock_acquire(struct lock*);
+void lock_release(struct lock*);
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
@@ -4,9 +4,20 @@
 #include "user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/uio.h"
+#include "kernel/poll.h"
+#include "kernel/ring.h"
+#include "kernel/spinlock.h"
+#include "kernel/mman.h"
+#include "kernel/ioctl.h"
 #include "kernel/syscall.h"
 #include "kernel/traps.h"
 #include "kernel/memlayout.h"
+#include "kernel/prof.h"
+#include "kernel/rusage.h"
+#include "kernel/stats.h"
+#include "kernel/irq.h"
+#include "kernel/trace.h"
 
 char buf[8192];
 char name[3];
@@ -354,6 +365,1036 @@ pipe1(void)
 	printf("pipe1 ok\n");
 }
 
+// Bytes keep their order when the ring wraps at every
+// offset and reads and writes straddle its end.
+void
+pipewrap(void)
+{
+	int fds[2], pid;
+	int seq, i, n, total;
+
+	if(pipe(fds) != 0){
+		printf("pipe() failed\n");
+		exit();
+	}
+	pid = fork();
+	if(pid < 0){
+		printf("fork() failed\n");
+		exit();
+	}
+	seq = 0;
+	if(pid == 0){
+		close(fds[0]);
+		for(n = 0; n < 200; n++){
+			for(i = 0; i < 999; i++)
+				buf[i] = seq++;
+			if(write(fds[1], buf, 999) != 999){
+				printf("pipewrap write failed\n");
+				exit();
+			}
+		}
+		exit();
+	}
+	close(fds[1]);
+	total = 0;
+	while((n = read(fds[0], buf, 4095)) > 0){
+		for(i = 0; i < n; i++){
+			if((buf[i] & 0xff) != (seq++ & 0xff)){
+				printf("pipewrap: wrong byte at %d\n", total + i);
+				exit();
+			}
+		}
+		total += n;
+	}
+	close(fds[0]);
+	wait();
+	if(total != 200 * 999){
+		printf("pipewrap: total %d\n", total);
+		exit();
+	}
+	printf("pipewrap ok\n");
+}
+
+// Move a file through two pipes and back into a file with
+// splice(), and check that it arrives intact.
+void
+splicetest(void)
+{
+	int a[2], b[2], fd, out, i, n, total;
+
+	printf("splice test\n");
+	unlink("splicein");
+	unlink("spliceout");
+	fd = open("splicein", O_CREATE|O_RDWR);
+	for(i = 0; i < 10000; i++){
+		buf[i % 1000] = i % 251;
+		if(i % 1000 == 999 && write(fd, buf, 1000) != 1000){
+			printf("splice: write failed\n");
+			exit();
+		}
+	}
+	close(fd);
+	if(pipe(a) != 0 || pipe(b) != 0){
+		printf("pipe() failed\n");
+		exit();
+	}
+	if(fork() == 0){
+		close(a[0]);
+		close(b[0]);
+		close(b[1]);
+		fd = open("splicein", O_RDONLY);
+		while((n = splice(fd, a[1], 3000)) > 0)
+			;
+		if(n < 0)
+			printf("splice file to pipe failed\n");
+		exit();
+	}
+	close(a[1]);
+	if(fork() == 0){
+		close(b[0]);
+		while((n = splice(a[0], b[1], 10000)) > 0)
+			;
+		if(n < 0)
+			printf("splice pipe to pipe failed\n");
+		exit();
+	}
+	close(a[0]);
+	close(b[1]);
+	out = open("spliceout", O_CREATE|O_RDWR);
+	total = 0;
+	while((n = splice(b[0], out, 1500)) > 0)
+		total += n;
+	close(b[0]);
+	close(out);
+	wait();
+	wait();
+	if(n < 0 || total != 10000){
+		printf("splice: moved %d\n", total);
+		exit();
+	}
+	fd = open("spliceout", O_RDONLY);
+	total = 0;
+	while((n = read(fd, buf, 1000)) > 0){
+		for(i = 0; i < n; i++){
+			if((buf[i] & 0xff) != (total + i) % 251){
+				printf("splice: wrong byte at %d\n", total + i);
+				exit();
+			}
+		}
+		total += n;
+	}
+	if(total != 10000){
+		printf("splice: file has %d bytes\n", total);
+		exit();
+	}
+	close(fd);
+	unlink("splicein");
+	unlink("spliceout");
+	printf("splice test ok\n");
+}
+
+// copy_file_range() between two files, from an unaligned
+// offset, and onto the end of a file that already has data.
+void
+copyrangetest(void)
+{
+	int in, out, i, n, total;
+
+	printf("copy_file_range test\n");
+	unlink("copyin");
+	unlink("copyout");
+	in = open("copyin", O_CREATE|O_RDWR);
+	for(i = 0; i < sizeof(buf); i++)
+		buf[i] = i % 253;
+	for(i = 0; i < 3; i++){
+		if(write(in, buf, sizeof(buf)) != sizeof(buf)){
+			printf("copy_file_range: write failed\n");
+			exit();
+		}
+	}
+	close(in);
+
+	in = open("copyin", O_RDONLY);
+	out = open("copyout", O_CREATE|O_RDWR);
+	if(read(in, buf, 100) != 100 || write(out, buf, 7) != 7){
+		printf("copy_file_range: setup failed\n");
+		exit();
+	}
+	if(copy_file_range(in, in, 10) >= 0){
+		printf("copy_file_range onto itself succeeded\n");
+		exit();
+	}
+	total = 0;
+	while((n = copy_file_range(in, out, 5000)) > 0)
+		total += n;
+	if(n < 0 || total != 3*sizeof(buf) - 100){
+		printf("copy_file_range: copied %d\n", total);
+		exit();
+	}
+	close(in);
+	close(out);
+
+	out = open("copyout", O_RDONLY);
+	if(read(out, buf, 7) != 7){
+		printf("copy_file_range: short file\n");
+		exit();
+	}
+	for(total = 100; (n = read(out, buf, sizeof(buf))) > 0; total += n){
+		for(i = 0; i < n; i++){
+			if((buf[i] & 0xff) != (total + i) % sizeof(buf) % 253){
+				printf("copy_file_range: wrong byte at %d\n", total + i);
+				exit();
+			}
+		}
+	}
+	if(total != 3*sizeof(buf)){
+		printf("copy_file_range: file ends at %d\n", total);
+		exit();
+	}
+	close(out);
+	unlink("copyin");
+	unlink("copyout");
+	printf("copy_file_range test ok\n");
+}
+
+// writev() segments of odd sizes, one of them empty, across
+// transaction boundaries, and read them back with readv().
+void
+iovtest(void)
+{
+	static char a[3000], b[7000], c[5];
+	struct iovec iov[4];
+	int fd, fds[2], i;
+
+	printf("iov test\n");
+	for(i = 0; i < sizeof(a); i++)
+		a[i] = i;
+	for(i = 0; i < sizeof(b); i++)
+		b[i] = i * 7;
+	iov[0].base = a;
+	iov[0].len = sizeof(a);
+	iov[1].base = a;
+	iov[1].len = 0;
+	iov[2].base = b;
+	iov[2].len = sizeof(b);
+	iov[3].base = "four";
+	iov[3].len = 5;
+	unlink("iovfile");
+	fd = open("iovfile", O_CREATE|O_RDWR);
+	if(writev(fd, iov, 4) != sizeof(a) + sizeof(b) + 5){
+		printf("writev failed\n");
+		exit();
+	}
+	close(fd);
+
+	memset(a, 0, sizeof(a));
+	memset(b, 0, sizeof(b));
+	iov[3].base = c;
+	fd = open("iovfile", O_RDONLY);
+	if(readv(fd, iov, 4) != sizeof(a) + sizeof(b) + 5){
+		printf("readv failed\n");
+		exit();
+	}
+	close(fd);
+	for(i = 0; i < sizeof(a); i++)
+		if(a[i] != (char)i){
+			printf("readv: wrong byte %d of a\n", i);
+			exit();
+		}
+	for(i = 0; i < sizeof(b); i++)
+		if(b[i] != (char)(i * 7)){
+			printf("readv: wrong byte %d of b\n", i);
+			exit();
+		}
+	if(strcmp(c, "four") != 0){
+		printf("readv: wrong last segment\n");
+		exit();
+	}
+	unlink("iovfile");
+
+	// A pipe read returns what one segment gets rather than
+	// waiting to fill the next.
+	if(pipe(fds) != 0){
+		printf("pipe() failed\n");
+		exit();
+	}
+	iov[0].base = c;
+	iov[0].len = 2;
+	iov[1].base = c + 2;
+	iov[1].len = 3;
+	if(writev(fds[1], iov, 1) != 2 || readv(fds[0], iov, 2) != 2){
+		printf("readv on pipe failed\n");
+		exit();
+	}
+	close(fds[0]);
+	close(fds[1]);
+
+	if(writev(1, iov, IOV_MAX+1) >= 0){
+		printf("writev with too many segments succeeded\n");
+		exit();
+	}
+	printf("iov test ok\n");
+}
+
+// pread() and pwrite() leave the file offset alone, and
+// several processes can pread() one file at once.
+void
+prwtest(void)
+{
+	int fd, fds[2], i, j, pid;
+
+	printf("pread/pwrite test\n");
+	unlink("prwfile");
+	fd = open("prwfile", O_CREATE|O_RDWR);
+	for(i = 0; i < 4096; i++)
+		buf[i] = i % 199;
+	if(write(fd, buf, 4096) != 4096 || write(fd, buf, 4096) != 4096){
+		printf("pread: write failed\n");
+		exit();
+	}
+	if(pwrite(fd, "abc", 3, 5000) != 3){
+		printf("pwrite failed\n");
+		exit();
+	}
+	if(pread(fd, buf, 10, 4998) != 10 || buf[2] != 'a' || buf[4] != 'c'){
+		printf("pread after pwrite failed\n");
+		exit();
+	}
+	if(pread(fd, buf, 10, 8190) != 2 || pread(fd, buf, 10, 8192) != 0){
+		printf("pread at end of file failed\n");
+		exit();
+	}
+	if(write(fd, "z", 1) != 1 || pread(fd, buf, 1, 8192) != 1 || buf[0] != 'z'){
+		printf("pwrite moved the file offset\n");
+		exit();
+	}
+
+	for(i = 0; i < 4; i++){
+		if((pid = fork()) < 0){
+			printf("fork failed\n");
+			exit();
+		}
+		if(pid == 0){
+			for(j = 0; j < 50; j++){
+				if(pread(fd, buf, 4096, 0) != 4096 ||
+				   buf[(i + j*97) % 4096] != (i + j*97) % 4096 % 199){
+					printf("concurrent pread failed\n");
+					exit();
+				}
+			}
+			exit();
+		}
+	}
+	for(i = 0; i < 4; i++)
+		wait();
+	close(fd);
+	unlink("prwfile");
+
+	if(pipe(fds) != 0){
+		printf("pipe() failed\n");
+		exit();
+	}
+	if(pread(fds[0], buf, 1, 0) >= 0 || pwrite(fds[1], buf, 1, 0) >= 0){
+		printf("pread/pwrite on a pipe succeeded\n");
+		exit();
+	}
+	close(fds[0]);
+	close(fds[1]);
+	printf("pread/pwrite test ok\n");
+}
+
+// poll() on two pipes: timeouts, wakeup by a writer, hangup,
+// and fds that are not open.
+void
+polltest(void)
+{
+	struct pollfd fds[3];
+	int a[2], b[2];
+
+	printf("poll test\n");
+	if(pipe(a) != 0 || pipe(b) != 0){
+		printf("pipe() failed\n");
+		exit();
+	}
+	fds[0].fd = a[0];
+	fds[0].events = POLLIN;
+	fds[1].fd = b[0];
+	fds[1].events = POLLIN;
+	fds[2].fd = a[1];
+	fds[2].events = POLLOUT;
+	if(poll(fds, 2, 0) != 0 || poll(fds, 2, 30) != 0){
+		printf("poll on empty pipes returned early\n");
+		exit();
+	}
+	if(poll(fds, 3, -1) != 1 || fds[2].revents != POLLOUT){
+		printf("poll: pipe not writable\n");
+		exit();
+	}
+
+	if(fork() == 0){
+		sleep(2);
+		write(b[1], "x", 1);
+		exit();
+	}
+	if(poll(fds, 2, -1) != 1 || fds[0].revents != 0 || fds[1].revents != POLLIN){
+		printf("poll: wrong pipe ready\n");
+		exit();
+	}
+	wait();
+	close(b[1]);
+	read(b[0], buf, 1);
+	if(poll(fds, 2, 1000) != 1 || (fds[1].revents & POLLHUP) == 0){
+		printf("poll: no hangup\n");
+		exit();
+	}
+
+	close(a[0]);
+	close(a[1]);
+	close(b[0]);
+	fds[0].fd = a[0];
+	if(poll(fds, 1, 0) != 1 || fds[0].revents != POLLNVAL){
+		printf("poll: closed fd not POLLNVAL\n");
+		exit();
+	}
+	printf("poll test ok\n");
+}
+
+// Path arguments are copied in: one that straddles a page
+// boundary works, and one that runs off the end of memory or
+// is too long fails.
+void
+argstrtest(void)
+{
+	char *p, *top;
+	int fd, pad;
+
+	printf("argstr test\n");
+	p = sbrk(0);
+	pad = 4096 - (uint)p % 4096;
+	if(sbrk(pad + 2*4096) == (char*)-1){
+		printf("sbrk failed\n");
+		exit();
+	}
+	p += pad;
+	top = p + 2*4096;
+	strcpy(p + 4096 - 3, "argstrfile");
+	if((fd = open(p + 4096 - 3, O_CREATE|O_RDWR)) < 0){
+		printf("open of a path across pages failed\n");
+		exit();
+	}
+	close(fd);
+	if(unlink("argstrfile") != 0){
+		printf("argstr: unlink failed\n");
+		exit();
+	}
+	memset(top - 5, 'a', 5);
+	if(open(top - 5, O_CREATE|O_RDWR) >= 0){
+		printf("open of an unterminated path succeeded\n");
+		exit();
+	}
+	memset(p, 'a', MAXPATH);
+	p[MAXPATH] = 0;
+	if(open(p, 0) >= 0 || mkdir(p) >= 0){
+		printf("too long a path succeeded\n");
+		exit();
+	}
+	sbrk(-(pad + 2*4096));
+	printf("argstr test ok\n");
+}
+
+static void
+ringput(struct ring *r, int op, int a0, int a1, int a2, int a3)
+{
+	struct sqe *e;
+
+	e = &r->sq[r->sqtail % RINGSIZE];
+	e->op = op;
+	e->arg[0] = a0;
+	e->arg[1] = a1;
+	e->arg[2] = a2;
+	e->arg[3] = a3;
+	e->data = r->sqtail;
+	r->sqtail++;
+}
+
+// Queue system calls in a ring and run them in batches.
+void
+ringtest(void)
+{
+	static struct ring r;
+	struct stat st;
+	int fd, i, n;
+
+	printf("ring test\n");
+	if(ringenter() >= 0){
+		printf("ringenter without a ring succeeded\n");
+		exit();
+	}
+	if(ringsetup(&r) != 0){
+		printf("ringsetup failed\n");
+		exit();
+	}
+	unlink("ringfile");
+	ringput(&r, SYS_open, (int)"ringfile", O_CREATE|O_RDWR, 0, 0);
+	if(ringenter() != 1 || r.cqtail != 1 || (fd = r.cq[0].res) < 0){
+		printf("ring open failed\n");
+		exit();
+	}
+
+	// With the open's result not reaped, the completion queue
+	// has room for all but the last of these.
+	for(i = 0; i < RINGSIZE - 3; i++)
+		ringput(&r, SYS_write, fd, (int)"0123456789", 10, 0);
+	ringput(&r, SYS_fork, 0, 0, 0, 0);
+	ringput(&r, SYS_fstat, fd, (int)&st, 0, 0);
+	ringput(&r, SYS_pread, fd, (int)buf, 10, 15);
+	if((n = ringenter()) != RINGSIZE - 1){
+		printf("ringenter ran %d\n", n);
+		exit();
+	}
+	for(i = 1; i <= RINGSIZE - 3; i++){
+		if(r.cq[i].res != 10){
+			printf("ring write failed\n");
+			exit();
+		}
+	}
+	if(r.cq[RINGSIZE - 2].res != -1){
+		printf("ring ran fork\n");
+		exit();
+	}
+	if(r.cq[RINGSIZE - 1].res != 0 || st.size != 10*(RINGSIZE - 3)){
+		printf("ring fstat failed\n");
+		exit();
+	}
+	r.cqhead = r.cqtail;
+	buf[10] = 0;
+	if(ringenter() != 1 || r.cq[r.cqhead % RINGSIZE].res != 10 ||
+	   r.cq[r.cqhead % RINGSIZE].data != r.sqtail - 1 || strcmp(buf, "5678901234") != 0){
+		printf("ring pread failed\n");
+		exit();
+	}
+	r.cqhead = r.cqtail;
+
+	ringput(&r, SYS_close, fd, 0, 0, 0);
+	ringput(&r, SYS_unlink, (int)"ringfile", 0, 0, 0);
+	if(ringenter() != 2 || r.cq[r.cqhead % RINGSIZE].res != 0 ||
+	   r.cq[(r.cqhead+1) % RINGSIZE].res != 0){
+		printf("ring close or unlink failed\n");
+		exit();
+	}
+	ringsetup(0);
+	printf("ring test ok\n");
+}
+
+// Program data is read in on first touch, each process
+// getting its own copy.
+char pagedata[3*4096] = { [0] = 1, [4096] = 2, [2*4096] = 3, [3*4096-1] = 4 };
+
+void
+lazyexectest(void)
+{
+	int pid;
+
+	printf("lazy exec test\n");
+	pid = fork();
+	if(pid < 0){
+		printf("fork failed\n");
+		exit();
+	}
+	if(pid == 0){
+		if(pagedata[3*4096-1] != 4 || pagedata[2*4096] != 3 ||
+		   pagedata[4096] != 2 || pagedata[0] != 1 || pagedata[100] != 0){
+			printf("lazy exec: wrong program data\n");
+			exit();
+		}
+		pagedata[0] = pagedata[4096] = pagedata[2*4096] = 9;
+		exit();
+	}
+	wait();
+	if(pagedata[0] != 1 || pagedata[4096] != 2 || pagedata[2*4096] != 3){
+		printf("lazy exec: child's stores seen by parent\n");
+		exit();
+	}
+	printf("lazy exec test ok\n");
+}
+
+// A program file cannot be opened for writing while it runs.
+void
+textbusytest(void)
+{
+	char *argv[] = { "cat", 0 };
+	int in[2], out[2], pid, fd;
+	char c;
+
+	printf("text busy test\n");
+	if((fd = open("/bin/usertests", O_RDWR)) >= 0){
+		printf("text busy: opened the running usertests to write\n");
+		exit();
+	}
+	if((fd = open("/bin/usertests", O_RDONLY)) < 0){
+		printf("text busy: cannot read usertests\n");
+		exit();
+	}
+	close(fd);
+
+	if(pipe(in) < 0 || pipe(out) < 0){
+		printf("text busy: pipe failed\n");
+		exit();
+	}
+	if((pid = fork()) < 0){
+		printf("text busy: fork failed\n");
+		exit();
+	}
+	if(pid == 0){
+		close(0);
+		dup(in[0]);
+		close(1);
+		dup(out[1]);
+		close(in[0]);
+		close(in[1]);
+		close(out[0]);
+		close(out[1]);
+		exec("/bin/cat", argv);
+		exit();
+	}
+	close(in[0]);
+	close(out[1]);
+	// Once cat echoes a byte, it is running.
+	if(write(in[1], "x", 1) != 1 || read(out[0], &c, 1) != 1){
+		printf("text busy: cat did not run\n");
+		exit();
+	}
+	if((fd = open("/bin/cat", O_WRONLY)) >= 0){
+		printf("text busy: opened the running cat to write\n");
+		exit();
+	}
+	close(in[1]);
+	close(out[0]);
+	wait();
+	if((fd = open("/bin/cat", O_WRONLY)) < 0){
+		printf("text busy: cat still busy after it exited\n");
+		exit();
+	}
+	close(fd);
+	printf("text busy test ok\n");
+}
+
+// The profiler catches this process spinning in user space.
+volatile int profspin;
+
+void
+proftest(void)
+{
+	static struct profsample s[256];
+	int i, n, start, found;
+
+	printf("prof test\n");
+	if(profread(s, -1) >= 0){
+		printf("prof: profread of -1 succeeded\n");
+		exit();
+	}
+	profile(1);
+	for(start = uptime(); uptime() - start < 5; )
+		for(i = 0; i < 100000; i++)
+			profspin = i;
+	profile(0);
+	found = 0;
+	while((n = profread(s, sizeof(s)/sizeof(s[0]))) > 0){
+		for(i = 0; i < n; i++)
+			if(s[i].pid == getpid() && s[i].user && s[i].eip < KERNBASE)
+				found = 1;
+	}
+	if(!found){
+		printf("prof: no samples of this process\n");
+		exit();
+	}
+	printf("prof test ok\n");
+}
+
+void
+rusagetest(void)
+{
+	static struct rusage ru, ru2;
+	char *p;
+	int i;
+
+	printf("rusage test\n");
+	if(getrusage(0, &ru, 1) != 1 || ru.pid != getpid() ||
+	   strcmp(ru.name, "usertests") != 0){
+		printf("rusage: wrong process\n");
+		exit();
+	}
+	if(getrusage(-1, &ru, NPROC+1) >= 0){
+		printf("rusage: getrusage of NPROC+1 succeeded\n");
+		exit();
+	}
+	if(getrusage(0x7fffffff, &ru2, 1) != 0){
+		printf("rusage: found a missing process\n");
+		exit();
+	}
+
+	for(i = 0; i < 10; i++)
+		getpid();
+	p = sbrk(4096);
+	p[0] = 1;
+	sleep(1);
+	getrusage(0, &ru2, 1);
+	if(ru2.nsyscall[SYS_getpid] < ru.nsyscall[SYS_getpid] + 10){
+		printf("rusage: getpid calls not counted\n");
+		exit();
+	}
+	if(ru2.nfault <= ru.nfault){
+		printf("rusage: page fault not counted\n");
+		exit();
+	}
+	if(ru2.nswitch <= ru.nswitch){
+		printf("rusage: sleep not counted\n");
+		exit();
+	}
+	sbrk(-4096);
+	printf("rusage test ok\n");
+}
+
+void
+statstest(void)
+{
+	uint st[NSTAT], st2[NSTAT];
+	int fd, sfd, p[2];
+	char *m;
+
+	printf("stats test\n");
+	if((sfd = open("/dev/stats", O_RDONLY)) < 0){
+		printf("stats: cannot open /dev/stats\n");
+		exit();
+	}
+	if(read(sfd, st, sizeof(st)) != sizeof(st)){
+		printf("stats: short read\n");
+		exit();
+	}
+	if(write(sfd, st, sizeof(st)) >= 0){
+		printf("stats: write succeeded\n");
+		exit();
+	}
+
+	if((fd = open("statsfile", O_CREATE|O_RDWR)) < 0 ||
+	   write(fd, "x", 1) != 1){
+		printf("stats: cannot write statsfile\n");
+		exit();
+	}
+	close(fd);
+	unlink("statsfile");
+	if(pipe(p) < 0 || write(p[1], "x", 1) != 1){
+		printf("stats: pipe failed\n");
+		exit();
+	}
+	close(p[0]);
+	close(p[1]);
+	m = sbrk(4096);
+	m[0] = 1;
+	sbrk(-4096);
+
+	read(sfd, st2, sizeof(st2));
+	close(sfd);
+	if(st2[ST_BGET] <= st[ST_BGET] || st2[ST_BHIT] > st2[ST_BGET]){
+		printf("stats: buffer cache not counted\n");
+		exit();
+	}
+	if(st2[ST_PIPEWRITE] <= st[ST_PIPEWRITE]){
+		printf("stats: pipe write not counted\n");
+		exit();
+	}
+	if(st2[ST_KALLOC] <= st[ST_KALLOC] || st2[ST_SWITCH] == 0){
+		printf("stats: kalloc or scheduler not counted\n");
+		exit();
+	}
+	printf("stats test ok\n");
+}
+
+// The IDE interrupt's entry in irqstat(), or 0.
+static struct irqstat*
+idestat(struct irqstat *st)
+{
+	int i, n;
+
+	n = irqstat(st, NIRQ);
+	for(i = 0; i < n; i++)
+		if(st[i].irq == IRQ_IDE)
+			return &st[i];
+	return 0;
+}
+
+void
+irqtest(void)
+{
+	struct irqstat st[NIRQ], *s;
+	uint before;
+	int old, fd;
+
+	printf("irq test\n");
+	if((s = idestat(st)) == 0){
+		printf("irq: no IDE interrupt in irqstat\n");
+		exit();
+	}
+	old = s->cpu;
+	if(irqaffinity(IRQ_IDE, NCPU) >= 0 || irqaffinity(NIRQ, 0) >= 0 ||
+	   irqaffinity(IRQ_TIMER, 0) >= 0){
+		printf("irq: bad irqaffinity succeeded\n");
+		exit();
+	}
+	if(irqaffinity(IRQ_IDE, 0) != old){
+		printf("irq: irqaffinity did not return the old cpu\n");
+		exit();
+	}
+	s = idestat(st);
+	if(s->cpu != 0 || !s->pinned){
+		printf("irq: IDE not pinned to cpu 0\n");
+		exit();
+	}
+	before = s->count[0];
+	if((fd = open("irqfile", O_CREATE|O_RDWR)) < 0 ||
+	   write(fd, buf, 512) != 512 || fsync(fd) < 0){
+		printf("irq: cannot write irqfile\n");
+		exit();
+	}
+	close(fd);
+	unlink("irqfile");
+	if(idestat(st)->count[0] == before){
+		printf("irq: cpu 0 took no IDE interrupts\n");
+		exit();
+	}
+	irqaffinity(IRQ_IDE, old);
+	if(irqaffinity(IRQ_IDE, -1) != old || idestat(st)->pinned){
+		printf("irq: IDE still pinned\n");
+		exit();
+	}
+	if(irqbalance(1) != 0 || irqbalance(0) != 1){
+		printf("irq: irqbalance did not return the old setting\n");
+		exit();
+	}
+	printf("irq test ok\n");
+}
+
+// Trace system calls and the disk over a getpid() and a file
+// write, and find their events.
+void
+tracetest(void)
+{
+	static struct traceev ev[256];
+	int i, n, fd, pid, call, ret, disk;
+
+	printf("trace test\n");
+	if(trace(0x100) >= 0){
+		printf("trace: bad category accepted\n");
+		exit();
+	}
+	pid = getpid();
+	if(trace(TC_SYSCALL|TC_DISK) < 0){
+		printf("trace: cannot start\n");
+		exit();
+	}
+	getpid();
+	if((fd = open("tracefile", O_CREATE|O_RDWR)) < 0 ||
+	   write(fd, buf, 512) != 512 || fsync(fd) < 0){
+		printf("trace: cannot write tracefile\n");
+		exit();
+	}
+	close(fd);
+	if(trace(0) < 0){
+		printf("trace: cannot stop\n");
+		exit();
+	}
+	unlink("tracefile");
+
+	call = ret = disk = 0;
+	while((n = traceread(ev, 256)) > 0){
+		for(i = 0; i < n; i++){
+			if(ev[i].type == TE_SYSCALL && ev[i].arg == SYS_getpid && ev[i].pid == pid)
+				call = 1;
+			if(ev[i].type == TE_SYSRET && ev[i].arg == pid && call)
+				ret = 1;
+			if(ev[i].type == TE_IDEREQ)
+				disk = 1;
+			if(ev[i].type == TE_SWITCH || ev[i].type == TE_COMMIT){
+				printf("trace: event of a category that is off\n");
+				exit();
+			}
+		}
+	}
+	if(!call || !ret || !disk){
+		printf("trace: missing events: getpid %d, return %d, disk %d\n", call, ret, disk);
+		exit();
+	}
+	printf("trace test ok\n");
+}
+
+// dir/name, in a static buffer.
+static char*
+mntpath(char *dir, char *name)
+{
+	static char p[64];
+
+	strcpy(p, dir);
+	strcpy(p + strlen(p), name);
+	return p;
+}
+
+// Use the file system mounted on dir, whose parent is parent:
+// a file written and read back, a subdirectory, ".." across
+// the mount point, and no links out of it.
+void
+mntcheck(char *dir, char *parent)
+{
+	struct stat st, pst;
+	int fd, i;
+
+	if((fd = open(mntpath(dir, "/f"), O_CREATE|O_RDWR)) < 0){
+		printf("mount: create in %s failed\n", dir);
+		exit();
+	}
+	for(i = 0; i < 5; i++){
+		memset(buf, 'a' + i, 2000);
+		if(write(fd, buf, 2000) != 2000){
+			printf("mount: write in %s failed\n", dir);
+			exit();
+		}
+	}
+	close(fd);
+	fd = open(mntpath(dir, "/f"), O_RDONLY);
+	for(i = 0; i < 5; i++){
+		if(read(fd, buf, 2000) != 2000 || buf[0] != 'a' + i || buf[1999] != 'a' + i){
+			printf("mount: read back in %s failed\n", dir);
+			exit();
+		}
+	}
+	if(read(fd, buf, 1) != 0 || fstat(fd, &st) < 0 || st.size != 10000){
+		printf("mount: wrong size in %s\n", dir);
+		exit();
+	}
+	close(fd);
+
+	if(mkdir(mntpath(dir, "/d")) < 0 || stat(mntpath(dir, "/d/../.."), &st) < 0 ||
+	   stat(parent, &pst) < 0 || st.dev != pst.dev || st.ino != pst.ino){
+		printf("mount: .. out of %s wrong\n", dir);
+		exit();
+	}
+	stat(dir, &st);
+	if(st.dev == pst.dev){
+		printf("mount: nothing mounted on %s\n", dir);
+		exit();
+	}
+	if(link(mntpath(dir, "/f"), "mntlink") == 0){
+		printf("mount: link out of %s succeeded\n", dir);
+		exit();
+	}
+	if(unlink(mntpath(dir, "/d")) < 0 || unlink(mntpath(dir, "/f")) < 0 ||
+	   open(mntpath(dir, "/f"), O_RDONLY) >= 0){
+		printf("mount: unlink in %s failed\n", dir);
+		exit();
+	}
+}
+
+// init mounts a tmpfs on /tmp; the RAM disk goes on a directory
+// of our own.
+void
+mounttest(void)
+{
+	printf("mount test\n");
+	mntcheck("/tmp", "/");
+	if(mount("tmpfs", "/tmp") == 0){
+		printf("mount: mounted twice on /tmp\n");
+		exit();
+	}
+	if(unlink("/tmp") == 0){
+		printf("mount: unlinked a mount point\n");
+		exit();
+	}
+	if(mkdir("ramdir") < 0 || mount("ramdisk", "ramdir") < 0){
+		printf("mount: cannot mount the RAM disk\n");
+		exit();
+	}
+	mntcheck("ramdir", ".");
+	if(mount("ramdisk", "/tmp") == 0){
+		printf("mount: RAM disk mounted twice\n");
+		exit();
+	}
+	printf("mount test ok\n");
+}
+
+// memmove() and memcmp() at every alignment, overlapping
+// either way.
+void
+memtest(void)
+{
+	static char a[256], b[256];
+	int i, src, dst, n;
+
+	printf("mem test\n");
+	for(src = 0; src < 8; src++){
+		for(dst = 0; dst < 8; dst++){
+			for(n = 0; n < 100; n += 7){
+				for(i = 0; i < sizeof(a); i++)
+					a[i] = b[i] = i;
+				memmove(a + 64 + dst, a + 64 + src, n);
+				for(i = n - 1; i >= 0; i--)
+					b[64 + dst + i] = (64 + src + i) & 0xFF;
+				if(memcmp(a, b, sizeof(a)) != 0){
+					printf("memmove %d to %d of %d failed\n", src, dst, n);
+					exit();
+				}
+			}
+		}
+	}
+	for(i = 0; i < sizeof(a); i++)
+		a[i] = b[i] = i;
+	for(i = 0; i < 64; i++){
+		b[i + 99]++;
+		if(memcmp(a + i, b + i, 100) >= 0 || memcmp(b + i, a + i, 100) <= 0 ||
+		   memcmp(a + i, b + i, 99) != 0){
+			printf("memcmp at %d failed\n", i);
+			exit();
+		}
+		b[i + 99]--;
+	}
+	printf("mem test ok\n");
+}
+
+// The kernel's locks report how often they were taken.
+void
+lockstattest(void)
+{
+	static struct lockstat st[NLOCKSTAT];
+	uint before;
+	int i, n, fd;
+
+	printf("lockstat test\n");
+	if(lockstat(st, NLOCKSTAT + 1) >= 0){
+		printf("lockstat of too many succeeded\n");
+		exit();
+	}
+	if((n = lockstat(st, NLOCKSTAT)) <= 0){
+		printf("lockstat failed\n");
+		exit();
+	}
+	for(i = 0; i < n; i++)
+		if(strcmp(st[i].name, "ftable") == 0)
+			break;
+	if(i == n){
+		printf("lockstat: no ftable lock\n");
+		exit();
+	}
+	before = st[i].nacquire;
+	if((fd = open("README", 0)) < 0){
+		printf("lockstat: open README failed\n");
+		exit();
+	}
+	close(fd);
+	if(lockstat(st, n) != n || st[i].nacquire < before + 2){
+		printf("lockstat: ftable acquires not counted\n");
+		exit();
+	}
+	printf("lockstat test ok\n");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(void)
@@ -438,23 +1479,228 @@ mem(void)
 			*(char**)m2 = m1;
 			m1 = m2;
 		}
-		while(m1){
-			m2 = *(char**)m1;
-			free(m1);
-			m1 = m2;
+		while(m1){
+			m2 = *(char**)m1;
+			free(m1);
+			m1 = m2;
+		}
+		m1 = malloc(1024*20);
+		if(m1 == 0){
+			printf("couldn't allocate mem?!!\n");
+			kill(ppid);
+			exit();
+		}
+		free(m1);
+		printf("mem ok\n");
+		exit();
+	} else {
+		wait();
+	}
+}
+
+// Small blocks come back from their bins; a large block freed
+// at the break goes back to the kernel.
+void
+malloctest(void)
+{
+	static char *p[500];
+	char *top, *big;
+	int i, j;
+
+	printf("malloc test\n");
+	for(j = 0; j < 2; j++){
+		for(i = 0; i < 500; i++){
+			if((p[i] = malloc(1 + i%200)) == 0){
+				printf("malloc: small malloc failed\n");
+				exit();
+			}
+			memset(p[i], i, 1 + i%200);
+		}
+		if(j == 0)
+			top = sbrk(0);
+		else if(sbrk(0) != top){
+			printf("malloc: freed small blocks not reused\n");
+			exit();
+		}
+		for(i = 0; i < 500; i++){
+			if(p[i][i%200] != (char)i){
+				printf("malloc: small blocks overlap\n");
+				exit();
+			}
+			free(p[i]);
+		}
+	}
+
+	top = sbrk(0);
+	if((big = malloc(200*1024)) == 0){
+		printf("malloc: large malloc failed\n");
+		exit();
+	}
+	big[200*1024-1] = 1;
+	free(big);
+	if(sbrk(0) > top){
+		printf("malloc: large block not returned\n");
+		exit();
+	}
+	printf("malloc test ok\n");
+}
+
+// Output to a pipe is buffered until exit(), and fork() flushes
+// it first so that the child does not print it again.
+void
+stdiotest(void)
+{
+	int p[2], pid, i, n, tot;
+	char b[64];
+
+	printf("stdio test\n");
+	if(pipe(p) < 0){
+		printf("stdio: pipe failed\n");
+		exit();
+	}
+	if((pid = fork()) < 0){
+		printf("stdio: fork failed\n");
+		exit();
+	}
+	if(pid == 0){
+		close(p[0]);
+		close(1);
+		dup(p[1]);
+		close(p[1]);
+		printf("x");
+		if(fork() == 0)
+			exit();
+		wait();
+		for(i = 0; i < 100; i++)
+			printf("%d\n", i % 10);
+		exit();
+	}
+	close(p[1]);
+	tot = 0;
+	while((n = read(p[0], b, sizeof(b))) > 0){
+		for(i = 0; i < n; i++)
+			if(b[i] == 'x' && tot + i != 0){
+				printf("stdio: output printed twice\n");
+				exit();
+			}
+		tot += n;
+	}
+	close(p[0]);
+	wait();
+	if(tot != 1 + 200){
+		printf("stdio: got %d bytes, not 201\n", tot);
+		exit();
+	}
+	printf("stdio test ok\n");
+}
+
+// Run script with /bin/sh and check what it prints.
+void
+shcheck(char *script, char *want)
+{
+	int in[2], out[2], pid, n, tot;
+	char *argv[] = { "sh", 0 };
+	char b[64];
+
+	if(pipe(in) < 0 || pipe(out) < 0){
+		printf("sh: pipe failed\n");
+		exit();
+	}
+	if((pid = fork()) < 0){
+		printf("sh: fork failed\n");
+		exit();
+	}
+	if(pid == 0){
+		close(0);
+		dup(in[0]);
+		close(1);
+		dup(out[1]);
+		close(in[0]);
+		close(in[1]);
+		close(out[0]);
+		close(out[1]);
+		exec("/bin/sh", argv);
+		printf("sh: exec failed\n");
+		exit();
+	}
+	close(in[0]);
+	close(out[1]);
+	write(in[1], script, strlen(script));
+	close(in[1]);
+	tot = 0;
+	while(tot < sizeof(b) - 1 && (n = read(out[0], b + tot, sizeof(b) - 1 - tot)) > 0)
+		tot += n;
+	b[tot] = 0;
+	close(out[0]);
+	wait();
+	if(strcmp(b, want) != 0){
+		printf("sh: %s printed %s, not %s\n", script, b, want);
+		exit();
+	}
+}
+
+static volatile int vfran;
+
+static void
+vfthread(void *arg)
+{
+	vfran++;
+}
+
+// vfork() children that exit and that exec, then threads in the
+// process slots they leave: those must still be threads.
+void
+vforktest(void)
+{
+	char *argv[] = { "bench", "-exit", 0 };
+	int i, pid;
+
+	printf("vfork test\n");
+	for(i = 0; i < 4; i++){
+		if((pid = vfork()) < 0){
+			printf("vfork failed\n");
+			exit();
+		}
+		if(pid == 0){
+			if(i % 2)
+				exec("/bin/bench", argv);
+			exit();
+		}
+		if(wait() != pid){
+			printf("vfork: wait did not return the child\n");
+			exit();
 		}
-		m1 = malloc(1024*20);
-		if(m1 == 0){
-			printf("couldn't allocate mem?!!\n");
-			kill(ppid);
+		if(thread_create(vfthread, 0) < 0){
+			printf("vfork: thread_create failed\n");
 			exit();
 		}
-		free(m1);
-		printf("mem ok\n");
+		if(wait() != -1){
+			printf("vfork: wait reaped a thread\n");
+			exit();
+		}
+		if(thread_join() < 0){
+			printf("vfork: thread_join failed\n");
+			exit();
+		}
+	}
+	if(vfran != 4){
+		printf("vfork: threads ran %d times\n", vfran);
 		exit();
-	} else {
-		wait();
 	}
+	printf("vfork test ok\n");
+}
+
+// Builtins, && and || in the shell.
+void
+shtest(void)
+{
+	printf("sh test\n");
+	shcheck("cd /tmp; pwd\n", "/tmp\n");
+	shcheck("test -d /tmp && echo yes || echo no\n", "yes\n");
+	shcheck("test -f /tmp && echo yes || echo no\n", "no\n");
+	shcheck("echo a   b ; nosuchcmd && echo c\necho d\n", "a b\nd\n");
+	shcheck("echo (\necho x | cat\n", "x\n");
+	printf("sh test ok\n");
 }
 
 // More file system tests
@@ -1695,6 +2941,513 @@ fsfull()
 	printf("fsfull test finished\n");
 }
 
+// ioctl() reaches only devices, and the console
+// accepts and reports its input modes.
+void
+ioctltest(void)
+{
+	int fds[2];
+
+	printf("ioctl test\n");
+	if(pipe(fds) != 0){
+		printf("pipe() failed\n");
+		exit();
+	}
+	if(ioctl(fds[0], CONSOLE_GETMODE, 0) != -1){
+		printf("ioctl on a pipe succeeded\n");
+		exit();
+	}
+	close(fds[0]);
+	close(fds[1]);
+
+	if(ioctl(1, CONSOLE_GETMODE, 0) != CONS_COOKED){
+		printf("console not in cooked mode\n");
+		exit();
+	}
+	if(ioctl(1, CONSOLE_SETMODE, 99) != -1){
+		printf("console accepted a bad mode\n");
+		exit();
+	}
+	if(ioctl(1, CONSOLE_SETMODE, CONS_CBREAK) != 0 ||
+	   ioctl(1, CONSOLE_GETMODE, 0) != CONS_CBREAK){
+		printf("console did not switch to cbreak\n");
+		exit();
+	}
+	ioctl(1, CONSOLE_SETMODE, CONS_COOKED);
+	printf("ioctl test ok\n");
+}
+
+void
+fsynctest(void)
+{
+	int fd;
+
+	printf("fsync test\n");
+	if(fsync(-1) != -1){
+		printf("fsync on a bad fd succeeded\n");
+		exit();
+	}
+	fd = open("fsyncf", O_CREATE|O_RDWR);
+	if(fd < 0){
+		printf("create fsyncf failed\n");
+		exit();
+	}
+	if(write(fd, "aaaaaaaaaa", 10) != 10 || fsync(fd) != 0){
+		printf("write or fsync of fsyncf failed\n");
+		exit();
+	}
+	close(fd);
+	unlink("fsyncf");
+	printf("fsync test ok\n");
+}
+
+// Page-aligned reads of whole pages are mapped from the
+// page cache; stores to the buffer and later writes to the
+// file must not see each other.
+void
+pcachetest(void)
+{
+	char *a, *b;
+	int fd, i;
+
+	printf("page cache test\n");
+	a = sbrk(0);
+	sbrk(4096 - (uint)a % 4096);
+	a = sbrk(3*4096);
+	b = a + 2*4096;
+	for(i = 0; i < 2*4096; i++)
+		a[i] = i % 251;
+	fd = open("pcachef", O_CREATE|O_RDWR);
+	if(fd < 0 || write(fd, a, 2*4096) != 2*4096){
+		printf("write pcachef failed\n");
+		exit();
+	}
+	close(fd);
+
+	memset(a, 0, 2*4096);
+	fd = open("pcachef", 0);
+	if(read(fd, a, 2*4096) != 2*4096){
+		printf("read pcachef failed\n");
+		exit();
+	}
+	close(fd);
+	a[0] = 'x';  // a private copy now
+	fd = open("pcachef", 0);
+	if(read(fd, b, 4096) != 4096 || b[0] != 0 || b[1] != 1){
+		printf("pcachef changed by a store to a reader\n");
+		exit();
+	}
+	close(fd);
+
+	fd = open("pcachef", O_RDWR);
+	if(write(fd, "y", 1) != 1){
+		printf("rewrite pcachef failed\n");
+		exit();
+	}
+	close(fd);
+	if(b[0] != 0){
+		printf("reader saw a later write\n");
+		exit();
+	}
+	fd = open("pcachef", 0);
+	if(read(fd, b, 4096) != 4096 || b[0] != 'y' || a[4096] != 4096 % 251){
+		printf("pcachef reread wrong\n");
+		exit();
+	}
+	close(fd);
+	unlink("pcachef");
+	sbrk(-3*4096);
+	printf("page cache test ok\n");
+}
+
+// sbrk only moves the break; pages appear when touched,
+// by the process or by the kernel.
+void
+lazysbrktest(void)
+{
+	char *a;
+	int fd;
+
+	printf("lazy sbrk test\n");
+	a = sbrk(64*1024*1024);
+	if(a == (char*)-1){
+		printf("sbrk of 64MB failed\n");
+		exit();
+	}
+	a[32*1024*1024] = 'x';
+	if(a[0] != 0 || a[32*1024*1024] != 'x'){
+		printf("lazy page wrong\n");
+		exit();
+	}
+	fd = open("README", 0);
+	if(fd < 0 || read(fd, a + 48*1024*1024, 100) != 100){
+		printf("read into untouched heap failed\n");
+		exit();
+	}
+	close(fd);
+	sbrk(-64*1024*1024);
+	printf("lazy sbrk test ok\n");
+}
+
+// User pages come from memory above PHYSTOP when there is
+// some; the kernel must reach them for faults, copy-on-write
+// and system call buffers.
+void
+highmemtest(void)
+{
+	char *a;
+	int i, pid, fds[2];
+	enum { N = 32*1024*1024 };
+
+	printf("high memory test\n");
+	a = sbrk(N);
+	if(a == (char*)-1){
+		printf("sbrk of 32MB failed\n");
+		exit();
+	}
+	for(i = 0; i < N; i += 4096)
+		a[i] = i / 4096;
+	if(pipe(fds) != 0){
+		printf("pipe failed\n");
+		exit();
+	}
+	pid = fork();
+	if(pid == 0){
+		for(i = 0; i < N; i += 4096)
+			a[i]++;
+		write(fds[1], a + N - 4096, 1);
+		exit();
+	}
+	if(read(fds[0], a + 1, 1) != 1 || a[1] != (char)((N/4096 - 1) + 1)){
+		printf("child page wrong\n");
+		exit();
+	}
+	wait();
+	close(fds[0]);
+	close(fds[1]);
+	for(i = 0; i < N; i += 4096){
+		if(a[i] != (char)(i / 4096)){
+			printf("high page %d changed\n", i / 4096);
+			exit();
+		}
+	}
+	sbrk(-N);
+	printf("high memory test ok\n");
+}
+
+// nice values are clamped, inherited by fork, and can be set
+// for another process.
+void
+nicetest(void)
+{
+	int pid, fds[2];
+	char c;
+
+	printf("nice test\n");
+	if(nice(0) != 0 || nice(5) != 5 || nice(100) != 19 || nice(-100) != 0){
+		printf("nice values wrong\n");
+		exit();
+	}
+	if(setpriority(0, 3) != 0 || nice(0) != 3){
+		printf("setpriority of self failed\n");
+		exit();
+	}
+	if(pipe(fds) != 0){
+		printf("pipe failed\n");
+		exit();
+	}
+	pid = fork();
+	if(pid == 0){
+		read(fds[0], &c, 1);
+		c = nice(0);
+		write(fds[1], &c, 1);
+		exit();
+	}
+	if(setpriority(pid, 12) != 0){
+		printf("setpriority of child failed\n");
+		exit();
+	}
+	write(fds[1], "x", 1);
+	wait();
+	if(read(fds[0], &c, 1) != 1 || c != 12){
+		printf("child nice wrong\n");
+		exit();
+	}
+	close(fds[0]);
+	close(fds[1]);
+	if(setpriority(pid, 0) != -1){
+		printf("setpriority of dead process succeeded\n");
+		exit();
+	}
+	setpriority(0, 0);
+	printf("nice test ok\n");
+}
+
+// nanosleep() is not rounded to whole ticks, and the clock
+// goes forward across sleeps.
+void
+nanosleeptest(void)
+{
+	uint64 t0, t1;
+	int i;
+
+	printf("nanosleep test\n");
+	if(nanosleep(0, 1000000000) != -1 || nanosleep(-1, 0) != -1){
+		printf("nanosleep accepted a bad time\n");
+		exit();
+	}
+	if(nanouptime(&t0) < 0){
+		printf("nanouptime failed\n");
+		exit();
+	}
+	for(i = 0; i < 10; i++)
+		nanosleep(0, 2000000);
+	nanouptime(&t1);
+	if(t1 - t0 < 20000000){
+		printf("nanosleep returned early\n");
+		exit();
+	}
+	// 10 sleeps rounded up to whole 10ms ticks would take 100ms.
+	if(t1 - t0 > 90000000)
+		printf("nanosleep: 10 x 2ms took more than 90ms\n");
+	nanouptime(&t0);
+	sleep(3);
+	nanouptime(&t1);
+	if(t1 - t0 < 30000000){
+		printf("sleep(3) returned early\n");
+		exit();
+	}
+	printf("nanosleep test ok\n");
+}
+
+// Threads made by clone() share memory: counters bumped by
+// all of them under a spinlock and a mutex come out exact,
+// and memory one thread gets from sbrk() is seen by the rest.
+#define NTHREAD 4
+#define NBUMP 2000
+
+static struct lock tlock;
+static struct mutex tmutex;
+static int tspin, tsleep;
+static char *volatile tmem;
+
+static void
+threadbump(void *arg)
+{
+	int i;
+
+	for(i = 0; i < NBUMP; i++){
+		lock_acquire(&tlock);
+		tspin++;
+		lock_release(&tlock);
+		mutex_lock(&tmutex);
+		tsleep++;
+		if(i % 500 == 0)
+			sleep(1);  // make the others wait in futexwait()
+		mutex_unlock(&tmutex);
+	}
+	if((int)arg == 0){
+		tmem = sbrk(4096);
+		tmem[0] = 'x';
+	}
+}
+
+void
+threadtest(void)
+{
+	void *stack;
+	int i;
+
+	printf("thread test\n");
+	if(join(&stack) != -1){
+		printf("join without threads succeeded\n");
+		exit();
+	}
+	lock_init(&tlock);
+	mutex_init(&tmutex);
+	for(i = 0; i < NTHREAD; i++){
+		if(thread_create(threadbump, (void*)i) < 0){
+			printf("thread_create failed\n");
+			exit();
+		}
+	}
+	if(wait() != -1){
+		printf("wait reaped a thread\n");
+		exit();
+	}
+	for(i = 0; i < NTHREAD; i++){
+		if(thread_join() < 0){
+			printf("thread_join failed\n");
+			exit();
+		}
+	}
+	if(thread_join() != -1){
+		printf("thread_join of no thread succeeded\n");
+		exit();
+	}
+	if(tspin != NTHREAD*NBUMP || tsleep != NTHREAD*NBUMP){
+		printf("threads lost updates: %d %d\n", tspin, tsleep);
+		exit();
+	}
+	if(tmem == 0 || tmem[0] != 'x'){
+		printf("thread's sbrk not shared\n");
+		exit();
+	}
+	printf("thread test ok\n");
+}
+
+// fork shares pages copy-on-write; stores on either side
+// must stay private, including stores made by the kernel.
+void
+cowtest(void)
+{
+	char *a;
+	int i, pid, fds[2];
+
+	printf("cow fork test\n");
+	a = sbrk(4*4096);
+	for(i = 0; i < 4*4096; i++)
+		a[i] = i % 7;
+	if(pipe(fds) != 0){
+		printf("pipe failed\n");
+		exit();
+	}
+	pid = fork();
+	if(pid == 0){
+		for(i = 0; i < 4*4096; i += 3)
+			a[i] = 'c';
+		// read() stores into a shared page from the kernel.
+		if(read(fds[0], a + 4096, 10) != 10 || a[4096] != 'p')
+			printf("child read wrong\n");
+		exit();
+	}
+	if(write(fds[1], "pppppppppp", 10) != 10){
+		printf("pipe write failed\n");
+		exit();
+	}
+	wait();
+	close(fds[0]);
+	close(fds[1]);
+	for(i = 0; i < 4*4096; i++){
+		if(a[i] != i % 7){
+			printf("parent memory changed by child\n");
+			exit();
+		}
+	}
+	sbrk(-4*4096);
+	printf("cow fork test ok\n");
+}
+
+void
+mmaptest(void)
+{
+	char *a, *f;
+	int fd, i, pid;
+
+	printf("mmap test\n");
+	a = mmap(0, 3*4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+	if(a == MAP_FAILED){
+		printf("anonymous mmap failed\n");
+		exit();
+	}
+	for(i = 0; i < 3*4096; i += 512){
+		if(a[i] != 0){
+			printf("anonymous page not zero\n");
+			exit();
+		}
+		a[i] = i / 512;
+	}
+	pid = fork();
+	if(pid == 0){
+		a[0] = 'c';
+		exit();
+	}
+	wait();
+	if(a[0] != 0 || a[512] != 1){
+		printf("child changed parent's mapping\n");
+		exit();
+	}
+
+	// A file that ends partway through its second page.
+	fd = open("mmapf", O_CREATE|O_RDWR);
+	for(i = 0; i < 4096 + 100; i++)
+		if(write(fd, (i % 2) ? "b" : "a", 1) != 1){
+			printf("write mmapf failed\n");
+			exit();
+		}
+	f = mmap(0, 2*4096, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(f == MAP_FAILED){
+		printf("file mmap failed\n");
+		exit();
+	}
+	if(f[0] != 'a' || f[4097] != 'b' || f[4096+100] != 0){
+		printf("file mapping has wrong contents\n");
+		exit();
+	}
+	// The kernel uses the mapping as a write() buffer.
+	fd = open("mmapf2", O_CREATE|O_RDWR);
+	if(write(fd, f + 4096, 100) != 100){
+		printf("write from mapping failed\n");
+		exit();
+	}
+	close(fd);
+
+	if(munmap(a + 4096, 4096) != 0 || a[0] != 0 || a[2*4096] != 16){
+		printf("munmap of middle page failed\n");
+		exit();
+	}
+	if(munmap(a, 3*4096) != 0 || munmap(f, 2*4096) != 0){
+		printf("munmap failed\n");
+		exit();
+	}
+	unlink("mmapf");
+	unlink("mmapf2");
+	printf("mmap test ok\n");
+}
+
+// /spool is a hashed directory made by mkfs -d.
+void
+hashdirtest(void)
+{
+	char path[16];
+	int i, fd;
+
+	printf("hashed directory test\n");
+	strcpy(path, "/spool/h00");
+	for(i = 0; i < 100; i++){
+		path[8] = '0' + i/10;
+		path[9] = '0' + i%10;
+		if((fd = open(path, O_CREATE|O_RDWR)) < 0){
+			printf("create %s failed\n", path);
+			exit();
+		}
+		close(fd);
+	}
+	if(unlink("/spool") == 0){
+		printf("unlink of non-empty /spool succeeded\n");
+		exit();
+	}
+	for(i = 0; i < 100; i++){
+		path[8] = '0' + i/10;
+		path[9] = '0' + i%10;
+		if((fd = open(path, 0)) < 0){
+			printf("open %s failed\n", path);
+			exit();
+		}
+		close(fd);
+		if(unlink(path) != 0){
+			printf("unlink %s failed\n", path);
+			exit();
+		}
+	}
+	if(open("/spool/h00", 0) >= 0){
+		printf("/spool/h00 still exists\n");
+		exit();
+	}
+	printf("hashed directory test ok\n");
+}
+
 void
 uio()
 {
@@ -1796,6 +3549,39 @@ main(int argc, char *argv[])
 	bigdir(); // slow
 
 	uio();
+	ioctltest();
+	fsynctest();
+	hashdirtest();
+	pcachetest();
+	mmaptest();
+	cowtest();
+	lazysbrktest();
+	highmemtest();
+	nicetest();
+	nanosleeptest();
+	threadtest();
+	pipewrap();
+	splicetest();
+	copyrangetest();
+	iovtest();
+	prwtest();
+	polltest();
+	argstrtest();
+	ringtest();
+	lockstattest();
+	memtest();
+	lazyexectest();
+	textbusytest();
+	mounttest();
+	proftest();
+	rusagetest();
+	statstest();
+	irqtest();
+	tracetest();
+	malloctest();
+	stdiotest();
+	shtest();
+	vforktest();
 
 	exectest();
 